@@ -1,16 +1,37 @@
 'use strict';
 
 const METRIC_LIMIT = 10000;
+const METRIC_AGG = 'ohlc';
 const ROUND_DECIMALS = 2;
 const PRICE_ARR_SIZE = 15;
 const VOLUME_ARR_SIZE = 5;
 const PAGE_ITEMS_MAX = 100;
 const PAGE_STEP = 5;
+const METRIC_BIN_MIME = 'application/octet-stream';
+const METRIC_BIN_MAGIC = 0x54454d43;
+const METRIC_BIN_VERSION = 1;
+const METRIC_BIN_HDR_SIZE = 16;
+const LIVE_PATH = '/crypto/live/';
+// Binary columns in the order of the response, names match the JSON keys //
+const METRIC_BIN_COLS = [
+    ['ts', BigUint64Array],
+    ['c', Float32Array],
+    ['v', Float32Array],
+    ['la', Float32Array],
+    ['lb', Float32Array],
+    ['o', Float32Array],
+    ['h', Float32Array],
+    ['l', Float32Array],
+    ['n', Uint32Array],
+    ['w', Uint8Array],
+];
 
 let metrics = [];
+let page_cur = 0;
 let calc = null;
+let live = null;
 
-async function api_request(act, data = null) {
+async function api_request(act, data = null, binary = false) {
     let req_data = {
         act: act,
     };
@@ -24,8 +45,42 @@ async function api_request(act, data = null) {
         },
         body: JSON.stringify(req_data),
     };
-    const res = await window.fetch('/api', info);
-    return res.ok ? await res.json() : null;
+    if (binary) {
+        info.headers['Accept'] = METRIC_BIN_MIME;
+    }
+    const res = await window.fetch('/crypto/api', info);
+    if (!res.ok) {
+        return null;
+    }
+    if (res.headers.get('Content-Type') === METRIC_BIN_MIME) {
+        return await res.arrayBuffer();
+    }
+    return await res.json();
+}
+
+function metrics_decode(buf) {
+    const view = new DataView(buf);
+    if (
+        buf.byteLength < METRIC_BIN_HDR_SIZE ||
+        view.getUint32(0, true) !== METRIC_BIN_MAGIC ||
+        view.getUint16(4, true) !== METRIC_BIN_VERSION
+    ) {
+        return null;
+    }
+    const cols_mask = view.getUint16(6, true);
+    const count = view.getUint32(8, true);
+    let cols = {
+        count: count,
+    };
+    let offset = METRIC_BIN_HDR_SIZE;
+    for (let i = 0; i < METRIC_BIN_COLS.length; i++) {
+        if (cols_mask & (1 << i)) {
+            const [name, type] = METRIC_BIN_COLS[i];
+            cols[name] = new type(buf, offset, count);
+            offset += count * type.BYTES_PER_ELEMENT;
+        }
+    }
+    return offset === buf.byteLength ? cols : null;
 }
 
 function time_get_unix(time) {
@@ -166,6 +221,7 @@ async function crypto_symbol_init() {
 }
 
 function crypto_table_page_set(idx) {
+    page_cur = idx;
     const frag = document.createDocumentFragment();
     for (const metric of metrics[idx]) {
         const time = document.createElement('td');
@@ -187,7 +243,7 @@ function crypto_table_page_set(idx) {
         rsi.textContent = isNaN(metric.rsi_val) ? '-' : metric.rsi_val.toFixed(ROUND_DECIMALS);
         tail.textContent = isNaN(metric.tail_val) ? '-' : metric.tail_val.toFixed(6);
         slope.textContent = isNaN(metric.slope_val) ? '-' : metric.slope_val.toFixed(6);
-        whales.textContent = metric.w;
+        whales.textContent = metric.w.toFixed(1);
         liquidity.textContent = (metric.la + metric.lb).toFixed(ROUND_DECIMALS);
         liq_bid.textContent = metric.lb.toFixed(ROUND_DECIMALS);
         liq_ask.textContent = metric.la.toFixed(ROUND_DECIMALS);
@@ -267,6 +323,140 @@ function crypto_table_page_update(cur_idx, page_count) {
     nav.hidden = false;
 }
 
+function metric_calc(metric) {
+    calc.push_price(metric.c);
+    calc.push_volume(metric.v);
+    metric.rsi_val = calc.get_rsi();
+    metric.tail_val = calc.get_tail();
+    metric.slope_val = calc.get_slope();
+    metric.volume_surge_val = calc.get_volume_surge(metric.v);
+    metric.volume_accel_val = calc.get_volume_accel(metric.volume_surge_val);
+}
+
+function metric_liq_update(metric) {
+    metric.liq_delta_val = metric.lb - metric.la / (metric.la + metric.lb);
+}
+
+function metric_append(metric) {
+    let page = metrics[metrics.length - 1];
+    if (!page || page.length >= PAGE_ITEMS_MAX) {
+        page = [];
+        metrics.push(page);
+    }
+    page.push(metric);
+}
+
+function metric_last() {
+    const page = metrics[metrics.length - 1];
+    return page ? page[page.length - 1] : null;
+}
+
+// Ticks are folded into the buckets of the interval, the indicators of a bucket are calculated once it is closed //
+function crypto_live_tick(tick) {
+    const ts = tick.ts - (tick.ts % live.interval);
+    if (ts >= live.end) {
+        crypto_live_stop();
+        return;
+    }
+
+    let last = metric_last();
+    if (last && ts < last.ts) {
+        return;
+    }
+    if (last && ts === last.ts) {
+        last.c = tick.c;
+        last.v += tick.v;
+        last.la = tick.la;
+        last.lb = tick.lb;
+        last.w = Math.max(last.w, tick.w);
+        metric_liq_update(last);
+    } else {
+        if (last && last.pending) {
+            metric_calc(last);
+            last.pending = false;
+        }
+        last = {
+            ts: ts,
+            c: tick.c,
+            v: tick.v,
+            la: tick.la,
+            lb: tick.lb,
+            w: tick.w,
+            rsi_val: NaN,
+            tail_val: NaN,
+            slope_val: NaN,
+            volume_surge_val: NaN,
+            volume_accel_val: NaN,
+            pending: true,
+        };
+        metric_liq_update(last);
+        const page_count = metrics.length;
+        metric_append(last);
+        if (metrics.length !== page_count) {
+            crypto_table_page_update(page_cur, metrics.length);
+            return;
+        }
+    }
+    if (page_cur === metrics.length - 1) {
+        crypto_table_page_set(page_cur);
+    }
+}
+
+function crypto_live_stop() {
+    if (live) {
+        live.source.close();
+        live = null;
+    }
+}
+
+// Subscribe before the range is loaded so no tick is lost, ticks are queued until it is //
+function crypto_live_start(symbol_val, end_ts, interval, reload) {
+    crypto_live_stop();
+    if (end_ts * 1000 <= Date.now()) {
+        return null;
+    }
+
+    const state = {
+        source: new EventSource(LIVE_PATH + symbol_val),
+        end: end_ts,
+        interval: interval,
+        queue: [],
+        lost: false,
+    };
+    state.source.addEventListener(symbol_val, function (event) {
+        const tick = JSON.parse(event.data);
+        if (state.queue) {
+            state.queue.push(tick);
+        } else {
+            crypto_live_tick(tick);
+        }
+    });
+    // The server drops clients which fall behind, ticks are missed until the stream is reopened //
+    state.source.onerror = function () {
+        state.lost = true;
+    };
+    state.source.onopen = function () {
+        if (state.lost) {
+            reload();
+        }
+    };
+    live = state;
+    return state;
+}
+
+function crypto_live_flush(state) {
+    if (live === state) {
+        const queue = state.queue;
+        state.queue = null;
+        for (const tick of queue) {
+            if (live !== state) {
+                break;
+            }
+            crypto_live_tick(tick);
+        }
+    }
+}
+
 async function crypto_form_init() {
     const form = document.getElementById('form');
     const start = document.getElementById('start');
@@ -302,6 +492,7 @@ async function crypto_form_init() {
         sessionStorage.setItem('form_interval', interval_val);
         calc.clear();
         metrics = [];
+        page_cur = 0;
 
         const req = {
             symbol: symbol_val,
@@ -309,32 +500,34 @@ async function crypto_form_init() {
             end: time_get_unix(end_val),
             interval: parseInt(interval_val),
             limit: METRIC_LIMIT,
+            agg: METRIC_AGG,
         };
-        const res = await api_request('get-metrics', req);
-        if (res) {
-            let mi = 0,
-                mj = 0;
-            for (let metric of res.metrics) {
-                if (!metrics[mi]) {
-                    metrics[mi] = [];
-                }
-
-                calc.push_price(metric.c);
-                calc.push_volume(metric.v);
-                metric.rsi_val = calc.get_rsi();
-                metric.tail_val = calc.get_tail();
-                metric.slope_val = calc.get_slope();
-                metric.volume_surge_val = calc.get_volume_surge(metric.v);
-                metric.volume_accel_val = calc.get_volume_accel(metric.volume_surge_val);
-                metric.liq_delta_val = metric.lb - metric.la / (metric.la + metric.lb);
-                metrics[mi][mj++] = metric;
-
-                if (mj >= PAGE_ITEMS_MAX) {
-                    mj = 0;
-                    mi++;
-                }
+        const live_state = crypto_live_start(symbol_val, req.end, req.interval, function () {
+            form.requestSubmit();
+        });
+        const res = await api_request('get-metrics', req, true);
+        const cols = res instanceof ArrayBuffer ? metrics_decode(res) : null;
+        if (cols) {
+            for (let i = 0; i < cols.count; i++) {
+                const metric = {
+                    ts: Number(cols.ts[i]),
+                    c: cols.c[i],
+                    v: cols.v[i],
+                    la: cols.la[i],
+                    lb: cols.lb[i],
+                    w: cols.w[i],
+                };
+
+                metric_calc(metric);
+                metric_liq_update(metric);
+                metric_append(metric);
+            }
+            if (metrics.length) {
+                crypto_table_page_update(0, metrics.length);
             }
-            crypto_table_page_update(0, mi);
+            crypto_live_flush(live_state);
+        } else if (live === live_state) {
+            crypto_live_stop();
         }
     };
 
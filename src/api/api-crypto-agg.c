@@ -0,0 +1,256 @@
+#include <api/api-crypto.h>
+#include <db/db-crypto-table.h>
+#include <core/json/json-gen.h>
+#include <core/base/log.h>
+#include <stdlib.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define AGG_ROW_MAX     384
+#define AGG_BODY_START  "{\"metrics\":["
+#define AGG_BODY_END    "]}"
+#define LTTB_POINTS_MIN 1024
+#define LTTB_POINTS_MAX (64 * 1024)
+
+/**
+ * @brief Buckets collected for the downsampling
+ * @note Beyond LTTB_POINTS_MAX neighbour points are merged pairwise, so memory stays bounded for any range
+ */
+typedef struct {
+    db_crypto_bucket_t *data; ///< Collected points
+    uint32_t count;           ///< Number of points
+    uint32_t size;            ///< Number of allocated points
+    uint32_t group;           ///< Buckets merged into one point
+    uint32_t pending;         ///< Buckets merged into the last point so far
+} lttb_points_t;
+
+static void bucket_merge(db_crypto_bucket_t *dst, const db_crypto_bucket_t *src)
+{
+    float count = dst->count + src->count;
+    float dst_part = dst->count / count;
+    float src_part = src->count / count;
+    dst->high = (src->high > dst->high) ? src->high : dst->high;
+    dst->low = (src->low < dst->low) ? src->low : dst->low;
+    dst->close = src->close;
+    dst->volume += src->volume;
+    dst->liq_ask = dst->liq_ask * dst_part + src->liq_ask * src_part;
+    dst->liq_bid = dst->liq_bid * dst_part + src->liq_bid * src_part;
+    dst->whales = dst->whales * dst_part + src->whales * src_part;
+    dst->count += src->count;
+}
+
+static bool lttb_points_add(lttb_points_t *points, const db_crypto_bucket_t *bucket)
+{
+    if(points->pending < points->group) {
+        bucket_merge(&points->data[points->count - 1], bucket);
+        points->pending++;
+        return true;
+    }
+    if(points->count == LTTB_POINTS_MAX) {
+        for(uint32_t i = 0; i < points->count / 2; i++) {
+            points->data[i] = points->data[i * 2];
+            bucket_merge(&points->data[i], &points->data[i * 2 + 1]);
+        }
+        points->count /= 2;
+        points->group *= 2;
+        points->pending = points->group;
+        return lttb_points_add(points, bucket);
+    }
+    if(points->count == points->size) {
+        uint32_t size = points->size ? points->size * 2 : LTTB_POINTS_MIN;
+        db_crypto_bucket_t *data = realloc(points->data, size * sizeof(db_crypto_bucket_t));
+        if(data == NULL) {
+            log_error("realloc lttb points size=%u failed", size);
+            return false;
+        }
+        points->data = data;
+        points->size = size;
+    }
+    points->data[points->count++] = *bucket;
+    points->pending = 1;
+    return true;
+}
+
+/**
+ * @brief Pick the points which keep the shape of the close price chart
+ * @param points - [in] Collected points
+ * @param threshold - [in] Number of points to pick, at least 3 and less than the number of points
+ * @param sel - [out] Indexes of the picked points in ascending order
+ */
+static void lttb_select(const lttb_points_t *points, uint32_t threshold, uint32_t *sel)
+{
+    const db_crypto_bucket_t *data = points->data;
+    double every = (double)(points->count - 2) / (threshold - 2);
+    uint32_t prev = 0;
+    uint32_t sel_count = 0;
+    sel[sel_count++] = 0;
+    for(uint32_t i = 0; i < threshold - 2; i++) {
+        // Third vertex is the average of the next bucket //
+        uint32_t avg_start = (uint32_t)((i + 1) * every) + 1;
+        uint32_t avg_end = (uint32_t)((i + 2) * every) + 1;
+        avg_end = (avg_end < points->count) ? avg_end : points->count;
+        double avg_x = 0, avg_y = 0;
+        for(uint32_t j = avg_start; j < avg_end; j++) {
+            avg_x += data[j].ts - data[0].ts;
+            avg_y += data[j].close;
+        }
+        avg_x /= avg_end - avg_start;
+        avg_y /= avg_end - avg_start;
+
+        uint32_t range_start = (uint32_t)(i * every) + 1;
+        uint32_t range_end = avg_start;
+        double prev_x = data[prev].ts - data[0].ts;
+        double prev_y = data[prev].close;
+        double area_max = -1;
+        for(uint32_t j = range_start; j < range_end; j++) {
+            double area = (prev_x - avg_x) * (data[j].close - prev_y) - (prev_x - (data[j].ts - data[0].ts)) *
+                                                                            (avg_y - prev_y);
+            area = (area < 0) ? -area : area;
+            if(area > area_max) {
+                area_max = area;
+                sel[sel_count] = j;
+            }
+        }
+        prev = sel[sel_count++];
+    }
+    sel[sel_count] = points->count - 1;
+}
+
+static json_gen_err_t bucket_gen(str_buf_t *out, const db_crypto_bucket_t *bucket)
+{
+    json_gen_item_t items[] = {
+        { "ts", json_gen_uint64, &bucket->ts },
+        { "o", json_gen_float, &bucket->open },
+        { "h", json_gen_float, &bucket->high },
+        { "l", json_gen_float, &bucket->low },
+        { "c", json_gen_float, &bucket->close },
+        { "v", json_gen_float, &bucket->volume },
+        { "la", json_gen_float, &bucket->liq_ask },
+        { "lb", json_gen_float, &bucket->liq_bid },
+        { "w", json_gen_float, &bucket->whales },
+        { "n", json_gen_uint32, &bucket->count },
+    };
+    return json_gen_obj(out, items, ARRAY_SIZE(items));
+}
+
+static db_err_t agg_ohlc(const api_crypto_cache_key_t *key, db_crypto_bucket_t **pbuckets, uint32_t *pcount)
+{
+    db_crypto_bucket_t *buckets = malloc(key->limit * sizeof(db_crypto_bucket_t));
+    if(buckets == NULL) {
+        log_error("malloc buckets count=%u failed", key->limit);
+        return DB_ERR_NO_MEM;
+    }
+    db_crypto_bucket_iter_t iter;
+    db_crypto_bucket_init(&iter, key->sym_id, key->start_ts, key->end_ts, key->interval);
+    db_err_t res = DB_ERR_OK;
+    uint32_t count = 0;
+    while(count < key->limit && (res = db_crypto_get_bucket(&iter, &buckets[count])) == DB_ERR_OK) {
+        count++;
+    }
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        free(buckets);
+        return res;
+    }
+    *pbuckets = buckets;
+    *pcount = count;
+    return DB_ERR_OK;
+}
+
+static db_err_t agg_lttb(const api_crypto_cache_key_t *key, db_crypto_bucket_t **pbuckets, uint32_t *pcount)
+{
+    lttb_points_t points = {
+        .group = 1,
+        .pending = 1,
+    };
+    db_crypto_bucket_iter_t iter;
+    db_crypto_bucket_t bucket;
+    db_crypto_bucket_init(&iter, key->sym_id, key->start_ts, key->end_ts, key->interval);
+    db_err_t res;
+    while((res = db_crypto_get_bucket(&iter, &bucket)) == DB_ERR_OK) {
+        if(lttb_points_add(&points, &bucket) == false) {
+            res = DB_ERR_NO_MEM;
+            break;
+        }
+    }
+    if(res != DB_ERR_NOT_FOUND) {
+        free(points.data);
+        return res;
+    }
+
+    uint32_t threshold = (key->limit < 3) ? 3 : key->limit;
+    if(points.count > threshold) {
+        uint32_t *sel = malloc(threshold * sizeof(uint32_t));
+        if(sel == NULL) {
+            log_error("malloc lttb selection size=%u failed", threshold);
+            free(points.data);
+            return DB_ERR_NO_MEM;
+        }
+        lttb_select(&points, threshold, sel);
+        // Indexes ascend and never precede their slot, so the picked points are moved in place //
+        for(uint32_t i = 0; i < threshold; i++) {
+            points.data[i] = points.data[sel[i]];
+        }
+        points.count = threshold;
+        free(sel);
+    }
+    *pbuckets = points.data;
+    *pcount = points.count;
+    return DB_ERR_OK;
+}
+
+db_err_t api_crypto_agg_collect(const api_crypto_cache_key_t *key, db_crypto_bucket_t **pbuckets, uint32_t *pcount)
+{
+    *pbuckets = NULL;
+    *pcount = 0;
+    db_txn_t *txn = db_rd_txn_open();
+    if(txn == NULL) {
+        return DB_ERR_NO_MEM;
+    }
+    db_txn_t *prev = db_txn_switch(txn);
+    db_err_t res = (key->agg == API_CRYPTO_AGG_LTTB) ? agg_lttb(key, pbuckets, pcount)
+                                                     : agg_ohlc(key, pbuckets, pcount);
+    db_txn_switch(prev);
+    db_rd_txn_close(txn);
+    if(res != DB_ERR_OK) {
+        log_error("aggregate metrics sym_id=%u agg=%u failed", key->sym_id, key->agg);
+    }
+    return res;
+}
+
+char *api_crypto_agg_build(const api_crypto_cache_key_t *key, uint32_t *len)
+{
+    db_crypto_bucket_t *buckets;
+    uint32_t count;
+    if(api_crypto_agg_collect(key, &buckets, &count) != DB_ERR_OK) {
+        return NULL;
+    }
+    uint32_t size = count * AGG_ROW_MAX + sizeof(AGG_BODY_START AGG_BODY_END);
+    char *body = malloc(size);
+    if(body == NULL) {
+        log_error("malloc metrics body size=%u failed", size);
+        free(buckets);
+        return NULL;
+    }
+    str_buf_t out = {
+        .data = body,
+        .size = size,
+    };
+    buf_puts(&out, AGG_BODY_START);
+    for(uint32_t i = 0; i < count; i++) {
+        if(i > 0) {
+            buf_putc(&out, ',');
+        }
+        if(bucket_gen(&out, &buckets[i]) != JSON_GEN_ERR_OK) {
+            free(buckets);
+            free(body);
+            return NULL;
+        }
+    }
+    buf_puts(&out, AGG_BODY_END);
+    free(buckets);
+
+    // Body is kept by the cache, so the unused tail is given back //
+    char *fit = realloc(body, out.offset);
+    *len = out.offset;
+    return fit ? fit : body;
+}
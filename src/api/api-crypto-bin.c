@@ -0,0 +1,155 @@
+#include <api/api-crypto.h>
+#include <db/db-crypto-table.h>
+#include <core/base/log.h>
+#include <stdlib.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+// Columns are written from host memory as is //
+STATIC_ASSERT(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+STATIC_ASSERT(sizeof(api_crypto_bin_hdr_t) == 16);
+
+#define BIN_COL(col) (1u << API_CRYPTO_BIN_COL_##col)
+#define BIN_COLS_ROW                                                                                                   \
+    (BIN_COL(TS) | BIN_COL(CLOSE) | BIN_COL(VOLUME) | BIN_COL(LIQ_ASK) | BIN_COL(LIQ_BID) | BIN_COL(WHALES))
+#define BIN_COLS_AGG (BIN_COLS_ROW | BIN_COL(OPEN) | BIN_COL(HIGH) | BIN_COL(LOW) | BIN_COL(COUNT))
+
+/**
+ * @brief Element sizes of the columns, their order keeps every array naturally aligned
+ */
+static const uint8_t col_size[] = {
+    [API_CRYPTO_BIN_COL_TS] = sizeof(uint64_t),
+    [API_CRYPTO_BIN_COL_CLOSE] = sizeof(float),
+    [API_CRYPTO_BIN_COL_VOLUME] = sizeof(float),
+    [API_CRYPTO_BIN_COL_LIQ_ASK] = sizeof(float),
+    [API_CRYPTO_BIN_COL_LIQ_BID] = sizeof(float),
+    [API_CRYPTO_BIN_COL_OPEN] = sizeof(float),
+    [API_CRYPTO_BIN_COL_HIGH] = sizeof(float),
+    [API_CRYPTO_BIN_COL_LOW] = sizeof(float),
+    [API_CRYPTO_BIN_COL_COUNT] = sizeof(uint32_t),
+    [API_CRYPTO_BIN_COL_WHALES] = sizeof(uint8_t),
+};
+STATIC_ASSERT(ARRAY_SIZE(col_size) == API_CRYPTO_BIN_COL_MAX);
+
+/**
+ * @brief Binary body with the column arrays laid out
+ */
+typedef struct {
+    char *body;                         ///< Header followed by the columns
+    uint32_t len;                       ///< Length of the body
+    void *cols[API_CRYPTO_BIN_COL_MAX]; ///< Column arrays inside the body, NULL if not present
+} bin_body_t;
+
+/**
+ * @brief Allocate the body and fill its header
+ * @param bin - [out] Pointer to the body
+ * @param key - [in] Pointer to the normalized request
+ * @param cols - [in] Bit mask of the present columns
+ * @param count - [in] Number of rows
+ * @return true on success, false otherwise
+ */
+static bool bin_alloc(bin_body_t *bin, const api_crypto_cache_key_t *key, uint16_t cols, uint32_t count)
+{
+    uint32_t offsets[API_CRYPTO_BIN_COL_MAX];
+    bin->len = sizeof(api_crypto_bin_hdr_t);
+    for(uint32_t i = 0; i < API_CRYPTO_BIN_COL_MAX; i++) {
+        offsets[i] = bin->len;
+        if(cols & (1u << i)) {
+            bin->len += count * col_size[i];
+        }
+    }
+    bin->body = malloc(bin->len);
+    if(bin->body == NULL) {
+        log_error("malloc binary body size=%u failed", bin->len);
+        return false;
+    }
+    for(uint32_t i = 0; i < API_CRYPTO_BIN_COL_MAX; i++) {
+        bin->cols[i] = (cols & (1u << i)) ? bin->body + offsets[i] : NULL;
+    }
+    api_crypto_bin_hdr_t *hdr = (api_crypto_bin_hdr_t *)bin->body;
+    hdr->magic = API_CRYPTO_BIN_MAGIC;
+    hdr->version = API_CRYPTO_BIN_VERSION;
+    hdr->cols = cols;
+    hdr->count = count;
+    hdr->interval = key->interval;
+    return true;
+}
+
+static char *bin_sample(const api_crypto_cache_key_t *key, uint32_t *len)
+{
+    api_crypto_rows_t rows;
+    if(api_crypto_sample_collect(key, &rows) != DB_ERR_OK) {
+        return NULL;
+    }
+    bin_body_t bin;
+    if(!bin_alloc(&bin, key, BIN_COLS_ROW, rows.count)) {
+        free(rows.ts);
+        return NULL;
+    }
+    uint64_t *ts = bin.cols[API_CRYPTO_BIN_COL_TS];
+    float *close = bin.cols[API_CRYPTO_BIN_COL_CLOSE];
+    float *volume = bin.cols[API_CRYPTO_BIN_COL_VOLUME];
+    float *liq_ask = bin.cols[API_CRYPTO_BIN_COL_LIQ_ASK];
+    float *liq_bid = bin.cols[API_CRYPTO_BIN_COL_LIQ_BID];
+    uint8_t *whales = bin.cols[API_CRYPTO_BIN_COL_WHALES];
+    for(uint32_t i = 0; i < rows.count; i++) {
+        const db_crypto_t *row = &rows.data[i];
+        ts[i] = rows.ts[i];
+        close[i] = row->close;
+        volume[i] = row->volume;
+        liq_ask[i] = row->liq_ask;
+        liq_bid[i] = row->liq_bid;
+        whales[i] = row->whales;
+    }
+    free(rows.ts);
+    *len = bin.len;
+    return bin.body;
+}
+
+static char *bin_agg(const api_crypto_cache_key_t *key, uint32_t *len)
+{
+    db_crypto_bucket_t *buckets;
+    uint32_t count;
+    if(api_crypto_agg_collect(key, &buckets, &count) != DB_ERR_OK) {
+        return NULL;
+    }
+    bin_body_t bin;
+    if(!bin_alloc(&bin, key, BIN_COLS_AGG, count)) {
+        free(buckets);
+        return NULL;
+    }
+    uint64_t *ts = bin.cols[API_CRYPTO_BIN_COL_TS];
+    float *close = bin.cols[API_CRYPTO_BIN_COL_CLOSE];
+    float *volume = bin.cols[API_CRYPTO_BIN_COL_VOLUME];
+    float *liq_ask = bin.cols[API_CRYPTO_BIN_COL_LIQ_ASK];
+    float *liq_bid = bin.cols[API_CRYPTO_BIN_COL_LIQ_BID];
+    float *open = bin.cols[API_CRYPTO_BIN_COL_OPEN];
+    float *high = bin.cols[API_CRYPTO_BIN_COL_HIGH];
+    float *low = bin.cols[API_CRYPTO_BIN_COL_LOW];
+    uint32_t *rows = bin.cols[API_CRYPTO_BIN_COL_COUNT];
+    uint8_t *whales = bin.cols[API_CRYPTO_BIN_COL_WHALES];
+    for(uint32_t i = 0; i < count; i++) {
+        const db_crypto_bucket_t *bucket = &buckets[i];
+        ts[i] = bucket->ts;
+        close[i] = bucket->close;
+        volume[i] = bucket->volume;
+        liq_ask[i] = bucket->liq_ask;
+        liq_bid[i] = bucket->liq_bid;
+        open[i] = bucket->open;
+        high[i] = bucket->high;
+        low[i] = bucket->low;
+        rows[i] = bucket->count;
+        whales[i] = bucket->whales + 0.5f;
+    }
+    free(buckets);
+    *len = bin.len;
+    return bin.body;
+}
+
+char *api_crypto_bin_build(const api_crypto_cache_key_t *key, uint32_t *len)
+{
+    if(key->agg == API_CRYPTO_AGG_SAMPLE) {
+        return bin_sample(key, len);
+    }
+    return bin_agg(key, len);
+}
@@ -0,0 +1,173 @@
+#include <api/api-crypto.h>
+#include <core/base/log.h>
+#include <sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define CACHE_ENTRIES_MAX 64
+#define CACHE_SIZE_MAX    (8 * 1024 * 1024)
+#define CACHE_BODY_MAX    (CACHE_SIZE_MAX / 4)
+
+struct api_crypto_cache_ent {
+    TAILQ_ENTRY(api_crypto_cache_ent) entry; ///< Entry in the LRU list, most recently used first
+    api_crypto_cache_key_t key;              ///< Normalized request
+    str_t body;                              ///< Response body, valid once ready
+    uint32_t refs;                           ///< Requests using the entry, plus one while listed
+    bool ready;                              ///< Building is finished, body is NULL if it failed
+    bool listed;                             ///< New requests can find the entry
+};
+
+typedef struct {
+    TAILQ_HEAD(cache_list, api_crypto_cache_ent) lru; ///< Listed entries, including those being built
+    pthread_mutex_t lock;                            ///< Guards the list and the entries
+    pthread_cond_t cond;                             ///< Signaled when an entry gets ready
+    uint32_t count;                                  ///< Number of listed entries
+    size_t size;                                     ///< Body size of the listed ready entries
+    uint64_t hits;                                   ///< Requests served from a ready entry
+    uint64_t joins;                                  ///< Requests which waited for another build
+    uint64_t builds;                                 ///< Requests which scanned the DB
+} api_crypto_cache_t;
+
+static api_crypto_cache_t cache_glob = {
+    .lru = TAILQ_HEAD_INITIALIZER(cache_glob.lru),
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static bool cache_key_eq(const api_crypto_cache_key_t *a, const api_crypto_cache_key_t *b)
+{
+    return a->sym_id == b->sym_id && a->interval == b->interval && a->start_ts == b->start_ts &&
+           a->end_ts == b->end_ts && a->limit == b->limit && a->agg == b->agg &&
+           a->fmt == b->fmt;
+}
+
+static void cache_unref(api_crypto_cache_ent_t *ent)
+{
+    if(--ent->refs == 0) {
+        free(ent->body.data);
+        free(ent);
+    }
+}
+
+static void cache_unlist(api_crypto_cache_t *cache, api_crypto_cache_ent_t *ent)
+{
+    if(ent->listed == false) {
+        return;
+    }
+    TAILQ_REMOVE(&cache->lru, ent, entry);
+    cache->count--;
+    if(ent->ready) {
+        cache->size -= ent->body.len;
+    }
+    ent->listed = false;
+    cache_unref(ent);
+}
+
+static void cache_evict(api_crypto_cache_t *cache)
+{
+    api_crypto_cache_ent_t *ent = TAILQ_LAST(&cache->lru, cache_list);
+    while(ent && (cache->count > CACHE_ENTRIES_MAX || cache->size > CACHE_SIZE_MAX)) {
+        api_crypto_cache_ent_t *prev = TAILQ_PREV(ent, cache_list, entry);
+        // Entries being built are kept, their waiters find them by the list //
+        if(ent->ready) {
+            cache_unlist(cache, ent);
+        }
+        ent = prev;
+    }
+}
+
+api_crypto_cache_ent_t *api_crypto_cache_get(const api_crypto_cache_key_t *key, bool *build)
+{
+    api_crypto_cache_t *cache = &cache_glob;
+    pthread_mutex_lock(&cache->lock);
+    api_crypto_cache_ent_t *ent;
+    TAILQ_FOREACH(ent, &cache->lru, entry) {
+        if(cache_key_eq(&ent->key, key)) {
+            break;
+        }
+    }
+    if(ent) {
+        ent->refs++;
+        TAILQ_REMOVE(&cache->lru, ent, entry);
+        TAILQ_INSERT_HEAD(&cache->lru, ent, entry);
+        if(ent->ready) {
+            cache->hits++;
+        } else {
+            cache->joins++;
+        }
+        while(ent->ready == false) {
+            pthread_cond_wait(&cache->cond, &cache->lock);
+        }
+        pthread_mutex_unlock(&cache->lock);
+        *build = false;
+        return ent;
+    }
+
+    ent = calloc(1, sizeof(api_crypto_cache_ent_t));
+    if(ent == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        log_error("calloc api_crypto_cache_ent_t failed");
+        return NULL;
+    }
+    ent->key = *key;
+    ent->refs = 2;
+    ent->listed = true;
+    TAILQ_INSERT_HEAD(&cache->lru, ent, entry);
+    cache->count++;
+    cache->builds++;
+    log_debug("cache build sym_id=%u, hits=%" PRIu64 " joins=%" PRIu64 " builds=%" PRIu64, key->sym_id, cache->hits,
+              cache->joins, cache->builds);
+    pthread_mutex_unlock(&cache->lock);
+    *build = true;
+    return ent;
+}
+
+void api_crypto_cache_done(api_crypto_cache_ent_t *ent, char *body, uint32_t len)
+{
+    api_crypto_cache_t *cache = &cache_glob;
+    pthread_mutex_lock(&cache->lock);
+    ent->body.data = body;
+    ent->body.len = body ? len : 0;
+    // Failed and oversized responses are only handed to the requests already waiting //
+    if(body == NULL || len > CACHE_BODY_MAX) {
+        cache_unlist(cache, ent);
+    } else if(ent->listed) {
+        cache->size += len;
+    }
+    ent->ready = true;
+    cache_evict(cache);
+    pthread_cond_broadcast(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+const str_t *api_crypto_cache_body(const api_crypto_cache_ent_t *ent)
+{
+    return ent->body.data ? &ent->body : NULL;
+}
+
+void api_crypto_cache_put(api_crypto_cache_ent_t *ent)
+{
+    api_crypto_cache_t *cache = &cache_glob;
+    pthread_mutex_lock(&cache->lock);
+    cache_unref(ent);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void api_crypto_cache_drop(uint32_t sym_id, uint64_t ts)
+{
+    api_crypto_cache_t *cache = &cache_glob;
+    pthread_mutex_lock(&cache->lock);
+    api_crypto_cache_ent_t *ent = TAILQ_FIRST(&cache->lru);
+    while(ent) {
+        api_crypto_cache_ent_t *next = TAILQ_NEXT(ent, entry);
+        // Builds in flight are dropped too, their scan may have started before the tick was written //
+        if(ent->key.sym_id == sym_id && ent->key.start_ts <= ts && ts < ent->key.end_ts) {
+            cache_unlist(cache, ent);
+        }
+        ent = next;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,453 @@
+#include <api/api-crypto.h>
+#include <db/db-crypto-table.h>
+#include <core/http/http-ext.h>
+#include <core/base/log.h>
+#include <sys/queue.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ev.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define API_CRYPTO_LIVE_PATH "/crypto/live/{symbols}"
+#define LIVE_HEADERS         "Cache-Control: no-cache\r\nX-Accel-Buffering: no\r\n"
+#define LIVE_RETRY           "retry: 3000\n\n"
+#define LIVE_PING            ":\n\n"
+#define LIVE_PING_SEC        15.0
+#define LIVE_SYM_MAX         16
+#define LIVE_SYM_NAME_MAX    32
+#define LIVE_EVENT_MAX       256
+#define LIVE_BUF_SIZE        (16 * 1024)
+#define LIVE_REC_SIZE(len)   ((sizeof(live_rec_t) + (len) + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1))
+#define LIVE_INBOX_SIZE      (CRYPTO_QUEUE_MAX * LIVE_REC_SIZE(LIVE_EVENT_MAX))
+
+typedef struct live_client live_client_t;
+typedef struct live_loop live_loop_t;
+
+typedef struct live_sub {
+    LIST_ENTRY(live_sub) entry; ///< Entry in the subscriber list of the symbol
+    live_client_t *client;      ///< Client which owns the subscription
+    uint32_t sym_id;            ///< Subscribed symbol ID
+} live_sub_t;
+
+struct live_client {
+    LIST_ENTRY(live_client) entry;  ///< Entry in the client list of the loop
+    live_loop_t *lloop;             ///< Loop which serves the client
+    shttp_conn_t *conn;             ///< Connection of the event stream
+    live_sub_t subs[LIVE_SYM_MAX];  ///< Subscriptions of the client
+    uint32_t subs_count;            ///< Number of subscriptions
+    bool overflow;                  ///< Client reads slower than ticks arrive, the stream is ended
+    uint32_t len;                   ///< Length of the events waiting for the socket
+    char buf[LIVE_BUF_SIZE];        ///< Events waiting for the socket
+};
+
+typedef struct {
+    LIST_HEAD(live_sub_list, live_sub) subs; ///< Subscribers of the symbol
+    char name[LIVE_SYM_NAME_MAX];            ///< Symbol name, used as the event type
+} live_sym_t;
+
+typedef struct {
+    uint32_t sym_id; ///< Symbol ID of the tick
+    uint32_t len;    ///< Length of the tick data which follows
+} live_rec_t;
+
+// Ticks of a whole queue flush are pushed at once, so the inbox holds as many of the largest ones //
+STATIC_ASSERT(LIVE_INBOX_SIZE <= UINT32_MAX);
+
+// Ticks reach the loop through its inbox, the rest of the state belongs to the thread running the loop //
+struct live_loop {
+    LIST_ENTRY(live_loop) entry;                      ///< Entry in the list of the loops with clients
+    struct ev_loop *loop;                             ///< Event loop which serves the clients
+    LIST_HEAD(live_client_list, live_client) clients; ///< Clients of the loop
+    live_sym_t **syms;                                ///< Subscribed symbols indexed by ID, NULL if none
+    uint32_t syms_count;                              ///< Size of the symbols array
+    ev_timer ping;                                    ///< Keeps idle streams open behind proxies
+    ev_async wake;                                    ///< Wakes the loop up when ticks are pushed to its inbox
+    bool busy;                                        ///< Inbox is being dispatched, the state is freed after it
+    bool overflow;                                    ///< Ticks were dropped from the inbox, protected by the lock
+    uint32_t inbox_len;                               ///< Length of the pushed ticks, protected by the lock
+    char *inbox;                                      ///< Pushed ticks, protected by the lock
+    char *work;                                       ///< Ticks taken from the inbox by the loop
+    char bufs[2][LIVE_INBOX_SIZE];                    ///< Storage of the inbox and the taken ticks
+};
+
+typedef struct {
+    LIST_HEAD(live_loop_list, live_loop) loops; ///< Loops with clients
+    pthread_mutex_t lock;                       ///< Protects the list and the inboxes
+} api_crypto_live_t;
+
+static api_crypto_live_t live_glob = {
+    .loops = LIST_HEAD_INITIALIZER(live_glob.loops),
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const json_gen_item_t bad_req_items[] = {
+    { "error", json_gen_str, "Bad request" },
+};
+static const json_gen_item_t mem_error_items[] = {
+    { "error", json_gen_str, "Memory allocation error" },
+};
+static const json_gen_item_t db_error_items[] = {
+    { "error", json_gen_str, "Database error" },
+};
+
+static shttp_err_t resp_json(shttp_conn_t *conn, shttp_resp_code_t code, const json_gen_item_t *items,
+                             uint32_t num_items)
+{
+    if(http_resp_json(conn, code, SHTTP_CONTENT_TYPE_JSON, SHTTP_CONNECTION_DEFAULT, items, num_items) !=
+       HTTP_GEN_ERR_OK) {
+        return SHTTP_ERR_IO;
+    }
+    return SHTTP_ERR_OK;
+}
+
+/**
+ * @brief Queue the event to the client and wake its stream up if it is idle
+ * @note Client may be freed before returning
+ */
+static void client_send(live_client_t *client, const char *data, uint32_t len)
+{
+    if(client->overflow) {
+        return;
+    }
+    if(client->len + len > sizeof(client->buf)) {
+        // Dropping a single tick would leave a silent gap, so the client reconnects and reloads instead //
+        log_warn("live client overflow, %u bytes pending", client->len);
+        client->overflow = true;
+    } else {
+        memcpy(client->buf + client->len, data, len);
+        client->len += len;
+    }
+    shttp_resp_resume(client->conn);
+}
+
+static void ping_cb(UNUSED struct ev_loop *loop, ev_timer *timer, UNUSED int events)
+{
+    live_loop_t *lloop = container_of(timer, live_loop_t, ping);
+    live_client_t *client = LIST_FIRST(&lloop->clients);
+    while(client) {
+        live_client_t *next = LIST_NEXT(client, entry);
+        client_send(client, LIVE_PING, sizeof(LIVE_PING) - 1);
+        client = next;
+    }
+}
+
+static void live_loop_free(live_loop_t *lloop)
+{
+    pthread_mutex_lock(&live_glob.lock);
+    LIST_REMOVE(lloop, entry);
+    pthread_mutex_unlock(&live_glob.lock);
+    // Pending wakeup is cleared by the stop, and no new one is sent once the loop is unlisted //
+    ev_async_stop(lloop->loop, &lloop->wake);
+    ev_timer_stop(lloop->loop, &lloop->ping);
+    free(lloop->syms);
+    free(lloop);
+}
+
+/**
+ * @brief Send the tick to the subscribers of the symbol on the loop
+ * @note Subscribers may be freed before returning
+ */
+static void live_loop_send(live_loop_t *lloop, uint32_t sym_id, const char *data, uint32_t len)
+{
+    if(sym_id >= lloop->syms_count || lloop->syms[sym_id] == NULL) {
+        return;
+    }
+    live_sym_t *sym = lloop->syms[sym_id];
+
+    // Event is formatted once per loop and copied to every subscriber //
+    char buf[LIVE_EVENT_MAX + LIVE_SYM_NAME_MAX + 16];
+    int n = snprintf(buf, sizeof(buf), "event: %s\ndata: %.*s\n\n", sym->name, (int)len, data);
+    if(n < 0 || (size_t)n >= sizeof(buf)) {
+        log_error("live event %s too large", sym->name);
+        return;
+    }
+
+    // Subscriber may be freed by a failed send, so the next one is taken beforehand //
+    live_sub_t *sub = LIST_FIRST(&sym->subs);
+    while(sub) {
+        live_sub_t *next = LIST_NEXT(sub, entry);
+        client_send(sub->client, buf, n);
+        sub = next;
+    }
+}
+
+static void wake_cb(UNUSED struct ev_loop *loop, ev_async *async, UNUSED int events)
+{
+    live_loop_t *lloop = container_of(async, live_loop_t, wake);
+    pthread_mutex_lock(&live_glob.lock);
+    char *work = lloop->inbox;
+    lloop->inbox = lloop->work;
+    lloop->work = work;
+    uint32_t len = lloop->inbox_len;
+    bool overflow = lloop->overflow;
+    lloop->inbox_len = 0;
+    lloop->overflow = false;
+    pthread_mutex_unlock(&live_glob.lock);
+
+    lloop->busy = true;
+    if(overflow) {
+        // Loop fell behind the ticks, so its clients reconnect and reload instead of missing some //
+        log_warn("live inbox overflow, %u bytes pending", len);
+        live_client_t *client = LIST_FIRST(&lloop->clients);
+        while(client) {
+            live_client_t *next = LIST_NEXT(client, entry);
+            client->overflow = true;
+            shttp_resp_resume(client->conn);
+            client = next;
+        }
+        len = 0;
+    }
+    uint32_t offset = 0;
+    while(offset < len && !LIST_EMPTY(&lloop->clients)) {
+        live_rec_t rec;
+        memcpy(&rec, work + offset, sizeof(rec));
+        live_loop_send(lloop, rec.sym_id, work + offset + sizeof(rec), rec.len);
+        offset += LIVE_REC_SIZE(rec.len);
+    }
+    lloop->busy = false;
+    if(LIST_EMPTY(&lloop->clients)) {
+        live_loop_free(lloop);
+    }
+}
+
+/**
+ * @brief Get the live state of the loop, creating it for the first client
+ * @note Must be called from the thread running the loop
+ */
+static live_loop_t *live_loop_get(struct ev_loop *loop)
+{
+    api_crypto_live_t *live = &live_glob;
+    live_loop_t *lloop;
+    pthread_mutex_lock(&live->lock);
+    LIST_FOREACH(lloop, &live->loops, entry)
+    {
+        if(lloop->loop == loop) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&live->lock);
+    if(lloop) {
+        return lloop;
+    }
+
+    lloop = calloc(1, sizeof(live_loop_t));
+    if(lloop == NULL) {
+        log_error("calloc live_loop_t failed");
+        return NULL;
+    }
+    lloop->loop = loop;
+    LIST_INIT(&lloop->clients);
+    lloop->inbox = lloop->bufs[0];
+    lloop->work = lloop->bufs[1];
+    ev_timer_init(&lloop->ping, ping_cb, LIVE_PING_SEC, LIVE_PING_SEC);
+    ev_timer_start(loop, &lloop->ping);
+    ev_async_init(&lloop->wake, wake_cb);
+    ev_async_start(loop, &lloop->wake);
+    pthread_mutex_lock(&live->lock);
+    LIST_INSERT_HEAD(&live->loops, lloop, entry);
+    pthread_mutex_unlock(&live->lock);
+    return lloop;
+}
+
+static shttp_err_t live_stream_cb(shttp_conn_t *conn, void *priv_data)
+{
+    live_client_t *client = priv_data;
+    if(client->overflow) {
+        return shttp_resp_end(conn);
+    }
+    str_t chunk = {
+        .data = client->buf,
+        .len = client->len,
+    };
+    client->len = 0;
+    return shttp_resp_chunk(conn, &chunk);
+}
+
+static void live_client_free(void *priv_data)
+{
+    live_client_t *client = priv_data;
+    live_loop_t *lloop = client->lloop;
+    for(uint32_t i = 0; i < client->subs_count; i++) {
+        live_sub_t *sub = &client->subs[i];
+        LIST_REMOVE(sub, entry);
+        live_sym_t *sym = lloop->syms[sub->sym_id];
+        if(LIST_EMPTY(&sym->subs)) {
+            lloop->syms[sub->sym_id] = NULL;
+            free(sym);
+        }
+    }
+    LIST_REMOVE(client, entry);
+    free(client);
+
+    if(LIST_EMPTY(&lloop->clients) && lloop->busy == false) {
+        live_loop_free(lloop);
+    }
+}
+
+static live_sym_t *live_sym_get(live_loop_t *lloop, uint32_t sym_id, const char *name)
+{
+    if(sym_id >= lloop->syms_count) {
+        uint32_t count = sym_id + 1;
+        live_sym_t **syms = realloc(lloop->syms, count * sizeof(live_sym_t *));
+        if(syms == NULL) {
+            log_error("realloc live syms %u failed", count);
+            return NULL;
+        }
+        memset(syms + lloop->syms_count, 0, (count - lloop->syms_count) * sizeof(live_sym_t *));
+        lloop->syms = syms;
+        lloop->syms_count = count;
+    }
+    live_sym_t *sym = lloop->syms[sym_id];
+    if(sym == NULL) {
+        sym = malloc(sizeof(live_sym_t));
+        if(sym == NULL) {
+            log_error("malloc live_sym_t failed");
+            return NULL;
+        }
+        LIST_INIT(&sym->subs);
+        strcpy(sym->name, name);
+        lloop->syms[sym_id] = sym;
+    }
+    return sym;
+}
+
+static shttp_err_t live_cb(const shttp_req_t *req)
+{
+    const str_t *symbols = shttp_req_param(req, "symbols");
+    uint32_t sym_ids[LIVE_SYM_MAX];
+    char names[LIVE_SYM_MAX][LIVE_SYM_NAME_MAX];
+    uint32_t count = 0;
+
+    // Symbols are separated by commas, duplicates are subscribed once //
+    const char *cur = symbols->data;
+    const char *end = symbols->data + symbols->len;
+    while(cur <= end) {
+        const char *sep = memchr(cur, ',', end - cur);
+        if(sep == NULL) {
+            sep = end;
+        }
+        size_t len = sep - cur;
+        if(len == 0 || len >= LIVE_SYM_NAME_MAX || count >= LIVE_SYM_MAX) {
+            log_error("live symbols %.*s invalid", (int)symbols->len, symbols->data);
+            return resp_json(req->conn, SHTTP_RESP_CODE_400_BAD_REQUEST, bad_req_items, ARRAY_SIZE(bad_req_items));
+        }
+        memcpy(names[count], cur, len);
+        names[count][len] = '\0';
+        cur = sep + 1;
+
+        uint32_t sym_id;
+        db_err_t res = db_crypto_get_sym(names[count], &sym_id);
+        db_txn_abort();
+        if(res != DB_ERR_OK) {
+            if(res == DB_ERR_NOT_FOUND) {
+                log_error("symbol %s not found", names[count]);
+                return resp_json(req->conn, SHTTP_RESP_CODE_400_BAD_REQUEST, bad_req_items,
+                                 ARRAY_SIZE(bad_req_items));
+            }
+            return resp_json(req->conn, SHTTP_RESP_CODE_500_SERVER_ERROR, db_error_items, ARRAY_SIZE(db_error_items));
+        }
+        bool is_dup = false;
+        for(uint32_t i = 0; i < count; i++) {
+            is_dup |= (sym_ids[i] == sym_id);
+        }
+        if(is_dup == false) {
+            sym_ids[count++] = sym_id;
+        }
+    }
+
+    // Client is served by the loop of its connection, the ticks are handed over to it //
+    live_loop_t *lloop = live_loop_get(shttp_conn_loop(req->conn));
+    live_client_t *client = lloop ? malloc(sizeof(live_client_t)) : NULL;
+    if(client == NULL) {
+        log_error("malloc live_client_t failed");
+        if(lloop && LIST_EMPTY(&lloop->clients)) {
+            live_loop_free(lloop);
+        }
+        return resp_json(req->conn, SHTTP_RESP_CODE_500_SERVER_ERROR, mem_error_items, ARRAY_SIZE(mem_error_items));
+    }
+    client->lloop = lloop;
+    client->conn = req->conn;
+    client->subs_count = 0;
+    client->overflow = false;
+    client->len = sizeof(LIVE_RETRY) - 1;
+    memcpy(client->buf, LIVE_RETRY, client->len);
+    LIST_INSERT_HEAD(&lloop->clients, client, entry);
+
+    for(uint32_t i = 0; i < count; i++) {
+        live_sym_t *sym = live_sym_get(lloop, sym_ids[i], names[i]);
+        if(sym == NULL) {
+            live_client_free(client);
+            return resp_json(req->conn, SHTTP_RESP_CODE_500_SERVER_ERROR, mem_error_items,
+                             ARRAY_SIZE(mem_error_items));
+        }
+        live_sub_t *sub = &client->subs[client->subs_count++];
+        sub->client = client;
+        sub->sym_id = sym_ids[i];
+        LIST_INSERT_HEAD(&sym->subs, sub, entry);
+    }
+    log_info("live client subscribed to %.*s", (int)symbols->len, symbols->data);
+    return shttp_resp_begin(req->conn, SHTTP_RESP_CODE_200_OK, SHTTP_CONTENT_TYPE_EVENT_STREAM,
+                            SHTTP_CONNECTION_DEFAULT, LIVE_HEADERS, live_stream_cb, live_client_free, client);
+}
+
+void api_crypto_live_push(uint32_t sym_id, const crypto_t *crypto)
+{
+    api_crypto_live_t *live = &live_glob;
+    pthread_mutex_lock(&live->lock);
+    if(LIST_EMPTY(&live->loops)) {
+        pthread_mutex_unlock(&live->lock);
+        return;
+    }
+
+    // Tick data is formatted once and handed to every loop with clients //
+    char buf[LIVE_EVENT_MAX];
+    str_buf_t out = {
+        .data = buf,
+        .size = sizeof(buf),
+    };
+    uint8_t whales = crypto->whales;
+    json_gen_item_t items[] = {
+        [API_CRYPTO_METRICS_TIMESTAMP] = { "ts", json_gen_uint64, &crypto->ts },
+        [API_CRYPTO_METRICS_CLOSE_PRICE] = { "c", json_gen_float, &crypto->close },
+        [API_CRYPTO_METRICS_VOLUME] = { "v", json_gen_float, &crypto->volume },
+        [API_CRYPTO_METRICS_LIQ_ASK] = { "la", json_gen_float, &crypto->liq_ask },
+        [API_CRYPTO_METRICS_LIQ_BID] = { "lb", json_gen_float, &crypto->liq_bid },
+        [API_CRYPTO_METRICS_WHALES] = { "w", json_gen_uint8, &whales },
+    };
+    STATIC_ASSERT(ARRAY_SIZE(items) == API_CRYPTO_METRICS_MAX);
+    if(json_gen_obj(&out, items, ARRAY_SIZE(items)) != JSON_GEN_ERR_OK || out.offset >= out.size) {
+        pthread_mutex_unlock(&live->lock);
+        log_error("live event of symbol %u too large", sym_id);
+        return;
+    }
+
+    live_rec_t rec = {
+        .sym_id = sym_id,
+        .len = out.offset,
+    };
+    uint32_t rec_size = LIVE_REC_SIZE(rec.len);
+    live_loop_t *lloop;
+    LIST_FOREACH(lloop, &live->loops, entry)
+    {
+        if(lloop->inbox_len + rec_size > LIVE_INBOX_SIZE) {
+            lloop->overflow = true;
+        } else {
+            memcpy(lloop->inbox + lloop->inbox_len, &rec, sizeof(rec));
+            memcpy(lloop->inbox + lloop->inbox_len + sizeof(rec), buf, rec.len);
+            lloop->inbox_len += rec_size;
+        }
+        ev_async_send(lloop->loop, &lloop->wake);
+    }
+    pthread_mutex_unlock(&live->lock);
+}
+
+shttp_err_t api_crypto_live_init(void)
+{
+    if(shttp_add_req_hand(SHTTP_METHOD_GET, API_CRYPTO_LIVE_PATH, live_cb) == NULL) {
+        return SHTTP_ERR_MEM_ALLOC;
+    }
+    return SHTTP_ERR_OK;
+}
@@ -1,43 +1,57 @@
-#include <global.h>
+#include <api/api-crypto.h>
+#include <core/base/log.h>
+#include <inttypes.h>
 
-#define INTERVAL_MAX_SEC 3600
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define INTERVAL_MAX_SEC (24 * 3600)
 #define LIMIT_MAX        10000
 
-static bool parse_metrics(app_t *app, const jsmntok_t *cur, const char *json, void *priv_data)
+static const char *agg_map[] = {
+    [API_CRYPTO_AGG_SAMPLE] = "sample",
+    [API_CRYPTO_AGG_OHLC] = "ohlc",
+    [API_CRYPTO_AGG_LTTB] = "lttb",
+};
+STATIC_ASSERT(ARRAY_SIZE(agg_map) == API_CRYPTO_AGG_MAX);
+
+static json_parse_err_t parse_metrics(const jsmntok_t *cur, const char *json, void *priv_data)
 {
     api_crypto_req_metrics_t *metrics = priv_data;
-    str_t symbol = {
-        .data = metrics->symbol,
-        .len = sizeof(metrics->symbol),
+    json_enum_t agg_enum = {
+        .enums = agg_map,
+        .enums_count = ARRAY_SIZE(agg_map),
+        .pval = &metrics->agg,
     };
     json_item_t items[] = {
-        { "symbol", json_parse_nstr, &symbol },          { "start", json_parse_int64, &metrics->start_date },
+        { "symbol", json_parse_pstr, &metrics->symbol },  { "start", json_parse_int64, &metrics->start_date },
         { "end", json_parse_int64, &metrics->end_date }, { "interval", json_parse_int32, &metrics->interval_sec },
-        { "limit", json_parse_int32, &metrics->limit },
+        { "limit", json_parse_int32, &metrics->limit }, { "agg", json_parse_enum, &agg_enum },
     };
-    if(!json_parse_obj(app, cur, json, items, ARRAY_SIZE(items))) {
-        return false;
+    json_parse_err_t res = json_parse_obj(cur, json, items, ARRAY_SIZE(items));
+    if(res != JSON_PARSE_ERR_OK) {
+        return res;
     }
-    if(symbol.data[0] == '\0') {
+    if(metrics->symbol == NULL || metrics->symbol[0] == '\0') {
         log_error("symbol missing");
-        return false;
+        return JSON_PARSE_ERR_NO_KEY;
     }
-    if(metrics->start_date <= 0 || metrics->end_date <= 0 || metrics->start_date >= metrics->end_date) {
-        log_error("start_date=%" PRId64 " end_date=%" PRId64 " invalid", metrics->start_date, metrics->end_date);
-        return false;
+    if((int64_t)metrics->start_date <= 0 || (int64_t)metrics->end_date <= 0 ||
+       metrics->start_date >= metrics->end_date) {
+        log_error("start_date=%" PRIu64 " end_date=%" PRIu64 " invalid", metrics->start_date, metrics->end_date);
+        return JSON_PARSE_ERR_INVALID;
     }
-    if(metrics->interval_sec <= 0 || metrics->interval_sec > INTERVAL_MAX_SEC) {
-        log_error("interval=%" PRIu32 "invalid", metrics->interval_sec);
-        return false;
+    if(metrics->interval_sec == 0 || metrics->interval_sec > INTERVAL_MAX_SEC) {
+        log_error("interval=%" PRIu32 " invalid", metrics->interval_sec);
+        return JSON_PARSE_ERR_INVALID;
     }
-    if(metrics->limit <= 0 || metrics->limit > LIMIT_MAX) {
+    if(metrics->limit == 0 || metrics->limit > LIMIT_MAX) {
         log_error("limit=%" PRIu32 " invalid", metrics->limit);
-        return false;
+        return JSON_PARSE_ERR_INVALID;
     }
-    return true;
+    return JSON_PARSE_ERR_OK;
 }
 
-bool api_crypto_parse_data(app_t *app, const jsmntok_t *cur, const char *json, void *priv_data)
+json_parse_err_t api_crypto_parse_data(const jsmntok_t *cur, const char *json, void *priv_data)
 {
     api_crypto_req_t *req = priv_data;
     static const json_parse_cb_t cb_arr[] = {
@@ -45,12 +59,12 @@ bool api_crypto_parse_data(app_t *app, const jsmntok_t *cur, const char *json, v
     };
     if(req->act >= API_CRYPTO_ACT_MAX) {
         log_error("act=%u invalid", req->act);
-        return false;
+        return JSON_PARSE_ERR_INVALID;
     }
     json_parse_cb_t cb = cb_arr[req->act];
     if(cb == NULL) {
         log_error("act=%u not implemented", req->act);
-        return false;
+        return JSON_PARSE_ERR_INVALID;
     }
-    return cb(app, cur, json, &req->data);
+    return cb(cur, json, &req->data);
 }
@@ -1,12 +1,29 @@
-#include <global.h>
+#include <api/api-crypto.h>
+#include <db/db-crypto-table.h>
+#include <core/http/http-ext.h>
+#include <core/base/log.h>
+#include <stdlib.h>
+#include <time.h>
 
-static void gen_resp_get_symbols(app_t *app, http_srv_resp_t *resp, const api_crypto_req_t *req);
-static void gen_resp_get_metrics(app_t *app, http_srv_resp_t *resp, const api_crypto_req_t *req);
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define API_CRYPTO_PATH    "/crypto/api"
+#define METRICS_CHUNK_SIZE (32 * 1024)
+#define METRICS_ROW_MAX    256
+
+typedef struct {
+    api_crypto_cache_ent_t *ent; ///< Shared response body
+    uint32_t offset;             ///< Offset of the next chunk in the body
+} metrics_stream_t;
+
+static shttp_err_t resp_get_symbols(shttp_conn_t *conn, const api_crypto_req_t *req);
+static shttp_err_t resp_get_metrics(shttp_conn_t *conn, const api_crypto_req_t *req);
 
 static const char *act_map[] = {
     [API_CRYPTO_ACT_GET_SYMBOLS] = "get-symbols",
     [API_CRYPTO_ACT_GET_METRICS] = "get-metrics",
 };
+STATIC_ASSERT(ARRAY_SIZE(act_map) == API_CRYPTO_ACT_MAX);
 static const json_gen_item_t bad_req_items[] = {
     { "error", json_gen_str, "Bad request" },
 };
@@ -16,86 +33,249 @@ static const json_gen_item_t mem_error_items[] = {
 static const json_gen_item_t db_error_items[] = {
     { "error", json_gen_str, "Database error" },
 };
-static const api_crypto_gen_resp_cb_t gen_resp_cb_arr[] = {
-    [API_CRYPTO_ACT_GET_SYMBOLS] = gen_resp_get_symbols,
-    [API_CRYPTO_ACT_GET_METRICS] = gen_resp_get_metrics,
+static const api_crypto_resp_cb_t resp_cb_arr[] = {
+    [API_CRYPTO_ACT_GET_SYMBOLS] = resp_get_symbols,
+    [API_CRYPTO_ACT_GET_METRICS] = resp_get_metrics,
 };
+STATIC_ASSERT(ARRAY_SIZE(resp_cb_arr) == API_CRYPTO_ACT_MAX);
+
+static shttp_err_t resp_json(shttp_conn_t *conn, shttp_resp_code_t code, const json_gen_item_t *items,
+                             uint32_t num_items)
+{
+    if(http_resp_json(conn, code, SHTTP_CONTENT_TYPE_JSON, SHTTP_CONNECTION_DEFAULT, items, num_items) !=
+       HTTP_GEN_ERR_OK) {
+        return SHTTP_ERR_IO;
+    }
+    return SHTTP_ERR_OK;
+}
+
+static json_gen_err_t json_gen_sym(str_buf_t *out, const void *priv_data)
+{
+    const crypto_sym_t *sym = priv_data;
+    return json_gen_str(out, sym->name);
+}
+
+static json_gen_err_t json_gen_sym_arr(str_buf_t *out, const void *priv_data)
+{
+    return json_gen_arr(out, priv_data);
+}
 
-static void gen_resp_get_symbols(app_t *app, http_srv_resp_t *resp, const api_crypto_req_t *req)
+static shttp_err_t resp_get_symbols(shttp_conn_t *conn, UNUSED const api_crypto_req_t *req)
 {
-    UNUSED(req);
-    crypto_sym_t sym;
-    if(!db_crypto_sym_get(app, &sym)) {
-        http_gen_resp_json(app, resp, HTTP_RESP_CODE_500_SERVER_ERROR, db_error_items, ARRAY_SIZE(db_error_items));
-        return;
-    }
-    json_str_arr_t json_sym = {
-        .arr = sym.symbols,
-        .size = sym.count,
+    char buf_mem[CRYPTO_SYM_ARR_BUF_SIZE];
+    buf_ext_t buf;
+    buf_init_ext(&buf, buf_mem, sizeof(buf_mem));
+    crypto_sym_arr_t arr;
+    db_err_t res = db_crypto_sym_arr_get(&arr, &buf);
+    db_txn_abort();
+    if(res != DB_ERR_OK) {
+        return resp_json(conn, SHTTP_RESP_CODE_500_SERVER_ERROR, db_error_items, ARRAY_SIZE(db_error_items));
+    }
+    json_gen_arr_t sym_arr = {
+        .cb = json_gen_sym,
+        .arr = arr.data,
+        .count = arr.count,
+        .item_size = sizeof(crypto_sym_t),
     };
     json_gen_item_t items[] = {
-        { "sym", json_gen_str_arr, &json_sym },
+        { "sym", json_gen_sym_arr, &sym_arr },
     };
-    http_gen_resp_json(app, resp, HTTP_RESP_CODE_200_OK, items, ARRAY_SIZE(items));
+    return resp_json(conn, SHTTP_RESP_CODE_200_OK, items, ARRAY_SIZE(items));
 }
 
-static bool json_gen_metrics(app_t *app, str_t *out, const void *priv_data)
+db_err_t api_crypto_sample_collect(const api_crypto_cache_key_t *key, api_crypto_rows_t *rows)
 {
-    const crypto_arr_t *metrics = priv_data;
+    void *mem = malloc(key->limit * (sizeof(uint64_t) + sizeof(db_crypto_t)));
+    if(mem == NULL) {
+        log_error("malloc metrics rows count=%u failed", key->limit);
+        return DB_ERR_NO_MEM;
+    }
+    rows->ts = mem;
+    rows->data = (db_crypto_t *)(rows->ts + key->limit);
+    rows->count = 0;
+    db_txn_t *txn = db_rd_txn_open();
+    if(txn == NULL) {
+        free(mem);
+        return DB_ERR_NO_MEM;
+    }
+
+    db_txn_t *prev = db_txn_switch(txn);
+    db_err_t res = DB_ERR_OK;
+    db_cursor_op_t op = DB_CURSOR_OP_SET_RANGE;
+    uint64_t next_ts = key->start_ts;
+    while(rows->count < key->limit) {
+        uint32_t i = rows->count;
+        res = db_crypto_get_next(key->sym_id, key->sym_id, next_ts, key->end_ts, &rows->ts[i], &rows->data[i], op);
+        if(res != DB_ERR_OK) {
+            break;
+        }
+        rows->count++;
+        next_ts = rows->ts[i] + key->interval;
+        // Skip to the next interval only when some rows must be left out //
+        op = (key->interval > 1) ? DB_CURSOR_OP_SET_RANGE : DB_CURSOR_OP_NEXT;
+    }
+    db_txn_switch(prev);
+    db_rd_txn_close(txn);
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        log_error("get metrics sym_id=%u failed after %u rows", key->sym_id, rows->count);
+        free(mem);
+        return res;
+    }
+    return DB_ERR_OK;
+}
+
+/**
+ * @brief Serialize the requested metrics into one allocated body
+ * @param key - [in] Pointer to the normalized request
+ * @param len - [out] Length of the body
+ * @return Pointer to the body, NULL on error
+ */
+static char *metrics_build(const api_crypto_cache_key_t *key, uint32_t *len)
+{
+    if(key->fmt == API_CRYPTO_FMT_BINARY) {
+        return api_crypto_bin_build(key, len);
+    }
+    if(key->agg != API_CRYPTO_AGG_SAMPLE) {
+        return api_crypto_agg_build(key, len);
+    }
+    api_crypto_rows_t rows;
+    if(api_crypto_sample_collect(key, &rows) != DB_ERR_OK) {
+        return NULL;
+    }
+    uint32_t size = rows.count * METRICS_ROW_MAX + sizeof("{\"metrics\":[]}");
+    char *body = malloc(size);
+    if(body == NULL) {
+        log_error("malloc metrics body size=%u failed", size);
+        free(rows.ts);
+        return NULL;
+    }
+    str_buf_t out = {
+        .data = body,
+        .size = size,
+    };
+    buf_puts(&out, "{\"metrics\":[");
+
+    uint64_t ts;
+    db_crypto_t crypto;
     json_gen_item_t items[] = {
-        [API_CRYPTO_METRICS_TIMESTAMP] = { "ts", json_gen_uint64, NULL },
-        [API_CRYPTO_METRICS_CLOSE_PRICE] = { "c", json_gen_float, NULL },
-        [API_CRYPTO_METRICS_VOLUME] = { "v", json_gen_float, NULL },
-        [API_CRYPTO_METRICS_LIQ_ASK] = { "la", json_gen_float, NULL },
-        [API_CRYPTO_METRICS_LIQ_BID] = { "lb", json_gen_float, NULL },
-        [API_CRYPTO_METRICS_WHALES] = { "w", json_gen_uint8, NULL },
+        [API_CRYPTO_METRICS_TIMESTAMP] = { "ts", json_gen_uint64, &ts },
+        [API_CRYPTO_METRICS_CLOSE_PRICE] = { "c", json_gen_float, &crypto.close },
+        [API_CRYPTO_METRICS_VOLUME] = { "v", json_gen_float, &crypto.volume },
+        [API_CRYPTO_METRICS_LIQ_ASK] = { "la", json_gen_float, &crypto.liq_ask },
+        [API_CRYPTO_METRICS_LIQ_BID] = { "lb", json_gen_float, &crypto.liq_bid },
+        [API_CRYPTO_METRICS_WHALES] = { "w", json_gen_uint8, &crypto.whales },
     };
-    str_append_cstr(out, "[");
-    for(uint32_t i = 0; i < metrics->count; i++) {
-        const crypto_t *metric = &metrics->data[i];
-        items[API_CRYPTO_METRICS_TIMESTAMP].priv_data = &metric->timestamp;
-        items[API_CRYPTO_METRICS_CLOSE_PRICE].priv_data = &metric->close_price;
-        items[API_CRYPTO_METRICS_VOLUME].priv_data = &metric->volume;
-        items[API_CRYPTO_METRICS_LIQ_ASK].priv_data = &metric->liq_ask;
-        items[API_CRYPTO_METRICS_LIQ_BID].priv_data = &metric->liq_bid;
-        items[API_CRYPTO_METRICS_WHALES].priv_data = &metric->whales;
+    STATIC_ASSERT(ARRAY_SIZE(items) == API_CRYPTO_METRICS_MAX);
+    for(uint32_t i = 0; i < rows.count; i++) {
         if(i > 0) {
-            str_append_cstr(out, ",");
+            buf_putc(&out, ',');
         }
-        if(!json_gen_obj(app, out, items, ARRAY_SIZE(items))) {
-            return false;
+        ts = rows.ts[i];
+        crypto = rows.data[i];
+        if(json_gen_obj(&out, items, ARRAY_SIZE(items)) != JSON_GEN_ERR_OK) {
+            free(rows.ts);
+            free(body);
+            return NULL;
         }
     }
-    str_append_cstr(out, "]");
-    return true;
+    buf_puts(&out, "]}");
+    free(rows.ts);
+
+    // Body is kept by the cache, so the unused tail is given back //
+    char *fit = realloc(body, out.offset);
+    *len = out.offset;
+    return fit ? fit : body;
 }
 
-static void gen_resp_get_metrics(app_t *app, http_srv_resp_t *resp, const api_crypto_req_t *req)
+/**
+ * @brief Send the next chunk of the shared metrics body
+ */
+static shttp_err_t metrics_stream_cb(shttp_conn_t *conn, void *priv_data)
+{
+    metrics_stream_t *stream = priv_data;
+    const str_t *body = api_crypto_cache_body(stream->ent);
+    uint32_t left = body->len - stream->offset;
+    str_t chunk = {
+        .data = body->data + stream->offset,
+        .len = (left < METRICS_CHUNK_SIZE) ? left : METRICS_CHUNK_SIZE,
+    };
+    shttp_err_t err = shttp_resp_chunk(conn, &chunk);
+    stream->offset += chunk.len;
+    if(err != SHTTP_ERR_OK || stream->offset < body->len) {
+        return err;
+    }
+    return shttp_resp_end(conn);
+}
+
+static void metrics_stream_free(void *priv_data)
+{
+    metrics_stream_t *stream = priv_data;
+    api_crypto_cache_put(stream->ent);
+    free(stream);
+}
+
+static shttp_err_t resp_get_metrics(shttp_conn_t *conn, const api_crypto_req_t *req)
 {
     const api_crypto_req_metrics_t *req_metrics = &req->data.metrics;
-    crypto_arr_t metrics;
-    metrics.data = mem_alloc(app, __func__, req_metrics->limit * sizeof(crypto_t));
-    if(metrics.data == NULL) {
-        http_gen_resp_json(app, resp, HTTP_RESP_CODE_500_SERVER_ERROR, mem_error_items, ARRAY_SIZE(mem_error_items));
-        return;
-    }
-    metrics.count = req_metrics->limit;
-    if(!db_crypto_get(app, &metrics, req_metrics->symbol, req_metrics->start_date, req_metrics->end_date,
-                      req_metrics->interval_sec)) {
-        http_gen_resp_json(app, resp, HTTP_RESP_CODE_500_SERVER_ERROR, db_error_items, ARRAY_SIZE(db_error_items));
-        return;
+    if(req_metrics->symbol == NULL) {
+        log_error("metrics data missing");
+        return resp_json(conn, SHTTP_RESP_CODE_400_BAD_REQUEST, bad_req_items, ARRAY_SIZE(bad_req_items));
     }
-    json_gen_item_t items[] = {
-        { "metrics", json_gen_metrics, &metrics },
+    uint32_t sym_id;
+    db_err_t res = db_crypto_get_sym(req_metrics->symbol, &sym_id);
+    db_txn_abort();
+    if(res != DB_ERR_OK) {
+        if(res == DB_ERR_NOT_FOUND) {
+            log_error("symbol %s not found", req_metrics->symbol);
+            return resp_json(conn, SHTTP_RESP_CODE_400_BAD_REQUEST, bad_req_items, ARRAY_SIZE(bad_req_items));
+        }
+        return resp_json(conn, SHTTP_RESP_CODE_500_SERVER_ERROR, db_error_items, ARRAY_SIZE(db_error_items));
+    }
+
+    // Ranges ending in the future give the same rows until a new tick drops them from the cache //
+    api_crypto_cache_key_t key = {
+        .sym_id = sym_id,
+        .interval = req_metrics->interval_sec,
+        .start_ts = req_metrics->start_date,
+        .end_ts = (req_metrics->end_date > (uint64_t)time(NULL)) ? UINT64_MAX : req_metrics->end_date,
+        .limit = req_metrics->limit,
+        .agg = req_metrics->agg,
+        .fmt = req->fmt,
     };
-    http_gen_resp_json(app, resp, HTTP_RESP_CODE_200_OK, items, ARRAY_SIZE(items));
+    metrics_stream_t *stream = malloc(sizeof(metrics_stream_t));
+    if(stream == NULL) {
+        log_error("malloc metrics_stream_t failed");
+        return resp_json(conn, SHTTP_RESP_CODE_500_SERVER_ERROR, mem_error_items, ARRAY_SIZE(mem_error_items));
+    }
+    bool build;
+    stream->ent = api_crypto_cache_get(&key, &build);
+    if(stream->ent == NULL) {
+        free(stream);
+        return resp_json(conn, SHTTP_RESP_CODE_500_SERVER_ERROR, mem_error_items, ARRAY_SIZE(mem_error_items));
+    }
+    if(build) {
+        uint32_t len = 0;
+        char *body = metrics_build(&key, &len);
+        api_crypto_cache_done(stream->ent, body, len);
+    }
+    if(api_crypto_cache_body(stream->ent) == NULL) {
+        metrics_stream_free(stream);
+        return resp_json(conn, SHTTP_RESP_CODE_500_SERVER_ERROR, db_error_items, ARRAY_SIZE(db_error_items));
+    }
+    stream->offset = 0;
+    shttp_content_type_t content_type =
+        (key.fmt == API_CRYPTO_FMT_BINARY) ? SHTTP_CONTENT_TYPE_BINARY : SHTTP_CONTENT_TYPE_JSON;
+    return shttp_resp_begin(conn, SHTTP_RESP_CODE_200_OK, content_type, SHTTP_CONNECTION_DEFAULT, NULL,
+                            metrics_stream_cb, metrics_stream_free, stream);
 }
 
-void api_crypto_cb(const http_srv_req_t *http_req, http_srv_resp_t *resp)
+static shttp_err_t api_crypto_cb(const shttp_req_t *http_req)
 {
-    app_t *app = http_req->app;
+    // Binary columns are sent only to clients which ask for them, errors stay JSON //
+    const phr_header_t *accept = http_find_header(http_req->headers, http_req->headers_count, "Accept");
     api_crypto_req_t req = {
         .act = API_CRYPTO_ACT_MAX,
+        .fmt = http_header_accepts(accept, API_CRYPTO_BIN_MIME) ? API_CRYPTO_FMT_BINARY : API_CRYPTO_FMT_JSON,
     };
     json_enum_t act_enum = {
         .enums = act_map,
@@ -106,13 +286,21 @@ void api_crypto_cb(const http_srv_req_t *http_req, http_srv_resp_t *resp)
         { "act", json_parse_enum, &act_enum },
         { "data", api_crypto_parse_data, &req },
     };
-    uint32_t mem_offset = mem_get_offset(app);
-    bool res = json_parse_wrap(app, http_req->data, http_req->size, items, ARRAY_SIZE(items));
-    mem_put_offset(app, mem_offset);
-    if(res == false) {
-        http_gen_resp_json(app, resp, HTTP_RESP_CODE_400_BAD_REQUEST, bad_req_items, ARRAY_SIZE(bad_req_items));
-        return;
-    }
-    api_crypto_gen_resp_cb_t cb = gen_resp_cb_arr[req.act];
-    cb(app, resp, &req);
+    if(json_parse(http_req->body.data, http_req->body.len, items, ARRAY_SIZE(items)) != JSON_PARSE_ERR_OK ||
+       req.act >= API_CRYPTO_ACT_MAX) {
+        return resp_json(http_req->conn, SHTTP_RESP_CODE_400_BAD_REQUEST, bad_req_items, ARRAY_SIZE(bad_req_items));
+    }
+    api_crypto_resp_cb_t cb = resp_cb_arr[req.act];
+    return cb(http_req->conn, &req);
+}
+
+shttp_err_t api_crypto_init(void)
+{
+    shttp_req_hand_t *hand = shttp_add_req_hand(SHTTP_METHOD_POST, API_CRYPTO_PATH, api_crypto_cb);
+    if(hand == NULL) {
+        return SHTTP_ERR_MEM_ALLOC;
+    }
+    // Metrics are read from the DB, so the dashboard does not stall the parser on the main loop //
+    shttp_req_hand_set_blocking(hand);
+    return api_crypto_live_init();
 }
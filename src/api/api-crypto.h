@@ -2,7 +2,7 @@
 
 #include <core/http/http-server.h>
 #include <core/json/json-parser.h>
-#include <db/db-crypto.h>
+#include <db/db-crypto-table.h>
 
 /**
  * @brief Crypto API actions
@@ -13,6 +13,58 @@ typedef enum {
     API_CRYPTO_ACT_MAX,         ///< Maximum action value (invalid)
 } api_crypto_act_t;
 
+/**
+ * @brief Crypto metrics aggregation modes
+ */
+typedef enum {
+    API_CRYPTO_AGG_SAMPLE, ///< Raw rows at least the interval apart
+    API_CRYPTO_AGG_OHLC,   ///< One aggregated row per interval bucket
+    API_CRYPTO_AGG_LTTB,   ///< Interval buckets downsampled to the limit by largest triangle three buckets
+    API_CRYPTO_AGG_MAX,
+} api_crypto_agg_t;
+
+/**
+ * @brief Crypto API response formats, negotiated by the Accept header
+ */
+typedef enum {
+    API_CRYPTO_FMT_JSON,   ///< JSON object per row
+    API_CRYPTO_FMT_BINARY, ///< Columnar arrays described by api_crypto_bin_hdr_t
+    API_CRYPTO_FMT_MAX,
+} api_crypto_fmt_t;
+
+/**
+ * @brief Column arrays of the binary format, in the order they follow the header
+ */
+typedef enum {
+    API_CRYPTO_BIN_COL_TS,      ///< u64 timestamps
+    API_CRYPTO_BIN_COL_CLOSE,   ///< f32 closing prices
+    API_CRYPTO_BIN_COL_VOLUME,  ///< f32 volumes
+    API_CRYPTO_BIN_COL_LIQ_ASK, ///< f32 liquidity on the ask side
+    API_CRYPTO_BIN_COL_LIQ_BID, ///< f32 liquidity on the bid side
+    API_CRYPTO_BIN_COL_OPEN,    ///< f32 opening prices, aggregated rows only
+    API_CRYPTO_BIN_COL_HIGH,    ///< f32 highest prices, aggregated rows only
+    API_CRYPTO_BIN_COL_LOW,     ///< f32 lowest prices, aggregated rows only
+    API_CRYPTO_BIN_COL_COUNT,   ///< u32 rows per bucket, aggregated rows only
+    API_CRYPTO_BIN_COL_WHALES,  ///< u8 whales count, rounded average for aggregated rows
+    API_CRYPTO_BIN_COL_MAX,
+} api_crypto_bin_col_t;
+
+#define API_CRYPTO_BIN_MIME    "application/octet-stream" ///< Accept value which selects the binary format
+#define API_CRYPTO_BIN_MAGIC   0x54454d43                 ///< "CMET" read as a little-endian u32
+#define API_CRYPTO_BIN_VERSION 1                          ///< Version of the binary format
+
+/**
+ * @brief Header of the binary format, all fields and arrays are little-endian
+ * @note Every present column is an array of count items, arrays are contiguous and 4-byte aligned
+ */
+typedef struct {
+    uint32_t magic;    ///< API_CRYPTO_BIN_MAGIC
+    uint16_t version;  ///< API_CRYPTO_BIN_VERSION
+    uint16_t cols;     ///< Bit mask of the present columns, see api_crypto_bin_col_t
+    uint32_t count;    ///< Number of rows
+    uint32_t interval; ///< Interval of the request in seconds
+} api_crypto_bin_hdr_t;
+
 /**
  * @brief Crypto metrics types
  */
@@ -30,13 +82,41 @@ typedef enum {
  * @brief Request structure for getting crypto metrics
  */
 typedef struct {
-    char symbol[CRYPTO_SYMBOL_LEN]; ///< Cryptocurrency symbol
-    uint64_t start_date;            ///< Start timestamp
-    uint64_t end_date;              ///< End timestamp
-    uint32_t interval_sec;          ///< Interval in seconds
-    uint32_t limit;                 ///< Maximum number of data points to retrieve
+    const char *symbol;    ///< Cryptocurrency symbol, points into the request body
+    uint64_t start_date;   ///< Start timestamp
+    uint64_t end_date;     ///< End timestamp
+    uint32_t interval_sec; ///< Interval in seconds
+    uint32_t limit;        ///< Maximum number of data points to retrieve
+    api_crypto_agg_t agg;  ///< Aggregation of the rows
 } api_crypto_req_metrics_t;
 
+/**
+ * @brief Normalized get-metrics request, equal keys share one response body
+ */
+typedef struct {
+    uint32_t sym_id;      ///< Symbol ID of the requested metrics
+    uint32_t interval;    ///< Minimum distance between two metrics or length of the buckets in seconds
+    uint64_t start_ts;    ///< Start of the requested range
+    uint64_t end_ts;      ///< End of the requested range, exclusive, UINT64_MAX if it is in the future
+    uint32_t limit;       ///< Maximum number of metrics
+    api_crypto_agg_t agg; ///< Aggregation of the rows
+    api_crypto_fmt_t fmt; ///< Response format
+} api_crypto_cache_key_t;
+
+/**
+ * @brief Raw rows of a get-metrics request
+ */
+typedef struct {
+    uint64_t *ts;      ///< Timestamps of the rows, the allocation of both arrays
+    db_crypto_t *data; ///< Rows
+    uint32_t count;    ///< Number of rows
+} api_crypto_rows_t;
+
+/**
+ * @brief Forward declaration of the cached get-metrics response
+ */
+typedef struct api_crypto_cache_ent api_crypto_cache_ent_t;
+
 /**
  * @brief Crypto API request data union
  */
@@ -49,30 +129,122 @@ typedef union {
  */
 typedef struct {
     api_crypto_act_t act;       ///< Crypto API action
+    api_crypto_fmt_t fmt;       ///< Response format
     api_crypto_req_data_t data; ///< Crypto API request data
 } api_crypto_req_t;
 
 /**
  * @brief Callback type for generating crypto API responses
- * @param app - [in] Pointer to application structure
- * @param resp - [out] Pointer to HTTP server response structure to be filled
+ * @param conn - [in] Pointer to the HTTP connection
  * @param req - [in] Pointer to crypto API request structure
+ * @return SHTTP_ERR_OK on success, error code otherwise
  */
-typedef void (*api_crypto_gen_resp_cb_t)(app_t *app, http_srv_resp_t *resp, const api_crypto_req_t *req);
+typedef shttp_err_t (*api_crypto_resp_cb_t)(shttp_conn_t *conn, const api_crypto_req_t *req);
 
 /**
  * @brief Parse crypto API data
- * @param app - [in] Pointer to application structure
  * @param cur - [in] Pointer to current JSON token
  * @param json - [in] Pointer to JSON string
  * @param priv_data - [in] Pointer to private data (api_crypto_req_t)
- * @return True on success, false on failure
+ * @return JSON_PARSE_ERR_OK on success, error code otherwise
+ */
+json_parse_err_t api_crypto_parse_data(const jsmntok_t *cur, const char *json, void *priv_data);
+
+/**
+ * @brief Add the crypto API request handler to the HTTP server
+ * @return SHTTP_ERR_OK on success, error code otherwise
+ * @note Must be called between shttp_init and shttp_start
+ */
+shttp_err_t api_crypto_init(void);
+
+/**
+ * @brief Collect the raw rows of the request, at least the interval apart
+ * @param key - [in] Pointer to the normalized request
+ * @param rows - [out] Pointer to store the rows, ts is freed by the caller
+ * @return DB_ERR_OK on success, error code otherwise
+ * @note Closes the thread read transaction
+ */
+db_err_t api_crypto_sample_collect(const api_crypto_cache_key_t *key, api_crypto_rows_t *rows);
+
+/**
+ * @brief Aggregate the metrics of the request into buckets
+ * @param key - [in] Pointer to the normalized request, agg must not be API_CRYPTO_AGG_SAMPLE
+ * @param pbuckets - [out] Pointer to store the allocated buckets, freed by the caller
+ * @param pcount - [out] Pointer to store the number of buckets
+ * @return DB_ERR_OK on success, error code otherwise
+ * @note Closes the thread read transaction
+ */
+db_err_t api_crypto_agg_collect(const api_crypto_cache_key_t *key, db_crypto_bucket_t **pbuckets, uint32_t *pcount);
+
+/**
+ * @brief Serialize the aggregated metrics of the request into one allocated JSON body
+ * @param key - [in] Pointer to the normalized request, agg must not be API_CRYPTO_AGG_SAMPLE
+ * @param len - [out] Length of the body
+ * @return Pointer to the body, NULL on error
+ */
+char *api_crypto_agg_build(const api_crypto_cache_key_t *key, uint32_t *len);
+
+/**
+ * @brief Serialize the metrics of the request into one allocated binary body
+ * @param key - [in] Pointer to the normalized request
+ * @param len - [out] Length of the body
+ * @return Pointer to the body, NULL on error
+ */
+char *api_crypto_bin_build(const api_crypto_cache_key_t *key, uint32_t *len);
+
+/**
+ * @brief Find the cached response of the request or start building it
+ *
+ * Identical requests in flight share one DB scan: the first caller gets build set and must pass the body
+ * to api_crypto_cache_done, the others wait for it. A ready response is returned straight away.
+ *
+ * @param key - [in] Pointer to the normalized request
+ * @param build - [out] Set if the caller must build the response
+ * @return Pointer to the referenced entry, NULL on memory allocation error
+ * @note Blocks while another thread builds the response, so it must be called from the blocking handlers only
+ */
+api_crypto_cache_ent_t *api_crypto_cache_get(const api_crypto_cache_key_t *key, bool *build);
+
+/**
+ * @brief Publish the response built after api_crypto_cache_get and wake up the waiting requests
+ * @param ent - [in] Pointer to the entry
+ * @param body - [in] Allocated response body owned by the entry from now on, NULL if building failed
+ * @param len - [in] Length of the response body
+ */
+void api_crypto_cache_done(api_crypto_cache_ent_t *ent, char *body, uint32_t len);
+
+/**
+ * @brief Get the response body of the entry
+ * @param ent - [in] Pointer to the entry
+ * @return Pointer to the body, NULL if building failed
+ */
+const str_t *api_crypto_cache_body(const api_crypto_cache_ent_t *ent);
+
+/**
+ * @brief Release the entry returned by api_crypto_cache_get
+ * @param ent - [in] Pointer to the entry
+ */
+void api_crypto_cache_put(api_crypto_cache_ent_t *ent);
+
+/**
+ * @brief Drop the cached responses of the symbol whose range covers the new tick
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param ts - [in] Timestamp of the new tick
+ * @note Requests which already wait for a dropped response still get it, new requests build it again
+ */
+void api_crypto_cache_drop(uint32_t sym_id, uint64_t ts);
+
+/**
+ * @brief Add the live ticks event stream handler to the HTTP server
+ * @return SHTTP_ERR_OK on success, error code otherwise
+ * @note Called by api_crypto_init
  */
-bool api_crypto_parse_data(app_t *app, const jsmntok_t *cur, const char *json, void *priv_data);
+shttp_err_t api_crypto_live_init(void);
 
 /**
- * @brief Crypto API request callback
- * @param req - [in] Pointer to HTTP server request structure
- * @param resp - [out] Pointer to HTTP server response structure to be filled
+ * @brief Push a new tick to the live event streams subscribed to the symbol
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param crypto - [in] Pointer to the new tick
+ * @note May be called from any thread, the tick is handed over to the loops serving the streams
  */
-void api_crypto_cb(const http_srv_req_t *req, http_srv_resp_t *resp);
+void api_crypto_live_push(uint32_t sym_id, const crypto_t *crypto);
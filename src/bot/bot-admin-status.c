@@ -23,6 +23,20 @@ typedef struct {
 } status_t;
 
 static status_t status = { 0 };
+#ifdef CONFIG_BOT_ADMIN_CRYPTO_PARSER
+static const char *const crypto_parser_fail_str[] = {
+    [IPC_CRYPTO_PARSER_ERR_DB] = "DB",
+    [IPC_CRYPTO_PARSER_ERR_BUSY] = "DB backup is running",
+};
+STATIC_ASSERT(ARRAY_SIZE(crypto_parser_fail_str) == IPC_CRYPTO_PARSER_ERR_MAX);
+static const char *const backup_state_str[] = {
+    [DB_BACKUP_STATE_NONE] = "none",
+    [DB_BACKUP_STATE_RUNNING] = "running",
+    [DB_BACKUP_STATE_DONE] = "done",
+    [DB_BACKUP_STATE_FAILED] = "failed",
+};
+STATIC_ASSERT(ARRAY_SIZE(backup_state_str) == DB_BACKUP_STATE_MAX);
+#endif
 
 static void send_status_msg(const status_priv_data_t *data, const str_buf_t *buf)
 {
@@ -69,17 +83,20 @@ static void crypto_parser_get_status_cb(const cipc_resp_t *resp)
             buf_strtime(&buf, "Last Update Time: %Y-%m-%d %H:%M:%S\n", res->last_upd_ts);
             buf_printf(&buf, "DB Used Size: %u.%03uMB\n", res->db_used_size_kb / 1024, res->db_used_size_kb % 1024);
             buf_printf(&buf, "DB Total Size: %u.%03uMB\n", res->db_tot_size_kb / 1024, res->db_tot_size_kb % 1024);
+            if(res->backup_state > DB_BACKUP_STATE_NONE && res->backup_state < DB_BACKUP_STATE_MAX) {
+                buf_strtime(&buf, "DB Backup Start Time: %Y-%m-%d %H:%M:%S\n", res->backup_start_ts);
+                buf_printf(&buf, "DB Backup: %s in %usec\n", backup_state_str[res->backup_state], res->backup_sec);
+                buf_printf(&buf, "DB Backup Size: %u.%03uMB of %u.%03uMB\n", res->backup_done_kb / 1024,
+                           res->backup_done_kb % 1024, res->backup_tot_kb / 1024, res->backup_tot_kb % 1024);
+            }
             if(is_outdated) {
                 buf_puts(&buf, "WARNING: Crypto Parser status is outdated!\n");
             }
         }
     } else {
         if(resp->body.size) {
-            static const char *const fail_str[] = {
-                [IPC_CRYPTO_PARSER_ERR_DB] = "DB",
-            };
             ipc_crypto_parser_fail_t *fail = resp->body.data;
-            buf_printf(&buf, "Crypto Parser Error: %s", fail_str[fail->err]);
+            buf_printf(&buf, "Crypto Parser Error: %s", crypto_parser_fail_str[fail->err]);
         } else {
             buf_puts(&buf, "Failed to get Crypto Parser status");
         }
@@ -103,6 +120,41 @@ bot_admin_err_t bot_admin_send_crypto_parser_status(uint64_t chat_id)
     }
     return BOT_ADMIN_ERR_OK;
 }
+
+static void crypto_parser_db_backup_cb(const cipc_resp_t *resp)
+{
+    const status_priv_data_t *data = resp->user_data;
+    char buf_mem[BOT_MSG_SIZE_MAX];
+    str_buf_t buf;
+    str_buf_init(&buf, buf_mem, sizeof(buf_mem));
+
+    if(resp->err == CIPC_ERR_OK) {
+        buf_puts(&buf, "DB backup started, see Crypto Parser status for progress");
+    } else if(resp->body.size) {
+        ipc_crypto_parser_fail_t *fail = resp->body.data;
+        buf_printf(&buf, "DB backup not started: %s", crypto_parser_fail_str[fail->err]);
+    } else {
+        buf_puts(&buf, "Failed to start DB backup");
+    }
+
+    buf_putc(&buf, '\0');
+    send_status_msg(data, &buf);
+}
+
+bot_admin_err_t bot_admin_start_db_backup(uint64_t chat_id)
+{
+    status_priv_data_t data = {
+        .chat_id = chat_id,
+    };
+    buf_t buf_data = {
+        .data = &data,
+        .size = sizeof(data),
+    };
+    if(cipc_crypto_parser_db_backup(crypto_parser_db_backup_cb, &buf_data) != CIPC_ERR_OK) {
+        return BOT_ADMIN_ERR_IPC;
+    }
+    return BOT_ADMIN_ERR_OK;
+}
 #endif
 
 void bot_admin_status_upd(UNUSED struct ev_loop *loop, UNUSED ev_timer *timer, UNUSED int events)
@@ -26,3 +26,10 @@ void bot_admin_status_upd(struct ev_loop *loop, struct ev_timer *timer, int even
  * @return BOT_ADMIN_ERR_OK on success, error code otherwise
  */
 bot_admin_err_t bot_admin_send_crypto_parser_status(uint64_t chat_id);
+
+/**
+ * @brief Start database backup of crypto parser and report it to chat
+ * @param chat_id - [in] Chat ID
+ * @return BOT_ADMIN_ERR_OK on success, error code otherwise
+ */
+bot_admin_err_t bot_admin_start_db_backup(uint64_t chat_id);
@@ -34,12 +34,20 @@ static void crypo_parser_status_cmd(const telebot_message_t *msg)
     bot_admin_send_crypto_parser_status(msg->chat.id);
     log_debug("user '%s' ask crypto parser status in chat %" PRIu64, from->first_name, msg->chat.id);
 }
+
+static void db_backup_cmd(const telebot_message_t *msg)
+{
+    const telebot_user_t *from = &msg->from;
+    bot_admin_start_db_backup(msg->chat.id);
+    log_info("user '%s' started DB backup in chat %" PRIu64, from->first_name, msg->chat.id);
+}
 #endif
 
 static const telebot_cmd_handler_t cmd_handlers[] = {
     { "start", start_cmd },
 #ifdef CONFIG_BOT_ADMIN_CRYPTO_PARSER
     { "crypo_parser_status", crypo_parser_status_cmd },
+    { "db_backup", db_backup_cmd },
 #endif
 };
 static bot_admin_t bot = { 0 };
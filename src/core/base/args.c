@@ -26,7 +26,7 @@ args_err_t args_parse(args_t *args, int argc, char *argv[])
 
     char optstr[256] = "c:l:v:m:ds";
 #ifdef CONFIG_DB
-    strcat(optstr, "i:e:");
+    strcat(optstr, "i:e:r:b:");
 #endif
     while(true) {
         int opt = getopt(argc, argv, optstr);
@@ -88,6 +88,19 @@ args_err_t args_parse(args_t *args, int argc, char *argv[])
             args->db_prm = prm[1];
             args->db_export_file = prm[2];
         } break;
+        case 'r': {
+            char *prm[2];
+            if(str_split(optarg, ':', prm, ARRAY_SIZE(prm)) != ARRAY_SIZE(prm)) {
+                log_error("invalid param: -r %s", optarg);
+                return ARGS_ERR_INVALID_PARAM;
+            }
+            args->db_table = prm[0];
+            args->db_prm = prm[1];
+            args->db_rebuild = true;
+        } break;
+        case 'b':
+            args->db_restore_dir = optarg;
+            break;
 #endif
         default:
             return ARGS_ERR_INVALID_PARAM;
@@ -98,8 +111,10 @@ args_err_t args_parse(args_t *args, int argc, char *argv[])
         return ARGS_ERR_INVALID_PARAM;
     }
 #ifdef CONFIG_DB
-    if(args->db_import_file && args->db_export_file) {
-        log_error("cannot use both -i and -e options simultaneously");
+    uint32_t db_cmd_count = (args->db_import_file != NULL) + (args->db_export_file != NULL);
+    db_cmd_count += args->db_rebuild + (args->db_restore_dir != NULL);
+    if(db_cmd_count > 1) {
+        log_error("cannot use -i, -e, -r and -b options simultaneously");
         return ARGS_ERR_INVALID_PARAM;
     }
 #endif
@@ -20,6 +20,8 @@ typedef struct {
     const char *db_prm;         ///< Database import parameter (default: NULL, means no param)
     const char *db_import_file; ///< Database import file path (default: NULL, means no import)
     const char *db_export_file; ///< Database export file path (default: NULL, means no export)
+    bool db_rebuild;            ///< Rebuild derived tables flag (default: false)
+    const char *db_restore_dir; ///< Database backup directory to restore (default: NULL, means no restore)
 #endif
     const char *cfg_file; ///< Configuration file path (default: NULL, means use built-in config)
     const char *log_file; ///< Log file path (default: NULL, means stdout)
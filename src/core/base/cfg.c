@@ -2,6 +2,9 @@
 #include <core/base/file.h>
 #include <core/base/log.h>
 #include <core/json/json-parser.h>
+#ifdef CONFIG_DB
+#include <core/db/db.h>
+#endif
 #include <malloc.h>
 #include <string.h>
 
@@ -10,6 +13,14 @@ LOG_MOD_INIT(LOG_LVL_DEFAULT)
 #define CFG_BUF_SIZE (64 * 1024)
 
 static char *data = NULL;
+#ifdef CONFIG_DB
+static const char *db_sync_map[] = {
+    [DB_SYNC_MODE_STRICT] = "strict",
+    [DB_SYNC_MODE_PERIODIC] = "periodic",
+    [DB_SYNC_MODE_ASYNC] = "async",
+};
+STATIC_ASSERT(ARRAY_SIZE(db_sync_map) == DB_SYNC_MODE_MAX);
+#endif
 
 cfg_err_t cfg_parse(cfg_t *cfg, const char *cfg_file)
 {
@@ -18,10 +29,20 @@ cfg_err_t cfg_parse(cfg_t *cfg, const char *cfg_file)
 #ifdef CONFIG_DB
     cfg->db_path = "tmp/db";
     cfg->db_size_mb = 64;
+    cfg->db_sync = DB_SYNC_MODE_PERIODIC;
+    cfg->db_sync_ms = 1000;
+    cfg->db_backup_path = "tmp/backup";
+    cfg->db_backup_rate_kb = 16384;
 #endif
 #ifdef CONFIG_HTTP_SERVER
     cfg->http_sock = "tmp/http.sock";
+    cfg->http_backlog = 128;
     cfg->html_path = "tmp/html";
+    cfg->http_pool = 2;
+    cfg->http_max_conn = 1024;
+    cfg->http_header_sec = 10;
+    cfg->http_body_sec = 30;
+    cfg->http_keepalive_sec = 60;
 #endif
 #if defined(CONFIG_IPC_SERVER) || defined(CONFIG_IPC_CLIENT)
     cfg->ipc_sock = "tmp/ipc.sock";
@@ -34,6 +55,7 @@ cfg_err_t cfg_parse(cfg_t *cfg, const char *cfg_file)
 #endif
 #ifdef CONFIG_DB_CRYPTO_TABLE
     cfg->crypto_list_path = "config/crypto-list.json";
+    cfg->crypto_retention_sec = 3600;
 #endif
 #ifdef CONFIG_PARSER_CVBANKAS
     cfg->parser_cvb_upd_sec = 5;
@@ -51,16 +73,35 @@ cfg_err_t cfg_parse(cfg_t *cfg, const char *cfg_file)
         return CFG_ERR_PARSE;
     }
 
+#ifdef CONFIG_DB
+    json_enum_t db_sync_enum = {
+        .enums = db_sync_map,
+        .enums_count = ARRAY_SIZE(db_sync_map),
+        .pval = &cfg->db_sync,
+    };
+#endif
     json_item_t items[] = {
         { "pid_file", json_parse_pstr, &cfg->pid_file },
 #ifdef CONFIG_DB
         { "db_path", json_parse_pstr, &cfg->db_path },
         { "db_size_mb", json_parse_int32, &cfg->db_size_mb },
         { "db_count", json_parse_int32, &cfg->db_count },
+        { "db_sync", json_parse_enum, &db_sync_enum },
+        { "db_sync_ms", json_parse_int32, &cfg->db_sync_ms },
+        { "db_backup_path", json_parse_pstr, &cfg->db_backup_path },
+        { "db_backup_rate_kb", json_parse_int32, &cfg->db_backup_rate_kb },
 #endif
 #ifdef CONFIG_HTTP_SERVER
         { "http_sock", json_parse_pstr, &cfg->http_sock },
+        { "http_listen", json_parse_pstr, &cfg->http_listen },
+        { "http_backlog", json_parse_int32, &cfg->http_backlog },
         { "html_path", json_parse_pstr, &cfg->html_path },
+        { "http_workers", json_parse_int32, &cfg->http_workers },
+        { "http_pool", json_parse_int32, &cfg->http_pool },
+        { "http_max_conn", json_parse_int32, &cfg->http_max_conn },
+        { "http_header_sec", json_parse_int32, &cfg->http_header_sec },
+        { "http_body_sec", json_parse_int32, &cfg->http_body_sec },
+        { "http_keepalive_sec", json_parse_int32, &cfg->http_keepalive_sec },
 #endif
 #if defined(CONFIG_IPC_SERVER) || defined(CONFIG_IPC_CLIENT)
         { "ipc_sock", json_parse_pstr, &cfg->ipc_sock },
@@ -74,6 +115,9 @@ cfg_err_t cfg_parse(cfg_t *cfg, const char *cfg_file)
 #endif
 #ifdef CONFIG_DB_CRYPTO_TABLE
         { "crypto_list_path", json_parse_pstr, &cfg->crypto_list_path },
+        { "crypto_flush_ms", json_parse_int32, &cfg->crypto_flush_ms },
+        { "crypto_retention_path", json_parse_pstr, &cfg->crypto_retention_path },
+        { "crypto_retention_sec", json_parse_int32, &cfg->crypto_retention_sec },
 #endif
 #ifdef CONFIG_PARSER_CVBANKAS
         { "parser_cvb_upd_sec", json_parse_int32, &cfg->parser_cvb_upd_sec },
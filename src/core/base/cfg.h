@@ -19,13 +19,25 @@ typedef enum {
 typedef struct {
     const char *pid_file; ///< Path to PID file (default: "tmp/cweb.pid")
 #ifdef CONFIG_DB
-    const char *db_path; ///< Path to database file (default: "tmp/db")
-    uint32_t db_size_mb; ///< Database size in megabytes (default: 64MB)
-    uint32_t db_count;   ///< Number of named databases (default: 0)
+    const char *db_path;        ///< Path to database file (default: "tmp/db")
+    uint32_t db_size_mb;        ///< Database size in megabytes (default: 64MB)
+    uint32_t db_count;          ///< Number of named databases (default: 0 - tables of the enabled modules)
+    uint32_t db_sync;           ///< Durability of commits: "strict", "periodic" or "async" (default: "periodic")
+    uint32_t db_sync_ms;        ///< Interval of disk syncs in "periodic" mode (default: 1000ms)
+    const char *db_backup_path; ///< Path to database backups (default: "tmp/backup")
+    uint32_t db_backup_rate_kb; ///< Backup write rate in KB/s, backups pin freed pages (default: 16384, 0 - none)
 #endif
 #ifdef CONFIG_HTTP_SERVER
-    const char *http_sock; ///< Path to HTTP server socket (default: "tmp/http.sock")
-    const char *html_path; ///< Path to HTML files (default: "tmp/html")
+    const char *http_sock;       ///< Path to HTTP server socket (default: "tmp/http.sock")
+    const char *http_listen;     ///< HTTP server TCP addresses, e.g. "0.0.0.0:8080,[::]:8080" (default: NULL - none)
+    uint32_t http_backlog;       ///< Listen backlog of HTTP server sockets (default: 128)
+    const char *html_path;       ///< Path to HTML files (default: "tmp/html")
+    uint32_t http_workers;       ///< Number of HTTP worker threads (default: 0 - serve on main loop)
+    uint32_t http_pool;          ///< Number of threads running blocking API handlers (default: 2, 0 - run on the loop)
+    uint32_t http_max_conn;      ///< Maximum number of open HTTP connections (default: 1024, 0 - no limit)
+    uint32_t http_header_sec;    ///< Time to receive an HTTP request header (default: 10sec)
+    uint32_t http_body_sec;      ///< Idle time between parts of an HTTP request body (default: 30sec)
+    uint32_t http_keepalive_sec; ///< Idle time of a keep-alive HTTP connection (default: 60sec)
 #endif
 #if defined(CONFIG_IPC_SERVER) || defined(CONFIG_IPC_CLIENT)
     const char *ipc_sock; ///< Path to IPC server socket (default: "tmp/ipc.sock")
@@ -38,7 +50,10 @@ typedef struct {
     const char *lang_path; ///< Path to language files (default: "tmp/lang.json")
 #endif
 #ifdef CONFIG_DB_CRYPTO_TABLE
-    const char *crypto_list_path; ///< Path to cryptocurrency list (default: "config/crypto-list.json")
+    const char *crypto_list_path;      ///< Path to cryptocurrency list (default: "config/crypto-list.json")
+    uint32_t crypto_flush_ms;          ///< Commit interval of queued live rows (default: 0 - every loop iteration)
+    const char *crypto_retention_path; ///< Path to retention policy of crypto tables (default: NULL - keep all)
+    uint32_t crypto_retention_sec;     ///< Interval of retention passes (default: 3600sec)
 #endif
 #ifdef CONFIG_PARSER_CVBANKAS
     uint32_t parser_cvb_upd_sec; ///< CVBankas update interval in seconds (default: 5sec)
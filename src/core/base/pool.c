@@ -0,0 +1,165 @@
+#include <core/base/pool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct pool_node {
+    struct pool_node *next; ///< Next free object or slab
+} pool_node_t;
+
+static const struct {
+    uint32_t size;     ///< Size of each buffer
+    uint32_t free_max; ///< Maximum number of cached buffers
+} pool_buf_classes[POOL_BUF_CLASS_COUNT] = {
+    { 4 * 1024, 64 },
+    { 64 * 1024, 16 },
+    { 1024 * 1024, 4 },
+};
+
+void pool_init(pool_t *pool, uint32_t item_size, uint32_t slab_items)
+{
+    bzero(pool, sizeof(pool_t));
+    pool->item_size = ROUND_UP(item_size, sizeof(void *));
+    pool->slab_items = slab_items ? slab_items : 1;
+}
+
+/**
+ * @brief Count a request of the owning thread
+ * @note Counter has a single writer, so a relaxed load and store replace the locked increment
+ */
+static void pool_cnt_inc(atomic_uint_fast64_t *cnt)
+{
+    atomic_store_explicit(cnt, atomic_load_explicit(cnt, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+void pool_stat_add(pool_stat_t *stat, const pool_cnt_t *cnt)
+{
+    stat->hits += atomic_load_explicit(&cnt->hits, memory_order_relaxed);
+    stat->misses += atomic_load_explicit(&cnt->misses, memory_order_relaxed);
+}
+
+static bool pool_grow(pool_t *pool)
+{
+    // First slot of the slab links slabs together //
+    char *slab = malloc((pool->slab_items + 1) * pool->item_size);
+    if(slab == NULL) {
+        return false;
+    }
+    pool_node_t *slab_node = (pool_node_t *)slab;
+    slab_node->next = pool->slab_list;
+    pool->slab_list = slab_node;
+
+    for(uint32_t i = pool->slab_items; i > 0; i--) {
+        pool_node_t *node = (pool_node_t *)(slab + i * pool->item_size);
+        node->next = pool->free_list;
+        pool->free_list = node;
+    }
+    return true;
+}
+
+void *pool_get(pool_t *pool)
+{
+    if(pool->free_list == NULL) {
+        pool_cnt_inc(&pool->stat.misses);
+        if(pool_grow(pool) == false) {
+            return NULL;
+        }
+    } else {
+        pool_cnt_inc(&pool->stat.hits);
+    }
+
+    pool_node_t *node = pool->free_list;
+    pool->free_list = node->next;
+    bzero(node, pool->item_size);
+    return node;
+}
+
+void pool_put(pool_t *pool, void *item)
+{
+    if(item == NULL) {
+        return;
+    }
+    pool_node_t *node = item;
+    node->next = pool->free_list;
+    pool->free_list = node;
+}
+
+void pool_destroy(pool_t *pool)
+{
+    pool_node_t *slab = pool->slab_list;
+    while(slab) {
+        pool_node_t *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slab_list = NULL;
+    pool->free_list = NULL;
+}
+
+void pool_buf_init(pool_buf_t *pool)
+{
+    bzero(pool, sizeof(pool_buf_t));
+    for(uint32_t i = 0; i < POOL_BUF_CLASS_COUNT; i++) {
+        pool->classes[i].size = pool_buf_classes[i].size;
+        pool->classes[i].free_max = pool_buf_classes[i].free_max;
+    }
+}
+
+static pool_buf_class_t *pool_buf_class(pool_buf_t *pool, uint32_t size)
+{
+    for(uint32_t i = 0; i < POOL_BUF_CLASS_COUNT; i++) {
+        if(size <= pool->classes[i].size) {
+            return &pool->classes[i];
+        }
+    }
+    return NULL;
+}
+
+void *pool_buf_get(pool_buf_t *pool, uint32_t size, uint32_t *psize)
+{
+    pool_buf_class_t *class = pool_buf_class(pool, size);
+    if(class == NULL) {
+        return NULL;
+    }
+    *psize = class->size;
+
+    pool_node_t *node = class->free_list;
+    if(node) {
+        pool_cnt_inc(&class->stat.hits);
+        class->free_list = node->next;
+        class->free_count--;
+        return node;
+    }
+    pool_cnt_inc(&class->stat.misses);
+    return malloc(class->size);
+}
+
+void pool_buf_put(pool_buf_t *pool, void *data, uint32_t size)
+{
+    if(data == NULL) {
+        return;
+    }
+    pool_buf_class_t *class = pool_buf_class(pool, size);
+    if(class == NULL || class->size != size || class->free_count == class->free_max) {
+        free(data);
+        return;
+    }
+    pool_node_t *node = data;
+    node->next = class->free_list;
+    class->free_list = node;
+    class->free_count++;
+}
+
+void pool_buf_destroy(pool_buf_t *pool)
+{
+    for(uint32_t i = 0; i < POOL_BUF_CLASS_COUNT; i++) {
+        pool_buf_class_t *class = &pool->classes[i];
+        pool_node_t *node = class->free_list;
+        while(node) {
+            pool_node_t *next = node->next;
+            free(node);
+            node = next;
+        }
+        class->free_list = NULL;
+        class->free_count = 0;
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <common.h>
+#include <stdatomic.h>
+
+#define POOL_BUF_CLASS_COUNT 3
+
+/**
+ * @brief Pool usage counters
+ */
+typedef struct {
+    uint64_t hits;   ///< Number of requests served from the free list
+    uint64_t misses; ///< Number of requests which required a new allocation
+} pool_stat_t;
+
+/**
+ * @brief Live pool usage counters
+ * @note Written only by the thread which owns the pool, other threads read them with pool_stat_add
+ */
+typedef struct {
+    atomic_uint_fast64_t hits;   ///< Number of requests served from the free list
+    atomic_uint_fast64_t misses; ///< Number of requests which required a new allocation
+} pool_cnt_t;
+
+/**
+ * @brief Slab pool of fixed size objects
+ * @note Not thread safe, each thread must use its own pool
+ */
+typedef struct {
+    void *free_list;     ///< Linked list of free objects
+    void *slab_list;     ///< Linked list of allocated slabs
+    uint32_t item_size;  ///< Size of each object
+    uint32_t slab_items; ///< Number of objects allocated at once
+    pool_cnt_t stat;     ///< Usage counters
+} pool_t;
+
+/**
+ * @brief Single size class of the buffer pool
+ */
+typedef struct {
+    void *free_list;     ///< Linked list of cached buffers
+    uint32_t size;       ///< Size of each buffer
+    uint32_t free_count; ///< Number of cached buffers
+    uint32_t free_max;   ///< Maximum number of cached buffers
+    pool_cnt_t stat;     ///< Usage counters
+} pool_buf_class_t;
+
+/**
+ * @brief Size classed buffer pool (4KB, 64KB and 1MB)
+ * @note Not thread safe, each thread must use its own pool
+ */
+typedef struct {
+    pool_buf_class_t classes[POOL_BUF_CLASS_COUNT]; ///< Size classes in ascending order
+} pool_buf_t;
+
+/**
+ * @brief Add the live counters of a pool to the statistics
+ * @param stat - [in,out] Pointer to the statistics
+ * @param cnt - [in] Pointer to the live counters, may be written by another thread
+ */
+void pool_stat_add(pool_stat_t *stat, const pool_cnt_t *cnt);
+
+/**
+ * @brief Initialize a slab pool
+ * @param pool - [out] Pointer to the pool
+ * @param item_size - [in] Size of each object
+ * @param slab_items - [in] Number of objects allocated at once
+ */
+void pool_init(pool_t *pool, uint32_t item_size, uint32_t slab_items);
+
+/**
+ * @brief Get a zero-initialized object from the pool
+ * @param pool - [in] Pointer to the pool
+ * @return Pointer to the object, or NULL if allocation fails
+ */
+void *pool_get(pool_t *pool);
+
+/**
+ * @brief Return an object to the pool
+ * @param pool - [in] Pointer to the pool
+ * @param item - [in] Pointer to the object, NULL is ignored
+ */
+void pool_put(pool_t *pool, void *item);
+
+/**
+ * @brief Free all slabs of the pool, objects must not be used after this call
+ * @param pool - [in] Pointer to the pool
+ */
+void pool_destroy(pool_t *pool);
+
+/**
+ * @brief Initialize a buffer pool
+ * @param pool - [out] Pointer to the buffer pool
+ */
+void pool_buf_init(pool_buf_t *pool);
+
+/**
+ * @brief Get a buffer from the pool
+ * @param pool - [in] Pointer to the buffer pool
+ * @param size - [in] Minimum size of the buffer
+ * @param psize - [out] Actual size of the buffer
+ * @return Pointer to the buffer, or NULL if size is too large or allocation fails
+ */
+void *pool_buf_get(pool_buf_t *pool, uint32_t size, uint32_t *psize);
+
+/**
+ * @brief Return a buffer to the pool
+ * @param pool - [in] Pointer to the buffer pool
+ * @param data - [in] Pointer to the buffer, NULL is ignored
+ * @param size - [in] Actual size of the buffer returned by pool_buf_get
+ */
+void pool_buf_put(pool_buf_t *pool, void *data, uint32_t size);
+
+/**
+ * @brief Free all cached buffers of the pool
+ * @param pool - [in] Pointer to the buffer pool
+ */
+void pool_buf_destroy(pool_buf_t *pool);
@@ -0,0 +1,96 @@
+#include <core/base/tpool.h>
+#include <core/base/log.h>
+#include <stdlib.h>
+#include <string.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+static void *tpool_thread(void *arg)
+{
+    tpool_t *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while(true) {
+        tpool_job_t *job = STAILQ_FIRST(&pool->queue);
+        if(job == NULL) {
+            if(pool->stop) {
+                break;
+            }
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+        STAILQ_REMOVE_HEAD(&pool->queue, entry);
+        pool->queue_count--;
+        pthread_mutex_unlock(&pool->lock);
+        // Job may be freed by its callback //
+        job->cb(job);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+tpool_err_t tpool_init(tpool_t *pool, uint32_t threads, uint32_t queue_max)
+{
+    bzero(pool, sizeof(tpool_t));
+    STAILQ_INIT(&pool->queue);
+    pool->queue_max = queue_max;
+    if(threads == 0) {
+        return TPOOL_ERR_OK;
+    }
+    if(pthread_mutex_init(&pool->lock, NULL) != 0 || pthread_cond_init(&pool->cond, NULL) != 0) {
+        log_error("pool lock init failed");
+        return TPOOL_ERR_THREAD;
+    }
+    pool->threads = calloc(threads, sizeof(pthread_t));
+    if(pool->threads == NULL) {
+        log_error("calloc threads[%u] failed", threads);
+        tpool_destroy(pool);
+        return TPOOL_ERR_MEM_ALLOC;
+    }
+    for(uint32_t i = 0; i < threads; i++) {
+        if(pthread_create(&pool->threads[i], NULL, tpool_thread, pool) != 0) {
+            log_error("pool thread create failed");
+            tpool_destroy(pool);
+            return TPOOL_ERR_THREAD;
+        }
+        pool->threads_count++;
+    }
+    return TPOOL_ERR_OK;
+}
+
+tpool_err_t tpool_push(tpool_t *pool, tpool_job_t *job, tpool_cb_t cb)
+{
+    if(pool->threads_count == 0) {
+        return TPOOL_ERR_FULL;
+    }
+    job->cb = cb;
+    pthread_mutex_lock(&pool->lock);
+    if(pool->queue_count >= pool->queue_max) {
+        pthread_mutex_unlock(&pool->lock);
+        return TPOOL_ERR_FULL;
+    }
+    STAILQ_INSERT_TAIL(&pool->queue, job, entry);
+    pool->queue_count++;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    return TPOOL_ERR_OK;
+}
+
+void tpool_destroy(tpool_t *pool)
+{
+    if(pool->threads == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for(uint32_t i = 0; i < pool->threads_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->threads_count = 0;
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <common.h>
+#include <sys/queue.h>
+#include <pthread.h>
+
+/**
+ * @brief Thread pool error codes
+ */
+typedef enum {
+    TPOOL_ERR_OK,        ///< No error
+    TPOOL_ERR_THREAD,    ///< Thread or lock creation failed
+    TPOOL_ERR_MEM_ALLOC, ///< Memory allocation failed
+    TPOOL_ERR_FULL,      ///< Job queue is full
+    TPOOL_ERR_MAX,
+} tpool_err_t;
+
+/**
+ * @brief Forward declaration of the pool job
+ */
+typedef struct tpool_job tpool_job_t;
+
+/**
+ * @brief Job callback, runs on one of the pool threads
+ * @param job - [in] Pointer to the job, usually embedded into the owner structure
+ */
+typedef void (*tpool_cb_t)(tpool_job_t *job);
+
+/**
+ * @brief Pool job, owned by the caller until its callback is called
+ */
+struct tpool_job {
+    STAILQ_ENTRY(tpool_job) entry; ///< Entry in the job queue
+    tpool_cb_t cb;                 ///< Job callback
+};
+
+/**
+ * @brief Fixed set of threads running jobs from a bounded queue
+ */
+typedef struct {
+    STAILQ_HEAD(tpool_job_list, tpool_job) queue; ///< Jobs waiting for a thread
+    uint32_t queue_count;                         ///< Number of queued jobs
+    uint32_t queue_max;                           ///< Maximum number of queued jobs
+    pthread_mutex_t lock;                         ///< Protects the queue
+    pthread_cond_t cond;                          ///< Wakes the threads up when jobs are queued
+    pthread_t *threads;                           ///< Array of threads
+    uint32_t threads_count;                       ///< Number of started threads
+    bool stop;                                    ///< Threads exit once the queue is empty
+} tpool_t;
+
+/**
+ * @brief Start the pool threads
+ * @param pool - [out] Pointer to the pool
+ * @param threads - [in] Number of threads, 0 to create an empty pool
+ * @param queue_max - [in] Maximum number of queued jobs
+ * @return TPOOL_ERR_OK on success, error code otherwise
+ */
+tpool_err_t tpool_init(tpool_t *pool, uint32_t threads, uint32_t queue_max);
+
+/**
+ * @brief Queue the job
+ * @param pool - [in] Pointer to the pool
+ * @param job - [in] Pointer to the job, must stay valid until its callback is called
+ * @param cb - [in] Job callback
+ * @return TPOOL_ERR_OK on success, TPOOL_ERR_FULL if the queue is full
+ */
+tpool_err_t tpool_push(tpool_t *pool, tpool_job_t *job, tpool_cb_t cb);
+
+/**
+ * @brief Run the queued jobs to the end and join the threads
+ * @param pool - [in] Pointer to the pool
+ */
+void tpool_destroy(tpool_t *pool);
@@ -0,0 +1,85 @@
+#include <core/base/twheel.h>
+#include <string.h>
+
+#define TWHEEL_MASK (TWHEEL_SLOTS - 1)
+STATIC_ASSERT((TWHEEL_SLOTS & TWHEEL_MASK) == 0);
+
+static void twheel_tick_cb(struct ev_loop *loop, ev_timer *w, UNUSED int events)
+{
+    twheel_t *wheel = container_of(w, twheel_t, tick_timer);
+    uint64_t now = (uint64_t)ev_now(loop);
+    // Slots are walked once even if the loop was stalled for more than a whole turn //
+    uint64_t tick = wheel->tick + 1;
+    if(now - wheel->tick > TWHEEL_SLOTS) {
+        tick = now - TWHEEL_SLOTS + 1;
+    }
+
+    // Expired timers are moved out first, so callbacks may arm timers in the walked slots //
+    struct twheel_list fired = LIST_HEAD_INITIALIZER(fired);
+    for(; tick <= now; tick++) {
+        twheel_timer_t *timer = LIST_FIRST(&wheel->slots[tick & TWHEEL_MASK]);
+        while(timer) {
+            twheel_timer_t *next = LIST_NEXT(timer, entry);
+            if(timer->expire <= now) {
+                LIST_REMOVE(timer, entry);
+                LIST_INSERT_HEAD(&fired, timer, entry);
+            }
+            timer = next;
+        }
+    }
+    wheel->tick = now;
+
+    while(!LIST_EMPTY(&fired)) {
+        twheel_timer_t *timer = LIST_FIRST(&fired);
+        twheel_del(wheel, timer);
+        timer->cb(timer);
+    }
+    if(wheel->count == 0) {
+        ev_timer_stop(loop, &wheel->tick_timer);
+    }
+}
+
+void twheel_init(twheel_t *wheel, struct ev_loop *loop)
+{
+    bzero(wheel, sizeof(twheel_t));
+    for(uint32_t i = 0; i < TWHEEL_SLOTS; i++) {
+        LIST_INIT(&wheel->slots[i]);
+    }
+    wheel->loop = loop;
+    ev_timer_init(&wheel->tick_timer, twheel_tick_cb, 1.0, 1.0);
+}
+
+void twheel_add(twheel_t *wheel, twheel_timer_t *timer, uint32_t sec, twheel_cb_t cb)
+{
+    twheel_del(wheel, timer);
+    if(sec == 0) {
+        return;
+    }
+    uint64_t now = (uint64_t)ev_now(wheel->loop);
+    if(ev_is_active(&wheel->tick_timer) == false) {
+        wheel->tick = now;
+        ev_timer_again(wheel->loop, &wheel->tick_timer);
+    }
+    timer->cb = cb;
+    timer->expire = now + sec;
+    timer->armed = true;
+    LIST_INSERT_HEAD(&wheel->slots[timer->expire & TWHEEL_MASK], timer, entry);
+    wheel->count++;
+}
+
+void twheel_del(twheel_t *wheel, twheel_timer_t *timer)
+{
+    if(timer->armed) {
+        LIST_REMOVE(timer, entry);
+        timer->armed = false;
+        wheel->count--;
+    }
+}
+
+void twheel_destroy(twheel_t *wheel)
+{
+    if(wheel->loop) {
+        ev_timer_stop(wheel->loop, &wheel->tick_timer);
+        wheel->loop = NULL;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <common.h>
+#include <sys/queue.h>
+#include <ev.h>
+
+#define TWHEEL_SLOTS 64 ///< Number of wheel slots, must be a power of two
+
+/**
+ * @brief Forward declaration of the wheel timer
+ */
+typedef struct twheel_timer twheel_timer_t;
+
+/**
+ * @brief Timer callback, the timer is disarmed before the call and may be armed again
+ * @param timer - [in] Pointer to the timer, usually embedded into the owner structure
+ */
+typedef void (*twheel_cb_t)(twheel_timer_t *timer);
+
+/**
+ * @brief Timer stored in the wheel slot of its expiration tick
+ */
+struct twheel_timer {
+    LIST_ENTRY(twheel_timer) entry; ///< Entry in the wheel slot
+    twheel_cb_t cb;                 ///< Expiration callback
+    uint64_t expire;                ///< Tick of the expiration
+    bool armed;                     ///< Timer is in the wheel
+};
+
+/**
+ * @brief Hashed timer wheel with one second ticks
+ * @note Arming and disarming cost O(1), each tick walks a single slot. Not thread safe, each loop needs its own wheel.
+ */
+typedef struct {
+    LIST_HEAD(twheel_list, twheel_timer) slots[TWHEEL_SLOTS]; ///< Timers hashed by the expiration tick
+    struct ev_loop *loop;                                     ///< Event loop of the wheel
+    ev_timer tick_timer;                                      ///< Ticks while there are armed timers
+    uint64_t tick;                                            ///< Last processed tick
+    uint32_t count;                                           ///< Number of armed timers
+} twheel_t;
+
+/**
+ * @brief Initialize the wheel
+ * @param wheel - [out] Pointer to the wheel
+ * @param loop - [in] Event loop which drives the ticks
+ */
+void twheel_init(twheel_t *wheel, struct ev_loop *loop);
+
+/**
+ * @brief Arm the timer, an armed timer is moved to the new deadline
+ * @param wheel - [in] Pointer to the wheel
+ * @param timer - [in] Pointer to the timer
+ * @param sec - [in] Seconds until the expiration, 0 to disarm the timer
+ * @param cb - [in] Expiration callback
+ */
+void twheel_add(twheel_t *wheel, twheel_timer_t *timer, uint32_t sec, twheel_cb_t cb);
+
+/**
+ * @brief Disarm the timer, does nothing if the timer is not armed
+ * @param wheel - [in] Pointer to the wheel
+ * @param timer - [in] Pointer to the timer
+ */
+void twheel_del(twheel_t *wheel, twheel_timer_t *timer);
+
+/**
+ * @brief Stop the wheel, armed timers are dropped without calling them
+ * @param wheel - [in] Pointer to the wheel
+ */
+void twheel_destroy(twheel_t *wheel);
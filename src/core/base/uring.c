@@ -0,0 +1,329 @@
+#include <core/base/uring.h>
+#include <core/base/log.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define CQ_ENTRIES_MUL 4
+
+static int uring_enter(int fd, uint32_t to_submit, uint32_t flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, NULL, 0);
+}
+
+static int uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+void uring_submit(uring_t *uring)
+{
+    while(uring->sq_pending > 0) {
+        int res = uring_enter(uring->fd, uring->sq_pending, 0);
+        if(res < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            // Completion ring is full, entries stay queued until the completions are reaped //
+            if(errno != EAGAIN && errno != EBUSY) {
+                log_error("io_uring_enter failed - %s", strerror(errno));
+            }
+            return;
+        }
+        uring->sq_pending -= res;
+    }
+}
+
+static void uring_reap(uring_t *uring)
+{
+    uint32_t head = *uring->cq_head;
+    uint32_t tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail) {
+        const struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+        uring_op_t *op = (uring_op_t *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+        uint32_t flags = cqe->flags;
+        // Release the entry before the callback, it may submit and reap again //
+        __atomic_store_n(uring->cq_head, ++head, __ATOMIC_RELEASE);
+        if(op) {
+            op->cb(op, res, flags);
+        }
+        head = *uring->cq_head;
+        tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void uring_io_cb(UNUSED struct ev_loop *loop, ev_io *w, UNUSED int revents)
+{
+    uring_t *uring = container_of(w, uring_t, io);
+    uint64_t value;
+    if(read(w->fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        log_error("read eventfd failed - %s", strerror(errno));
+    }
+    uring_reap(uring);
+    // Completions which did not fit into the ring are kept by the kernel until flushed //
+    while(__atomic_load_n(uring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+        if(uring_enter(uring->fd, 0, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            log_error("io_uring_enter flush failed - %s", strerror(errno));
+            break;
+        }
+        uring_reap(uring);
+    }
+}
+
+static void uring_prepare_cb(UNUSED struct ev_loop *loop, ev_prepare *w, UNUSED int revents)
+{
+    uring_t *uring = container_of(w, uring_t, prepare);
+    uring_submit(uring);
+}
+
+uring_err_t uring_init(uring_t *uring, struct ev_loop *loop, uint32_t entries)
+{
+    bzero(uring, sizeof(uring_t));
+    struct io_uring_params params = {
+        .flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL,
+        .cq_entries = entries * CQ_ENTRIES_MUL,
+    };
+    uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(uring->fd < 0) {
+        log_error("io_uring_setup entries=%u failed - %s", entries, strerror(errno));
+        return URING_ERR_SETUP;
+    }
+    if((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_NODROP) == 0) {
+        log_error("io_uring features=0x%x not supported", params.features);
+        close(uring->fd);
+        return URING_ERR_SETUP;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+    uring->ring_ptr = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd,
+                           IORING_OFF_SQ_RING);
+    if(uring->ring_ptr == MAP_FAILED) {
+        log_error("mmap ring[%zu] failed - %s", uring->ring_size, strerror(errno));
+        close(uring->fd);
+        return URING_ERR_MEM_ALLOC;
+    }
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd,
+                       IORING_OFF_SQES);
+    if(uring->sqes == MAP_FAILED) {
+        log_error("mmap sqes[%zu] failed - %s", uring->sqes_size, strerror(errno));
+        munmap(uring->ring_ptr, uring->ring_size);
+        close(uring->fd);
+        return URING_ERR_MEM_ALLOC;
+    }
+
+    char *ptr = uring->ring_ptr;
+    uring->sq_head = (uint32_t *)(ptr + params.sq_off.head);
+    uring->sq_tail = (uint32_t *)(ptr + params.sq_off.tail);
+    uring->sq_flags = (uint32_t *)(ptr + params.sq_off.flags);
+    uring->sq_array = (uint32_t *)(ptr + params.sq_off.array);
+    uring->sq_mask = *(uint32_t *)(ptr + params.sq_off.ring_mask);
+    uring->sq_entries = params.sq_entries;
+    uring->cq_head = (uint32_t *)(ptr + params.cq_off.head);
+    uring->cq_tail = (uint32_t *)(ptr + params.cq_off.tail);
+    uring->cq_mask = *(uint32_t *)(ptr + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(ptr + params.cq_off.cqes);
+    // Submission entries are used in ring order, so the index array never changes //
+    for(uint32_t i = 0; i < uring->sq_entries; i++) {
+        uring->sq_array[i] = i;
+    }
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(efd < 0) {
+        log_error("eventfd failed - %s", strerror(errno));
+        munmap(uring->sqes, uring->sqes_size);
+        munmap(uring->ring_ptr, uring->ring_size);
+        close(uring->fd);
+        return URING_ERR_REGISTER;
+    }
+    if(uring_register(uring->fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0) {
+        log_error("register eventfd failed - %s", strerror(errno));
+        close(efd);
+        munmap(uring->sqes, uring->sqes_size);
+        munmap(uring->ring_ptr, uring->ring_size);
+        close(uring->fd);
+        return URING_ERR_REGISTER;
+    }
+
+    uring->loop = loop;
+    ev_io_init(&uring->io, uring_io_cb, efd, EV_READ);
+    ev_io_start(loop, &uring->io);
+    ev_prepare_init(&uring->prepare, uring_prepare_cb);
+    ev_prepare_start(loop, &uring->prepare);
+    return URING_ERR_OK;
+}
+
+void uring_destroy(uring_t *uring)
+{
+    if(uring->loop == NULL) {
+        return;
+    }
+    ev_prepare_stop(uring->loop, &uring->prepare);
+    ev_io_stop(uring->loop, &uring->io);
+    close(uring->io.fd);
+    munmap(uring->sqes, uring->sqes_size);
+    munmap(uring->ring_ptr, uring->ring_size);
+    close(uring->fd);
+    uring->loop = NULL;
+}
+
+struct io_uring_sqe *uring_sqe_get(uring_t *uring, uring_op_t *op)
+{
+    uint32_t tail = *uring->sq_tail;
+    if(tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) {
+        uring_submit(uring);
+        if(tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) {
+            log_error("submission ring[%u] full", uring->sq_entries);
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &uring->sqes[tail & uring->sq_mask];
+    bzero(sqe, sizeof(struct io_uring_sqe));
+    sqe->user_data = (uintptr_t)op;
+    // Kernel reads the entries only in io_uring_enter, so the tail may move before the entry is filled //
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->sq_pending++;
+    return sqe;
+}
+
+bool uring_accept_multishot(uring_t *uring, uring_op_t *op, int fd)
+{
+    struct io_uring_sqe *sqe = uring_sqe_get(uring, op);
+    if(sqe == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    return true;
+}
+
+bool uring_recv_multishot(uring_t *uring, uring_op_t *op, int fd, const uring_buf_ring_t *bufs)
+{
+    struct io_uring_sqe *sqe = uring_sqe_get(uring, op);
+    if(sqe == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufs->bgid;
+    return true;
+}
+
+bool uring_send(uring_t *uring, uring_op_t *op, int fd, const void *data, uint32_t len)
+{
+    struct io_uring_sqe *sqe = uring_sqe_get(uring, op);
+    if(sqe == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)data;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    return true;
+}
+
+bool uring_cancel(uring_t *uring, uring_op_t *op)
+{
+    struct io_uring_sqe *sqe = uring_sqe_get(uring, NULL);
+    if(sqe == NULL) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)op;
+    return true;
+}
+
+static void buf_ring_push(uring_buf_ring_t *bufs, uint16_t bid, uint16_t tail)
+{
+    struct io_uring_buf *buf = &bufs->ring->bufs[tail & (bufs->count - 1)];
+    buf->addr = (uintptr_t)(bufs->data + (size_t)bid * bufs->buf_size);
+    buf->len = bufs->buf_size;
+    buf->bid = bid;
+}
+
+uring_err_t uring_buf_ring_init(uring_t *uring, uring_buf_ring_t *bufs, uint16_t bgid, uint32_t count,
+                                uint32_t buf_size)
+{
+    bzero(bufs, sizeof(uring_buf_ring_t));
+    size_t ring_size = count * sizeof(struct io_uring_buf);
+    // Ring must be page aligned, anonymous mapping guarantees that //
+    bufs->ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(bufs->ring == MAP_FAILED) {
+        log_error("mmap buf ring[%u] failed - %s", count, strerror(errno));
+        bufs->ring = NULL;
+        return URING_ERR_MEM_ALLOC;
+    }
+    bufs->data = mmap(NULL, (size_t)count * buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(bufs->data == MAP_FAILED) {
+        log_error("mmap bufs[%u * %u] failed - %s", count, buf_size, strerror(errno));
+        munmap(bufs->ring, ring_size);
+        bufs->ring = NULL;
+        bufs->data = NULL;
+        return URING_ERR_MEM_ALLOC;
+    }
+    bufs->count = count;
+    bufs->buf_size = buf_size;
+    bufs->bgid = bgid;
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uintptr_t)bufs->ring,
+        .ring_entries = count,
+        .bgid = bgid,
+    };
+    if(uring_register(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        log_error("register buf ring bgid=%u failed - %s", bgid, strerror(errno));
+        munmap(bufs->data, (size_t)count * buf_size);
+        munmap(bufs->ring, ring_size);
+        bzero(bufs, sizeof(uring_buf_ring_t));
+        return URING_ERR_REGISTER;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        buf_ring_push(bufs, i, i);
+    }
+    __atomic_store_n(&bufs->ring->tail, (uint16_t)count, __ATOMIC_RELEASE);
+    return URING_ERR_OK;
+}
+
+char *uring_buf_get(const uring_buf_ring_t *bufs, uint32_t flags)
+{
+    uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    return bufs->data + (size_t)bid * bufs->buf_size;
+}
+
+void uring_buf_put(uring_buf_ring_t *bufs, uint32_t flags)
+{
+    uint16_t tail = bufs->ring->tail;
+    buf_ring_push(bufs, flags >> IORING_CQE_BUFFER_SHIFT, tail);
+    __atomic_store_n(&bufs->ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void uring_buf_ring_destroy(uring_t *uring, uring_buf_ring_t *bufs)
+{
+    if(bufs->ring == NULL) {
+        return;
+    }
+    struct io_uring_buf_reg reg = {
+        .bgid = bufs->bgid,
+    };
+    if(uring_register(uring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1) < 0) {
+        log_error("unregister buf ring bgid=%u failed - %s", bufs->bgid, strerror(errno));
+    }
+    munmap(bufs->data, (size_t)bufs->count * bufs->buf_size);
+    munmap(bufs->ring, bufs->count * sizeof(struct io_uring_buf));
+    bzero(bufs, sizeof(uring_buf_ring_t));
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <common.h>
+#include <linux/io_uring.h>
+#include <ev.h>
+
+/**
+ * @brief io_uring error codes
+ */
+typedef enum {
+    URING_ERR_OK,        ///< No error
+    URING_ERR_SETUP,     ///< Ring setup failed
+    URING_ERR_MEM_ALLOC, ///< Memory allocation failed
+    URING_ERR_REGISTER,  ///< Eventfd or buffer ring registration failed
+    URING_ERR_MAX,
+} uring_err_t;
+
+/**
+ * @brief Forward declaration of the ring operation
+ */
+typedef struct uring_op uring_op_t;
+
+/**
+ * @brief Completion callback of a ring operation
+ * @param op - [in] Pointer to the operation, usually embedded into the owner structure
+ * @param res - [in] Result of the operation, negative errno on failure
+ * @param flags - [in] Completion flags (IORING_CQE_F_*)
+ */
+typedef void (*uring_cb_t)(uring_op_t *op, int res, uint32_t flags);
+
+/**
+ * @brief Ring operation, its address is passed to the kernel as user data
+ */
+struct uring_op {
+    uring_cb_t cb; ///< Completion callback
+};
+
+/**
+ * @brief Submission and completion rings bound to a libev loop
+ *
+ * Prepared entries are submitted with one io_uring_enter right before the loop polls,
+ * completions are signalled through an eventfd watched by the loop.
+ */
+typedef struct {
+    int fd;                      ///< Ring file descriptor
+    uint32_t sq_mask;            ///< Submission ring index mask
+    uint32_t sq_entries;         ///< Number of submission entries
+    uint32_t sq_pending;         ///< Number of prepared entries not submitted yet
+    uint32_t *sq_head;           ///< Submission ring head, written by the kernel
+    uint32_t *sq_tail;           ///< Submission ring tail
+    uint32_t *sq_flags;          ///< Submission ring flags
+    uint32_t *sq_array;          ///< Submission ring index array
+    struct io_uring_sqe *sqes;   ///< Submission entries
+    uint32_t cq_mask;            ///< Completion ring index mask
+    uint32_t *cq_head;           ///< Completion ring head
+    uint32_t *cq_tail;           ///< Completion ring tail, written by the kernel
+    struct io_uring_cqe *cqes;   ///< Completion entries
+    void *ring_ptr;              ///< Mapping of the submission and completion rings
+    size_t ring_size;            ///< Size of the rings mapping
+    size_t sqes_size;            ///< Size of the submission entries mapping
+    struct ev_loop *loop;        ///< Event loop the ring is bound to
+    ev_io io;                    ///< Eventfd watcher
+    ev_prepare prepare;          ///< Submits the prepared entries before the loop polls
+} uring_t;
+
+/**
+ * @brief Provided buffer ring, the kernel picks a buffer for each received packet
+ */
+typedef struct {
+    struct io_uring_buf_ring *ring; ///< Shared buffer ring
+    char *data;                     ///< Memory of all buffers
+    uint32_t count;                 ///< Number of buffers, power of two
+    uint32_t buf_size;              ///< Size of each buffer
+    uint16_t bgid;                  ///< Buffer group ID
+} uring_buf_ring_t;
+
+/**
+ * @brief Create a ring and attach it to the event loop
+ * @param uring - [out] Pointer to the ring
+ * @param loop - [in] Event loop which processes the completions
+ * @param entries - [in] Number of submission entries
+ * @return URING_ERR_OK on success, error code otherwise
+ * @note The ring must only be used from the thread running the loop
+ */
+uring_err_t uring_init(uring_t *uring, struct ev_loop *loop, uint32_t entries);
+
+/**
+ * @brief Detach the ring from the loop and close it, pending operations are cancelled without callbacks
+ * @param uring - [in] Pointer to the ring
+ */
+void uring_destroy(uring_t *uring);
+
+/**
+ * @brief Get a zeroed submission entry, it is submitted before the loop polls next time
+ * @param uring - [in] Pointer to the ring
+ * @param op - [in] Operation to complete, NULL to ignore the completion
+ * @return Pointer to the submission entry, NULL if the ring is full
+ */
+struct io_uring_sqe *uring_sqe_get(uring_t *uring, uring_op_t *op);
+
+/**
+ * @brief Submit all prepared entries now
+ * @param uring - [in] Pointer to the ring
+ */
+void uring_submit(uring_t *uring);
+
+/**
+ * @brief Prepare multishot accept, accepted sockets are non-blocking and close-on-exec
+ * @param uring - [in] Pointer to the ring
+ * @param op - [in] Operation completed for every accepted connection
+ * @param fd - [in] Listening socket
+ * @return true on success, false if the ring is full
+ */
+bool uring_accept_multishot(uring_t *uring, uring_op_t *op, int fd);
+
+/**
+ * @brief Prepare multishot receive into the provided buffers
+ * @param uring - [in] Pointer to the ring
+ * @param op - [in] Operation completed for every received packet
+ * @param fd - [in] Connected socket
+ * @param bufs - [in] Buffer ring to receive into
+ * @return true on success, false if the ring is full
+ */
+bool uring_recv_multishot(uring_t *uring, uring_op_t *op, int fd, const uring_buf_ring_t *bufs);
+
+/**
+ * @brief Prepare send
+ * @param uring - [in] Pointer to the ring
+ * @param op - [in] Operation to complete
+ * @param fd - [in] Connected socket
+ * @param data - [in] Data to send, must stay valid until the completion
+ * @param len - [in] Length of the data
+ * @return true on success, false if the ring is full
+ */
+bool uring_send(uring_t *uring, uring_op_t *op, int fd, const void *data, uint32_t len);
+
+/**
+ * @brief Prepare cancellation of the operation, its last completion gets -ECANCELED unless already finished
+ * @param uring - [in] Pointer to the ring
+ * @param op - [in] Operation to cancel
+ * @return true on success, false if the ring is full
+ */
+bool uring_cancel(uring_t *uring, uring_op_t *op);
+
+/**
+ * @brief Allocate buffers and register them as a provided buffer ring
+ * @param uring - [in] Pointer to the ring
+ * @param bufs - [out] Pointer to the buffer ring
+ * @param bgid - [in] Buffer group ID, unique within the ring
+ * @param count - [in] Number of buffers, power of two
+ * @param buf_size - [in] Size of each buffer
+ * @return URING_ERR_OK on success, error code otherwise
+ */
+uring_err_t uring_buf_ring_init(uring_t *uring, uring_buf_ring_t *bufs, uint16_t bgid, uint32_t count,
+                                uint32_t buf_size);
+
+/**
+ * @brief Get the buffer picked by the kernel for a completion
+ * @param bufs - [in] Pointer to the buffer ring
+ * @param flags - [in] Completion flags, must contain IORING_CQE_F_BUFFER
+ * @return Pointer to the buffer data
+ */
+char *uring_buf_get(const uring_buf_ring_t *bufs, uint32_t flags);
+
+/**
+ * @brief Give the buffer of a completion back to the kernel
+ * @param bufs - [in] Pointer to the buffer ring
+ * @param flags - [in] Completion flags, must contain IORING_CQE_F_BUFFER
+ */
+void uring_buf_put(uring_buf_ring_t *bufs, uint32_t flags);
+
+/**
+ * @brief Unregister and free the buffer ring
+ * @param uring - [in] Pointer to the ring
+ * @param bufs - [in] Pointer to the buffer ring
+ */
+void uring_buf_ring_destroy(uring_t *uring, uring_buf_ring_t *bufs);
@@ -13,7 +13,7 @@ typedef struct {
     uint64_t ts;
 } db_key_id_ts_t;
 
-db_err_t db_get_value_by_id(const char *table, uint32_t id, buf_t *value)
+db_err_t db_get_value_by_id(db_table_t *table, uint32_t id, buf_t *value)
 {
     uint32_t kid = htonl(id);
     buf_t key = {
@@ -26,13 +26,13 @@ db_err_t db_get_value_by_id(const char *table, uint32_t id, buf_t *value)
         return res;
     }
     if(value->size != value_size) {
-        log_error("invalid size %s[%u] got=%zu/expected=%zu", table, id, value->size, value_size);
+        log_error("invalid size %s[%u] got=%zu/expected=%zu", table->name, id, value->size, value_size);
         return DB_ERR_SIZE_MISMATCH;
     }
     return DB_ERR_OK;
 }
 
-db_err_t db_put_value_by_id(const char *table, uint32_t id, const buf_t *value)
+db_err_t db_put_value_by_id(db_table_t *table, uint32_t id, const buf_t *value)
 {
     id = htonl(id);
     buf_t key = {
@@ -42,7 +42,7 @@ db_err_t db_put_value_by_id(const char *table, uint32_t id, const buf_t *value)
     return db_put(table, &key, value);
 }
 
-db_err_t db_get_value_by_id64(const char *table, uint64_t id, buf_t *value)
+db_err_t db_get_value_by_id64(db_table_t *table, uint64_t id, buf_t *value)
 {
     uint64_t kid = htobe64(id);
     buf_t key = {
@@ -55,13 +55,13 @@ db_err_t db_get_value_by_id64(const char *table, uint64_t id, buf_t *value)
         return res;
     }
     if(value->size != value_size) {
-        log_error("invalid size %s[%" PRIu64 "] got=%zu/expected=%zu", table, id, value->size, value_size);
+        log_error("invalid size %s[%" PRIu64 "] got=%zu/expected=%zu", table->name, id, value->size, value_size);
         return DB_ERR_SIZE_MISMATCH;
     }
     return DB_ERR_OK;
 }
 
-db_err_t db_put_value_by_id64(const char *table, uint64_t id, const buf_t *value)
+db_err_t db_put_value_by_id64(db_table_t *table, uint64_t id, const buf_t *value)
 {
     id = htobe64(id);
     buf_t key = {
@@ -71,7 +71,7 @@ db_err_t db_put_value_by_id64(const char *table, uint64_t id, const buf_t *value
     return db_put(table, &key, value);
 }
 
-db_err_t db_get_id64_value_next(const char *table, uint64_t *pid, buf_t *pvalue)
+db_err_t db_get_id64_value_next(db_table_t *table, uint64_t *pid, buf_t *pvalue)
 {
     buf_t key = { 0 }, value;
     db_err_t res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_NEXT);
@@ -79,20 +79,20 @@ db_err_t db_get_id64_value_next(const char *table, uint64_t *pid, buf_t *pvalue)
         return res;
     }
     if(key.size != sizeof(uint64_t)) {
-        log_error("invalid %s key size got=%zu/expected=%zu", table, key.size, sizeof(uint64_t));
+        log_error("invalid %s key size got=%zu/expected=%zu", table->name, key.size, sizeof(uint64_t));
         return DB_ERR_SIZE_MISMATCH;
     }
     memcpy(pid, key.data, sizeof(uint64_t));
     *pid = be64toh(*pid);
     if(value.size != pvalue->size) {
-        log_error("invalid %s size id64=%" PRIu64 " got=%zu/expected=%zu", table, *pid, value.size, pvalue->size);
+        log_error("invalid %s size id64=%" PRIu64 " got=%zu/expected=%zu", table->name, *pid, value.size, pvalue->size);
         return DB_ERR_SIZE_MISMATCH;
     }
     memcpy(pvalue->data, value.data, value.size);
     return DB_ERR_OK;
 }
 
-db_err_t db_get_id_by_str(const char *table, const char *str, uint32_t *pid)
+db_err_t db_get_id_by_str(db_table_t *table, const char *str, uint32_t *pid)
 {
     buf_t key = {
         .size = strlen(str),
@@ -104,14 +104,14 @@ db_err_t db_get_id_by_str(const char *table, const char *str, uint32_t *pid)
         return res;
     }
     if(value.size != sizeof(uint32_t)) {
-        log_error("invalid size %s[%s] got=%zu/expected=%zu", table, str, value.size, sizeof(uint32_t));
+        log_error("invalid size %s[%s] got=%zu/expected=%zu", table->name, str, value.size, sizeof(uint32_t));
         return DB_ERR_SIZE_MISMATCH;
     }
     memcpy(pid, value.data, sizeof(uint32_t));
     return DB_ERR_OK;
 }
 
-db_err_t db_get_str_id_next(const char *table, const char **pstr, uint32_t *pstr_len, uint32_t *pid)
+db_err_t db_get_str_id_next(db_table_t *table, const char **pstr, uint32_t *pstr_len, uint32_t *pid)
 {
     buf_t key, value;
     db_err_t res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_NEXT);
@@ -120,7 +120,7 @@ db_err_t db_get_str_id_next(const char *table, const char **pstr, uint32_t *pstr
     }
     const char *str = key.data;
     if(value.size != sizeof(uint32_t)) {
-        log_error("invalid size %s[%.*s] got=%zu/expected=%zu", table, (uint32_t)key.size, str, value.size,
+        log_error("invalid size %s[%.*s] got=%zu/expected=%zu", table->name, (uint32_t)key.size, str, value.size,
                   sizeof(uint32_t));
         return DB_ERR_SIZE_MISMATCH;
     }
@@ -130,7 +130,7 @@ db_err_t db_get_str_id_next(const char *table, const char **pstr, uint32_t *pstr
     return DB_ERR_OK;
 }
 
-db_err_t db_put_id_by_str(const char *table, const char *str, uint32_t id)
+db_err_t db_put_id_by_str(db_table_t *table, const char *str, uint32_t id)
 {
     buf_t key = {
         .size = strlen(str),
@@ -143,7 +143,7 @@ db_err_t db_put_id_by_str(const char *table, const char *str, uint32_t id)
     return db_put(table, &key, &value);
 }
 
-db_err_t db_get_value_by_id_ts(const char *table, uint32_t id, uint64_t ts, buf_t *value)
+db_err_t db_get_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts, buf_t *value)
 {
     db_key_id_ts_t key_data = {
         .id = htonl(id),
@@ -159,15 +159,15 @@ db_err_t db_get_value_by_id_ts(const char *table, uint32_t id, uint64_t ts, buf_
     if(res != DB_ERR_OK) {
         return res;
     }
-    if(value->size != value_size) {
-        log_error("invalid size %s[%u:%" PRIu64 "] got=%zu/expected=%zu", table, id, ts, value->size, value_size);
+    if(value_size != 0 && value->size != value_size) {
+        log_error("invalid size %s[%u:%" PRIu64 "] got=%zu/expected=%zu", table->name, id, ts, value->size, value_size);
         return DB_ERR_SIZE_MISMATCH;
     }
     return DB_ERR_OK;
 }
 
-db_err_t db_get_ts_value_by_id_next(const char *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
-                                    uint64_t max_ts, uint64_t *pts, buf_t *value, db_cursor_op_t op)
+db_err_t db_get_id_ts_value_next(db_table_t *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
+                                 uint64_t max_ts, uint32_t *pid, uint64_t *pts, buf_t *value, db_cursor_op_t op)
 {
     db_key_id_ts_t kdata = {
         .id = htonl(min_id),
@@ -184,13 +184,13 @@ db_err_t db_get_ts_value_by_id_next(const char *table, uint32_t min_id, uint32_t
         return res;
     }
     if(key.size != sizeof(db_key_id_ts_t)) {
-        log_error("invalid key size %s[%u:%" PRIu64 "-%u:%" PRIu64 "] got=%zu/expected=%zu", table, min_id, min_ts,
-                  max_id, max_ts, key.size, sizeof(db_key_id_ts_t));
+        log_error("invalid key size %s[%u:%" PRIu64 "-%u:%" PRIu64 "] got=%zu/expected=%zu", table->name, min_id,
+                  min_ts, max_id, max_ts, key.size, sizeof(db_key_id_ts_t));
         return DB_ERR_SIZE_MISMATCH;
     }
-    if(value->size != value_size) {
-        log_error("invalid size %s[%u:%" PRIu64 "-%u:%" PRIu64 "] got=%zu/expected=%zu", table, min_id, min_ts, max_id,
-                  max_ts, value->size, value_size);
+    if(value_size != 0 && value->size != value_size) {
+        log_error("invalid size %s[%u:%" PRIu64 "-%u:%" PRIu64 "] got=%zu/expected=%zu", table->name, min_id,
+                  min_ts, max_id, max_ts, value->size, value_size);
         return DB_ERR_SIZE_MISMATCH;
     }
 
@@ -203,11 +203,47 @@ db_err_t db_get_ts_value_by_id_next(const char *table, uint32_t min_id, uint32_t
     if(memcmp(&kdata, &end_kdata, sizeof(end_kdata)) >= 0) {
         return DB_ERR_NOT_FOUND;
     }
+    *pid = ntohl(kdata.id);
     *pts = be64toh(kdata.ts);
     return DB_ERR_OK;
 }
 
-db_err_t db_put_value_by_id_ts(const char *table, uint32_t id, uint64_t ts, const buf_t *value)
+db_err_t db_get_ts_value_by_id_next(db_table_t *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
+                                    uint64_t max_ts, uint64_t *pts, buf_t *value, db_cursor_op_t op)
+{
+    uint32_t id;
+    return db_get_id_ts_value_next(table, min_id, max_id, min_ts, max_ts, &id, pts, value, op);
+}
+
+db_err_t db_put_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts, const buf_t *value)
+{
+    db_key_id_ts_t key_data = {
+        .id = htonl(id),
+        .pad = 0,
+        .ts = htobe64(ts),
+    };
+    buf_t key = {
+        .size = sizeof(key_data),
+        .data = &key_data,
+    };
+    return db_put(table, &key, value);
+}
+
+db_err_t db_append_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts, const buf_t *value)
+{
+    db_key_id_ts_t key_data = {
+        .id = htonl(id),
+        .pad = 0,
+        .ts = htobe64(ts),
+    };
+    buf_t key = {
+        .size = sizeof(key_data),
+        .data = &key_data,
+    };
+    return db_cursor_append(table, &key, value);
+}
+
+db_err_t db_del_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts)
 {
     db_key_id_ts_t key_data = {
         .id = htonl(id),
@@ -218,5 +254,163 @@ db_err_t db_put_value_by_id_ts(const char *table, uint32_t id, uint64_t ts, cons
         .size = sizeof(key_data),
         .data = &key_data,
     };
+    return db_del(table, &key);
+}
+
+static uint64_t db_value_ts(const void *data)
+{
+    uint64_t ts;
+    memcpy(&ts, data, sizeof(ts));
+    return be64toh(ts);
+}
+
+db_err_t db_get_ts_values_by_id_next(db_table_t *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
+                                     uint32_t *pid, buf_t *values, db_cursor_op_t op)
+{
+    size_t value_size = values->size;
+    uint32_t kid = htonl(min_id);
+    uint64_t kts = htobe64(min_ts);
+    buf_t key = {
+        .size = sizeof(kid),
+        .data = &kid,
+    };
+    buf_t value = {
+        .size = sizeof(kts),
+        .data = &kts,
+    };
+    bool page = false;
+    db_err_t res;
+    if(op == DB_CURSOR_OP_SET_RANGE) {
+        // Values of a key are sorted by all their bytes, so the timestamp alone finds the first one after it //
+        res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_GET_BOTH_RANGE);
+        if(res == DB_ERR_NOT_FOUND && min_id < max_id) {
+            kid = htonl(min_id + 1);
+            key.size = sizeof(kid);
+            key.data = &kid;
+            min_ts = 0;
+            res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_SET_RANGE);
+        }
+    } else {
+        min_ts = 0;
+        res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_NEXT_MULTIPLE);
+        page = (res == DB_ERR_OK);
+        if(res == DB_ERR_NOT_FOUND) {
+            res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_NEXT_NODUP);
+        }
+    }
+    if(res == DB_ERR_OK && !page) {
+        // Single value of a key is not in a page of its own and is kept by the lookup //
+        res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_GET_MULTIPLE);
+    }
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    if(key.size != sizeof(kid)) {
+        log_error("invalid key size %s[%u-%u] got=%zu/expected=%zu", table->name, min_id, max_id, key.size,
+                  sizeof(kid));
+        return DB_ERR_SIZE_MISMATCH;
+    }
+    if(value.size == 0 || value.size % value_size != 0) {
+        log_error("invalid size %s[%u-%u] got=%zu/expected=n*%zu", table->name, min_id, max_id, value.size,
+                  value_size);
+        return DB_ERR_SIZE_MISMATCH;
+    }
+    memcpy(&kid, key.data, sizeof(kid));
+    if(ntohl(kid) > max_id) {
+        return DB_ERR_NOT_FOUND;
+    }
+
+    // Page of the first lookup starts before the value found, which is the last one left out at most //
+    const uint8_t *data = value.data;
+    size_t size = value.size;
+    while(size > value_size && db_value_ts(data) < min_ts) {
+        data += value_size;
+        size -= value_size;
+    }
+    *pid = ntohl(kid);
+    values->data = (void *)data;
+    values->size = size;
+    return DB_ERR_OK;
+}
+
+db_err_t db_put_ts_value_by_id(db_table_t *table, uint32_t id, const buf_t *value)
+{
+    // Old value is looked up in the write transaction of the put //
+    db_err_t res = db_txn_begin(false);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    uint32_t kid = htonl(id);
+    buf_t key = {
+        .size = sizeof(kid),
+        .data = &kid,
+    };
+    buf_t old = {
+        .size = sizeof(uint64_t),
+        .data = value->data,
+    };
+    res = db_cursor_get(table, &key, &old, DB_CURSOR_OP_GET_BOTH_RANGE);
+    if(res == DB_ERR_OK && db_value_ts(old.data) == db_value_ts(value->data)) {
+        if(old.size == value->size && memcmp(old.data, value->data, value->size) == 0) {
+            return DB_ERR_OK;
+        }
+        res = db_cursor_del(table);
+    }
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        return res;
+    }
+    key.size = sizeof(kid);
+    key.data = &kid;
     return db_put(table, &key, value);
 }
+
+db_err_t db_append_ts_value_by_id(db_table_t *table, uint32_t id, const buf_t *value)
+{
+    uint32_t kid = htonl(id);
+    buf_t key = {
+        .size = sizeof(kid),
+        .data = &kid,
+    };
+    db_err_t res = db_cursor_append_dup(table, &key, value);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    // Greater value may still share the timestamp of the last one, which it replaces then //
+    buf_t prev = {
+        .size = 0,
+    };
+    res = db_cursor_get(table, &key, &prev, DB_CURSOR_OP_PREV_DUP);
+    if(res != DB_ERR_OK) {
+        return (res == DB_ERR_NOT_FOUND) ? DB_ERR_OK : res;
+    }
+    if(db_value_ts(prev.data) != db_value_ts(value->data)) {
+        return DB_ERR_OK;
+    }
+    return db_cursor_del(table);
+}
+
+db_err_t db_del_ts_value_by_id(db_table_t *table, uint32_t id, uint64_t ts)
+{
+    db_err_t res = db_txn_begin(false);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    uint32_t kid = htonl(id);
+    uint64_t kts = htobe64(ts);
+    buf_t key = {
+        .size = sizeof(kid),
+        .data = &kid,
+    };
+    buf_t value = {
+        .size = sizeof(kts),
+        .data = &kts,
+    };
+    res = db_cursor_get(table, &key, &value, DB_CURSOR_OP_GET_BOTH_RANGE);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    if(db_value_ts(value.data) != ts) {
+        return DB_ERR_NOT_FOUND;
+    }
+    return db_cursor_del(table);
+}
@@ -4,90 +4,106 @@
 
 /**
  * @brief Get value by ID
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param id - [in] ID key
  * @param value - [out] Pointer to the buffer to store the value
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get_value_by_id(const char *table, uint32_t id, buf_t *value);
+db_err_t db_get_value_by_id(db_table_t *table, uint32_t id, buf_t *value);
 
 /**
  * @brief Put value by ID
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param id - [in] ID key
  * @param value - [in] Pointer to the buffer to store the value
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_put_value_by_id(const char *table, uint32_t id, const buf_t *value);
+db_err_t db_put_value_by_id(db_table_t *table, uint32_t id, const buf_t *value);
 
 /**
  * @brief Get value by ID 64bit
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param id - [in] ID key
  * @param value - [out] Pointer to the buffer to store the value
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get_value_by_id64(const char *table, uint64_t id, buf_t *value);
+db_err_t db_get_value_by_id64(db_table_t *table, uint64_t id, buf_t *value);
 
 /**
  * @brief Put value by ID 64bit
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param id - [in] ID key
  * @param value - [in] Pointer to the buffer to store the value
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_put_value_by_id64(const char *table, uint64_t id, const buf_t *value);
+db_err_t db_put_value_by_id64(db_table_t *table, uint64_t id, const buf_t *value);
 
 /**
  * @brief Get next value by ID 64bit
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param pid - [out] Pointer to the variable to store the ID key
  * @param value - [out] Pointer to the buffer to store the value
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get_id64_value_next(const char *table, uint64_t *pid, buf_t *value);
+db_err_t db_get_id64_value_next(db_table_t *table, uint64_t *pid, buf_t *value);
 
 /**
  * @brief Get ID key by string
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param str - [in] string key
  * @param pid - [out] Pointer to the variable to store the ID key
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get_id_by_str(const char *table, const char *str, uint32_t *pid);
+db_err_t db_get_id_by_str(db_table_t *table, const char *str, uint32_t *pid);
 
 /**
  * @brief Get next string and its ID key
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param pstr - [out] Pointer to the variable to store the string key
  * @param pstr_len - [out] Pointer to the variable to store the length of the string key
  * @param pid - [out] Pointer to the variable to store the ID key
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get_str_id_next(const char *table, const char **pstr, uint32_t *pstr_len, uint32_t *pid);
+db_err_t db_get_str_id_next(db_table_t *table, const char **pstr, uint32_t *pstr_len, uint32_t *pid);
 
 /**
  * @brief Put ID key by string
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param str - [in] string key
  * @param id - [in] ID key to store
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_put_id_by_str(const char *table, const char *str, uint32_t id);
+db_err_t db_put_id_by_str(db_table_t *table, const char *str, uint32_t id);
 
 /**
  * @brief Get value by ID and timestamp
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param id - [in] ID key
  * @param ts - [in] Timestamp
- * @param value - [out] Pointer to the buffer to store the value
+ * @param value - [in,out] Pointer to the buffer with the expected size, 0 for a value of any size
+ * @return DB_ERR_OK on success, error code otherwise
+ */
+db_err_t db_get_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts, buf_t *value);
+
+/**
+ * @brief Get ID, timestamp and value in the range of IDs
+ * @param table - [in] Pointer to the database table
+ * @param min_id - [in] ID key
+ * @param max_id - [in] Maximum ID key
+ * @param min_ts - [in] Minimum timestamp
+ * @param max_ts - [in] Maximum timestamp
+ * @param pid - [out] Pointer to the variable to store the ID key
+ * @param pts - [out] Pointer to the variable to store the timestamp
+ * @param value - [in,out] Pointer to the buffer with the expected size, 0 for a value of any size
+ * @param op - [in] Cursor operation
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get_value_by_id_ts(const char *table, uint32_t id, uint64_t ts, buf_t *value);
+db_err_t db_get_id_ts_value_next(db_table_t *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
+                                 uint64_t max_ts, uint32_t *pid, uint64_t *pts, buf_t *value, db_cursor_op_t op);
 
 /**
  * @brief Get timestamp and value by ID
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param min_id - [in] ID key
  * @param max_id - [in] Maximum ID key
  * @param min_ts - [in] Minimum timestamp
@@ -97,15 +113,77 @@ db_err_t db_get_value_by_id_ts(const char *table, uint32_t id, uint64_t ts, buf_
  * @param op - [in] Cursor operation
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get_ts_value_by_id_next(const char *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
+db_err_t db_get_ts_value_by_id_next(db_table_t *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
                                     uint64_t max_ts, uint64_t *pts, buf_t *value, db_cursor_op_t op);
 
 /**
  * @brief Put value by ID and timestamp
- * @param table - [in] Name of the database table
+ * @param table - [in] Pointer to the database table
  * @param id - [in] ID key
  * @param ts - [in] Timestamp
  * @param value - [in] Pointer to the buffer to store the value
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_put_value_by_id_ts(const char *table, uint32_t id, uint64_t ts, const buf_t *value);
+db_err_t db_put_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts, const buf_t *value);
+
+/**
+ * @brief Append value by ID and timestamp after the last key of the table
+ * @param table - [in] Pointer to the database table
+ * @param id - [in] ID key
+ * @param ts - [in] Timestamp
+ * @param value - [in] Pointer to the buffer to store the value
+ * @return DB_ERR_OK on success, DB_ERR_DBI_ORDER if the key is not after the last key, error code otherwise
+ */
+db_err_t db_append_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts, const buf_t *value);
+
+/**
+ * @brief Delete value by ID and timestamp
+ * @param table - [in] Pointer to the database table
+ * @param id - [in] ID key
+ * @param ts - [in] Timestamp
+ * @return DB_ERR_OK on success, DB_ERR_NOT_FOUND if there is no such value, error code otherwise
+ */
+db_err_t db_del_value_by_id_ts(db_table_t *table, uint32_t id, uint64_t ts);
+
+/**
+ * @brief Get the next page of values by ID from a duplicate table whose values start with a big-endian timestamp
+ * @param table - [in] Pointer to the duplicate table
+ * @param min_id - [in] ID key
+ * @param max_id - [in] Maximum ID key
+ * @param min_ts - [in] Minimum timestamp, values before it are left out of the first page of the ID key
+ * @param pid - [out] Pointer to the variable to store the ID key
+ * @param values - [in,out] Pointer to the buffer with the size of one value, set to the values of the page
+ * @param op - [in] Cursor operation, DB_CURSOR_OP_SET_RANGE for the first page, DB_CURSOR_OP_NEXT for the next one
+ * @note Values point into the page and are valid until the next write of the transaction
+ * @return DB_ERR_OK on success, DB_ERR_NOT_FOUND past the maximum ID key, error code otherwise
+ */
+db_err_t db_get_ts_values_by_id_next(db_table_t *table, uint32_t min_id, uint32_t max_id, uint64_t min_ts,
+                                     uint32_t *pid, buf_t *values, db_cursor_op_t op);
+
+/**
+ * @brief Put value by ID into a duplicate table, the value with the same leading timestamp is replaced
+ * @param table - [in] Pointer to the duplicate table
+ * @param id - [in] ID key
+ * @param value - [in] Pointer to the value buffer, starting with a big-endian timestamp
+ * @return DB_ERR_OK on success, error code otherwise
+ */
+db_err_t db_put_ts_value_by_id(db_table_t *table, uint32_t id, const buf_t *value);
+
+/**
+ * @brief Append value by ID after the last value of the ID key in a duplicate table
+ * @param table - [in] Pointer to the duplicate table
+ * @param id - [in] ID key
+ * @param value - [in] Pointer to the value buffer, starting with a big-endian timestamp
+ * @note The last value is replaced if the timestamps are the same
+ * @return DB_ERR_OK on success, DB_ERR_DBI_ORDER if the value is not after the last value, error code otherwise
+ */
+db_err_t db_append_ts_value_by_id(db_table_t *table, uint32_t id, const buf_t *value);
+
+/**
+ * @brief Delete value by ID and its leading timestamp from a duplicate table
+ * @param table - [in] Pointer to the duplicate table
+ * @param id - [in] ID key
+ * @param ts - [in] Timestamp
+ * @return DB_ERR_OK on success, DB_ERR_NOT_FOUND if there is no such value, error code otherwise
+ */
+db_err_t db_del_ts_value_by_id(db_table_t *table, uint32_t id, uint64_t ts);
@@ -1,29 +1,185 @@
 #include <core/db/db.h>
 #include <core/base/log.h>
+#include <core/base/file.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <lmdb.h>
+#include <ev.h>
 
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
 
-#define DB_FLAGS (MDB_NOTLS | MDB_NOMETASYNC | MDB_NOSYNC)
+// Handles of the named tables are numbered after the free and main ones //
+#define DB_DBI_MAX 64
+
+// Reset read transactions kept for reuse, each of them holds a reader slot //
+#define DB_RD_TXN_POOL_MAX 16
+
+// Map is doubled once it is full, or ahead of time once its usage passes the limit //
+#define DB_MAP_GROW_FACTOR   2
+#define DB_MAP_GROW_USED_PCT 80
+
+// Backup is written in chunks, the rate limit is applied between them //
+#define DB_BACKUP_CHUNK_SIZE (64 * 1024)
+
+struct db_txn {
+    SLIST_ENTRY(db_txn) entry;       ///< Linked list entries of the pooled objects
+    MDB_txn *txn;                    ///< Running transaction, NULL if none
+    MDB_txn *rd_txn;                 ///< Reset read transaction to be renewed, only for pooled objects
+    MDB_cursor *cur[DB_DBI_MAX];     ///< Cursors of the tables, opened lazily
+    uint64_t cur_mask;               ///< Bit mask of the opened cursors
+    db_table_t *pending[DB_DBI_MAX]; ///< Tables with handles opened by the running transaction
+    uint64_t pending_mask;           ///< Bit mask of the pending tables
+    void *priv;                      ///< Private memory of the walks over the object
+    size_t priv_size;                ///< Size of the private memory
+    bool rd_only;                    ///< Running transaction is read-only
+    bool pooled;                     ///< Object was taken from the read transaction pool
+};
+
+/**
+ * @brief Backup running on a background thread
+ */
+typedef struct {
+    pthread_t thread;                  ///< Thread writing the copy from the pipe into the file
+    pthread_t copy_thread;             ///< Thread waiting for the process running the LMDB copy into the pipe
+    char path[FILE_PATH_LEN_MAX];      ///< Path to the backup directory
+    char file_path[FILE_PATH_LEN_MAX]; ///< Path to the backup file
+    int pipe_fd[2];                    ///< Pipe between the threads
+    int file_fd;                       ///< Backup file
+    int copy_rc;                       ///< Result of the LMDB copy
+    uint32_t rate_kb;                  ///< Maximum write rate in KB/s, 0 for no limit
+    uint64_t start_ts;                 ///< Start time
+    size_t tot_size;                   ///< Used size of the database at start
+    atomic_size_t done_size;           ///< Written size
+    atomic_uint_fast64_t end_ts;       ///< End time, 0 while running
+    atomic_uint state;                 ///< State of the backup
+    atomic_bool stop;                  ///< Cancel the running backup
+    bool started;                      ///< Thread is not joined yet
+} db_backup_t;
 
 typedef struct {
     MDB_env *env;
-    MDB_txn *txn;
-    MDB_cursor *cur;
-    MDB_dbi dbi;
+    db_backup_t backup;
+    ev_timer sync_timer;
+    atomic_bool dirty;
+    // Held for reading by every active transaction, the map is resized only under the write lock //
+    pthread_rwlock_t map_lock;
+    atomic_bool map_grow;
+    atomic_bool map_resized;
+    size_t page_size;
+    pthread_mutex_t dbi_lock;
+    pthread_mutex_t pool_lock;
+    SLIST_HEAD(, db_table) tables;
+    SLIST_HEAD(, db_txn) rd_pool;
+    uint32_t rd_pool_count;
+    bool rd_only;
 } db_t;
 
-static db_t db = { 0 };
+// Environment is opened with MDB_NOTLS, so every thread can hold its own read transaction //
+static const uint32_t sync_mode_flags[] = {
+    [DB_SYNC_MODE_STRICT] = MDB_NOTLS,
+    [DB_SYNC_MODE_PERIODIC] = MDB_NOTLS | MDB_NOMETASYNC | MDB_NOSYNC,
+    [DB_SYNC_MODE_ASYNC] = MDB_NOTLS | MDB_WRITEMAP | MDB_MAPASYNC,
+};
+STATIC_ASSERT(ARRAY_SIZE(sync_mode_flags) == DB_SYNC_MODE_MAX);
 
-STATIC_ASSERT((uint32_t)MDB_SET_RANGE == DB_CURSOR_OP_SET_RANGE);
+static db_t db = {
+    .map_lock = PTHREAD_RWLOCK_INITIALIZER,
+    .dbi_lock = PTHREAD_MUTEX_INITIALIZER,
+    .pool_lock = PTHREAD_MUTEX_INITIALIZER,
+    .tables = SLIST_HEAD_INITIALIZER(db.tables),
+    .rd_pool = SLIST_HEAD_INITIALIZER(db.rd_pool),
+};
+// Every thread has its own transaction object //
+static _Thread_local db_txn_t thread_txn = { 0 };
+// Transaction object used by the calls of the thread, NULL for its own one //
+static _Thread_local db_txn_t *cur_txn = NULL;
+
+static inline db_txn_t *db_txn_cur(void)
+{
+    return cur_txn ? cur_txn : &thread_txn;
+}
+
+STATIC_ASSERT((uint32_t)MDB_GET_BOTH_RANGE == DB_CURSOR_OP_GET_BOTH_RANGE);
+STATIC_ASSERT((uint32_t)MDB_GET_MULTIPLE == DB_CURSOR_OP_GET_MULTIPLE);
 STATIC_ASSERT((uint32_t)MDB_NEXT == DB_CURSOR_OP_NEXT);
+STATIC_ASSERT((uint32_t)MDB_NEXT_MULTIPLE == DB_CURSOR_OP_NEXT_MULTIPLE);
+STATIC_ASSERT((uint32_t)MDB_NEXT_NODUP == DB_CURSOR_OP_NEXT_NODUP);
+STATIC_ASSERT((uint32_t)MDB_PREV_DUP == DB_CURSOR_OP_PREV_DUP);
+STATIC_ASSERT((uint32_t)MDB_SET_RANGE == DB_CURSOR_OP_SET_RANGE);
+
+/**
+ * @brief Open handles of all existing named databases
+ * @note Handles are opened once for the whole process, so later mdb_dbi_open calls are plain lookups.
+ *       LMDB does not allow concurrent transactions to open new handles, which would race on the pool threads.
+ */
+static db_err_t db_dbi_preopen(void)
+{
+    MDB_txn *mdb_txn;
+    int rc = mdb_txn_begin(db.env, NULL, MDB_RDONLY, &mdb_txn);
+    if(rc != MDB_SUCCESS) {
+        log_error("txn begin failed - %s", mdb_strerror(rc));
+        db_close();
+        return DB_ERR_TXN_BEGIN;
+    }
+    MDB_cursor *mdb_cur;
+    rc = mdb_cursor_open(mdb_txn, 0, &mdb_cur);
+    if(rc != MDB_SUCCESS) {
+        log_error("main db cursor open failed - %s", mdb_strerror(rc));
+        mdb_txn_abort(mdb_txn);
+        db_close();
+        return DB_ERR_DBI_OPEN;
+    }
+    MDB_val mdb_key, mdb_value;
+    while(mdb_cursor_get(mdb_cur, &mdb_key, &mdb_value, MDB_NEXT) == MDB_SUCCESS) {
+        char name[256];
+        if(mdb_key.mv_size >= sizeof(name)) {
+            continue;
+        }
+        memcpy(name, mdb_key.mv_data, mdb_key.mv_size);
+        name[mdb_key.mv_size] = '\0';
+        MDB_dbi dbi;
+        rc = mdb_dbi_open(mdb_txn, name, 0, &dbi);
+        if(rc != MDB_SUCCESS) {
+            log_warn("dbi %s open failed - %s", name, mdb_strerror(rc));
+        }
+    }
+    mdb_cursor_close(mdb_cur);
+    // Committed read transaction keeps the opened handles //
+    rc = mdb_txn_commit(mdb_txn);
+    if(rc != MDB_SUCCESS) {
+        log_error("txn commit failed - %s", mdb_strerror(rc));
+        db_close();
+        return DB_ERR_TXN_COMMIT;
+    }
+    return DB_ERR_OK;
+}
 
-db_err_t db_open(const char *path, uint32_t size_mb, uint32_t max_dbs, bool rd_only)
+static void db_sync_cb(UNUSED struct ev_loop *loop, UNUSED ev_timer *timer, UNUSED int events)
 {
+    // Nothing to flush if no write transaction was committed since the last sync //
+    if(atomic_exchange(&db.dirty, false)) {
+        db_sync();
+    }
+}
+
+db_err_t db_open(const char *path, uint32_t size_mb, uint32_t max_dbs, db_sync_mode_t sync_mode, uint32_t sync_ms,
+                 bool rd_only)
+{
+    if(sync_mode >= DB_SYNC_MODE_MAX) {
+        log_error("invalid sync mode %u", sync_mode);
+        return DB_ERR_OPEN;
+    }
     int rc = mdb_env_create(&db.env);
     if(rc != MDB_SUCCESS) {
         log_error("env create failed - %s", mdb_strerror(rc));
@@ -37,6 +193,11 @@ db_err_t db_open(const char *path, uint32_t size_mb, uint32_t max_dbs, bool rd_o
         return DB_ERR_ENV_CREATE;
     }
 
+    if(max_dbs > DB_DBI_MAX - 2) {
+        log_error("max dbs %u over the limit %u", max_dbs, DB_DBI_MAX - 2);
+        db_close();
+        return DB_ERR_ENV_CREATE;
+    }
     rc = mdb_env_set_maxdbs(db.env, max_dbs);
     if(rc != MDB_SUCCESS) {
         log_error("env set max dbs %u failed - %s", max_dbs, mdb_strerror(rc));
@@ -52,7 +213,7 @@ db_err_t db_open(const char *path, uint32_t size_mb, uint32_t max_dbs, bool rd_o
         }
     }
 
-    uint32_t flags = DB_FLAGS;
+    uint32_t flags = sync_mode_flags[sync_mode];
     if(rd_only) {
         flags |= MDB_RDONLY;
     }
@@ -62,8 +223,31 @@ db_err_t db_open(const char *path, uint32_t size_mb, uint32_t max_dbs, bool rd_o
         db_close();
         return DB_ERR_OPEN;
     }
+    db.rd_only = rd_only;
 
-    return DB_ERR_OK;
+    MDB_stat mdb_stat;
+    rc = mdb_env_stat(db.env, &mdb_stat);
+    if(rc != MDB_SUCCESS) {
+        log_error("stat failed - %s", mdb_strerror(rc));
+        db_close();
+        return DB_ERR_ENV_INFO;
+    }
+    db.page_size = mdb_stat.ms_psize;
+
+    if(sync_mode == DB_SYNC_MODE_PERIODIC && !rd_only) {
+        ev_tstamp sync_sec = (sync_ms > 0 ? sync_ms : 1) / 1000.0;
+        ev_timer_init(&db.sync_timer, db_sync_cb, sync_sec, sync_sec);
+        ev_timer_start(EV_DEFAULT, &db.sync_timer);
+        // Timer must not keep the loop running on exit //
+        ev_unref(EV_DEFAULT);
+    }
+
+    return db_dbi_preopen();
+}
+
+bool db_is_rd_only(void)
+{
+    return db.rd_only;
 }
 
 db_err_t db_get_stat(db_stat_t *stat)
@@ -84,6 +268,7 @@ db_err_t db_get_stat(db_stat_t *stat)
 
     stat->tot_size = mdb_info.me_mapsize;
     stat->used_size = (mdb_info.me_last_pgno + 1) * mdb_stat.ms_psize;
+    stat->free_size = stat->tot_size > stat->used_size ? stat->tot_size - stat->used_size : 0;
 
     return DB_ERR_OK;
 }
@@ -98,75 +283,735 @@ db_err_t db_sync(void)
     return DB_ERR_OK;
 }
 
+/**
+ * @brief Check whether the map has to be resized once no transaction of the process is active
+ */
+static inline bool db_map_pending(void)
+{
+    return atomic_load_explicit(&db.map_grow, memory_order_relaxed) ||
+           atomic_load_explicit(&db.map_resized, memory_order_relaxed);
+}
+
+/**
+ * @brief Resize the map under the write lock, growing it if requested or if its usage is over the limit
+ * @param used_pct - [in] Usage limit of the map in percent
+ */
+static void db_map_resize(uint32_t used_pct)
+{
+    if(atomic_exchange(&db.map_resized, false)) {
+        // Size grown by another process is adopted before it is grown further //
+        int rc = mdb_env_set_mapsize(db.env, 0);
+        if(rc != MDB_SUCCESS) {
+            log_error("map adopt failed - %s", mdb_strerror(rc));
+        }
+    }
+    bool grow = atomic_exchange(&db.map_grow, false);
+    MDB_envinfo mdb_info;
+    int rc = mdb_env_info(db.env, &mdb_info);
+    if(rc == MDB_SUCCESS) {
+        size_t used_size = (mdb_info.me_last_pgno + 1) * db.page_size;
+        size_t size = grow ? mdb_info.me_mapsize * DB_MAP_GROW_FACTOR : mdb_info.me_mapsize;
+        while(used_size * 100 > size * used_pct) {
+            size *= DB_MAP_GROW_FACTOR;
+        }
+        if(size == mdb_info.me_mapsize) {
+            return;
+        }
+        rc = mdb_env_set_mapsize(db.env, size);
+        if(rc == MDB_SUCCESS) {
+            log_warn("map grown from %zuMB to %zuMB", mdb_info.me_mapsize >> 20, size >> 20);
+        }
+    }
+    if(rc != MDB_SUCCESS) {
+        log_error("map grow failed - %s", mdb_strerror(rc));
+    }
+}
+
+/**
+ * @brief Grow the map if requested, which is only possible while no transaction of the process is active
+ * @note If other transactions are running, the last of them grows the map when it ends
+ */
+static void db_map_grow(void)
+{
+    if(pthread_rwlock_trywrlock(&db.map_lock) != 0) {
+        return;
+    }
+    db_map_resize(100);
+    pthread_rwlock_unlock(&db.map_lock);
+}
+
+/**
+ * @brief Grow the map ahead of time once its usage passes the limit
+ */
+static void db_map_check(void)
+{
+    MDB_envinfo mdb_info;
+    if(mdb_env_info(db.env, &mdb_info) != MDB_SUCCESS) {
+        return;
+    }
+    size_t used_size = (mdb_info.me_last_pgno + 1) * db.page_size;
+    if(used_size * 100 > mdb_info.me_mapsize * DB_MAP_GROW_USED_PCT) {
+        atomic_store(&db.map_grow, true);
+        db_map_grow();
+    }
+}
+
+/**
+ * @brief Convert the error of a write, a full map is grown once no transaction is active
+ */
+static db_err_t db_write_err(int rc, db_err_t err)
+{
+    if(rc == MDB_MAP_FULL) {
+        atomic_store(&db.map_grow, true);
+        return DB_ERR_MAP_FULL;
+    }
+    return err;
+}
+
+static bool db_path_join(char *path, const char *dir, const char *name)
+{
+    int len = snprintf(path, FILE_PATH_LEN_MAX, "%s/%s", dir, name);
+    if(len < 0 || len >= FILE_PATH_LEN_MAX) {
+        log_error("path %s/%s too long", dir, name);
+        return false;
+    }
+    return true;
+}
+
+static bool db_write_all(int fd, const char *data, size_t len)
+{
+    while(len > 0) {
+        ssize_t res = write(fd, data, len);
+        if(res < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += res;
+        len -= res;
+    }
+    return true;
+}
+
+/**
+ * @brief Stream the compacting copy into the pipe from its own environment, runs in the forked copy process
+ */
+static int db_backup_copy_env(const char *path, int fd)
+{
+    MDB_env *env;
+    int rc = mdb_env_create(&env);
+    if(rc != MDB_SUCCESS) {
+        return rc;
+    }
+    rc = mdb_env_open(env, path, MDB_RDONLY | MDB_NOTLS, 0644);
+    if(rc == MDB_SUCCESS) {
+        rc = mdb_env_copyfd2(env, fd, MDB_CP_COMPACT);
+        if(rc == MDB_MAP_RESIZED) {
+            // Map was grown by the daemon between the open and the snapshot //
+            rc = mdb_env_set_mapsize(env, 0);
+            if(rc == MDB_SUCCESS) {
+                rc = mdb_env_copyfd2(env, fd, MDB_CP_COMPACT);
+            }
+        }
+    }
+    mdb_env_close(env);
+    return rc;
+}
+
+/**
+ * @brief Run the copy in a child process and wait for it
+ * @note Resizing the map unmaps it, which must not happen under a reader of this process. The copy is a reader of
+ *       its own process, so the map of the daemon keeps growing while the snapshot of the copy is read.
+ */
+static void *db_backup_copy_thread(UNUSED void *arg)
+{
+    db_backup_t *b = &db.backup;
+    const char *path;
+    int *prc = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(prc == MAP_FAILED || mdb_env_get_path(db.env, &path) != MDB_SUCCESS) {
+        b->copy_rc = (prc == MAP_FAILED) ? errno : EINVAL;
+        close(b->pipe_fd[1]);
+        if(prc != MAP_FAILED) {
+            munmap(prc, sizeof(int));
+        }
+        return NULL;
+    }
+    *prc = ECHILD;
+    pid_t pid = fork();
+    if(pid == 0) {
+        // Only the inherited pipe is used, the environment of the parent must not be touched after the fork //
+        close(b->pipe_fd[0]);
+        *prc = db_backup_copy_env(path, b->pipe_fd[1]);
+        _exit(EXIT_SUCCESS);
+    }
+    b->copy_rc = (pid < 0) ? errno : ECHILD;
+    close(b->pipe_fd[1]);
+    if(pid > 0) {
+        int status;
+        while(waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        // Value stays ECHILD if the process died before storing its result //
+        b->copy_rc = *prc;
+    }
+    munmap(prc, sizeof(int));
+    return NULL;
+}
+
+/**
+ * @brief Write the copy from the pipe into the backup file at the limited rate
+ */
+static bool db_backup_pump(db_backup_t *b)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char buf[DB_BACKUP_CHUNK_SIZE];
+    size_t done_size = 0;
+    while(!atomic_load(&b->stop)) {
+        ssize_t len = read(b->pipe_fd[0], buf, sizeof(buf));
+        if(len < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            log_error("backup read failed - %s", strerror(errno));
+            return false;
+        }
+        if(len == 0) {
+            return true;
+        }
+        if(!db_write_all(b->file_fd, buf, len)) {
+            log_error("backup write %s failed - %s", b->file_path, strerror(errno));
+            return false;
+        }
+        done_size += len;
+        atomic_store(&b->done_size, done_size);
+        if(b->rate_kb == 0) {
+            continue;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+        double delay = (double)done_size / ((double)b->rate_kb * 1024) - elapsed;
+        if(delay > 0) {
+            struct timespec ts = {
+                .tv_sec = (time_t)delay,
+                .tv_nsec = (long)((delay - (time_t)delay) * 1e9),
+            };
+            nanosleep(&ts, NULL);
+        }
+    }
+    log_warn("backup %s cancelled", b->path);
+    return false;
+}
+
+static void *db_backup_thread(UNUSED void *arg)
+{
+    db_backup_t *b = &db.backup;
+    bool ok = db_backup_pump(b);
+    // Closed pipe fails the copy if it is still running //
+    close(b->pipe_fd[0]);
+    pthread_join(b->copy_thread, NULL);
+    if(ok && b->copy_rc != MDB_SUCCESS) {
+        log_error("backup copy failed - %s", mdb_strerror(b->copy_rc));
+        ok = false;
+    }
+    if(ok && fsync(b->file_fd) < 0) {
+        log_error("backup sync %s failed - %s", b->file_path, strerror(errno));
+        ok = false;
+    }
+    close(b->file_fd);
+    if(!ok) {
+        unlink(b->file_path);
+        rmdir(b->path);
+    }
+    atomic_store(&b->end_ts, time(NULL));
+    atomic_store(&b->state, ok ? DB_BACKUP_STATE_DONE : DB_BACKUP_STATE_FAILED);
+    if(ok) {
+        log_info("backup %s done, %zu bytes in %" PRIu64 "s", b->path, atomic_load(&b->done_size),
+                 atomic_load(&b->end_ts) - b->start_ts);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Cancel the running backup and wait for its thread
+ */
+static void db_backup_stop(void)
+{
+    db_backup_t *b = &db.backup;
+    if(!b->started) {
+        return;
+    }
+    atomic_store(&b->stop, true);
+    pthread_join(b->thread, NULL);
+    b->started = false;
+}
+
+db_err_t db_backup_start(const char *dir, uint32_t rate_kb)
+{
+    db_backup_t *b = &db.backup;
+    if(atomic_load(&b->state) == DB_BACKUP_STATE_RUNNING) {
+        return DB_ERR_BUSY;
+    }
+    // Finished thread is joined by the next backup //
+    db_backup_stop();
+
+    db_stat_t stat;
+    db_err_t res = db_get_stat(&stat);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    if(access(dir, F_OK) < 0 && mkdir(dir, 0755) < 0) {
+        log_error("mkdir %s failed - %s", dir, strerror(errno));
+        return DB_ERR_OPEN;
+    }
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char name[32];
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tm);
+    if(!db_path_join(b->path, dir, name) || !db_path_join(b->file_path, b->path, "data.mdb")) {
+        return DB_ERR_OPEN;
+    }
+    if(mkdir(b->path, 0755) < 0) {
+        log_error("mkdir %s failed - %s", b->path, strerror(errno));
+        return DB_ERR_OPEN;
+    }
+    b->file_fd = open(b->file_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(b->file_fd < 0) {
+        log_error("open %s failed - %s", b->file_path, strerror(errno));
+        rmdir(b->path);
+        return DB_ERR_OPEN;
+    }
+    if(pipe2(b->pipe_fd, O_CLOEXEC) < 0) {
+        log_error("pipe failed - %s", strerror(errno));
+        close(b->file_fd);
+        unlink(b->file_path);
+        rmdir(b->path);
+        return DB_ERR_OPEN;
+    }
+
+    b->rate_kb = rate_kb;
+    b->start_ts = now;
+    b->tot_size = stat.used_size;
+    b->copy_rc = MDB_SUCCESS;
+    atomic_store(&b->done_size, 0);
+    atomic_store(&b->end_ts, 0);
+    atomic_store(&b->stop, false);
+    atomic_store(&b->state, DB_BACKUP_STATE_RUNNING);
+    if(pthread_create(&b->copy_thread, NULL, db_backup_copy_thread, NULL) != 0) {
+        log_error("backup copy thread create failed");
+        close(b->pipe_fd[0]);
+        close(b->pipe_fd[1]);
+        close(b->file_fd);
+        unlink(b->file_path);
+        rmdir(b->path);
+        atomic_store(&b->state, DB_BACKUP_STATE_FAILED);
+        return DB_ERR_FAIL;
+    }
+    if(pthread_create(&b->thread, NULL, db_backup_thread, NULL) != 0) {
+        log_error("backup thread create failed");
+        // Copy fails on the closed pipe //
+        close(b->pipe_fd[0]);
+        pthread_join(b->copy_thread, NULL);
+        close(b->file_fd);
+        unlink(b->file_path);
+        rmdir(b->path);
+        atomic_store(&b->state, DB_BACKUP_STATE_FAILED);
+        return DB_ERR_FAIL;
+    }
+    b->started = true;
+    log_info("backup to %s started, %zu bytes used", b->path, b->tot_size);
+    return DB_ERR_OK;
+}
+
+void db_backup_get_stat(db_backup_stat_t *stat)
+{
+    db_backup_t *b = &db.backup;
+    stat->state = atomic_load(&b->state);
+    stat->start_ts = b->start_ts;
+    stat->end_ts = atomic_load(&b->end_ts);
+    stat->done_size = atomic_load(&b->done_size);
+    stat->tot_size = b->tot_size;
+}
+
+db_err_t db_restore(const char *backup_path, const char *path)
+{
+    if(db.env) {
+        log_error("restore of the open database");
+        return DB_ERR_BUSY;
+    }
+    char src_path[FILE_PATH_LEN_MAX];
+    char dst_path[FILE_PATH_LEN_MAX];
+    char tmp_path[FILE_PATH_LEN_MAX];
+    char lock_path[FILE_PATH_LEN_MAX];
+    if(!db_path_join(src_path, backup_path, "data.mdb") || !db_path_join(dst_path, path, "data.mdb") ||
+       !db_path_join(tmp_path, path, "data.mdb.restore") || !db_path_join(lock_path, path, "lock.mdb")) {
+        return DB_ERR_OPEN;
+    }
+
+    // Backup must be a valid environment, opening it checks its meta pages //
+    MDB_env *env;
+    int rc = mdb_env_create(&env);
+    if(rc == MDB_SUCCESS) {
+        rc = mdb_env_open(env, src_path, MDB_RDONLY | MDB_NOSUBDIR | MDB_NOLOCK, 0644);
+        mdb_env_close(env);
+    }
+    if(rc != MDB_SUCCESS) {
+        log_error("backup %s open failed - %s", src_path, mdb_strerror(rc));
+        return DB_ERR_OPEN;
+    }
+
+    // Every process with the database open holds a shared lock on the lock file //
+    int lock_fd = open(lock_path, O_RDWR | O_CLOEXEC);
+    if(lock_fd >= 0) {
+        struct flock lock = {
+            .l_type = F_WRLCK,
+            .l_whence = SEEK_SET,
+            .l_start = 0,
+            .l_len = 1,
+        };
+        if(fcntl(lock_fd, F_SETLK, &lock) < 0) {
+            log_error("database %s is in use", path);
+            close(lock_fd);
+            return DB_ERR_BUSY;
+        }
+    }
+    if(access(path, F_OK) < 0 && mkdir(path, 0755) < 0) {
+        log_error("mkdir %s failed - %s", path, strerror(errno));
+        if(lock_fd >= 0) {
+            close(lock_fd);
+        }
+        return DB_ERR_OPEN;
+    }
+
+    // Copy is renamed over the database only once it is complete //
+    db_err_t res = DB_ERR_OPEN;
+    int src_fd = open(src_path, O_RDONLY | O_CLOEXEC);
+    int dst_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(src_fd < 0 || dst_fd < 0) {
+        log_error("open %s failed - %s", src_fd < 0 ? src_path : tmp_path, strerror(errno));
+    } else {
+        char buf[DB_BACKUP_CHUNK_SIZE];
+        ssize_t len;
+        do {
+            len = read(src_fd, buf, sizeof(buf));
+        } while(len > 0 && db_write_all(dst_fd, buf, len));
+        if(len != 0) {
+            log_error("copy %s to %s failed - %s", src_path, tmp_path, strerror(errno));
+        } else if(fsync(dst_fd) < 0 || rename(tmp_path, dst_path) < 0) {
+            log_error("replace %s failed - %s", dst_path, strerror(errno));
+        } else {
+            res = DB_ERR_OK;
+        }
+    }
+    if(src_fd >= 0) {
+        close(src_fd);
+    }
+    if(dst_fd >= 0) {
+        close(dst_fd);
+        if(res != DB_ERR_OK) {
+            unlink(tmp_path);
+        }
+    }
+    if(lock_fd >= 0) {
+        close(lock_fd);
+    }
+    if(res == DB_ERR_OK) {
+        log_info("database %s restored from %s", path, backup_path);
+    }
+    return res;
+}
+
+/**
+ * @brief End the running transaction of the object
+ * @param t - [in] Pointer to the transaction object
+ * @param commit - [in] Commit a write transaction if true, abort it otherwise
+ * @return MDB_SUCCESS or the error of the commit
+ */
+static int db_txn_end(db_txn_t *t, bool commit)
+{
+    // Cursors of a write transaction must be closed before the commit //
+    uint64_t mask = t->cur_mask;
+    while(mask) {
+        mdb_cursor_close(t->cur[__builtin_ctzll(mask)]);
+        mask &= mask - 1;
+    }
+    t->cur_mask = 0;
+
+    int rc = MDB_SUCCESS;
+    if(t->pooled && t->pending_mask == 0) {
+        // Reset transaction keeps its reader slot and is renewed by the next read of the object //
+        mdb_txn_reset(t->txn);
+        t->rd_txn = t->txn;
+    } else if(commit || t->rd_only) {
+        // Commit of a read transaction only releases its snapshot, but keeps the handles it opened //
+        rc = mdb_txn_commit(t->txn);
+    } else {
+        mdb_txn_abort(t->txn);
+    }
+
+    // Handles opened by an aborted transaction are dropped by LMDB //
+    if((commit || t->rd_only) && rc == MDB_SUCCESS && t->pending_mask) {
+        pthread_mutex_lock(&db.dbi_lock);
+        mask = t->pending_mask;
+        while(mask) {
+            MDB_dbi dbi = __builtin_ctzll(mask);
+            db_table_t *table = t->pending[dbi];
+            if(atomic_load(&table->dbi) == 0) {
+                atomic_store_explicit(&table->dbi, dbi, memory_order_release);
+                SLIST_INSERT_HEAD(&db.tables, table, entry);
+            }
+            mask &= mask - 1;
+        }
+        pthread_mutex_unlock(&db.dbi_lock);
+    }
+    t->pending_mask = 0;
+    t->txn = NULL;
+    pthread_rwlock_unlock(&db.map_lock);
+    if(rc == MDB_MAP_FULL) {
+        atomic_store(&db.map_grow, true);
+    }
+    if(db_map_pending()) {
+        db_map_grow();
+    }
+    return rc;
+}
+
+static void db_txn_free(db_txn_t *t)
+{
+    if(t->txn) {
+        db_txn_end(t, false);
+    }
+    if(t->rd_txn) {
+        mdb_txn_abort(t->rd_txn);
+    }
+    free(t->priv);
+    free(t);
+}
+
 void db_close(void)
 {
+    // Copy reads the environment until its thread ends //
+    db_backup_stop();
     db_txn_abort();
+    cur_txn = NULL;
+    free(thread_txn.priv);
+    thread_txn.priv = NULL;
+    thread_txn.priv_size = 0;
+    // Pooled objects must be returned by their users before //
+    pthread_mutex_lock(&db.pool_lock);
+    while(!SLIST_EMPTY(&db.rd_pool)) {
+        db_txn_t *t = SLIST_FIRST(&db.rd_pool);
+        SLIST_REMOVE_HEAD(&db.rd_pool, entry);
+        db_txn_free(t);
+    }
+    db.rd_pool_count = 0;
+    pthread_mutex_unlock(&db.pool_lock);
+    if(ev_is_active(&db.sync_timer)) {
+        ev_ref(EV_DEFAULT);
+        ev_timer_stop(EV_DEFAULT, &db.sync_timer);
+    }
+    atomic_store(&db.dirty, false);
+    atomic_store(&db.map_grow, false);
+    atomic_store(&db.map_resized, false);
     if(db.env) {
         mdb_env_sync(db.env, true);
         mdb_env_close(db.env);
         db.env = NULL;
     }
+    // Handles belong to the closed environment //
+    db_table_t *table;
+    SLIST_FOREACH(table, &db.tables, entry) {
+        atomic_store(&table->dbi, 0);
+    }
+    SLIST_INIT(&db.tables);
 }
 
 db_err_t db_txn_begin(bool rd_only)
 {
-    if(db.txn == NULL) {
-        uint32_t flags = rd_only ? MDB_RDONLY : 0;
-        int rc = mdb_txn_begin(db.env, NULL, flags, &db.txn);
-        if(rc != MDB_SUCCESS) {
-            log_error("txn begin failed - %s", mdb_strerror(rc));
-            return DB_ERR_TXN_BEGIN;
+    db_txn_t *t = db_txn_cur();
+    if(t->txn != NULL) {
+        return DB_ERR_OK;
+    }
+    if(t->pooled && !rd_only) {
+        log_error("write txn in a read txn object");
+        return DB_ERR_TXN_BEGIN;
+    }
+    pthread_rwlock_rdlock(&db.map_lock);
+    if(t->rd_txn) {
+        int rc = mdb_txn_renew(t->rd_txn);
+        if(rc == MDB_SUCCESS) {
+            t->txn = t->rd_txn;
+            t->rd_txn = NULL;
+            t->rd_only = true;
+            return DB_ERR_OK;
         }
+        log_warn("txn renew failed - %s", mdb_strerror(rc));
+        mdb_txn_abort(t->rd_txn);
+        t->rd_txn = NULL;
     }
+    uint32_t flags = rd_only ? MDB_RDONLY : 0;
+    int rc = mdb_txn_begin(db.env, NULL, flags, &t->txn);
+    if(rc == MDB_MAP_RESIZED) {
+        // Map was grown by another process, its size is adopted once no transaction of the process is active //
+        pthread_rwlock_unlock(&db.map_lock);
+        atomic_store(&db.map_resized, true);
+        db_map_grow();
+        pthread_rwlock_rdlock(&db.map_lock);
+        rc = mdb_txn_begin(db.env, NULL, flags, &t->txn);
+    }
+    if(rc != MDB_SUCCESS) {
+        pthread_rwlock_unlock(&db.map_lock);
+        log_error("txn begin failed - %s", mdb_strerror(rc));
+        t->txn = NULL;
+        return DB_ERR_TXN_BEGIN;
+    }
+    t->rd_only = rd_only;
     return DB_ERR_OK;
 }
 
-static db_err_t db_name_open(const char *db_name, bool rd_only)
+/**
+ * @brief Get the handle of the table in the current transaction, beginning it if needed
+ * @note Handles are cached in the tables only after the transaction which opened them commits
+ */
+static db_err_t db_table_open(db_table_t *table, bool rd_only, MDB_dbi *pdbi)
 {
     db_err_t res = db_txn_begin(rd_only);
     if(res != DB_ERR_OK) {
         return res;
     }
-    int rc = mdb_dbi_open(db.txn, db_name, MDB_CREATE, &db.dbi);
+    MDB_dbi dbi = atomic_load_explicit(&table->dbi, memory_order_acquire);
+    if(dbi != 0) {
+        *pdbi = dbi;
+        return DB_ERR_OK;
+    }
+    db_txn_t *t = db_txn_cur();
+    uint64_t mask = t->pending_mask;
+    while(mask) {
+        dbi = __builtin_ctzll(mask);
+        if(t->pending[dbi] == table) {
+            *pdbi = dbi;
+            return DB_ERR_OK;
+        }
+        mask &= mask - 1;
+    }
+
+    // Read transaction can not create a table, a missing one is just empty //
+    uint32_t flags = t->rd_only ? 0 : MDB_CREATE;
+    if(table->dup && !t->rd_only) {
+        // Fixed size values are stored without node headers in the pages of their key //
+        flags |= MDB_DUPSORT | MDB_DUPFIXED;
+    }
+    pthread_mutex_lock(&db.dbi_lock);
+    int rc = mdb_dbi_open(t->txn, table->name, flags, &dbi);
+    pthread_mutex_unlock(&db.dbi_lock);
     if(rc != MDB_SUCCESS) {
-        log_error("dbi %s open failed - %s", db_name, mdb_strerror(rc));
+        if(rc == MDB_NOTFOUND) {
+            return DB_ERR_NOT_FOUND;
+        }
+        log_error("dbi %s open failed - %s", table->name, mdb_strerror(rc));
         return DB_ERR_DBI_OPEN;
     }
+    t->pending[dbi] = table;
+    t->pending_mask |= 1ull << dbi;
+    *pdbi = dbi;
     return DB_ERR_OK;
 }
 
 db_err_t db_txn_commit(void)
 {
-    if(db.cur) {
-        mdb_cursor_close(db.cur);
-        db.cur = NULL;
-    }
-    if(db.txn) {
-        int rc = mdb_txn_commit(db.txn);
+    db_txn_t *t = db_txn_cur();
+    if(t->txn) {
+        bool rd_only = t->rd_only;
+        int rc = db_txn_end(t, true);
         if(rc != MDB_SUCCESS) {
             log_error("txn commit failed - %s", mdb_strerror(rc));
-            return DB_ERR_TXN_COMMIT;
+            return db_write_err(rc, DB_ERR_TXN_COMMIT);
+        }
+        if(!rd_only) {
+            atomic_store(&db.dirty, true);
+            db_map_check();
         }
-        db.txn = NULL;
     }
     return DB_ERR_OK;
 }
 
 void db_txn_abort(void)
 {
-    if(db.cur) {
-        mdb_cursor_close(db.cur);
-        db.cur = NULL;
+    db_txn_t *t = db_txn_cur();
+    if(t->txn) {
+        db_txn_end(t, false);
+    }
+}
+
+db_txn_t *db_rd_txn_open(void)
+{
+    pthread_mutex_lock(&db.pool_lock);
+    db_txn_t *t = SLIST_FIRST(&db.rd_pool);
+    if(t) {
+        SLIST_REMOVE_HEAD(&db.rd_pool, entry);
+        db.rd_pool_count--;
+    }
+    pthread_mutex_unlock(&db.pool_lock);
+    if(t == NULL) {
+        t = calloc(1, sizeof(db_txn_t));
+        if(t == NULL) {
+            log_error("calloc txn failed");
+            return NULL;
+        }
+        t->pooled = true;
+    }
+    return t;
+}
+
+void db_rd_txn_close(db_txn_t *t)
+{
+    if(cur_txn == t) {
+        cur_txn = NULL;
+    }
+    if(t->txn) {
+        db_txn_end(t, false);
+    }
+    pthread_mutex_lock(&db.pool_lock);
+    bool pooled = (db.rd_pool_count < DB_RD_TXN_POOL_MAX);
+    if(pooled) {
+        SLIST_INSERT_HEAD(&db.rd_pool, t, entry);
+        db.rd_pool_count++;
     }
-    if(db.txn) {
-        mdb_txn_abort(db.txn);
-        db.txn = NULL;
+    pthread_mutex_unlock(&db.pool_lock);
+    if(!pooled) {
+        db_txn_free(t);
     }
 }
 
-db_err_t db_get(const char *db_name, const buf_t *key, buf_t *value)
+db_txn_t *db_txn_switch(db_txn_t *t)
+{
+    db_txn_t *prev = cur_txn;
+    cur_txn = t;
+    return prev;
+}
+
+void *db_txn_priv(size_t size)
 {
-    db_err_t res = db_name_open(db_name, true);
+    db_txn_t *t = db_txn_cur();
+    if(t->priv_size < size) {
+        free(t->priv);
+        t->priv = calloc(1, size);
+        if(t->priv == NULL) {
+            log_error("calloc txn private memory size=%zu failed", size);
+            t->priv_size = 0;
+            return NULL;
+        }
+        t->priv_size = size;
+    }
+    return t->priv;
+}
+
+db_err_t db_get(db_table_t *table, const buf_t *key, buf_t *value)
+{
+    MDB_dbi dbi;
+    db_err_t res = db_table_open(table, true, &dbi);
     if(res != DB_ERR_OK) {
         return res;
     }
@@ -174,10 +1019,10 @@ db_err_t db_get(const char *db_name, const buf_t *key, buf_t *value)
         .mv_size = key->size,
         .mv_data = key->data,
     };
-    int rc = mdb_get(db.txn, db.dbi, &mdb_key, &mdb_value);
+    int rc = mdb_get(db_txn_cur()->txn, dbi, &mdb_key, &mdb_value);
     if(rc != MDB_SUCCESS) {
         if(rc != MDB_NOTFOUND) {
-            log_error("db %s get failed - %s", db_name, mdb_strerror(rc));
+            log_error("db %s get failed - %s", table->name, mdb_strerror(rc));
             return DB_ERR_DBI_GET;
         }
         return DB_ERR_NOT_FOUND;
@@ -187,9 +1032,10 @@ db_err_t db_get(const char *db_name, const buf_t *key, buf_t *value)
     return DB_ERR_OK;
 }
 
-db_err_t db_put(const char *db_name, const buf_t *key, const buf_t *value)
+db_err_t db_put(db_table_t *table, const buf_t *key, const buf_t *value)
 {
-    db_err_t res = db_name_open(db_name, false);
+    MDB_dbi dbi;
+    db_err_t res = db_table_open(table, false, &dbi);
     if(res != DB_ERR_OK) {
         return res;
     }
@@ -201,39 +1047,79 @@ db_err_t db_put(const char *db_name, const buf_t *key, const buf_t *value)
         .mv_size = value->size,
         .mv_data = value->data,
     };
-    int rc = mdb_put(db.txn, db.dbi, &mdb_key, &mdb_value, 0);
+    int rc = mdb_put(db_txn_cur()->txn, dbi, &mdb_key, &mdb_value, 0);
     if(rc != MDB_SUCCESS) {
-        log_error("db %s put failed - %s", db_name, mdb_strerror(rc));
-        return DB_ERR_DBI_PUT;
+        log_error("db %s put failed - %s", table->name, mdb_strerror(rc));
+        return db_write_err(rc, DB_ERR_DBI_PUT);
     }
     return DB_ERR_OK;
 }
 
-db_err_t db_cursor_get(const char *db_name, buf_t *key, buf_t *value, db_cursor_op_t op)
+db_err_t db_del(db_table_t *table, const buf_t *key)
 {
-    db_err_t res = db_name_open(db_name, true);
+    MDB_dbi dbi;
+    db_err_t res = db_table_open(table, false, &dbi);
     if(res != DB_ERR_OK) {
         return res;
     }
-    if(db.cur && mdb_cursor_dbi(db.cur) != db.dbi) {
-        mdb_cursor_close(db.cur);
-        db.cur = NULL;
+    MDB_val mdb_key = {
+        .mv_size = key->size,
+        .mv_data = key->data,
+    };
+    int rc = mdb_del(db_txn_cur()->txn, dbi, &mdb_key, NULL);
+    if(rc != MDB_SUCCESS) {
+        if(rc != MDB_NOTFOUND) {
+            log_error("db %s del failed - %s", table->name, mdb_strerror(rc));
+            return db_write_err(rc, DB_ERR_DBI_DEL);
+        }
+        return DB_ERR_NOT_FOUND;
+    }
+    return DB_ERR_OK;
+}
+
+/**
+ * @brief Get the cursor of the table in the current transaction, opening it if needed
+ */
+static db_err_t db_table_cursor(db_table_t *table, bool rd_only, MDB_cursor **pcur)
+{
+    MDB_dbi dbi;
+    db_err_t res = db_table_open(table, rd_only, &dbi);
+    if(res != DB_ERR_OK) {
+        return res;
     }
-    if(db.cur == NULL) {
-        int rc = mdb_cursor_open(db.txn, db.dbi, &db.cur);
+    // Every table keeps its own cursor, so walks over different tables do not reposition each other //
+    db_txn_t *t = db_txn_cur();
+    if((t->cur_mask & (1ull << dbi)) == 0) {
+        int rc = mdb_cursor_open(t->txn, dbi, &t->cur[dbi]);
         if(rc != MDB_SUCCESS) {
-            log_error("db %s cursor open failed - %s", db_name, mdb_strerror(rc));
+            log_error("db %s cursor open failed - %s", table->name, mdb_strerror(rc));
             return DB_ERR_DBI_GET;
         }
+        t->cur_mask |= 1ull << dbi;
     }
-    MDB_val mdb_value, mdb_key = {
+    *pcur = t->cur[dbi];
+    return DB_ERR_OK;
+}
+
+db_err_t db_cursor_get(db_table_t *table, buf_t *key, buf_t *value, db_cursor_op_t op)
+{
+    MDB_cursor *cur;
+    db_err_t res = db_table_cursor(table, true, &cur);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    MDB_val mdb_value = { 0 }, mdb_key = {
         .mv_size = key->size,
         .mv_data = key->data,
     };
-    int rc = mdb_cursor_get(db.cur, &mdb_key, &mdb_value, (uint32_t)op);
+    if(op == DB_CURSOR_OP_GET_BOTH_RANGE || op == DB_CURSOR_OP_GET_MULTIPLE) {
+        mdb_value.mv_size = value->size;
+        mdb_value.mv_data = value->data;
+    }
+    int rc = mdb_cursor_get(cur, &mdb_key, &mdb_value, (uint32_t)op);
     if(rc != MDB_SUCCESS) {
         if(rc != MDB_NOTFOUND) {
-            log_error("db %s cursor get failed - %s", db_name, mdb_strerror(rc));
+            log_error("db %s cursor get failed - %s", table->name, mdb_strerror(rc));
             return DB_ERR_DBI_GET;
         }
         return DB_ERR_NOT_FOUND;
@@ -244,3 +1130,59 @@ db_err_t db_cursor_get(const char *db_name, buf_t *key, buf_t *value, db_cursor_
     value->data = mdb_value.mv_data;
     return DB_ERR_OK;
 }
+
+/**
+ * @brief Put key-value pair with the cursor of the table
+ */
+static db_err_t db_cursor_put(db_table_t *table, const buf_t *key, const buf_t *value, uint32_t flags)
+{
+    MDB_cursor *cur;
+    db_err_t res = db_table_cursor(table, false, &cur);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    MDB_val mdb_key = {
+        .mv_size = key->size,
+        .mv_data = key->data,
+    };
+    MDB_val mdb_value = {
+        .mv_size = value->size,
+        .mv_data = value->data,
+    };
+    int rc = mdb_cursor_put(cur, &mdb_key, &mdb_value, flags);
+    if(rc != MDB_SUCCESS) {
+        if(rc == MDB_KEYEXIST) {
+            return DB_ERR_DBI_ORDER;
+        }
+        log_error("db %s append failed - %s", table->name, mdb_strerror(rc));
+        return db_write_err(rc, DB_ERR_DBI_PUT);
+    }
+    return DB_ERR_OK;
+}
+
+db_err_t db_cursor_append(db_table_t *table, const buf_t *key, const buf_t *value)
+{
+    // Appended key goes to the last leaf page without a search, LMDB only compares it with the last key //
+    return db_cursor_put(table, key, value, MDB_APPEND);
+}
+
+db_err_t db_cursor_append_dup(db_table_t *table, const buf_t *key, const buf_t *value)
+{
+    // Key is searched, the value goes to the last page of the key after a compare with its last value //
+    return db_cursor_put(table, key, value, MDB_APPENDDUP);
+}
+
+db_err_t db_cursor_del(db_table_t *table)
+{
+    MDB_cursor *cur;
+    db_err_t res = db_table_cursor(table, false, &cur);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    int rc = mdb_cursor_del(cur, 0);
+    if(rc != MDB_SUCCESS) {
+        log_error("db %s cursor del failed - %s", table->name, mdb_strerror(rc));
+        return db_write_err(rc, DB_ERR_DBI_DEL);
+    }
+    return DB_ERR_OK;
+}
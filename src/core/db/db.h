@@ -1,6 +1,8 @@
 #pragma once
 
 #include <core/base/buf.h>
+#include <sys/queue.h>
+#include <stdatomic.h>
 
 /**
  * @brief Enumeration of database error codes
@@ -16,10 +18,14 @@ typedef enum {
     DB_ERR_DBI_OPEN,      ///< Database instance open error
     DB_ERR_DBI_GET,       ///< Database instance get error
     DB_ERR_DBI_PUT,       ///< Database instance put error
+    DB_ERR_DBI_DEL,       ///< Database instance delete error
+    DB_ERR_DBI_ORDER,     ///< Appended key is not after the last key
+    DB_ERR_MAP_FULL,      ///< Database map is full, it is grown once no transaction is active
     DB_ERR_NOT_FOUND,     ///< Database value not found
     DB_ERR_SIZE_MISMATCH, ///< Size mismatch error
     DB_ERR_PARSE,         ///< Parsing error
     DB_ERR_NO_MEM,        ///< Memory allocation error
+    DB_ERR_BUSY,          ///< Database or operation is in use
     DB_ERR_FAIL,          ///< General failure
     DB_ERR_MAX,
 } db_err_t;
@@ -28,28 +34,101 @@ typedef enum {
  * @brief Enumeration of database cursor operations
  */
 typedef enum {
-    DB_CURSOR_OP_NEXT = 8,       ///< Move cursor to the next key
-    DB_CURSOR_OP_SET_RANGE = 17, ///< Set cursor to a specific key
+    DB_CURSOR_OP_GET_BOTH_RANGE = 3, ///< Set cursor to the first value of the key not less than the given one
+    DB_CURSOR_OP_GET_MULTIPLE = 5,   ///< Get the page of values at the cursor of a duplicate table
+    DB_CURSOR_OP_NEXT = 8,           ///< Move cursor to the next key
+    DB_CURSOR_OP_NEXT_MULTIPLE = 10, ///< Move cursor to the next page of values of the key and get it
+    DB_CURSOR_OP_NEXT_NODUP = 11,    ///< Move cursor to the first value of the next key
+    DB_CURSOR_OP_PREV_DUP = 13,      ///< Move cursor to the previous value of the key
+    DB_CURSOR_OP_SET_RANGE = 17,     ///< Set cursor to a specific key
     DB_CURSOR_OP_MAX,
 } db_cursor_op_t;
 
+/**
+ * @brief Durability of the committed write transactions
+ */
+typedef enum {
+    DB_SYNC_MODE_STRICT,   ///< Every commit is flushed to disk before it returns
+    DB_SYNC_MODE_PERIODIC, ///< Commits are flushed to disk by a timer, a crash loses at most one period
+    DB_SYNC_MODE_ASYNC,    ///< Commits are written to a writable map flushed by the kernel in the background
+    DB_SYNC_MODE_MAX,
+} db_sync_mode_t;
+
+/**
+ * @brief Named table of the database
+ * @note Handle is resolved once per open environment and shared by all threads
+ */
+typedef struct db_table {
+    SLIST_ENTRY(db_table) entry; ///< Linked list entries of the resolved tables
+    const char *name;            ///< Name of the table
+    bool dup;                    ///< Key holds many sorted values of the same size
+    atomic_uint dbi;             ///< LMDB handle, 0 until resolved in the open environment
+} db_table_t;
+
+/**
+ * @brief Initializer of a table with the given name
+ */
+#define DB_TABLE_INIT(table_name) { .name = table_name }
+
+/**
+ * @brief Initializer of a duplicate table with the given name, values of a key are packed into its own pages
+ */
+#define DB_TABLE_INIT_DUP(table_name) { .name = table_name, .dup = true }
+
+/**
+ * @brief Transaction object, the calls of a thread run in its own one unless switched
+ */
+typedef struct db_txn db_txn_t;
+
 /**
  * @brief Database statistics structure
  */
 typedef struct {
     size_t used_size; ///< Used size in bytes
-    size_t tot_size;  ///< Total size in bytes
+    size_t tot_size;  ///< Total size in bytes, the map grows as it fills up
+    size_t free_size; ///< Headroom in bytes until the map is full
 } db_stat_t;
 
+/**
+ * @brief State of the last database backup
+ */
+typedef enum {
+    DB_BACKUP_STATE_NONE,    ///< No backup was started
+    DB_BACKUP_STATE_RUNNING, ///< Backup is being written
+    DB_BACKUP_STATE_DONE,    ///< Backup is complete
+    DB_BACKUP_STATE_FAILED,  ///< Backup failed and was removed
+    DB_BACKUP_STATE_MAX,
+} db_backup_state_t;
+
+/**
+ * @brief Database backup statistics structure
+ */
+typedef struct {
+    db_backup_state_t state; ///< State of the last backup
+    uint64_t start_ts;       ///< Start time of the last backup
+    uint64_t end_ts;         ///< End time of the last backup, 0 while running
+    size_t done_size;        ///< Written size in bytes
+    size_t tot_size;         ///< Used size of the database when the backup started, the compacted copy is not larger
+} db_backup_stat_t;
+
 /**
  * @brief Create or open database in specified path
  * @param path - [in] Path to the database directory
- * @param size_mb - [in] Size of the database in megabytes
+ * @param size_mb - [in] Initial size of the database map in megabytes
  * @param max_dbs - [in] Maximum number of databases
+ * @param sync_mode - [in] Durability of the commits
+ * @param sync_ms - [in] Interval of the disk syncs in DB_SYNC_MODE_PERIODIC
  * @param rd_only - [in] Open database in read-only mode if true
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_open(const char *path, uint32_t size_mb, uint32_t max_dbs, bool rd_only);
+db_err_t db_open(const char *path, uint32_t size_mb, uint32_t max_dbs, db_sync_mode_t sync_mode, uint32_t sync_ms,
+                 bool rd_only);
+
+/**
+ * @brief Check if database was opened in read-only mode
+ * @return true if write transactions are not allowed, false otherwise
+ */
+bool db_is_rd_only(void);
 
 /**
  * @brief Get database statistics
@@ -66,9 +145,34 @@ db_err_t db_sync(void);
 
 /**
  * @brief Close database and free resources
+ * @note A running backup is cancelled
  */
 void db_close(void);
 
+/**
+ * @brief Start a compacting copy of the database into a new timestamped directory on a background thread
+ * @note The copy reads one snapshot in a child process, so neither the loop nor the writers wait for it and the map
+ *       can grow meanwhile. Pages freed after the snapshot are reused only once the copy ends.
+ * @param dir - [in] Path to the directory of the backups
+ * @param rate_kb - [in] Maximum write rate in KB/s, 0 for no limit
+ * @return DB_ERR_OK if started, DB_ERR_BUSY if a backup is running, error code otherwise
+ */
+db_err_t db_backup_start(const char *dir, uint32_t rate_kb);
+
+/**
+ * @brief Get statistics of the last database backup
+ * @param stat - [out] Pointer to the statistics structure
+ */
+void db_backup_get_stat(db_backup_stat_t *stat);
+
+/**
+ * @brief Replace the database with a backup, the database must not be open by any process
+ * @param backup_path - [in] Path to the backup directory
+ * @param path - [in] Path to the database directory
+ * @return DB_ERR_OK on success, DB_ERR_BUSY if the database is open, error code otherwise
+ */
+db_err_t db_restore(const char *backup_path, const char *path);
+
 /**
  * @brief Begin a new transaction
  * @param rd_only - [in] Begin read-only transaction if true
@@ -87,30 +191,92 @@ db_err_t db_txn_commit(void);
  */
 void db_txn_abort(void);
 
+/**
+ * @brief Take a read transaction object from the pool
+ * @note The snapshot is taken by the first read and released by db_txn_abort, the object stays usable
+ * @return Pointer to the object or NULL on allocation failure
+ */
+db_txn_t *db_rd_txn_open(void);
+
+/**
+ * @brief End the transaction of the object and return it to the pool
+ * @param t - [in] Pointer to the object from db_rd_txn_open
+ */
+void db_rd_txn_close(db_txn_t *t);
+
+/**
+ * @brief Run the following calls of the thread in the transaction object
+ * @param t - [in] Pointer to the object from db_rd_txn_open or NULL for the own one of the thread
+ * @return Previous object to switch back to
+ */
+db_txn_t *db_txn_switch(db_txn_t *t);
+
+/**
+ * @brief Get private memory of the current transaction object
+ * @param size - [in] Size of the memory, callers of an object share it
+ * @return Pointer to the memory, zeroed when allocated, or NULL on allocation failure
+ */
+void *db_txn_priv(size_t size);
+
 /**
  * @brief Get value from the database within a transaction
- * @param db_name - [in] Name of the database
+ * @param table - [in] Pointer to the table
  * @param key - [in] Pointer to the key buffer
  * @param value - [out] Pointer to the value buffer
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_get(const char *db_name, const buf_t *key, buf_t *value);
+db_err_t db_get(db_table_t *table, const buf_t *key, buf_t *value);
 
 /**
  * @brief Put key-value pair into the database within a transaction
- * @param db_name - [in] Name of the database
+ * @param table - [in] Pointer to the table
  * @param key - [in] Pointer to the key buffer
  * @param value - [in] Pointer to the value buffer
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_put(const char *db_name, const buf_t *key, const buf_t *value);
+db_err_t db_put(db_table_t *table, const buf_t *key, const buf_t *value);
+
+/**
+ * @brief Delete key-value pair from the database within a transaction
+ * @param table - [in] Pointer to the table
+ * @param key - [in] Pointer to the key buffer
+ * @return DB_ERR_OK on success, DB_ERR_NOT_FOUND if the key does not exist, error code otherwise
+ */
+db_err_t db_del(db_table_t *table, const buf_t *key);
 
 /**
  * @brief Get next key-value pair from the database cursor within a transaction
- * @param db_name - [in] Name of the database
+ * @param table - [in] Pointer to the table
  * @param key - [in,out] Pointer to the key buffer
- * @param value - [in,out] Pointer to the value buffer
+ * @param value - [in,out] Pointer to the value buffer, read by DB_CURSOR_OP_GET_BOTH_RANGE and
+ *                DB_CURSOR_OP_GET_MULTIPLE, the latter keeps it for a key with a single value
  * @param op - [in] Cursor operation (set or next)
+ * @note Every table has its own cursor in the transaction, which keeps its position until the transaction ends
+ * @return DB_ERR_OK on success, error code otherwise
+ */
+db_err_t db_cursor_get(db_table_t *table, buf_t *key, buf_t *value, db_cursor_op_t op);
+
+/**
+ * @brief Append key-value pair after the last key of the database with its cursor within a transaction
+ * @param table - [in] Pointer to the table
+ * @param key - [in] Pointer to the key buffer, greater than every key of the database
+ * @param value - [in] Pointer to the value buffer
+ * @return DB_ERR_OK on success, DB_ERR_DBI_ORDER if the key is not after the last key, error code otherwise
+ */
+db_err_t db_cursor_append(db_table_t *table, const buf_t *key, const buf_t *value);
+
+/**
+ * @brief Append value after the last value of the key of a duplicate table with its cursor within a transaction
+ * @param table - [in] Pointer to the table
+ * @param key - [in] Pointer to the key buffer
+ * @param value - [in] Pointer to the value buffer, greater than every value of the key
+ * @return DB_ERR_OK on success, DB_ERR_DBI_ORDER if the value is not after the last value, error code otherwise
+ */
+db_err_t db_cursor_append_dup(db_table_t *table, const buf_t *key, const buf_t *value);
+
+/**
+ * @brief Delete the key-value pair at the cursor of the table within a transaction
+ * @param table - [in] Pointer to the table
  * @return DB_ERR_OK on success, error code otherwise
  */
-db_err_t db_cursor_get(const char *db_name, buf_t *key, buf_t *value, db_cursor_op_t op);
+db_err_t db_cursor_del(db_table_t *table);
@@ -2,35 +2,81 @@
 #include <core/json/json-gen.h>
 #include <core/base/log.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
 
 #define MAX_JSON_BODY_SIZE (1024 * 1024)
 
+const phr_header_t *http_find_header(const phr_header_t *headers, uint32_t num_headers, const char *name)
+{
+    size_t name_len = strlen(name);
+    for(uint32_t i = 0; i < num_headers; i++) {
+        const phr_header_t *header = &headers[i];
+        if(header->name_len == name_len && strncasecmp(header->name, name, name_len) == 0) {
+            return header;
+        }
+    }
+    return NULL;
+}
+
+bool http_header_accepts(const phr_header_t *header, const char *name)
+{
+    if(header == NULL) {
+        return false;
+    }
+    size_t name_len = strlen(name);
+    const char *ptr = header->value;
+    const char *end = header->value + header->value_len;
+    while(ptr < end) {
+        while(ptr < end && (*ptr == ' ' || *ptr == ',')) {
+            ptr++;
+        }
+        const char *tok_end = ptr;
+        while(tok_end < end && *tok_end != ',') {
+            tok_end++;
+        }
+        size_t tok_len = 0;
+        while(ptr + tok_len < tok_end && ptr[tok_len] != ';' && ptr[tok_len] != ' ') {
+            tok_len++;
+        }
+        if(tok_len == name_len && strncasecmp(ptr, name, name_len) == 0) {
+            // Token listed with zero quality is refused //
+            const char *q = memmem(ptr, tok_end - ptr, "q=0", 3);
+            if(q == NULL) {
+                return true;
+            }
+            const char *digit = q + 3;
+            if(digit < tok_end && *digit == '.') {
+                digit++;
+            }
+            while(digit < tok_end && *digit == '0') {
+                digit++;
+            }
+            return digit < tok_end && *digit >= '1' && *digit <= '9';
+        }
+        ptr = tok_end;
+    }
+    return false;
+}
+
 http_parse_err_t http_parse_headers(const phr_header_t *headers, uint32_t num_headers, const http_header_item_t *items,
                                     uint32_t num_items)
 {
     for(uint32_t i = 0; i < num_items; i++) {
         const http_header_item_t *item = &items[i];
-        for(uint32_t j = 0; j < num_headers; j++) {
-            const phr_header_t *header = &headers[j];
-            char *h_name = (char *)header->name;
-            h_name[header->name_len] = '\0';
-
-            if(strcmp(item->name, h_name) == 0) {
-                http_parse_err_t res = item->cb(header, item->priv_data);
-                if(res != HTTP_PARSE_ERR_OK) {
-                    return res;
-                }
-                goto next;
-            }
+        const phr_header_t *header = http_find_header(headers, num_headers, item->name);
+        if(header == NULL) {
+            continue;
         }
+        char *h_name = (char *)header->name;
+        h_name[header->name_len] = '\0';
 
-        log_error("header not found: %s", items[i].name);
-        return HTTP_PARSE_ERR_NOT_FOUND;
-    next:
-        continue;
+        http_parse_err_t res = item->cb(header, item->priv_data);
+        if(res != HTTP_PARSE_ERR_OK) {
+            return res;
+        }
     }
     return HTTP_PARSE_ERR_OK;
 }
@@ -47,6 +93,24 @@ http_parse_err_t http_parse_int32(const phr_header_t *header, void *priv_data)
     return HTTP_PARSE_ERR_OK;
 }
 
+http_parse_err_t http_parse_uint32(const phr_header_t *header, void *priv_data)
+{
+    // strtoul() silently negates a leading minus sign //
+    if(header->value_len == 0 || header->value[0] < '0' || header->value[0] > '9') {
+        log_error("invalid uint32 value: %.*s", (int)header->value_len, header->value);
+        return HTTP_PARSE_ERR_INVALID;
+    }
+    char *end = NULL;
+    uint32_t *pval = priv_data;
+    unsigned long long val = strtoull(header->value, &end, 10);
+    if(end != &header->value[header->value_len] || val > UINT32_MAX) {
+        log_error("invalid uint32 value: %.*s", (int)header->value_len, header->value);
+        return HTTP_PARSE_ERR_INVALID;
+    }
+    *pval = val;
+    return HTTP_PARSE_ERR_OK;
+}
+
 http_parse_err_t http_parse_enum(const phr_header_t *header, void *priv_data)
 {
     const http_enum_t *info = priv_data;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <common.h>
 #include <core/http/http-parser.h>
 #include <core/http/http-server.h>
 #include <core/json/json-gen.h>
@@ -50,13 +51,31 @@ typedef struct {
     uint32_t enums_count;     ///< Number of enum values
 } http_enum_t;
 
+/**
+ * @brief Find an HTTP header by name, names are compared case-insensitively
+ * @param headers - [in] Pointer to the array of HTTP headers
+ * @param num_headers - [in] Number of HTTP headers
+ * @param name - [in] Header name
+ * @return Pointer to the header, or NULL if not found
+ */
+const phr_header_t *http_find_header(const phr_header_t *headers, uint32_t num_headers, const char *name);
+
+/**
+ * @brief Check if a list header such as Accept or Accept-Encoding allows the token
+ * @param header - [in] Pointer to the HTTP header, may be NULL
+ * @param name - [in] Token to look for, compared case-insensitively
+ * @return true if the token is listed without zero quality, false otherwise
+ */
+bool http_header_accepts(const phr_header_t *header, const char *name);
+
 /**
  * @brief Parse HTTP headers using specified header items and their callbacks
+ * @note Items missing from the headers are skipped, so their values must be preset to defaults
  * @param headers - [in] Pointer to the array of HTTP headers
  * @param num_headers - [in] Number of HTTP headers
  * @param items - [in] Pointer to the array of HTTP header items with their callbacks
  * @param num_items - [in] Number of HTTP header items
- * @return HTTP_PARSE_ERR_OK if all headers are successfully parsed, appropriate error code otherwise
+ * @return HTTP_PARSE_ERR_OK if all present headers are successfully parsed, appropriate error code otherwise
  */
 http_parse_err_t http_parse_headers(const phr_header_t *headers, uint32_t num_headers, const http_header_item_t *items,
                                     uint32_t num_items);
@@ -69,6 +88,14 @@ http_parse_err_t http_parse_headers(const phr_header_t *headers, uint32_t num_he
  */
 http_parse_err_t http_parse_int32(const phr_header_t *header, void *priv_data);
 
+/**
+ * @brief Parse an unsigned 32-bit integer from an HTTP header
+ * @param header - [in] Pointer to the HTTP header to be parsed
+ * @param priv_data - [out] Pointer to a uint32_t variable to store the parsed integer
+ * @return HTTP_PARSE_ERR_OK if the header is a decimal number in the uint32_t range, appropriate error code otherwise
+ */
+http_parse_err_t http_parse_uint32(const phr_header_t *header, void *priv_data);
+
 /**
  * @brief Parse an enumeration value from an HTTP header
  * @param header - [in] Pointer to the HTTP header to be parsed
@@ -27,7 +27,11 @@
 #include <assert.h>
 #include <stddef.h>
 #include <string.h>
-#ifdef __SSE4_2__
+#if defined(__x86_64__) && defined(__GNUC__)
+    /* AVX2 and AVX-512BW scanners are built with target attributes and picked at startup */
+    #define FINDCHAR_DISPATCH 1
+#endif
+#if defined(__SSE4_2__) || defined(FINDCHAR_DISPATCH)
     #ifdef _MSC_VER
         #include <nmmintrin.h>
     #else
@@ -71,9 +75,8 @@
 #define ADVANCE_TOKEN(tok, toklen)                                                                                     \
     do {                                                                                                               \
         const char *tok_start = buf;                                                                                   \
-        static const char ALIGNED(16) ranges2[16] = "\000\040\177\177";                                                \
         int found2;                                                                                                    \
-        buf = findchar_fast(buf, buf_end, ranges2, 4, &found2);                                                        \
+        buf = findchar_ops->path(buf, buf_end, &found2);                                                               \
         if(!found2) {                                                                                                  \
             CHECK_EOF();                                                                                               \
         }                                                                                                              \
@@ -102,8 +105,8 @@ static const char *token_char_map = "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\
                                     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
                                     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
 
-static const char *findchar_fast(const char *buf, const char *buf_end, const char *ranges, size_t ranges_size,
-                                 int *found)
+static const char *findchar_sse42(const char *buf, const char *buf_end, const char *ranges, size_t ranges_size,
+                                  int *found)
 {
     *found = 0;
 #if __SSE4_2__
@@ -133,20 +136,234 @@ static const char *findchar_fast(const char *buf, const char *buf_end, const cha
     return buf;
 }
 
+/* non-token characters in ADVANCE_TOKEN, get_token_to_eol and parse_token, see the call sites for the details */
+static const char ALIGNED(16) ranges_path[16] = "\000\040\177\177";
+static const char ALIGNED(16) ranges_eol[16] = "\0\010"    /* allow HT */
+                                               "\012\037"  /* allow SP and up to but not including DEL */
+                                               "\177\177"; /* allow chars w. MSB set */
+/* We use pcmpestri to detect non-token characters. This instruction can take no more than eight character ranges (8*2*8=128
+ * bits that is the size of a SSE register). Due to this restriction, characters `|` and `~` are handled in the slow loop. */
+static const char ALIGNED(16) ranges_token[] = "\x00 "  /* control chars and up to SP */
+                                               "\"\""   /* 0x22 */
+                                               "()"     /* 0x28,0x29 */
+                                               ",,"     /* 0x2c */
+                                               "//"     /* 0x2f */
+                                               ":@"     /* 0x3a-0x40 */
+                                               "[]"     /* 0x5b-0x5d */
+                                               "{\xff"; /* 0x7b-0xff */
+
+static const char *findchar_path_sse42(const char *buf, const char *buf_end, int *found)
+{
+    return findchar_sse42(buf, buf_end, ranges_path, 4, found);
+}
+
+static const char *findchar_eol_sse42(const char *buf, const char *buf_end, int *found)
+{
+    return findchar_sse42(buf, buf_end, ranges_eol, 6, found);
+}
+
+static const char *findchar_token_sse42(const char *buf, const char *buf_end, int *found)
+{
+    return findchar_sse42(buf, buf_end, ranges_token, sizeof(ranges_token) - 1, found);
+}
+
+#ifdef FINDCHAR_DISPATCH
+/* Each character class gets its own scanner with constant vectors, generic range pairs cost more than pcmpestri
+ * on short header lines. Token characters are looked up by nibbles: token_nibble_lo[c & 15] has bit (c >> 4) set
+ * for every token character, token_nibble_hi[c >> 4] selects the bit and is zero for chars with MSB set. */
+static uint8_t ALIGNED(16) token_nibble_lo[16];
+static const uint8_t ALIGNED(16) token_nibble_hi[16] = {1, 2, 4, 8, 16, 32, 64, 128};
+
+__attribute__((target("avx2"))) static const char *findchar_path_avx2(const char *buf, const char *buf_end, int *found)
+{
+    const __m256i sp = _mm256_set1_epi8('\040'), del = _mm256_set1_epi8('\177');
+    *found = 0;
+    while(likely(buf_end - buf >= 32)) {
+        __m256i b32 = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(b32, sp), b32);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(ctl, _mm256_cmpeq_epi8(b32, del)));
+        if(unlikely(mask != 0)) {
+            *found = 1;
+            return buf + __builtin_ctz(mask);
+        }
+        buf += 32;
+    }
+    return buf;
+}
+
+__attribute__((target("avx2"))) static const char *findchar_eol_avx2(const char *buf, const char *buf_end, int *found)
+{
+    const __m256i us = _mm256_set1_epi8('\037'), ht = _mm256_set1_epi8('\011'), del = _mm256_set1_epi8('\177');
+    *found = 0;
+    while(likely(buf_end - buf >= 32)) {
+        __m256i b32 = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(b32, ht), _mm256_cmpeq_epi8(_mm256_min_epu8(b32, us), b32));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(ctl, _mm256_cmpeq_epi8(b32, del)));
+        if(unlikely(mask != 0)) {
+            *found = 1;
+            return buf + __builtin_ctz(mask);
+        }
+        buf += 32;
+    }
+    return buf;
+}
+
+__attribute__((target("avx2"))) static const char *findchar_token_avx2(const char *buf, const char *buf_end, int *found)
+{
+    const __m256i lo_tbl = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)token_nibble_lo));
+    const __m256i hi_tbl = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)token_nibble_hi));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    *found = 0;
+    while(likely(buf_end - buf >= 32)) {
+        __m256i b32 = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i lo = _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(b32, nibble));
+        __m256i hi = _mm256_shuffle_epi8(hi_tbl, _mm256_and_si256(_mm256_srli_epi16(b32, 4), nibble));
+        __m256i tok = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256());
+        unsigned mask = (unsigned)_mm256_movemask_epi8(tok);
+        if(unlikely(mask != 0)) {
+            *found = 1;
+            return buf + __builtin_ctz(mask);
+        }
+        buf += 32;
+    }
+    return buf;
+}
+
+/* 64 byte steps, the tail is finished by the 32 byte scanners before the byte loops of the caller */
+__attribute__((target("avx512bw"))) static const char *findchar_path_avx512(const char *buf, const char *buf_end,
+                                                                            int *found)
+{
+    const __m512i sp = _mm512_set1_epi8('\040'), del = _mm512_set1_epi8('\177');
+    while(likely(buf_end - buf >= 64)) {
+        __m512i b64 = _mm512_loadu_si512((const void *)buf);
+        __mmask64 mask = _mm512_cmple_epu8_mask(b64, sp) | _mm512_cmpeq_epi8_mask(b64, del);
+        if(unlikely(mask != 0)) {
+            *found = 1;
+            return buf + __builtin_ctzll(mask);
+        }
+        buf += 64;
+    }
+    return findchar_path_avx2(buf, buf_end, found);
+}
+
+__attribute__((target("avx512bw"))) static const char *findchar_eol_avx512(const char *buf, const char *buf_end,
+                                                                           int *found)
+{
+    const __m512i us = _mm512_set1_epi8('\037'), ht = _mm512_set1_epi8('\011'), del = _mm512_set1_epi8('\177');
+    while(likely(buf_end - buf >= 64)) {
+        __m512i b64 = _mm512_loadu_si512((const void *)buf);
+        __mmask64 mask = (_mm512_cmple_epu8_mask(b64, us) & ~_mm512_cmpeq_epi8_mask(b64, ht)) |
+                         _mm512_cmpeq_epi8_mask(b64, del);
+        if(unlikely(mask != 0)) {
+            *found = 1;
+            return buf + __builtin_ctzll(mask);
+        }
+        buf += 64;
+    }
+    return findchar_eol_avx2(buf, buf_end, found);
+}
+
+__attribute__((target("avx512bw"))) static const char *findchar_token_avx512(const char *buf, const char *buf_end,
+                                                                             int *found)
+{
+    const __m512i lo_tbl = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *)token_nibble_lo));
+    const __m512i hi_tbl = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *)token_nibble_hi));
+    const __m512i nibble = _mm512_set1_epi8(0x0f);
+    while(likely(buf_end - buf >= 64)) {
+        __m512i b64 = _mm512_loadu_si512((const void *)buf);
+        __m512i lo = _mm512_shuffle_epi8(lo_tbl, _mm512_and_si512(b64, nibble));
+        __m512i hi = _mm512_shuffle_epi8(hi_tbl, _mm512_and_si512(_mm512_srli_epi16(b64, 4), nibble));
+        __mmask64 mask = _mm512_testn_epi8_mask(lo, hi);
+        if(unlikely(mask != 0)) {
+            *found = 1;
+            return buf + __builtin_ctzll(mask);
+        }
+        buf += 64;
+    }
+    return findchar_token_avx2(buf, buf_end, found);
+}
+#endif
+
+typedef const char *(*findchar_fn_t)(const char *buf, const char *buf_end, int *found);
+
+typedef struct {
+    findchar_fn_t path;  /* request target, stops at SP and control chars */
+    findchar_fn_t eol;   /* header value, stops at control chars except HT */
+    findchar_fn_t token; /* method and header name, stops at non-token chars */
+} findchar_ops_t;
+
+static const findchar_ops_t findchar_ops_all[PHR_SIMD_MAX] = {
+    [PHR_SIMD_NONE] = {findchar_path_sse42, findchar_eol_sse42, findchar_token_sse42},
+#ifdef FINDCHAR_DISPATCH
+    [PHR_SIMD_AVX2] = {findchar_path_avx2, findchar_eol_avx2, findchar_token_avx2},
+    [PHR_SIMD_AVX512] = {findchar_path_avx512, findchar_eol_avx512, findchar_token_avx512},
+#endif
+};
+static phr_simd_t findchar_simd = PHR_SIMD_NONE;
+static const findchar_ops_t *findchar_ops = &findchar_ops_all[PHR_SIMD_NONE];
+
+static int simd_supported(phr_simd_t simd)
+{
+#ifdef FINDCHAR_DISPATCH
+    __builtin_cpu_init();
+    switch(simd) {
+    case PHR_SIMD_NONE:
+        return 1;
+    case PHR_SIMD_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case PHR_SIMD_AVX512:
+        return __builtin_cpu_supports("avx512bw");
+    default:
+        return 0;
+    }
+#else
+    return simd == PHR_SIMD_NONE;
+#endif
+}
+
+/* runs before main, so the scanners are fixed before any thread parses */
+__attribute__((constructor)) static void findchar_init(void)
+{
+#ifdef FINDCHAR_DISPATCH
+    for(int c = 0; c < 128; c++) {
+        if(token_char_map[c]) {
+            token_nibble_lo[c & 15] |= 1 << (c >> 4);
+        }
+    }
+#endif
+    /* AVX-512 measured slower than AVX2 on real header lines, its setup does not pay off on short tokens */
+    if(simd_supported(PHR_SIMD_AVX2)) {
+        phr_simd_set(PHR_SIMD_AVX2);
+    }
+}
+
+phr_simd_t phr_simd_get(void)
+{
+    return findchar_simd;
+}
+
+int phr_simd_set(phr_simd_t simd)
+{
+    if(simd >= PHR_SIMD_MAX || !simd_supported(simd)) {
+        return -1;
+    }
+    findchar_simd = simd;
+    findchar_ops = &findchar_ops_all[simd];
+    return 0;
+}
+
 static const char *get_token_to_eol(const char *buf, const char *buf_end, const char **token, size_t *token_len,
                                     int *ret)
 {
     const char *token_start = buf;
 
-#ifdef __SSE4_2__
-    static const char ALIGNED(16) ranges1[16] = "\0\010"    /* allow HT */
-                                                "\012\037"  /* allow SP and up to but not including DEL */
-                                                "\177\177"; /* allow chars w. MSB set */
+#if defined(__SSE4_2__) || defined(FINDCHAR_DISPATCH)
     int found;
-    buf = findchar_fast(buf, buf_end, ranges1, 6, &found);
+    buf = findchar_ops->eol(buf, buf_end, &found);
     if(found)
         goto FOUND_CTL;
-#else
+#endif
+#ifndef __SSE4_2__
     /* find non-printable char within the next 8 bytes, this is the hottest code; manually inlined */
     while(likely(buf_end - buf >= 8)) {
     #define DOIT()                                                                                                     \
@@ -248,19 +465,9 @@ static const char *is_complete(const char *buf, const char *buf_end, size_t last
 static const char *parse_token(const char *buf, const char *buf_end, const char **token, size_t *token_len,
                                char next_char, int *ret)
 {
-    /* We use pcmpestri to detect non-token characters. This instruction can take no more than eight character ranges (8*2*8=128
-     * bits that is the size of a SSE register). Due to this restriction, characters `|` and `~` are handled in the slow loop. */
-    static const char ALIGNED(16) ranges[] = "\x00 "  /* control chars and up to SP */
-                                             "\"\""   /* 0x22 */
-                                             "()"     /* 0x28,0x29 */
-                                             ",,"     /* 0x2c */
-                                             "//"     /* 0x2f */
-                                             ":@"     /* 0x3a-0x40 */
-                                             "[]"     /* 0x5b-0x5d */
-                                             "{\xff"; /* 0x7b-0xff */
     const char *buf_start = buf;
     int found;
-    buf = findchar_fast(buf, buf_end, ranges, sizeof(ranges) - 1, &found);
+    buf = findchar_ops->token(buf, buf_end, &found);
     if(!found) {
         CHECK_EOF();
     }
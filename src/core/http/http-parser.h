@@ -47,6 +47,21 @@ typedef struct phr_header {
     size_t value_len;
 } phr_header_t;
 
+/* vector extension used to scan tokens, AVX2 is picked at startup if the CPU supports it */
+typedef enum phr_simd {
+    PHR_SIMD_NONE,   /* SSE4.2 if the build enables it, byte loops otherwise */
+    PHR_SIMD_AVX2,   /* 32 byte scans */
+    PHR_SIMD_AVX512, /* 64 byte scans, needs AVX-512BW, only set explicitly as header tokens are too short for it */
+    PHR_SIMD_MAX,
+} phr_simd_t;
+
+/* returns the vector extension in use */
+phr_simd_t phr_simd_get(void);
+
+/* overrides the vector extension, e.g. to compare them in benchmarks. must not be called while other threads parse.
+ * returns -1 if the CPU does not support it */
+int phr_simd_set(phr_simd_t simd);
+
 /* returns number of bytes consumed if successful, -2 if request is partial,
  * -1 if failed */
 int phr_parse_request(const char *buf, size_t len, const char **method, size_t *method_len, const char **path,
@@ -0,0 +1,277 @@
+#include <core/http/http-router.h>
+#include <core/base/log.h>
+#include <stdlib.h>
+#include <string.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define ROUTE_ANY_METHOD SHTTP_METHOD_MAX
+
+typedef struct http_route_node {
+    const char *seg;                                      ///< Static segment of the node
+    uint32_t seg_len;                                     ///< Length of the static segment
+    uint32_t children_count;                              ///< Number of static children
+    uint32_t children_size;                               ///< Allocated size of the children array
+    http_route_node_t *children;                          ///< Static children, sorted after build
+    http_route_node_t *param;                             ///< Parameter child
+    const char *param_name;                               ///< Name of the parameter child
+    uint32_t param_name_len;                              ///< Length of the parameter name
+    const shttp_req_hand_t *exact[SHTTP_METHOD_MAX + 1];  ///< Handlers of the path ending at this node
+    const shttp_req_hand_t *prefix[SHTTP_METHOD_MAX + 1]; ///< Handlers of the paths starting with this node
+} http_route_node_t;
+
+typedef struct {
+    shttp_method_t method; ///< HTTP method of the request
+    shttp_param_t *params; ///< Array to store captured parameters
+    uint32_t params_size;  ///< Size of the params array
+    uint32_t params_count; ///< Number of captured parameters of the match
+} route_match_t;
+
+static http_route_node_t *node_new(void)
+{
+    return calloc(1, sizeof(http_route_node_t));
+}
+
+static void node_free(http_route_node_t *node)
+{
+    for(uint32_t i = 0; i < node->children_count; i++) {
+        node_free(&node->children[i]);
+    }
+    free(node->children);
+    if(node->param) {
+        node_free(node->param);
+        free(node->param);
+    }
+}
+
+static http_route_node_t *node_static_child(http_route_node_t *node, const char *seg, uint32_t seg_len)
+{
+    for(uint32_t i = 0; i < node->children_count; i++) {
+        http_route_node_t *child = &node->children[i];
+        if(child->seg_len == seg_len && memcmp(child->seg, seg, seg_len) == 0) {
+            return child;
+        }
+    }
+
+    if(node->children_count == node->children_size) {
+        uint32_t size = node->children_size ? node->children_size * 2 : 4;
+        http_route_node_t *children = realloc(node->children, size * sizeof(http_route_node_t));
+        if(children == NULL) {
+            log_error("realloc children[%u] failed", size);
+            return NULL;
+        }
+        node->children = children;
+        node->children_size = size;
+    }
+    http_route_node_t *child = &node->children[node->children_count++];
+    bzero(child, sizeof(http_route_node_t));
+    child->seg = seg;
+    child->seg_len = seg_len;
+    return child;
+}
+
+static http_route_node_t *node_param_child(http_route_node_t *node, const char *name, uint32_t name_len)
+{
+    if(node->param) {
+        if(node->param_name_len != name_len || memcmp(node->param_name, name, name_len) != 0) {
+            log_error("param name conflict {%.*s} vs {%.*s}", (int)node->param_name_len, node->param_name,
+                      (int)name_len, name);
+            return NULL;
+        }
+        return node->param;
+    }
+    node->param = node_new();
+    if(node->param == NULL) {
+        log_error("calloc http_route_node_t failed");
+        return NULL;
+    }
+    node->param_name = name;
+    node->param_name_len = name_len;
+    return node->param;
+}
+
+http_router_err_t http_router_add(http_router_t *router, shttp_method_t method, const char *pattern,
+                                  const shttp_req_hand_t *hand)
+{
+    if(pattern[0] != '/' || method > ROUTE_ANY_METHOD) {
+        log_error("invalid route %s", pattern);
+        return HTTP_ROUTER_ERR_PATTERN;
+    }
+    if(router->root == NULL) {
+        router->root = node_new();
+        if(router->root == NULL) {
+            log_error("calloc http_route_node_t failed");
+            return HTTP_ROUTER_ERR_MEM_ALLOC;
+        }
+    }
+
+    http_route_node_t *node = router->root;
+    const shttp_req_hand_t **slot = NULL;
+    const char *seg = pattern + 1;
+    while(slot == NULL) {
+        const char *end = strchrnul(seg, '/');
+        uint32_t seg_len = end - seg;
+        bool is_last = *end == '\0';
+
+        if(seg_len == 1 && seg[0] == '*') {
+            if(is_last == false) {
+                log_error("'*' must be the last segment %s", pattern);
+                return HTTP_ROUTER_ERR_PATTERN;
+            }
+            slot = &node->prefix[method];
+            break;
+        }
+
+        if(seg_len >= 2 && seg[0] == '{' && seg[seg_len - 1] == '}') {
+            node = node_param_child(node, seg + 1, seg_len - 2);
+            if(node == NULL) {
+                return HTTP_ROUTER_ERR_PATTERN;
+            }
+        } else {
+            if(memchr(seg, '{', seg_len) || memchr(seg, '}', seg_len) || memchr(seg, '?', seg_len)) {
+                log_error("invalid segment %.*s in %s", (int)seg_len, seg, pattern);
+                return HTTP_ROUTER_ERR_PATTERN;
+            }
+            node = node_static_child(node, seg, seg_len);
+            if(node == NULL) {
+                return HTTP_ROUTER_ERR_MEM_ALLOC;
+            }
+        }
+
+        if(is_last) {
+            slot = &node->exact[method];
+        }
+        seg = end + 1;
+    }
+
+    if(*slot) {
+        log_error("duplicate route %s method=%u", pattern, method);
+        return HTTP_ROUTER_ERR_DUPLICATE;
+    }
+    *slot = hand;
+    return HTTP_ROUTER_ERR_OK;
+}
+
+static int node_cmp(const void *a, const void *b)
+{
+    const http_route_node_t *na = a, *nb = b;
+    uint32_t len = na->seg_len < nb->seg_len ? na->seg_len : nb->seg_len;
+    int res = memcmp(na->seg, nb->seg, len);
+    if(res != 0) {
+        return res;
+    }
+    return (int)na->seg_len - (int)nb->seg_len;
+}
+
+static void node_build(http_route_node_t *node)
+{
+    if(node->children_count > 0) {
+        qsort(node->children, node->children_count, sizeof(http_route_node_t), node_cmp);
+    }
+    for(uint32_t i = 0; i < node->children_count; i++) {
+        node_build(&node->children[i]);
+    }
+    if(node->param) {
+        node_build(node->param);
+    }
+}
+
+void http_router_build(http_router_t *router)
+{
+    if(router->root) {
+        node_build(router->root);
+    }
+}
+
+static const shttp_req_hand_t *node_hand(const shttp_req_hand_t *const *hands, shttp_method_t method)
+{
+    if(method < SHTTP_METHOD_MAX && hands[method]) {
+        return hands[method];
+    }
+    return hands[ROUTE_ANY_METHOD];
+}
+
+static const shttp_req_hand_t *node_match(const http_route_node_t *node, const char *seg, uint32_t params_count,
+                                          route_match_t *match);
+
+static const shttp_req_hand_t *node_match_child(const http_route_node_t *child, const char *end,
+                                                uint32_t params_count, route_match_t *match)
+{
+    if(*end == '/') {
+        return node_match(child, end + 1, params_count, match);
+    }
+    const shttp_req_hand_t *hand = node_hand(child->exact, match->method);
+    if(hand == NULL) {
+        hand = node_hand(child->prefix, match->method);
+    }
+    if(hand) {
+        match->params_count = params_count;
+    }
+    return hand;
+}
+
+static const shttp_req_hand_t *node_match(const http_route_node_t *node, const char *seg, uint32_t params_count,
+                                          route_match_t *match)
+{
+    uint32_t seg_len = strcspn(seg, "/?");
+    const char *end = seg + seg_len;
+    const shttp_req_hand_t *hand;
+
+    const http_route_node_t key = {
+        .seg = seg,
+        .seg_len = seg_len,
+    };
+    const http_route_node_t *child = NULL;
+    if(node->children_count > 0) {
+        child = bsearch(&key, node->children, node->children_count, sizeof(http_route_node_t), node_cmp);
+    }
+    if(child) {
+        hand = node_match_child(child, end, params_count, match);
+        if(hand) {
+            return hand;
+        }
+    }
+
+    if(node->param && seg_len > 0 && params_count < match->params_size) {
+        shttp_param_t *param = &match->params[params_count];
+        param->name.data = (char *)node->param_name;
+        param->name.len = node->param_name_len;
+        param->value.data = (char *)seg;
+        param->value.len = seg_len;
+        hand = node_match_child(node->param, end, params_count + 1, match);
+        if(hand) {
+            return hand;
+        }
+    }
+
+    hand = node_hand(node->prefix, match->method);
+    if(hand) {
+        match->params_count = params_count;
+    }
+    return hand;
+}
+
+const shttp_req_hand_t *http_router_find(const http_router_t *router, shttp_method_t method, const char *path,
+                                         shttp_param_t *params, uint32_t *params_count)
+{
+    if(router->root == NULL || path[0] != '/') {
+        return NULL;
+    }
+    route_match_t match = {
+        .method = method,
+        .params = params,
+        .params_size = *params_count,
+    };
+    const shttp_req_hand_t *hand = node_match(router->root, path + 1, 0, &match);
+    *params_count = hand ? match.params_count : 0;
+    return hand;
+}
+
+void http_router_destroy(http_router_t *router)
+{
+    if(router->root) {
+        node_free(router->root);
+        free(router->root);
+        router->root = NULL;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <core/http/http-server.h>
+
+/**
+ * @brief HTTP router error codes
+ */
+typedef enum {
+    HTTP_ROUTER_ERR_OK,        ///< No error
+    HTTP_ROUTER_ERR_MEM_ALLOC, ///< Memory allocation failed
+    HTTP_ROUTER_ERR_PATTERN,   ///< Invalid route pattern
+    HTTP_ROUTER_ERR_DUPLICATE, ///< Route with the same pattern and method already exists
+    HTTP_ROUTER_ERR_MAX,
+} http_router_err_t;
+
+/**
+ * @brief Forward declaration of the route trie node
+ */
+typedef struct http_route_node http_route_node_t;
+
+/**
+ * @brief Router which maps request paths to handlers using a trie of path segments
+ *
+ * Pattern syntax:
+ *  - "/api/status" matches the path exactly
+ *  - "/api/metrics/{symbol}" captures one path segment as a parameter
+ *  - a trailing "*" segment matches any path starting with the preceding segments
+ *
+ * On every segment a static child is tried first, then a parameter, then a prefix route,
+ * so the result never depends on the order routes were added in.
+ */
+typedef struct {
+    http_route_node_t *root; ///< Root node of the trie
+} http_router_t;
+
+/**
+ * @brief Add a route to the router
+ * @param router - [in] Pointer to the router
+ * @param method - [in] HTTP method to match, SHTTP_METHOD_MAX to match any method
+ * @param pattern - [in] Route pattern, must stay valid while the router exists
+ * @param hand - [in] Request handler, must stay valid while the router exists
+ * @return HTTP_ROUTER_ERR_OK on success, error code otherwise
+ */
+http_router_err_t http_router_add(http_router_t *router, shttp_method_t method, const char *pattern,
+                                  const shttp_req_hand_t *hand);
+
+/**
+ * @brief Prepare the router for lookups, no routes can be added after this call
+ * @param router - [in] Pointer to the router
+ */
+void http_router_build(http_router_t *router);
+
+/**
+ * @brief Find the handler for the request path
+ * @param router - [in] Pointer to the built router
+ * @param method - [in] HTTP method of the request
+ * @param path - [in] Request path, query string is ignored
+ * @param params - [out] Array to store captured path parameters
+ * @param params_count - [in,out] Size of the params array on input, number of captured parameters on output
+ * @return Request handler, or NULL if no route matches
+ */
+const shttp_req_hand_t *http_router_find(const http_router_t *router, shttp_method_t method, const char *path,
+                                         shttp_param_t *params, uint32_t *params_count);
+
+/**
+ * @brief Free all router nodes
+ * @param router - [in] Pointer to the router
+ */
+void http_router_destroy(http_router_t *router);
@@ -1,50 +1,194 @@
 #include <core/http/http-server.h>
 #include <core/http/http-ext.h>
+#include <core/http/http-router.h>
 #include <core/base/log.h>
+#include <core/base/pool.h>
+#include <core/base/tpool.h>
+#include <core/base/twheel.h>
+#ifdef CONFIG_IO_URING
+#include <core/base/uring.h>
+#endif
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <sys/queue.h>
 #include <sys/uio.h>
+#include <inttypes.h>
 #include <sys/un.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <errno.h>
 #include <ev.h>
 
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
 
-#define MAX_CONN        16
-#define MAX_HEADERS     64
-#define HEADER_BUF_SIZE (128 * 1024)
-#define BODY_BUF_SIZE   (1024 * 1024)
+#define MAX_CONN          16
+#define MAX_HEADERS       64
+#define MAX_PARAMS        8
+#define MAX_WORKERS       64
+#define MAX_LISTENERS     8
+#define TCP_DEFER_SEC     5
+#define WORKER_QUEUE_SIZE 256
+#define JOB_QUEUE_SIZE    64
+#define JOB_OUT_SIZE      (4 * 1024)
+#define ACCEPT_PARK_SIZE  64
+#define HEADER_BUF_SIZE   (128 * 1024)
+#define BODY_BUF_SIZE     (1024 * 1024)
+#define IN_BUF_MAX_SIZE   (BODY_BUF_SIZE - 1)
+#define RESP_CHUNKED      SIZE_MAX
+#define URING_ENTRIES     256
+#define URING_BUF_COUNT   256
+#define URING_BUF_SIZE    (4 * 1024)
+#define STAT_LOG_SEC      600.0
+
+typedef struct shttp_worker shttp_worker_t;
+
+typedef enum {
+    CONN_IDLE_NONE,      ///< Response is pending, no deadline
+    CONN_IDLE_HEADER,    ///< Waiting for the complete request header
+    CONN_IDLE_BODY,      ///< Waiting for the next part of the request body
+    CONN_IDLE_KEEPALIVE, ///< Waiting for the next request
+    CONN_IDLE_MAX,
+} conn_idle_t;
 
 typedef struct shttp_conn {
-    LIST_ENTRY(shttp_conn) entry;      ///< Linked list entry for managing multiple connections
-    str_buf_t body;                    ///< Buffer to hold the request/responce body
-    ev_io io;                          ///< Read/Write events watcher
-    shttp_method_t method;             ///< HTTP method of the request
-    shttp_content_type_t content_type; ///< HTTP content type of the request
-    char *path;                        ///< Request path
+    LIST_ENTRY(shttp_conn) entry;       ///< Linked list entry for managing multiple connections
+    shttp_worker_t *worker;             ///< Worker which owns the connection
+    str_buf_t in;                       ///< Received data, offset points to the first unprocessed byte
+    uint32_t in_len;                    ///< Length of the received data
+    uint32_t last_len;                  ///< Length of the incomplete header seen by the previous parse
+    uint32_t hdr_len;                   ///< Header length of the current request waiting for its body, 0 if none
+    uint32_t content_len;               ///< Body length of the current request waiting for its body
+    str_buf_t body;                     ///< Buffer to hold the unsent responce data
+    uint32_t body_cap;                  ///< Pool size of the responce body buffer
+    int file_fd;                        ///< File to send after the body buffer, -1 if none
+    off_t file_offset;                  ///< Offset of the unsent file data
+    size_t file_len;                    ///< Length of the unsent file data
+    shttp_stream_cb_t stream_cb;        ///< Producer of the streamed responce chunks, NULL if none
+    shttp_stream_free_cb_t stream_free; ///< Frees the producer data once the stream is finished
+    void *stream_priv;                  ///< Private data of the stream producer
+    bool stream_end;                    ///< Last chunk of the streamed responce is buffered
+    bool stream_idle;                   ///< Producer has no data yet and waits for shttp_resp_resume
+    ev_io io;                           ///< Read/Write events watcher
+    bool in_process;                    ///< Requests are being dispatched from the input buffer
+    bool resp_pending;                  ///< Current request is dispatched but its response is not sent yet
+    bool close;                         ///< Connection must be closed once processing unwinds
+    bool closing;                       ///< Connection is freed once its pool job and ring operations complete
+    bool job_busy;                      ///< Pool job of the connection is queued or running
+    bool stream_pool;                   ///< Stream producer runs on the pool threads
+    conn_idle_t idle;                   ///< What the connection waits for while no response is pending
+    twheel_timer_t idle_timer;          ///< Deadline of the idle state
+#ifdef CONFIG_IO_URING
+    uring_op_t recv_op;                 ///< Multishot receive into the worker buffer ring
+    uring_op_t send_op;                 ///< Send of the unsent responce data
+    bool recv_armed;                    ///< Multishot receive is submitted and not terminated yet
+    bool recv_cancel;                   ///< Receive is cancelled until the pending response is sent
+    bool send_busy;                     ///< Send is submitted and not completed yet
+#endif
 } shttp_conn_t;
 
 typedef struct shttp_req_hand {
     LIST_ENTRY(shttp_req_hand) entry; ///< Linked list entry for managing multiple request handlers
     shttp_req_cb_t func;              ///< Request handler callback
-    uint32_t len;                     ///< Length of the request path
-    char path[];                      ///< Request path
+    shttp_method_t method;            ///< HTTP method to match
+    bool blocking;                    ///< Handler runs on the pool threads
+    char path[];                      ///< Request path pattern
 } shttp_req_hand_t;
 
+/**
+ * @brief Request or stream chunks handled on a pool thread
+ *
+ * The handler writes its responce into the job, which is moved to the connection once the job is back
+ * on the connection loop. The request is copied, so the connection keeps receiving meanwhile.
+ */
+typedef struct shttp_job {
+    tpool_job_t job;                    ///< Thread pool job
+    STAILQ_ENTRY(shttp_job) entry;      ///< Entry in the done queue of the worker
+    shttp_conn_t *conn;                 ///< Connection waiting for the job
+    const shttp_req_hand_t *hand;       ///< Handler to call, NULL to call the stream producer
+    shttp_err_t res;                    ///< Result of the handler or the stream producer
+    bool resp;                          ///< Responce is complete or its stream is started
+    str_buf_t out;                      ///< Responce data produced by the job
+    int file_fd;                        ///< File to send after the responce data, -1 if none
+    size_t file_len;                    ///< Length of the file data
+    shttp_stream_cb_t stream_cb;        ///< Stream producer
+    shttp_stream_free_cb_t stream_free; ///< Frees the producer data
+    void *stream_priv;                  ///< Private data of the stream producer
+    bool stream_end;                    ///< Last chunk of the stream is produced
+    shttp_req_t req;                    ///< Copy of the request
+    phr_header_t headers[MAX_HEADERS];  ///< Headers of the request copy
+    shttp_param_t params[MAX_PARAMS];   ///< Path parameters of the request copy
+    char data[];                        ///< Raw request data
+} shttp_job_t;
+
+typedef struct shttp_worker {
+    LIST_HEAD(shttp_conn_list, shttp_conn) conn_list; ///< List of active connections
+    atomic_uint conn_count;                           ///< Number of connections owned or queued to the worker
+    pool_t conn_pool;                                 ///< Pool of connection objects
+    pool_buf_t buf_pool;                              ///< Pool of input and responce buffers
+    struct ev_loop *loop;                             ///< Event loop of the worker
+    ev_async accept_async;                            ///< Wakes the worker up when new connections are queued
+    ev_async stop_async;                              ///< Breaks the worker event loop
+    pthread_mutex_t lock;                             ///< Protects the accept queue
+    pthread_t thread;                                 ///< Worker thread
+    bool is_running;                                  ///< Worker thread is started
+    uint32_t fd_head;                                 ///< Head of the accept queue
+    uint32_t fd_count;                                ///< Number of queued connections
+    int fd_queue[WORKER_QUEUE_SIZE];                  ///< Accepted sockets waiting for the worker
+    struct shttp_conn_list closing_list;              ///< Freed connections waiting for their jobs or ring operations
+    STAILQ_HEAD(shttp_job_list, shttp_job) job_done;  ///< Jobs finished by the pool, protected by the lock
+    ev_async job_async;                               ///< Wakes the worker up when jobs are finished
+    twheel_t wheel;                                   ///< Idle deadlines of the connections
+#ifdef CONFIG_IO_URING
+    uring_t uring;                                    ///< Ring of the connection sockets
+    uring_buf_ring_t bufs;                            ///< Receive buffers of the connections
+#endif
+} shttp_worker_t;
+
 typedef struct shttp {
-    LIST_HEAD(shttp_conn_list, shttp_conn) conn_list;             ///< List of active connections
     LIST_HEAD(shttp_req_hand_list, shttp_req_hand) req_hand_list; ///< List of request handlers
-    ev_io io;                                                     ///< Accept events watcher
+    http_router_t router;                                         ///< Router built from the handlers in shttp_start
+    shttp_worker_t *workers;                                      ///< Array of workers
+    uint32_t workers_count;                                       ///< Number of workers
+    bool threaded;                                                ///< Workers run in their own threads
+    tpool_t pool;                                                 ///< Threads running the blocking handlers
+    uint32_t idle_sec[CONN_IDLE_MAX];                             ///< Idle timeouts of the connection states
+    uint32_t max_conn;                                            ///< Maximum number of open connections, 0 if none
+    atomic_uint conn_total;                                       ///< Number of open connections of all workers
+    bool accept_paused;                                           ///< Listeners are stopped by the connection limit
+    ev_async resume_async;                                        ///< Resumes accepting once connections are released
+    ev_timer stat_timer;                                          ///< Logs the pool counters
+    uint32_t park_count;                                          ///< Number of parked sockets
+    int park_fds[ACCEPT_PARK_SIZE];                               ///< Sockets accepted over the limit, oldest first
+    uint32_t listen_count;                                        ///< Number of listening sockets
+    ev_io listen_io[MAX_LISTENERS];                               ///< Accept events watchers
+#ifdef CONFIG_IO_URING
+    uring_t uring;                                                ///< Ring of the listening sockets
+    uring_op_t accept_op[MAX_LISTENERS];                          ///< Multishot accept of each listener
+    bool accept_armed[MAX_LISTENERS];                             ///< Multishot accept is submitted and not terminated
+#endif
 } shttp_t;
 
-static shttp_t shttp_glob = {
-    .io.fd = -1,
-};
+static shttp_t shttp_glob = { 0 };
+// Responce of a blocking handler is written into its job instead of the connection //
+static _Thread_local shttp_job_t *job_cur = NULL;
 
 static const char *content_type_str[] = {
     [SHTTP_CONTENT_TYPE_HTML] = "text/html",
     [SHTTP_CONTENT_TYPE_JSON] = "application/json",
+    [SHTTP_CONTENT_TYPE_CSS] = "text/css",
+    [SHTTP_CONTENT_TYPE_JS] = "text/javascript",
+    [SHTTP_CONTENT_TYPE_WASM] = "application/wasm",
+    [SHTTP_CONTENT_TYPE_SVG] = "image/svg+xml",
+    [SHTTP_CONTENT_TYPE_PNG] = "image/png",
+    [SHTTP_CONTENT_TYPE_ICON] = "image/x-icon",
+    [SHTTP_CONTENT_TYPE_TEXT] = "text/plain",
+    [SHTTP_CONTENT_TYPE_BINARY] = "application/octet-stream",
+    [SHTTP_CONTENT_TYPE_EVENT_STREAM] = "text/event-stream",
 };
 STATIC_ASSERT(ARRAY_SIZE(content_type_str) == SHTTP_CONTENT_TYPE_MAX);
 static const char *connection_str[] = {
@@ -68,389 +212,1835 @@ static const char *resp_code_str(shttp_resp_code_t code)
     switch(code) {
     case SHTTP_RESP_CODE_200_OK:
         return "OK";
+    case SHTTP_RESP_CODE_304_NOT_MODIFIED:
+        return "Not Modified";
     case SHTTP_RESP_CODE_400_BAD_REQUEST:
         return "Bad Request";
     case SHTTP_RESP_CODE_404_NOT_FOUND:
         return "Not Found";
     case SHTTP_RESP_CODE_500_SERVER_ERROR:
         return "Internal Server Error";
+    case SHTTP_RESP_CODE_503_SERVICE_UNAVAILABLE:
+        return "Service Unavailable";
     default:
         return NULL;
     }
 }
 
-static void conn_free(shttp_conn_t *conn)
+static void conn_stream_free(shttp_conn_t *conn)
 {
-    LIST_REMOVE(conn, entry);
-
-    if(ev_is_active(&conn->io)) {
-        log_debug("free fd=%d", conn->io.fd);
-        ev_io_stop(EV_DEFAULT, &conn->io);
-        close(conn->io.fd);
+    if(conn->stream_free) {
+        conn->stream_free(conn->stream_priv);
     }
+    conn->stream_cb = NULL;
+    conn->stream_free = NULL;
+    conn->stream_priv = NULL;
+    conn->stream_end = false;
+    conn->stream_idle = false;
+    conn->stream_pool = false;
+}
 
-    free(conn->body.data);
-    free(conn);
+/**
+ * @brief Account a released connection, accepting is resumed on the default loop once the count drops below the limit
+ */
+static void conn_total_put(shttp_t *shttp)
+{
+    uint32_t count = atomic_fetch_sub(&shttp->conn_total, 1);
+    if(shttp->max_conn > 0 && count >= shttp->max_conn) {
+        ev_async_send(EV_DEFAULT, &shttp->resume_async);
+    }
 }
 
-static shttp_err_t req_hand_call(const shttp_req_t *req)
+static void conn_release(shttp_conn_t *conn)
 {
-    shttp_conn_t *conn = req->conn;
-    shttp_t *shttp = conn->io.data;
-    shttp_req_hand_t *req_hand;
-    LIST_FOREACH(req_hand, &shttp->req_hand_list, entry)
-    {
-        if(strncmp(req->path, req_hand->path, req_hand->len) == 0) {
-            return req_hand->func(req);
-        }
+    shttp_worker_t *worker = conn->worker;
+    log_debug("free fd=%d", conn->io.fd);
+    close(conn->io.fd);
+    if(conn->in.data) {
+        pool_buf_put(&worker->buf_pool, conn->in.data, conn->in.size + 1);
+    }
+    conn_stream_free(conn);
+    shttp_buf_free(conn);
+    if(conn->file_fd >= 0) {
+        close(conn->file_fd);
     }
-    log_warn("no handler path=%s", req->path);
-    return SHTTP_ERR_NO_HANDLER;
+    pool_put(&worker->conn_pool, conn);
+    conn_total_put(&shttp_glob);
 }
 
-static void read_body_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
+static void conn_free(shttp_conn_t *conn)
 {
-    shttp_conn_t *conn = container_of(io, shttp_conn_t, io);
-    if((events & EV_READ) == 0) {
-        log_error("unexpected events=%d fd=%d", events, io->fd);
-        conn_free(conn);
-        return;
+    shttp_worker_t *worker = conn->worker;
+    LIST_REMOVE(conn, entry);
+    atomic_fetch_sub(&worker->conn_count, 1);
+    // Watcher is stopped while a response is pending, the socket must be closed anyway //
+    ev_io_stop(worker->loop, &conn->io);
+    twheel_del(&worker->wheel, &conn->idle_timer);
+    if(conn->job_busy == false) {
+        // Producer may hold references to the connection, so it is detached before the deferred release //
+        conn_stream_free(conn);
     }
 
-    ssize_t n = read(io->fd, conn->body.data + conn->body.offset, conn->body.size - conn->body.offset);
-    if(n <= 0) {
-        if(n < 0) {
-            log_error("read fd=%d failed - %s", io->fd, strerror(errno));
-        }
-        conn_free(conn);
+    // Pool thread still uses the connection and its stream producer until the job is back //
+    bool busy = conn->job_busy;
+#ifdef CONFIG_IO_URING
+    // Kernel still references the socket and the responce buffer until the operations complete //
+    if(conn->recv_armed) {
+        uring_cancel(&worker->uring, &conn->recv_op);
+    }
+    if(conn->send_busy) {
+        uring_cancel(&worker->uring, &conn->send_op);
+    }
+    busy |= conn->recv_armed || conn->send_busy;
+#endif
+    if(busy) {
+        conn->closing = true;
+        LIST_INSERT_HEAD(&worker->closing_list, conn, entry);
         return;
     }
+    conn_release(conn);
+}
 
-    conn->body.offset += n;
-    if(conn->body.offset < conn->body.size) {
-        log_warn("read fd=%d incomplete %u/%u", conn->io.fd, conn->body.offset, conn->body.size);
-        return;
+static void conn_closing_done(shttp_conn_t *conn)
+{
+    bool busy = conn->job_busy;
+#ifdef CONFIG_IO_URING
+    busy |= conn->recv_armed || conn->send_busy;
+#endif
+    if(busy == false) {
+        LIST_REMOVE(conn, entry);
+        conn_release(conn);
     }
+}
 
-    shttp_req_t req = {
-        .conn = conn,
-        .path = conn->path,
-        .body.data = conn->body.data,
-        .body.len = conn->body.size,
-        .method = conn->method,
-        .content_type = conn->content_type,
-    };
-    if(req_hand_call(&req) != SHTTP_ERR_OK) {
-        conn_free(conn);
-        return;
+static void job_free(shttp_job_t *job)
+{
+    // Stream of a handler job is still owned by the job until it is moved to the connection //
+    if(job->stream_free) {
+        job->stream_free(job->stream_priv);
+    }
+    if(job->file_fd >= 0) {
+        close(job->file_fd);
     }
+    free(job->out.data);
+    free(job);
 }
 
-static void read_header_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
+static shttp_err_t conn_job_req(const shttp_req_t *req, const shttp_req_hand_t *hand, uint32_t req_len);
+static bool conn_job_stream(shttp_conn_t *conn);
+static void job_done_cb(struct ev_loop *loop, ev_async *async, int events);
+
+static shttp_err_t req_hand_call(shttp_req_t *req, uint32_t req_len)
 {
-    shttp_conn_t *conn = container_of(io, shttp_conn_t, io);
-    if((events & EV_READ) == 0) {
-        log_error("unexpected events=%d fd=%d", events, io->fd);
-        conn_free(conn);
-        return;
+    // Router is immutable after shttp_start, so workers share it without locking //
+    uint32_t params_count = req->params_count;
+    const shttp_req_hand_t *hand =
+        http_router_find(&shttp_glob.router, req->method, req->path, req->params, &params_count);
+    if(hand == NULL) {
+        log_warn("no handler path=%s", req->path);
+        return SHTTP_ERR_NO_HANDLER;
+    }
+    req->params_count = params_count;
+    if(hand->blocking && shttp_glob.pool.threads_count > 0) {
+        return conn_job_req(req, hand, req_len);
     }
+    return hand->func(req);
+}
 
-    char buf[HEADER_BUF_SIZE];
-    ssize_t n = read(conn->io.fd, buf, sizeof(buf) - 1);
-    if(n <= 0) {
-        if(n < 0) {
-            log_error("read fd=%d failed - %s", conn->io.fd, strerror(errno));
-        }
-        conn_free(conn);
+static void read_cb(struct ev_loop *loop, ev_io *io, int events);
+static void write_cb(struct ev_loop *loop, ev_io *io, int events);
+#ifdef CONFIG_IO_URING
+static bool conn_recv_arm(shttp_conn_t *conn);
+#endif
+
+static void conn_idle_cb(twheel_timer_t *timer)
+{
+    shttp_conn_t *conn = container_of(timer, shttp_conn_t, idle_timer);
+    log_info("idle timeout fd=%d state=%u", conn->io.fd, conn->idle);
+    conn_free(conn);
+}
+
+/**
+ * @brief Move the connection to the idle state and arm its deadline
+ * @note Header deadline is not extended by partial data, so a slowly dribbled header still expires
+ */
+static void conn_idle_set(shttp_conn_t *conn, conn_idle_t idle)
+{
+    if(idle == conn->idle && idle == CONN_IDLE_HEADER) {
         return;
     }
-    buf[n] = '\0';
+    conn->idle = idle;
+    twheel_add(&conn->worker->wheel, &conn->idle_timer, shttp_glob.idle_sec[idle], conn_idle_cb);
+}
+
+static void conn_io_set(shttp_conn_t *conn, void (*cb)(struct ev_loop *, ev_io *, int), int events)
+{
+    ev_io_stop(conn->worker->loop, &conn->io);
+    ev_io_init(&conn->io, cb, conn->io.fd, events);
+    ev_io_start(conn->worker->loop, &conn->io);
+}
+
+/**
+ * @brief Parse the next buffered request
+ * @note The buffer is modified only once the whole request is received, so an incomplete request can be parsed again
+ * @return 1 when the request is complete, 0 when more data is needed, -1 on error
+ */
+static int conn_parse_req(shttp_conn_t *conn, shttp_req_t *req, phr_header_t *headers, size_t headers_count)
+{
+    char *buf = conn->in.data + conn->in.offset;
+    uint32_t len = conn->in_len - conn->in.offset;
 
-    phr_header_t headers[MAX_HEADERS];
-    size_t headers_count = ARRAY_SIZE(headers);
     str_t method, path;
     int minor_version;
-    int offset = phr_parse_request(buf, n, (const char **)&method.data, &method.len, (const char **)&path.data,
-                                   &path.len, &minor_version, headers, &headers_count, 0);
-    if(offset < 0) {
-        log_error("parse request fd=%d failed - %s", conn->io.fd, buf);
-        conn_free(conn);
-        return;
+    int offset = phr_parse_request(buf, len, (const char **)&method.data, &method.len, (const char **)&path.data,
+                                   &path.len, &minor_version, headers, &headers_count, conn->last_len);
+    if(offset == -2) {
+        if(len >= HEADER_BUF_SIZE) {
+            log_error("header too large fd=%d len=%u", conn->io.fd, len);
+            return -1;
+        }
+        conn->last_len = len;
+        return 0;
+    } else if(offset < 0) {
+        log_error("parse request fd=%d failed - %.*s", conn->io.fd, (int)len, buf);
+        return -1;
     }
-    conn->method = http_str_method(method.data);
+    conn->last_len = 0;
 
     uint32_t content_len = 0;
+    const phr_header_t *header = http_find_header(headers, headers_count, "Content-Length");
+    if(header && http_parse_uint32(header, &content_len) != HTTP_PARSE_ERR_OK) {
+        return -1;
+    }
+    if(content_len > IN_BUF_MAX_SIZE - (uint32_t)offset) {
+        log_error("content_len too large fd=%d len=%u", conn->io.fd, content_len);
+        return -1;
+    }
+    if(len < offset + content_len) {
+        // Header is parsed again once the body is received //
+        conn->hdr_len = offset;
+        conn->content_len = content_len;
+        return 0;
+    }
+    conn->hdr_len = 0;
+    conn->content_len = 0;
+
+    method.data[method.len] = '\0';
+    path.data[path.len] = '\0';
+    req->method = http_str_method(method.data);
+    req->path = path.data;
+    req->body.data = buf + offset;
+    req->body.len = content_len;
+    req->headers = headers;
+    req->headers_count = headers_count;
+
+    req->content_type = SHTTP_CONTENT_TYPE_MAX;
     http_enum_t content_type_enum = {
-        .pval = &conn->content_type,
+        .pval = &req->content_type,
         .enums = content_type_str,
         .enums_count = ARRAY_SIZE(content_type_str),
     };
     http_header_item_t items[] = {
-        { "Content-Length", http_parse_int32, &content_len },
         { "Content-Type", http_parse_enum, &content_type_enum },
     };
     if(http_parse_headers(headers, headers_count, items, ARRAY_SIZE(items)) != HTTP_PARSE_ERR_OK) {
-        conn_free(conn);
-        return;
+        return -1;
     }
+    if(content_len > 0 && req->content_type == SHTTP_CONTENT_TYPE_MAX) {
+        log_error("invalid Content-Type fd=%d", conn->io.fd);
+        return -1;
+    }
+    return offset + content_len;
+}
 
-    if(content_len > 0) {
-        uint32_t path_offset = BODY_BUF_SIZE - (path.len + 1);
-        if(content_len >= path_offset) {
-            log_error("content_len too large fd=%d len=%u", conn->io.fd, content_len);
-            conn_free(conn);
-            return;
+/**
+ * @brief Dispatch all complete requests from the input buffer in order
+ * @note Processing stops while a response is pending, so responses keep the request order
+ */
+static void conn_process(shttp_conn_t *conn)
+{
+    conn->in_process = true;
+    while(conn->resp_pending == false && conn->close == false) {
+        phr_header_t headers[MAX_HEADERS];
+        shttp_param_t params[MAX_PARAMS];
+        shttp_req_t req = {
+            .conn = conn,
+            .params = params,
+            .params_count = ARRAY_SIZE(params),
+        };
+        int req_len = conn_parse_req(conn, &req, headers, ARRAY_SIZE(headers));
+        if(req_len < 0) {
+            conn->close = true;
+            break;
+        } else if(req_len == 0) {
+            break;
         }
-        if(conn->content_type == SHTTP_CONTENT_TYPE_MAX) {
-            log_error("invalid Content-Type fd=%d", conn->io.fd);
-            conn_free(conn);
-            return;
+
+        // Next request gets its own header deadline //
+        conn->idle = CONN_IDLE_NONE;
+        conn->resp_pending = true;
+        if(req_hand_call(&req, req_len) != SHTTP_ERR_OK) {
+            conn->close = true;
+            break;
         }
+        conn->in.offset += req_len;
+    }
+    conn->in_process = false;
 
-        n -= offset;
-        if(n != content_len) {
-            conn->body.data = malloc(BODY_BUF_SIZE);
-            if(conn->body.data == NULL) {
-                log_error("malloc body failed");
-                conn_free(conn);
-                return;
-            }
+    if(conn->close) {
+        conn_free(conn);
+        return;
+    }
+    if(conn->resp_pending) {
+        conn_idle_set(conn, CONN_IDLE_NONE);
+#ifdef CONFIG_IO_URING
+        if(conn->recv_armed && conn->recv_cancel == false && conn->in_len - conn->in.offset >= HEADER_BUF_SIZE) {
+            // Stop receiving pipelined requests until the pending response is sent //
+            conn->recv_cancel = uring_cancel(&conn->worker->uring, &conn->recv_op);
+        }
+#else
+        if(conn->io.cb == read_cb) {
+            // Wait for the response before reading the next requests //
+            ev_io_stop(conn->worker->loop, &conn->io);
+        }
+#endif
+        return;
+    }
+    if(conn->in.offset == conn->in_len) {
+        conn->in.offset = 0;
+        conn->in_len = 0;
+        conn_idle_set(conn, CONN_IDLE_KEEPALIVE);
+    } else {
+        conn_idle_set(conn, conn->hdr_len > 0 ? CONN_IDLE_BODY : CONN_IDLE_HEADER);
+    }
+#ifdef CONFIG_IO_URING
+    if(conn_recv_arm(conn) == false) {
+        conn_free(conn);
+    }
+#else
+    if(ev_is_active(&conn->io) == false) {
+        conn_io_set(conn, read_cb, EV_READ);
+    }
+#endif
+}
 
-            memcpy(conn->body.data, buf + offset, n);
-            conn->body.size = content_len;
-            conn->body.offset = n;
-            conn->io.cb = read_body_cb;
+static bool conn_in_reserve(shttp_conn_t *conn)
+{
+    if(conn->in.offset > 0) {
+        // Move the unprocessed tail to the start of the buffer //
+        uint32_t len = conn->in_len - conn->in.offset;
+        memmove(conn->in.data, conn->in.data + conn->in.offset, len);
+        conn->in.offset = 0;
+        conn->in_len = len;
+    }
+    if(conn->in_len < conn->in.size) {
+        return true;
+    }
 
-            memcpy(conn->body.data + path_offset, path.data, path.len);
-            return;
-        }
+    // Move to the next size class, keep a spare byte for the terminating zero //
+    uint32_t size = conn->in.size + 2;
+    if(conn->hdr_len > 0 && size < conn->hdr_len + conn->content_len + 1) {
+        size = conn->hdr_len + conn->content_len + 1;
+    }
+    if(size > IN_BUF_MAX_SIZE + 1) {
+        log_error("request too large fd=%d", conn->io.fd);
+        return false;
     }
+    shttp_worker_t *worker = conn->worker;
+    char *data = pool_buf_get(&worker->buf_pool, size, &size);
+    if(data == NULL) {
+        log_error("pool_buf_get(%u) failed", size);
+        return false;
+    }
+    if(conn->in.data) {
+        memcpy(data, conn->in.data, conn->in_len);
+        pool_buf_put(&worker->buf_pool, conn->in.data, conn->in.size + 1);
+    }
+    conn->in.data = data;
+    conn->in.size = size - 1;
+    return true;
+}
 
-    method.data[method.len] = '\0';
-    path.data[path.len] = '\0';
+static void read_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
+{
+    shttp_conn_t *conn = container_of(io, shttp_conn_t, io);
+    if((events & EV_READ) == 0) {
+        log_error("unexpected events=%d fd=%d", events, io->fd);
+        conn_free(conn);
+        return;
+    }
 
-    shttp_req_t req = {
-        .conn = conn,
-        .path = path.data,
-        .body.data = buf + offset,
-        .body.len = content_len,
-        .method = conn->method,
-        .content_type = conn->content_type,
-    };
-    if(req_hand_call(&req) != SHTTP_ERR_OK) {
+    if(conn_in_reserve(conn) == false) {
+        conn_free(conn);
+        return;
+    }
+    ssize_t n = read(io->fd, conn->in.data + conn->in_len, conn->in.size - conn->in_len);
+    if(n <= 0) {
+        if(n < 0) {
+            log_error("read fd=%d failed - %s", io->fd, strerror(errno));
+        }
         conn_free(conn);
         return;
     }
+    conn->in_len += n;
+    conn->in.data[conn->in_len] = '\0';
+
+    conn_process(conn);
 }
 
-static void accept_cb(struct ev_loop *loop, ev_io *io, int events)
+#ifdef CONFIG_IO_URING
+static bool conn_in_copy(shttp_conn_t *conn, const char *data, uint32_t len)
 {
-    shttp_t *shttp = io->data;
-    if((events & EV_READ) == 0) {
-        log_error("unexpected events=%d", events);
+    while(len > 0) {
+        if(conn_in_reserve(conn) == false) {
+            return false;
+        }
+        uint32_t n = conn->in.size - conn->in_len;
+        n = (n < len) ? n : len;
+        memcpy(conn->in.data + conn->in_len, data, n);
+        conn->in_len += n;
+        data += n;
+        len -= n;
+    }
+    conn->in.data[conn->in_len] = '\0';
+    return true;
+}
+
+static void conn_recv_cb(uring_op_t *op, int res, uint32_t flags)
+{
+    shttp_conn_t *conn = container_of(op, shttp_conn_t, recv_op);
+    shttp_worker_t *worker = conn->worker;
+    if((flags & IORING_CQE_F_MORE) == 0) {
+        conn->recv_armed = false;
+        conn->recv_cancel = false;
+    }
+    if(conn->closing) {
+        if(flags & IORING_CQE_F_BUFFER) {
+            uring_buf_put(&worker->bufs, flags);
+        }
+        conn_closing_done(conn);
         return;
     }
 
-    while(true) {
-        int fd = accept(io->fd, NULL, NULL);
-        if(fd < 0) {
-            if(errno == EAGAIN || errno == EWOULDBLOCK) {
-                break;
+    if(res <= 0) {
+        if(res == -ENOBUFS || res == -ECANCELED) {
+            // Buffers ran out or receive is paused, a paused receive is armed again by conn_process //
+            if(conn->resp_pending == false && conn_recv_arm(conn) == false) {
+                conn_free(conn);
             }
-            log_error("accept failed");
             return;
         }
-
-        shttp_conn_t *conn = calloc(1, sizeof(shttp_conn_t));
-        if(conn == NULL) {
-            log_error("malloc shttp_conn_t failed");
-            close(fd);
-            return;
+        if(res < 0) {
+            log_error("recv fd=%d failed - %s", conn->io.fd, strerror(-res));
         }
-        LIST_INSERT_HEAD(&shttp->conn_list, conn, entry);
-        conn->io.fd = fd;
-
-        ev_io_init(&conn->io, read_header_cb, conn->io.fd, EV_READ);
-        conn->io.data = shttp;
-        ev_io_start(loop, &conn->io);
+        conn_free(conn);
+        return;
+    }
 
-        log_debug("new fd=%d", conn->io.fd);
+    // Data is copied out, so the buffer goes back to the kernel right away //
+    bool is_ok = conn_in_copy(conn, uring_buf_get(&worker->bufs, flags), res);
+    uring_buf_put(&worker->bufs, flags);
+    if(is_ok == false) {
+        conn_free(conn);
+        return;
     }
+    conn_process(conn);
 }
 
-shttp_err_t shttp_init(const char *sock_path)
+static bool conn_recv_arm(shttp_conn_t *conn)
 {
-    shttp_glob.io.fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if(shttp_glob.io.fd < 0) {
-        log_error("socket create");
-        shttp_destroy();
-        return SHTTP_ERR_SOCKET;
+    shttp_worker_t *worker = conn->worker;
+    if(conn->recv_armed) {
+        return true;
     }
-    unlink(sock_path);
-
-    struct sockaddr_un addr = {
-        .sun_family = AF_UNIX,
-    };
-    strcpy(addr.sun_path, sock_path);
-    if(bind(shttp_glob.io.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        log_error("socket bind %s", sock_path);
-        shttp_destroy();
-        return SHTTP_ERR_SOCKET;
+    conn->recv_op.cb = conn_recv_cb;
+    if(uring_recv_multishot(&worker->uring, &conn->recv_op, conn->io.fd, &worker->bufs) == false) {
+        return false;
     }
+    conn->recv_armed = true;
+    return true;
+}
+#endif
 
-    if(listen(shttp_glob.io.fd, MAX_CONN) < 0) {
-        log_error("socket listen %s", sock_path);
-        shttp_destroy();
-        return SHTTP_ERR_SOCKET;
+static void conn_new(shttp_worker_t *worker, int fd)
+{
+    shttp_conn_t *conn = pool_get(&worker->conn_pool);
+    if(conn == NULL) {
+        log_error("pool_get shttp_conn_t failed");
+        atomic_fetch_sub(&worker->conn_count, 1);
+        conn_total_put(&shttp_glob);
+        close(fd);
+        return;
     }
+    LIST_INSERT_HEAD(&worker->conn_list, conn, entry);
+    conn->worker = worker;
+    conn->file_fd = -1;
+    conn->io.fd = fd;
+    conn_idle_set(conn, CONN_IDLE_HEADER);
 
-    ev_io_init(&shttp_glob.io, accept_cb, shttp_glob.io.fd, EV_READ);
-    shttp_glob.io.data = &shttp_glob;
-    ev_io_start(EV_DEFAULT, &shttp_glob.io);
+    ev_io_init(&conn->io, read_cb, conn->io.fd, EV_READ);
+#ifdef CONFIG_IO_URING
+    if(conn_recv_arm(conn) == false) {
+        conn_free(conn);
+        return;
+    }
+#else
+    ev_io_start(worker->loop, &conn->io);
+#endif
 
-    return SHTTP_ERR_OK;
+    log_debug("new fd=%d", conn->io.fd);
 }
 
-void shttp_destroy(void)
+static void worker_accept_cb(UNUSED struct ev_loop *loop, ev_async *async, UNUSED int events)
 {
-    shttp_conn_t *conn = shttp_glob.conn_list.lh_first;
-    while(conn) {
-        shttp_conn_t *next = conn->entry.le_next;
-        conn_free(conn);
-        conn = next;
-    }
+    shttp_worker_t *worker = container_of(async, shttp_worker_t, accept_async);
+    int fds[WORKER_QUEUE_SIZE];
+    uint32_t count = 0;
 
-    shttp_req_hand_t *hand = shttp_glob.req_hand_list.lh_first;
-    while(hand) {
-        shttp_req_hand_t *next = hand->entry.le_next;
-        shttp_del_req_hand(hand);
-        hand = next;
+    pthread_mutex_lock(&worker->lock);
+    while(worker->fd_count > 0) {
+        fds[count++] = worker->fd_queue[worker->fd_head];
+        worker->fd_head = (worker->fd_head + 1) % WORKER_QUEUE_SIZE;
+        worker->fd_count--;
     }
+    pthread_mutex_unlock(&worker->lock);
 
-    ev_io_stop(EV_DEFAULT, &shttp_glob.io);
-    if(shttp_glob.io.fd >= 0) {
-        close(shttp_glob.io.fd);
-        shttp_glob.io.fd = -1;
+    for(uint32_t i = 0; i < count; i++) {
+        conn_new(worker, fds[i]);
     }
 }
 
-shttp_req_hand_t *shttp_add_req_hand(const char *path, shttp_req_cb_t cb)
+static void worker_stop_cb(struct ev_loop *loop, UNUSED ev_async *async, UNUSED int events)
 {
-    size_t len = strlen(path);
-    shttp_req_hand_t *hand = malloc(sizeof(shttp_req_hand_t) + len + 1);
-    if(hand == NULL) {
-        log_error("malloc shttp_req_hand_t failed");
-        return NULL;
+    ev_break(loop, EVBREAK_ALL);
+}
+
+static void *worker_thread(void *arg)
+{
+    shttp_worker_t *worker = arg;
+    ev_run(worker->loop, 0);
+    return NULL;
+}
+
+static shttp_worker_t *worker_pick(shttp_t *shttp)
+{
+    shttp_worker_t *best = &shttp->workers[0];
+    uint32_t best_count = atomic_load(&best->conn_count);
+    for(uint32_t i = 1; i < shttp->workers_count; i++) {
+        shttp_worker_t *worker = &shttp->workers[i];
+        uint32_t count = atomic_load(&worker->conn_count);
+        if(count < best_count) {
+            best = worker;
+            best_count = count;
+        }
     }
+    return best;
+}
 
-    bzero(hand, sizeof(shttp_req_hand_t));
-    LIST_INSERT_HEAD(&shttp_glob.req_hand_list, hand, entry);
-    strcpy(hand->path, path);
-    hand->len = len;
-    hand->func = cb;
+static bool worker_push(shttp_worker_t *worker, int fd)
+{
+    pthread_mutex_lock(&worker->lock);
+    if(worker->fd_count == WORKER_QUEUE_SIZE) {
+        pthread_mutex_unlock(&worker->lock);
+        return false;
+    }
+    uint32_t tail = (worker->fd_head + worker->fd_count) % WORKER_QUEUE_SIZE;
+    worker->fd_queue[tail] = fd;
+    worker->fd_count++;
+    pthread_mutex_unlock(&worker->lock);
 
-    return hand;
+    ev_async_send(worker->loop, &worker->accept_async);
+    return true;
 }
 
-void shttp_del_req_hand(shttp_req_hand_t *hand)
+static bool accept_full(shttp_t *shttp)
 {
-    LIST_REMOVE(hand, entry);
-    free(hand);
+    return shttp->max_conn > 0 && atomic_load(&shttp->conn_total) >= shttp->max_conn;
 }
 
-static void write_cb(struct ev_loop *loop, ev_io *io, int events)
+/**
+ * @brief Stop accepting until enough connections are released, new clients wait in the listen backlog meanwhile
+ */
+static void accept_pause(shttp_t *shttp)
 {
-    shttp_conn_t *conn = io->data;
-    if((events & EV_WRITE) == 0) {
-        log_error("unexpected events=%d fd=%d", events, io->fd);
-        conn_free(conn);
+    if(shttp->accept_paused) {
         return;
     }
+    log_warn("connection limit %u reached, accept paused", shttp->max_conn);
+    shttp->accept_paused = true;
+    for(uint32_t i = 0; i < shttp->listen_count; i++) {
+#ifdef CONFIG_IO_URING
+        if(shttp->accept_armed[i]) {
+            uring_cancel(&shttp->uring, &shttp->accept_op[i]);
+        }
+#else
+        ev_io_stop(EV_DEFAULT, &shttp->listen_io[i]);
+#endif
+    }
+}
 
-    ssize_t n = write(io->fd, conn->body.data + conn->body.offset, conn->body.size - conn->body.offset);
-    if(n < 0) {
-        log_error("write fd=%d failed - %s", io->fd, strerror(errno));
-        conn_free(conn);
+static void conn_accept(shttp_t *shttp, int fd)
+{
+    if(accept_full(shttp)) {
+        // Accept completed before the listeners were paused, the socket waits for a free slot //
+        if(shttp->park_count == ACCEPT_PARK_SIZE) {
+            log_warn("connection limit %u reached fd=%d", shttp->max_conn, fd);
+            close(fd);
+            return;
+        }
+        shttp->park_fds[shttp->park_count++] = fd;
         return;
     }
-    conn->body.offset += n;
-
-    if(conn->body.offset == conn->body.size) {
-        log_debug("write fd=%d complete", io->fd);
-        shttp_buf_free(conn);
+    atomic_fetch_add(&shttp->conn_total, 1);
 
-        ev_io_stop(loop, &conn->io);
-        ev_io_init(&conn->io, read_header_cb, io->fd, EV_READ);
-        ev_io_start(loop, &conn->io);
-    } else {
-        log_warn("write fd=%d incomplete %u/%u", conn->io.fd, conn->body.offset, conn->body.size);
+    // Hand the connection over to the least loaded worker //
+    shttp_worker_t *worker = worker_pick(shttp);
+    atomic_fetch_add(&worker->conn_count, 1);
+    if(shttp->threaded == false) {
+        conn_new(worker, fd);
+    } else if(worker_push(worker, fd) == false) {
+        log_error("worker queue full fd=%d", fd);
+        atomic_fetch_sub(&worker->conn_count, 1);
+        conn_total_put(shttp);
+        close(fd);
+    }
+    if(accept_full(shttp)) {
+        accept_pause(shttp);
     }
 }
 
-shttp_err_t shttp_resp(shttp_conn_t *conn, shttp_resp_code_t code, shttp_content_type_t content_type,
-                       shttp_connection_t connection, const str_t *body)
+static void accept_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
 {
-    if(body->len >= BODY_BUF_SIZE) {
-        log_error("resp too large %zu", body->len);
-        shttp_buf_free(conn);
-        return SHTTP_ERR_PARAM;
+    shttp_t *shttp = io->data;
+    if((events & EV_READ) == 0) {
+        log_error("unexpected events=%d", events);
+        return;
     }
-    char hbuf[256];
-    uint32_t hlen =
-            snprintf(hbuf, sizeof(hbuf) - 1,
-                     "HTTP/1.1 %u %s\r\n"
-                     "Content-Type: %s\r\n"
-                     "Content-Length: %zu\r\n"
-                     "Connection: %s\r\n"
-                     "\r\n",
-                     code, resp_code_str(code), content_type_str[content_type], body->len, connection_str[connection]);
-
-    struct iovec iov[2] = {
-        { hbuf, hlen },
-        { body->data, body->len },
-    };
-    ssize_t n = writev(conn->io.fd, iov, ARRAY_SIZE(iov));
-    if(n < 0) {
-        log_error("writev fd=%d failed - %s", conn->io.fd, strerror(errno));
-        conn_free(conn);
-        return SHTTP_ERR_IO;
-    } else if(n < hlen) {
-        log_error("writev fd=%d header incomplete %zd/%u", conn->io.fd, n, hlen);
-        conn_free(conn);
-        return SHTTP_ERR_IO;
-    } else {
-        n -= hlen;
-        if((size_t)n != body->len) {
-            log_warn("writev fd=%d body incomplete %zd/%zu", conn->io.fd, n, body->len);
 
-            if(conn->body.data == NULL) {
-                conn->body.data = malloc(BODY_BUF_SIZE);
-                if(conn->body.data == NULL) {
-                    log_error("malloc body failed");
-                    conn_free(conn);
-                    return SHTTP_ERR_MEM_ALLOC;
-                }
+    while(shttp->accept_paused == false) {
+        int fd = accept4(io->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
             }
+            log_error("accept failed - %s", strerror(errno));
+            return;
+        }
+        conn_accept(shttp, fd);
+    }
+}
 
-            size_t len = body->len - n;
-            memcpy(conn->body.data, body->data + n, len);
-            conn->body.size = len;
-            conn->body.offset = 0;
+#ifdef CONFIG_IO_URING
+static bool listen_accept_arm(shttp_t *shttp, uint32_t idx);
 
-            ev_io_stop(EV_DEFAULT, &conn->io);
-            ev_io_init(&conn->io, write_cb, conn->io.fd, EV_WRITE);
-            ev_io_start(EV_DEFAULT, &conn->io);
-            return SHTTP_ERR_OK;
+static void uring_accept_cb(uring_op_t *op, int res, uint32_t flags)
+{
+    shttp_t *shttp = &shttp_glob;
+    uint32_t idx = op - shttp->accept_op;
+    if(res >= 0) {
+        conn_accept(shttp, res);
+    } else if(res != -EINTR && res != -ECONNABORTED && res != -ECANCELED) {
+        log_error("accept failed - %s", strerror(-res));
+    }
+    if((flags & IORING_CQE_F_MORE) == 0) {
+        shttp->accept_armed[idx] = false;
+        if(shttp->accept_paused == false) {
+            listen_accept_arm(shttp, idx);
         }
     }
+}
 
-    conn->io.cb = read_header_cb;
-    shttp_buf_free(conn);
-    return SHTTP_ERR_OK;
+static bool listen_accept_arm(shttp_t *shttp, uint32_t idx)
+{
+    uring_op_t *op = &shttp->accept_op[idx];
+    op->cb = uring_accept_cb;
+    if(uring_accept_multishot(&shttp->uring, op, shttp->listen_io[idx].fd) == false) {
+        return false;
+    }
+    shttp->accept_armed[idx] = true;
+    return true;
 }
+#endif
 
-void shttp_buf_free(shttp_conn_t *conn)
+static void accept_resume_cb(UNUSED struct ev_loop *loop, ev_async *async, UNUSED int events)
 {
-    free(conn->body.data);
+    shttp_t *shttp = container_of(async, shttp_t, resume_async);
+    if(shttp->accept_paused == false || accept_full(shttp)) {
+        return;
+    }
+    while(shttp->park_count > 0 && accept_full(shttp) == false) {
+        int fd = shttp->park_fds[0];
+        shttp->park_count--;
+        memmove(shttp->park_fds, shttp->park_fds + 1, shttp->park_count * sizeof(int));
+        conn_accept(shttp, fd);
+    }
+    if(accept_full(shttp)) {
+        return;
+    }
+    log_info("accept resumed conn=%u", atomic_load(&shttp->conn_total));
+    shttp->accept_paused = false;
+    for(uint32_t i = 0; i < shttp->listen_count; i++) {
+#ifdef CONFIG_IO_URING
+        if(shttp->accept_armed[i] == false && listen_accept_arm(shttp, i) == false) {
+            log_error("accept arm failed");
+        }
+#else
+        ev_io_start(EV_DEFAULT, &shttp->listen_io[i]);
+#endif
+    }
+}
+
+static shttp_err_t worker_init(shttp_worker_t *worker, bool threaded)
+{
+    LIST_INIT(&worker->conn_list);
+    atomic_init(&worker->conn_count, 0);
+    pool_init(&worker->conn_pool, sizeof(shttp_conn_t), MAX_CONN);
+    pool_buf_init(&worker->buf_pool);
+    if(pthread_mutex_init(&worker->lock, NULL) != 0) {
+        log_error("worker mutex init failed");
+        return SHTTP_ERR_THREAD;
+    }
+    worker->loop = threaded ? ev_loop_new(EVFLAG_AUTO) : EV_DEFAULT;
+    if(worker->loop == NULL) {
+        log_error("worker loop create failed");
+        return SHTTP_ERR_THREAD;
+    }
+    ev_async_init(&worker->accept_async, worker_accept_cb);
+    ev_async_init(&worker->stop_async, worker_stop_cb);
+    ev_async_init(&worker->job_async, job_done_cb);
+    twheel_init(&worker->wheel, worker->loop);
+    LIST_INIT(&worker->closing_list);
+    STAILQ_INIT(&worker->job_done);
+#ifdef CONFIG_IO_URING
+    if(uring_init(&worker->uring, worker->loop, URING_ENTRIES) != URING_ERR_OK ||
+       uring_buf_ring_init(&worker->uring, &worker->bufs, 0, URING_BUF_COUNT, URING_BUF_SIZE) != URING_ERR_OK) {
+        return SHTTP_ERR_IO;
+    }
+#endif
+    return SHTTP_ERR_OK;
+}
+
+static shttp_err_t worker_start(shttp_worker_t *worker, const shttp_t *shttp)
+{
+    ev_async_start(worker->loop, &worker->job_async);
+    if(shttp->threaded == false) {
+        return SHTTP_ERR_OK;
+    }
+    ev_async_start(worker->loop, &worker->accept_async);
+    ev_async_start(worker->loop, &worker->stop_async);
+    if(pthread_create(&worker->thread, NULL, worker_thread, worker) != 0) {
+        log_error("worker thread create failed");
+        return SHTTP_ERR_THREAD;
+    }
+    worker->is_running = true;
+    return SHTTP_ERR_OK;
+}
+
+static void worker_destroy(shttp_worker_t *worker, bool threaded)
+{
+    if(worker->is_running) {
+        ev_async_send(worker->loop, &worker->stop_async);
+        pthread_join(worker->thread, NULL);
+        worker->is_running = false;
+    }
+    while(worker->fd_count > 0) {
+        close(worker->fd_queue[worker->fd_head]);
+        worker->fd_head = (worker->fd_head + 1) % WORKER_QUEUE_SIZE;
+        worker->fd_count--;
+    }
+    // Pool is stopped before the workers, so every job is back in the done queue //
+    while(!STAILQ_EMPTY(&worker->job_done)) {
+        shttp_job_t *job = STAILQ_FIRST(&worker->job_done);
+        STAILQ_REMOVE_HEAD(&worker->job_done, entry);
+        job->conn->job_busy = false;
+        job_free(job);
+    }
+    while(!LIST_EMPTY(&worker->conn_list)) {
+        conn_free(LIST_FIRST(&worker->conn_list));
+    }
+    if(worker->loop) {
+#ifdef CONFIG_IO_URING
+        // Closing the ring cancels the remaining operations, so the buffers can be released afterwards //
+        uring_buf_ring_destroy(&worker->uring, &worker->bufs);
+        uring_destroy(&worker->uring);
+#endif
+        while(!LIST_EMPTY(&worker->closing_list)) {
+            shttp_conn_t *conn = LIST_FIRST(&worker->closing_list);
+            LIST_REMOVE(conn, entry);
+            conn_release(conn);
+        }
+        ev_async_stop(worker->loop, &worker->accept_async);
+        ev_async_stop(worker->loop, &worker->stop_async);
+        ev_async_stop(worker->loop, &worker->job_async);
+        twheel_destroy(&worker->wheel);
+        if(threaded) {
+            ev_loop_destroy(worker->loop);
+        }
+        worker->loop = NULL;
+    }
+    pthread_mutex_destroy(&worker->lock);
+    pool_buf_destroy(&worker->buf_pool);
+    pool_destroy(&worker->conn_pool);
+}
+
+static shttp_err_t listen_add(shttp_t *shttp, int fd)
+{
+    if(shttp->listen_count == MAX_LISTENERS) {
+        log_error("too many listeners %u", MAX_LISTENERS);
+        close(fd);
+        return SHTTP_ERR_PARAM;
+    }
+    ev_io *io = &shttp->listen_io[shttp->listen_count++];
+    ev_io_init(io, accept_cb, fd, EV_READ);
+    io->data = shttp;
+    return SHTTP_ERR_OK;
+}
+
+static shttp_err_t listen_unix(shttp_t *shttp, const char *path, int backlog)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        log_error("socket create");
+        return SHTTP_ERR_SOCKET;
+    }
+    shttp_err_t res = listen_add(shttp, fd);
+    if(res != SHTTP_ERR_OK) {
+        return res;
+    }
+    unlink(path);
+
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_error("socket bind %s", path);
+        return SHTTP_ERR_SOCKET;
+    }
+
+    if(listen(fd, backlog) < 0) {
+        log_error("socket listen %s", path);
+        return SHTTP_ERR_SOCKET;
+    }
+    log_info("listen unix %s", path);
+    return SHTTP_ERR_OK;
+}
+
+/**
+ * @brief Parse "ipv4:port" or "[ipv6]:port" address
+ */
+static bool tcp_addr_parse(const char *str, uint32_t len, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    const char *port = memrchr(str, ':', len);
+    char host[INET6_ADDRSTRLEN + 2];
+    if(port == NULL || (size_t)(port - str) >= sizeof(host)) {
+        return false;
+    }
+    uint32_t host_len = port - str;
+    memcpy(host, str, host_len);
+    host[host_len] = '\0';
+
+    char *end = NULL;
+    unsigned long port_num = strtoul(port + 1, &end, 10);
+    if(end != str + len || port_num == 0 || port_num > UINT16_MAX) {
+        return false;
+    }
+
+    bzero(addr, sizeof(struct sockaddr_storage));
+    if(host_len > 2 && host[0] == '[' && host[host_len - 1] == ']') {
+        struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)addr;
+        host[host_len - 1] = '\0';
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(port_num);
+        *addr_len = sizeof(struct sockaddr_in6);
+        return inet_pton(AF_INET6, host + 1, &addr6->sin6_addr) == 1;
+    }
+    struct sockaddr_in *addr4 = (struct sockaddr_in *)addr;
+    addr4->sin_family = AF_INET;
+    addr4->sin_port = htons(port_num);
+    *addr_len = sizeof(struct sockaddr_in);
+    return inet_pton(AF_INET, host, &addr4->sin_addr) == 1;
+}
+
+static bool tcp_sock_opt(int fd, int level, int name, int value)
+{
+    if(setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        log_error("setsockopt(%d, %d) failed - %s", level, name, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static shttp_err_t listen_tcp(shttp_t *shttp, const char *str, uint32_t len, int backlog)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if(tcp_addr_parse(str, len, &addr, &addr_len) == false) {
+        log_error("invalid listen address %.*s", (int)len, str);
+        return SHTTP_ERR_PARAM;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        log_error("socket create %.*s", (int)len, str);
+        return SHTTP_ERR_SOCKET;
+    }
+    shttp_err_t res = listen_add(shttp, fd);
+    if(res != SHTTP_ERR_OK) {
+        return res;
+    }
+
+    // SO_REUSEPORT lets several server processes share the port, the kernel balances connections between them //
+    // Accepted sockets inherit TCP_NODELAY, TCP_DEFER_ACCEPT wakes accept only once the request data arrives //
+    if(tcp_sock_opt(fd, SOL_SOCKET, SO_REUSEADDR, 1) == false ||
+       tcp_sock_opt(fd, SOL_SOCKET, SO_REUSEPORT, 1) == false ||
+       tcp_sock_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1) == false ||
+       tcp_sock_opt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, TCP_DEFER_SEC) == false) {
+        return SHTTP_ERR_SOCKET;
+    }
+    if(addr.ss_family == AF_INET6 && tcp_sock_opt(fd, IPPROTO_IPV6, IPV6_V6ONLY, 1) == false) {
+        return SHTTP_ERR_SOCKET;
+    }
+
+    if(bind(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+        log_error("socket bind %.*s - %s", (int)len, str, strerror(errno));
+        return SHTTP_ERR_SOCKET;
+    }
+    if(listen(fd, backlog) < 0) {
+        log_error("socket listen %.*s - %s", (int)len, str, strerror(errno));
+        return SHTTP_ERR_SOCKET;
+    }
+    log_info("listen tcp %.*s", (int)len, str);
+    return SHTTP_ERR_OK;
+}
+
+static shttp_err_t listen_tcp_list(shttp_t *shttp, const char *list, int backlog)
+{
+    while(*list != '\0') {
+        uint32_t len = strcspn(list, ",");
+        if(len > 0) {
+            shttp_err_t res = listen_tcp(shttp, list, len, backlog);
+            if(res != SHTTP_ERR_OK) {
+                return res;
+            }
+        }
+        list += len;
+        if(*list == ',') {
+            list++;
+        }
+    }
+    return SHTTP_ERR_OK;
+}
+
+shttp_err_t shttp_init(const shttp_cfg_t *cfg)
+{
+    if(cfg->workers > MAX_WORKERS) {
+        log_error("too many workers %u/%u", cfg->workers, MAX_WORKERS);
+        return SHTTP_ERR_PARAM;
+    }
+    if(tpool_init(&shttp_glob.pool, cfg->pool_threads, JOB_QUEUE_SIZE) != TPOOL_ERR_OK) {
+        return SHTTP_ERR_THREAD;
+    }
+    shttp_glob.idle_sec[CONN_IDLE_HEADER] = cfg->header_sec;
+    shttp_glob.idle_sec[CONN_IDLE_BODY] = cfg->body_sec;
+    shttp_glob.idle_sec[CONN_IDLE_KEEPALIVE] = cfg->keepalive_sec;
+    shttp_glob.max_conn = cfg->max_conn;
+    atomic_init(&shttp_glob.conn_total, 0);
+    ev_async_init(&shttp_glob.resume_async, accept_resume_cb);
+    shttp_glob.threaded = cfg->workers > 0;
+    shttp_glob.workers_count = shttp_glob.threaded ? cfg->workers : 1;
+    shttp_glob.workers = calloc(shttp_glob.workers_count, sizeof(shttp_worker_t));
+    if(shttp_glob.workers == NULL) {
+        log_error("calloc workers[%u] failed", shttp_glob.workers_count);
+        return SHTTP_ERR_MEM_ALLOC;
+    }
+    for(uint32_t i = 0; i < shttp_glob.workers_count; i++) {
+        shttp_err_t res = worker_init(&shttp_glob.workers[i], shttp_glob.threaded);
+        if(res != SHTTP_ERR_OK) {
+            shttp_destroy();
+            return res;
+        }
+    }
+
+    int backlog = cfg->backlog ? (int)cfg->backlog : SOMAXCONN;
+    shttp_err_t res = SHTTP_ERR_OK;
+    if(cfg->sock_path && cfg->sock_path[0] != '\0') {
+        res = listen_unix(&shttp_glob, cfg->sock_path, backlog);
+    }
+    if(res == SHTTP_ERR_OK && cfg->listen) {
+        res = listen_tcp_list(&shttp_glob, cfg->listen, backlog);
+    }
+    if(res == SHTTP_ERR_OK && shttp_glob.listen_count == 0) {
+        log_error("no listen address");
+        res = SHTTP_ERR_PARAM;
+    }
+#ifdef CONFIG_IO_URING
+    if(res == SHTTP_ERR_OK && uring_init(&shttp_glob.uring, EV_DEFAULT, MAX_LISTENERS) != URING_ERR_OK) {
+        res = SHTTP_ERR_IO;
+    }
+#endif
+    if(res != SHTTP_ERR_OK) {
+        shttp_destroy();
+        return res;
+    }
+    return SHTTP_ERR_OK;
+}
+
+STATIC_ASSERT(POOL_BUF_CLASS_COUNT == 3);
+static void stat_timer_cb(UNUSED struct ev_loop *loop, UNUSED ev_timer *timer, UNUSED int events)
+{
+    shttp_stat_t stat;
+    shttp_get_stat(&stat);
+    log_info("pool hits/misses conn=%" PRIu64 "/%" PRIu64 " buf=%" PRIu64 "/%" PRIu64 ",%" PRIu64 "/%" PRIu64
+             ",%" PRIu64 "/%" PRIu64,
+             stat.conn_pool.hits, stat.conn_pool.misses, stat.buf_pool[0].hits, stat.buf_pool[0].misses,
+             stat.buf_pool[1].hits, stat.buf_pool[1].misses, stat.buf_pool[2].hits, stat.buf_pool[2].misses);
+}
+
+shttp_err_t shttp_start(void)
+{
+    shttp_req_hand_t *hand;
+    LIST_FOREACH(hand, &shttp_glob.req_hand_list, entry)
+    {
+        if(http_router_add(&shttp_glob.router, hand->method, hand->path, hand) != HTTP_ROUTER_ERR_OK) {
+            return SHTTP_ERR_PARAM;
+        }
+    }
+    http_router_build(&shttp_glob.router);
+    ev_async_start(EV_DEFAULT, &shttp_glob.resume_async);
+
+    for(uint32_t i = 0; i < shttp_glob.workers_count; i++) {
+        shttp_err_t res = worker_start(&shttp_glob.workers[i], &shttp_glob);
+        if(res != SHTTP_ERR_OK) {
+            return res;
+        }
+    }
+    for(uint32_t i = 0; i < shttp_glob.listen_count; i++) {
+#ifdef CONFIG_IO_URING
+        if(listen_accept_arm(&shttp_glob, i) == false) {
+            return SHTTP_ERR_IO;
+        }
+#else
+        ev_io_start(EV_DEFAULT, &shttp_glob.listen_io[i]);
+#endif
+    }
+    ev_timer_init(&shttp_glob.stat_timer, stat_timer_cb, STAT_LOG_SEC, STAT_LOG_SEC);
+    ev_timer_start(EV_DEFAULT, &shttp_glob.stat_timer);
+    // Timer must not keep the loop running on exit //
+    ev_unref(EV_DEFAULT);
+    log_info("started workers=%u threaded=%u pool=%u", shttp_glob.workers_count, shttp_glob.threaded,
+             shttp_glob.pool.threads_count);
+    return SHTTP_ERR_OK;
+}
+
+void shttp_get_stat(shttp_stat_t *stat)
+{
+    bzero(stat, sizeof(shttp_stat_t));
+    for(uint32_t i = 0; i < shttp_glob.workers_count; i++) {
+        const shttp_worker_t *worker = &shttp_glob.workers[i];
+        pool_stat_add(&stat->conn_pool, &worker->conn_pool.stat);
+        for(uint32_t j = 0; j < POOL_BUF_CLASS_COUNT; j++) {
+            pool_stat_add(&stat->buf_pool[j], &worker->buf_pool.classes[j].stat);
+        }
+    }
+}
+
+void shttp_destroy(void)
+{
+    // Running jobs post their results to the worker loops, so the pool is joined first //
+    tpool_destroy(&shttp_glob.pool);
+    ev_async_stop(EV_DEFAULT, &shttp_glob.resume_async);
+    if(ev_is_active(&shttp_glob.stat_timer)) {
+        ev_ref(EV_DEFAULT);
+        ev_timer_stop(EV_DEFAULT, &shttp_glob.stat_timer);
+    }
+    for(uint32_t i = 0; i < shttp_glob.park_count; i++) {
+        close(shttp_glob.park_fds[i]);
+    }
+    shttp_glob.park_count = 0;
+#ifdef CONFIG_IO_URING
+    uring_destroy(&shttp_glob.uring);
+#endif
+    for(uint32_t i = 0; i < shttp_glob.listen_count; i++) {
+        ev_io_stop(EV_DEFAULT, &shttp_glob.listen_io[i]);
+        close(shttp_glob.listen_io[i].fd);
+    }
+    shttp_glob.listen_count = 0;
+
+    if(shttp_glob.workers) {
+        for(uint32_t i = 0; i < shttp_glob.workers_count; i++) {
+            worker_destroy(&shttp_glob.workers[i], shttp_glob.threaded);
+        }
+        free(shttp_glob.workers);
+        shttp_glob.workers = NULL;
+    }
+
+    http_router_destroy(&shttp_glob.router);
+    shttp_req_hand_t *hand = shttp_glob.req_hand_list.lh_first;
+    while(hand) {
+        shttp_req_hand_t *next = hand->entry.le_next;
+        shttp_del_req_hand(hand);
+        hand = next;
+    }
+}
+
+shttp_req_hand_t *shttp_add_req_hand(shttp_method_t method, const char *path, shttp_req_cb_t cb)
+{
+    size_t len = strlen(path);
+    shttp_req_hand_t *hand = malloc(sizeof(shttp_req_hand_t) + len + 1);
+    if(hand == NULL) {
+        log_error("malloc shttp_req_hand_t failed");
+        return NULL;
+    }
+
+    bzero(hand, sizeof(shttp_req_hand_t));
+    LIST_INSERT_HEAD(&shttp_glob.req_hand_list, hand, entry);
+    strcpy(hand->path, path);
+    hand->method = method;
+    hand->func = cb;
+
+    return hand;
+}
+
+const str_t *shttp_req_param(const shttp_req_t *req, const char *name)
+{
+    for(uint32_t i = 0; i < req->params_count; i++) {
+        const shttp_param_t *param = &req->params[i];
+        if(strncmp(param->name.data, name, param->name.len) == 0 && name[param->name.len] == '\0') {
+            return &param->value;
+        }
+    }
+    return NULL;
+}
+
+void shttp_req_hand_set_blocking(shttp_req_hand_t *hand)
+{
+    hand->blocking = true;
+}
+
+void shttp_del_req_hand(shttp_req_hand_t *hand)
+{
+    LIST_REMOVE(hand, entry);
+    free(hand);
+}
+
+static void conn_resp_done(shttp_conn_t *conn)
+{
+    conn->resp_pending = false;
+    if(conn->in_process == false) {
+        conn_process(conn);
+    }
+}
+
+/**
+ * @brief Send the pending file data
+ * @return 1 when all data is sent, 0 when the socket is full, -1 on error
+ */
+static int conn_send_file(shttp_conn_t *conn)
+{
+    while(conn->file_len > 0) {
+        ssize_t n = sendfile(conn->io.fd, conn->file_fd, &conn->file_offset, conn->file_len);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            log_error("sendfile fd=%d failed - %s", conn->io.fd, strerror(errno));
+            return -1;
+        } else if(n == 0) {
+            log_error("sendfile fd=%d file truncated", conn->io.fd);
+            return -1;
+        }
+        conn->file_len -= n;
+    }
+    close(conn->file_fd);
+    conn->file_fd = -1;
+    return 1;
+}
+
+/**
+ * @brief Ask the stream producer for the next chunks
+ * @return true when the producer buffered data, finished the stream or went idle, false on error
+ */
+static bool conn_stream_next(shttp_conn_t *conn)
+{
+    if(conn->stream_pool && conn_job_stream(conn)) {
+        // Output is started again once the job is back, the stream waits meanwhile //
+        conn->stream_idle = true;
+        return true;
+    }
+    if(conn->stream_cb(conn, conn->stream_priv) != SHTTP_ERR_OK) {
+        log_error("stream fd=%d failed", conn->io.fd);
+        return false;
+    }
+    // Producer without data keeps the response open until it calls shttp_resp_resume //
+    conn->stream_idle = (conn->body.size == 0 && conn->stream_end == false);
+    return true;
+}
+
+static void write_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
+{
+    shttp_conn_t *conn = container_of(io, shttp_conn_t, io);
+    if((events & EV_WRITE) == 0) {
+        log_error("unexpected events=%d fd=%d", events, io->fd);
+        conn_free(conn);
+        return;
+    }
+
+    while(conn->body.offset < conn->body.size) {
+        ssize_t n = write(io->fd, conn->body.data + conn->body.offset, conn->body.size - conn->body.offset);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            log_error("write fd=%d failed - %s", io->fd, strerror(errno));
+            conn_free(conn);
+            return;
+        }
+        conn->body.offset += n;
+        if(conn->body.offset < conn->body.size) {
+            log_debug("write fd=%d incomplete %u/%u", conn->io.fd, conn->body.offset, conn->body.size);
+            return;
+        }
+
+        if(conn->stream_cb == NULL) {
+            shttp_buf_free(conn);
+            break;
+        }
+        // Next chunks are produced only after the previous ones are sent, so the socket drives the producer //
+        conn->body.offset = 0;
+        conn->body.size = 0;
+        if(conn->stream_end == false && conn_stream_next(conn) == false) {
+            conn_free(conn);
+            return;
+        }
+        if(conn->stream_idle) {
+            // Hangup is still noticed while the producer waits, so a closed stream does not linger //
+            log_debug("stream fd=%d idle", io->fd);
+            conn_io_set(conn, read_cb, EV_READ);
+            return;
+        }
+    }
+
+    if(conn->file_fd >= 0) {
+        int res = conn_send_file(conn);
+        if(res < 0) {
+            conn_free(conn);
+            return;
+        } else if(res == 0) {
+            return;
+        }
+    }
+
+    log_debug("write fd=%d complete", io->fd);
+    conn_stream_free(conn);
+    shttp_buf_free(conn);
+    ev_io_stop(conn->worker->loop, &conn->io);
+    conn_resp_done(conn);
+}
+
+static bool job_out_reserve(shttp_job_t *job, uint32_t len)
+{
+    if(job->out.offset + len <= job->out.size) {
+        return true;
+    }
+    uint32_t size = job->out.size ? job->out.size : JOB_OUT_SIZE;
+    while(size < job->out.offset + len) {
+        size *= 2;
+    }
+    char *data = realloc(job->out.data, size);
+    if(data == NULL) {
+        log_error("realloc job out %u failed", size);
+        return false;
+    }
+    job->out.data = data;
+    job->out.size = size;
+    return true;
+}
+
+/**
+ * @brief Make room for len more bytes of the pending output after the unsent data
+ */
+static bool conn_body_reserve(shttp_conn_t *conn, uint32_t len)
+{
+    if(job_cur) {
+        return job_out_reserve(job_cur, len);
+    }
+    if(conn->body.offset > 0) {
+        uint32_t size = conn->body.size - conn->body.offset;
+        memmove(conn->body.data, conn->body.data + conn->body.offset, size);
+        conn->body.offset = 0;
+        conn->body.size = size;
+    }
+    if(conn->body.size + len <= conn->body_cap) {
+        return true;
+    }
+
+    uint32_t cap;
+    char *data = pool_buf_get(&conn->worker->buf_pool, conn->body.size + len, &cap);
+    if(data == NULL) {
+        log_error("pool_buf_get(%u) failed", conn->body.size + len);
+        return false;
+    }
+    if(conn->body.data) {
+        memcpy(data, conn->body.data, conn->body.size);
+        pool_buf_put(&conn->worker->buf_pool, conn->body.data, conn->body_cap);
+    }
+    conn->body.data = data;
+    conn->body_cap = cap;
+    return true;
+}
+
+static void conn_body_append(shttp_conn_t *conn, const void *data, uint32_t len)
+{
+    if(job_cur) {
+        memcpy(job_cur->out.data + job_cur->out.offset, data, len);
+        job_cur->out.offset += len;
+        return;
+    }
+    memcpy(conn->body.data + conn->body.size, data, len);
+    conn->body.size += len;
+}
+
+static shttp_err_t conn_resp_fail(shttp_conn_t *conn, shttp_err_t err)
+{
+    if(job_cur) {
+        // Connection is freed by the loop once the failed job is back //
+        return err;
+    }
+    if(conn->in_process) {
+        conn->close = true;
+    } else {
+        conn_free(conn);
+    }
+    return err;
+}
+
+#ifdef CONFIG_IO_URING
+static void conn_send_cb(uring_op_t *op, int res, uint32_t flags);
+
+/**
+ * @brief Submit the unsent responce data, produce the next stream chunks or finish the response
+ * @return false on error, the caller frees the connection
+ */
+static bool conn_send_next(shttp_conn_t *conn)
+{
+    if(conn->body.data && conn->body.offset == conn->body.size) {
+        if(conn->stream_cb == NULL) {
+            shttp_buf_free(conn);
+        } else {
+            // Next chunks are produced only after the previous ones are sent, so the socket drives the producer //
+            conn->body.offset = 0;
+            conn->body.size = 0;
+            if(conn->stream_end == false && conn_stream_next(conn) == false) {
+                return false;
+            }
+            if(conn->stream_idle) {
+                log_debug("stream fd=%d idle", conn->io.fd);
+                return true;
+            }
+        }
+    }
+    if(conn->body.offset < conn->body.size) {
+        conn->send_op.cb = conn_send_cb;
+        if(uring_send(&conn->worker->uring, &conn->send_op, conn->io.fd, conn->body.data + conn->body.offset,
+                      conn->body.size - conn->body.offset) == false) {
+            return false;
+        }
+        conn->send_busy = true;
+        return true;
+    }
+
+    if(conn->file_fd >= 0) {
+        // File data goes through sendfile, the remainder is finished by write_cb //
+        int res = conn_send_file(conn);
+        if(res < 0) {
+            return false;
+        } else if(res == 0) {
+            conn_io_set(conn, write_cb, EV_WRITE);
+            return true;
+        }
+    }
+
+    log_debug("send fd=%d complete", conn->io.fd);
+    conn_stream_free(conn);
+    shttp_buf_free(conn);
+    conn_resp_done(conn);
+    return true;
+}
+
+static void conn_send_cb(uring_op_t *op, int res, UNUSED uint32_t flags)
+{
+    shttp_conn_t *conn = container_of(op, shttp_conn_t, send_op);
+    conn->send_busy = false;
+    if(conn->closing) {
+        conn_closing_done(conn);
+        return;
+    }
+    if(res < 0) {
+        log_error("send fd=%d failed - %s", conn->io.fd, strerror(-res));
+        conn_free(conn);
+        return;
+    }
+    conn->body.offset += res;
+    if(conn_send_next(conn) == false) {
+        conn_free(conn);
+    }
+}
+#endif
+
+/**
+ * @brief Start sending the buffered response
+ */
+static shttp_err_t conn_out_start(shttp_conn_t *conn)
+{
+#ifdef CONFIG_IO_URING
+    if(conn_send_next(conn) == false) {
+        return conn_resp_fail(conn, SHTTP_ERR_IO);
+    }
+#else
+    conn_io_set(conn, write_cb, EV_WRITE);
+#endif
+    return SHTTP_ERR_OK;
+}
+
+/**
+ * @brief Send the response header, body and file, the unsent remainder is finished by write_cb
+ */
+static shttp_err_t job_send(shttp_job_t *job, const char *hbuf, uint32_t hlen, const str_t *body, int fd,
+                            size_t size);
+
+static shttp_err_t conn_send(shttp_conn_t *conn, const char *hbuf, uint32_t hlen, const str_t *body, int fd,
+                             size_t size)
+{
+    if(job_cur) {
+        return job_send(job_cur, hbuf, hlen, body, fd, size);
+    }
+#ifdef CONFIG_IO_URING
+    // Ring sends asynchronously, so the header and body are always copied into the responce buffer //
+    if(conn_body_reserve(conn, hlen + body->len) == false) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return conn_resp_fail(conn, SHTTP_ERR_MEM_ALLOC);
+    }
+    conn->body.offset = 0;
+    conn->body.size = 0;
+    conn_body_append(conn, hbuf, hlen);
+    if(body->len > 0) {
+        conn_body_append(conn, body->data, body->len);
+    }
+    if(fd >= 0) {
+        conn->file_fd = fd;
+        conn->file_offset = 0;
+        conn->file_len = size;
+    }
+    return conn_out_start(conn);
+#else
+    struct iovec iov[2] = {
+        { (char *)hbuf, hlen },
+        { body->data, body->len },
+    };
+    size_t tot_len = hlen + body->len;
+    ssize_t n = writev(conn->io.fd, iov, ARRAY_SIZE(iov));
+    if(n < 0) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            log_error("writev fd=%d failed - %s", conn->io.fd, strerror(errno));
+            if(fd >= 0) {
+                close(fd);
+            }
+            return conn_resp_fail(conn, SHTTP_ERR_IO);
+        }
+        n = 0;
+    }
+
+    if((size_t)n < tot_len) {
+        log_warn("writev fd=%d incomplete %zd/%zu", conn->io.fd, n, tot_len);
+
+        size_t len = tot_len - n;
+        if(conn->body_cap < len) {
+            shttp_buf_free(conn);
+            conn->body.data = pool_buf_get(&conn->worker->buf_pool, len, &conn->body_cap);
+            if(conn->body.data == NULL) {
+                log_error("pool_buf_get(%zu) failed", len);
+                if(fd >= 0) {
+                    close(fd);
+                }
+                return conn_resp_fail(conn, SHTTP_ERR_MEM_ALLOC);
+            }
+        }
+        if((size_t)n < hlen) {
+            memcpy(conn->body.data, hbuf + n, hlen - n);
+            memcpy(conn->body.data + hlen - n, body->data, body->len);
+        } else {
+            memcpy(conn->body.data, body->data + (n - hlen), len);
+        }
+        conn->body.size = len;
+        conn->body.offset = 0;
+    } else {
+        shttp_buf_free(conn);
+    }
+
+    if(fd >= 0) {
+        conn->file_fd = fd;
+        conn->file_offset = 0;
+        conn->file_len = size;
+        if(conn->body.data == NULL) {
+            int res = conn_send_file(conn);
+            if(res < 0) {
+                return conn_resp_fail(conn, SHTTP_ERR_IO);
+            }
+        }
+    }
+
+    if(conn->body.data || conn->file_fd >= 0) {
+        return conn_out_start(conn);
+    }
+    conn_resp_done(conn);
+    return SHTTP_ERR_OK;
+#endif
+}
+
+static shttp_err_t job_send(shttp_job_t *job, const char *hbuf, uint32_t hlen, const str_t *body, int fd,
+                            size_t size)
+{
+    if(job_out_reserve(job, hlen + body->len) == false) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return SHTTP_ERR_MEM_ALLOC;
+    }
+    memcpy(job->out.data + job->out.offset, hbuf, hlen);
+    job->out.offset += hlen;
+    if(body->len > 0) {
+        memcpy(job->out.data + job->out.offset, body->data, body->len);
+        job->out.offset += body->len;
+    }
+    job->file_fd = fd;
+    job->file_len = size;
+    job->resp = true;
+    return SHTTP_ERR_OK;
+}
+
+static void job_run_cb(tpool_job_t *tjob)
+{
+    shttp_job_t *job = container_of(tjob, shttp_job_t, job);
+    job_cur = job;
+    if(job->hand) {
+        job->res = job->hand->func(&job->req);
+    } else {
+        job->res = job->stream_cb(job->conn, job->stream_priv);
+    }
+    job_cur = NULL;
+
+    shttp_worker_t *worker = job->conn->worker;
+    pthread_mutex_lock(&worker->lock);
+    STAILQ_INSERT_TAIL(&worker->job_done, job, entry);
+    pthread_mutex_unlock(&worker->lock);
+    ev_async_send(worker->loop, &worker->job_async);
+}
+
+static shttp_job_t *job_new(shttp_conn_t *conn, uint32_t data_len)
+{
+    shttp_job_t *job = malloc(sizeof(shttp_job_t) + data_len);
+    if(job == NULL) {
+        log_error("malloc shttp_job_t failed");
+        return NULL;
+    }
+    bzero(job, sizeof(shttp_job_t));
+    job->conn = conn;
+    job->file_fd = -1;
+    return job;
+}
+
+static const char *job_rebase(const shttp_job_t *job, const char *src, const char *ptr)
+{
+    return ptr ? job->data + (ptr - src) : NULL;
+}
+
+/**
+ * @brief Queue the blocking handler, the request is copied so the input buffer keeps moving
+ */
+static shttp_err_t conn_job_req(const shttp_req_t *req, const shttp_req_hand_t *hand, uint32_t req_len)
+{
+    shttp_conn_t *conn = req->conn;
+    shttp_job_t *job = job_new(conn, req_len + 1);
+    if(job == NULL) {
+        return SHTTP_ERR_MEM_ALLOC;
+    }
+    const char *src = conn->in.data + conn->in.offset;
+    memcpy(job->data, src, req_len);
+    job->data[req_len] = '\0';
+
+    job->hand = hand;
+    job->req = *req;
+    job->req.path = job_rebase(job, src, req->path);
+    job->req.body.data = (char *)job_rebase(job, src, req->body.data);
+    job->req.headers = job->headers;
+    for(uint32_t i = 0; i < req->headers_count; i++) {
+        const phr_header_t *header = &req->headers[i];
+        job->headers[i] = *header;
+        job->headers[i].name = job_rebase(job, src, header->name);
+        job->headers[i].value = job_rebase(job, src, header->value);
+    }
+    // Parameter names point to the route pattern, only the values are in the request //
+    job->req.params = job->params;
+    for(uint32_t i = 0; i < req->params_count; i++) {
+        job->params[i] = req->params[i];
+        job->params[i].value.data = (char *)job_rebase(job, src, req->params[i].value.data);
+    }
+
+    if(tpool_push(&shttp_glob.pool, &job->job, job_run_cb) != TPOOL_ERR_OK) {
+        log_warn("job queue full path=%s", req->path);
+        job_free(job);
+        str_t body = STR("Server busy");
+        return shttp_resp(conn, SHTTP_RESP_CODE_503_SERVICE_UNAVAILABLE, SHTTP_CONTENT_TYPE_TEXT,
+                          SHTTP_CONNECTION_DEFAULT, &body);
+    }
+    conn->job_busy = true;
+    return SHTTP_ERR_OK;
+}
+
+/**
+ * @brief Queue the stream producer of the connection
+ * @return false if the queue is full, the producer is called on the loop then
+ */
+static bool conn_job_stream(shttp_conn_t *conn)
+{
+    shttp_job_t *job = job_new(conn, 0);
+    if(job == NULL) {
+        return false;
+    }
+    job->stream_cb = conn->stream_cb;
+    job->stream_priv = conn->stream_priv;
+    if(tpool_push(&shttp_glob.pool, &job->job, job_run_cb) != TPOOL_ERR_OK) {
+        job_free(job);
+        return false;
+    }
+    conn->job_busy = true;
+    return true;
+}
+
+/**
+ * @brief Move the output of the finished job to the connection and start sending it
+ */
+static void conn_job_done(shttp_job_t *job)
+{
+    shttp_conn_t *conn = job->conn;
+    conn->job_busy = false;
+    if(conn->closing) {
+        job_free(job);
+        conn_closing_done(conn);
+        return;
+    }
+    if(job->res != SHTTP_ERR_OK || (job->hand && job->resp == false)) {
+        log_error("job fd=%d failed", conn->io.fd);
+        job_free(job);
+        conn_free(conn);
+        return;
+    }
+
+    if(job->hand) {
+        if(job->stream_cb) {
+            conn->stream_cb = job->stream_cb;
+            conn->stream_free = job->stream_free;
+            conn->stream_priv = job->stream_priv;
+            conn->stream_pool = true;
+            job->stream_free = NULL;
+        }
+        if(job->file_fd >= 0) {
+            conn->file_fd = job->file_fd;
+            conn->file_offset = 0;
+            conn->file_len = job->file_len;
+            job->file_fd = -1;
+        }
+    }
+    conn->stream_end |= job->stream_end;
+    if(job->out.offset > 0) {
+        if(conn_body_reserve(conn, job->out.offset) == false) {
+            job_free(job);
+            conn_free(conn);
+            return;
+        }
+        conn_body_append(conn, job->out.data, job->out.offset);
+    }
+    job_free(job);
+
+    // Producer without data keeps the response open until it calls shttp_resp_resume //
+    conn->stream_idle = (conn->stream_cb && conn->body.size == 0 && conn->stream_end == false);
+    if(conn->stream_idle == false) {
+        conn_out_start(conn);
+    }
+}
+
+static void job_done_cb(UNUSED struct ev_loop *loop, ev_async *async, UNUSED int events)
+{
+    shttp_worker_t *worker = container_of(async, shttp_worker_t, job_async);
+    struct shttp_job_list done = STAILQ_HEAD_INITIALIZER(done);
+
+    pthread_mutex_lock(&worker->lock);
+    STAILQ_CONCAT(&done, &worker->job_done);
+    pthread_mutex_unlock(&worker->lock);
+
+    while(!STAILQ_EMPTY(&done)) {
+        shttp_job_t *job = STAILQ_FIRST(&done);
+        STAILQ_REMOVE_HEAD(&done, entry);
+        conn_job_done(job);
+    }
+}
+
+static uint32_t resp_header(char *buf, uint32_t size, shttp_resp_code_t code, shttp_content_type_t content_type,
+                            shttp_connection_t connection, const char *headers, size_t content_len)
+{
+    char len_buf[64];
+    if(content_len == RESP_CHUNKED) {
+        strcpy(len_buf, "Transfer-Encoding: chunked");
+    } else {
+        snprintf(len_buf, sizeof(len_buf), "Content-Length: %zu", content_len);
+    }
+    int len = snprintf(buf, size,
+                       "HTTP/1.1 %u %s\r\n"
+                       "Content-Type: %s\r\n"
+                       "%s\r\n"
+                       "Connection: %s\r\n"
+                       "%s"
+                       "\r\n",
+                       code, resp_code_str(code), content_type_str[content_type], len_buf,
+                       connection_str[connection], headers ? headers : "");
+    if(len < 0 || (uint32_t)len >= size) {
+        log_error("resp header too large");
+        return 0;
+    }
+    return len;
+}
+
+shttp_err_t shttp_resp(shttp_conn_t *conn, shttp_resp_code_t code, shttp_content_type_t content_type,
+                       shttp_connection_t connection, const str_t *body)
+{
+    char hbuf[256];
+    uint32_t hlen = resp_header(hbuf, sizeof(hbuf), code, content_type, connection, NULL, body->len);
+    if(hlen == 0 || hlen + body->len > BODY_BUF_SIZE) {
+        log_error("resp too large %zu", body->len);
+        shttp_buf_free(conn);
+        return SHTTP_ERR_PARAM;
+    }
+    return conn_send(conn, hbuf, hlen, body, -1, 0);
+}
+
+shttp_err_t shttp_resp_file(shttp_conn_t *conn, shttp_resp_code_t code, shttp_content_type_t content_type,
+                            shttp_connection_t connection, const char *headers, int fd, size_t size)
+{
+    char hbuf[1024];
+    uint32_t hlen = resp_header(hbuf, sizeof(hbuf), code, content_type, connection, headers, fd >= 0 ? size : 0);
+    if(hlen == 0) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return SHTTP_ERR_PARAM;
+    }
+    str_t body = {};
+    return conn_send(conn, hbuf, hlen, &body, fd, size);
+}
+
+shttp_err_t shttp_resp_begin(shttp_conn_t *conn, shttp_resp_code_t code, shttp_content_type_t content_type,
+                             shttp_connection_t connection, const char *headers, shttp_stream_cb_t cb,
+                             shttp_stream_free_cb_t free_cb, void *priv_data)
+{
+    char hbuf[1024];
+    uint32_t hlen = resp_header(hbuf, sizeof(hbuf), code, content_type, connection, headers, RESP_CHUNKED);
+    if(hlen == 0 || conn_body_reserve(conn, hlen) == false) {
+        if(free_cb) {
+            free_cb(priv_data);
+        }
+        return conn_resp_fail(conn, SHTTP_ERR_MEM_ALLOC);
+    }
+    if(job_cur) {
+        conn_body_append(conn, hbuf, hlen);
+        job_cur->stream_cb = cb;
+        job_cur->stream_free = free_cb;
+        job_cur->stream_priv = priv_data;
+        job_cur->resp = true;
+        return SHTTP_ERR_OK;
+    }
+    conn->body.offset = 0;
+    conn->body.size = 0;
+    conn_body_append(conn, hbuf, hlen);
+
+    conn->stream_cb = cb;
+    conn->stream_free = free_cb;
+    conn->stream_priv = priv_data;
+    conn->stream_end = false;
+    conn->stream_idle = false;
+    return conn_out_start(conn);
+}
+
+struct ev_loop *shttp_conn_loop(const shttp_conn_t *conn)
+{
+    return conn->worker->loop;
+}
+
+shttp_err_t shttp_resp_resume(shttp_conn_t *conn)
+{
+    if(conn->stream_idle == false || conn->job_busy) {
+        // Output is in flight, the producer is called again once it is sent //
+        return SHTTP_ERR_OK;
+    }
+    if(conn_stream_next(conn) == false) {
+        conn_free(conn);
+        return SHTTP_ERR_IO;
+    }
+    if(conn->stream_idle) {
+        return SHTTP_ERR_OK;
+    }
+    return conn_out_start(conn);
+}
+
+shttp_err_t shttp_resp_chunk(shttp_conn_t *conn, const str_t *data)
+{
+    // Zero length chunk terminates the body, so empty data is skipped //
+    if(data->len == 0) {
+        return SHTTP_ERR_OK;
+    }
+    if(data->len > BODY_BUF_SIZE / 2) {
+        log_error("chunk too large %zu", data->len);
+        return SHTTP_ERR_PARAM;
+    }
+    char hbuf[16];
+    uint32_t hlen = snprintf(hbuf, sizeof(hbuf), "%zx\r\n", data->len);
+    if(conn_body_reserve(conn, hlen + data->len + 2) == false) {
+        return SHTTP_ERR_MEM_ALLOC;
+    }
+    conn_body_append(conn, hbuf, hlen);
+    conn_body_append(conn, data->data, data->len);
+    conn_body_append(conn, "\r\n", 2);
+    return SHTTP_ERR_OK;
+}
+
+shttp_err_t shttp_resp_end(shttp_conn_t *conn)
+{
+    static const char last_chunk[] = "0\r\n\r\n";
+    if(conn_body_reserve(conn, sizeof(last_chunk) - 1) == false) {
+        return SHTTP_ERR_MEM_ALLOC;
+    }
+    conn_body_append(conn, last_chunk, sizeof(last_chunk) - 1);
+    if(job_cur) {
+        job_cur->stream_end = true;
+    } else {
+        conn->stream_end = true;
+    }
+    return SHTTP_ERR_OK;
+}
+
+void shttp_buf_free(shttp_conn_t *conn)
+{
+    if(job_cur) {
+        // Handler on a pool thread owns no connection buffer //
+        return;
+    }
+    pool_buf_put(&conn->worker->buf_pool, conn->body.data, conn->body_cap);
     conn->body.data = NULL;
+    conn->body.offset = 0;
+    conn->body.size = 0;
+    conn->body_cap = 0;
 }
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <core/base/pool.h>
 #include <core/base/str.h>
+#include <core/http/http-parser.h>
+#include <ev.h>
 
 /**
  * @brief Enumeration of HTTP server error codes
@@ -12,6 +15,7 @@ typedef enum {
     SHTTP_ERR_PARAM,      ///< Invalid parameter
     SHTTP_ERR_MEM_ALLOC,  ///< Memory allocation failed
     SHTTP_ERR_NO_HANDLER, ///< No handler found for the request
+    SHTTP_ERR_THREAD,     ///< Worker thread error
     SHTTP_ERR_MAX,
 } shttp_err_t;
 
@@ -19,10 +23,12 @@ typedef enum {
  * @brief Enumeration of HTTP server response codes
  */
 typedef enum {
-    SHTTP_RESP_CODE_200_OK = 200,           ///< 200 OK
-    SHTTP_RESP_CODE_400_BAD_REQUEST = 400,  ///< 400 Bad Request
-    SHTTP_RESP_CODE_404_NOT_FOUND = 404,    ///< 404 Not Found
-    SHTTP_RESP_CODE_500_SERVER_ERROR = 500, ///< 500 Internal Server Error
+    SHTTP_RESP_CODE_200_OK = 200,                  ///< 200 OK
+    SHTTP_RESP_CODE_304_NOT_MODIFIED = 304,        ///< 304 Not Modified
+    SHTTP_RESP_CODE_400_BAD_REQUEST = 400,         ///< 400 Bad Request
+    SHTTP_RESP_CODE_404_NOT_FOUND = 404,           ///< 404 Not Found
+    SHTTP_RESP_CODE_500_SERVER_ERROR = 500,        ///< 500 Internal Server Error
+    SHTTP_RESP_CODE_503_SERVICE_UNAVAILABLE = 503, ///< 503 Service Unavailable
     SHTTP_RESP_CODE_MAX,
 } shttp_resp_code_t;
 
@@ -30,8 +36,17 @@ typedef enum {
  * @brief Enumeration of HTTP server content types
  */
 typedef enum {
-    SHTTP_CONTENT_TYPE_HTML, ///< text/html
-    SHTTP_CONTENT_TYPE_JSON, ///< application/json
+    SHTTP_CONTENT_TYPE_HTML,         ///< text/html
+    SHTTP_CONTENT_TYPE_JSON,         ///< application/json
+    SHTTP_CONTENT_TYPE_CSS,          ///< text/css
+    SHTTP_CONTENT_TYPE_JS,           ///< text/javascript
+    SHTTP_CONTENT_TYPE_WASM,         ///< application/wasm
+    SHTTP_CONTENT_TYPE_SVG,          ///< image/svg+xml
+    SHTTP_CONTENT_TYPE_PNG,          ///< image/png
+    SHTTP_CONTENT_TYPE_ICON,         ///< image/x-icon
+    SHTTP_CONTENT_TYPE_TEXT,         ///< text/plain
+    SHTTP_CONTENT_TYPE_BINARY,       ///< application/octet-stream
+    SHTTP_CONTENT_TYPE_EVENT_STREAM, ///< text/event-stream
     SHTTP_CONTENT_TYPE_MAX,
 } shttp_content_type_t;
 
@@ -64,6 +79,14 @@ typedef struct shttp_conn shttp_conn_t;
  */
 typedef struct shttp_req_hand shttp_req_hand_t;
 
+/**
+ * @brief Structure to represent a path parameter captured by the router
+ */
+typedef struct {
+    str_t name;  ///< Parameter name from the route pattern
+    str_t value; ///< Parameter value from the request path
+} shttp_param_t;
+
 /**
  * @brief Structure to represent an HTTP server request
  */
@@ -73,39 +96,113 @@ typedef struct {
     str_t body;                        ///< Request body
     shttp_method_t method;             ///< HTTP method
     shttp_content_type_t content_type; ///< HTTP content type
+    shttp_param_t *params;             ///< Path parameters captured by the router
+    uint32_t params_count;             ///< Number of path parameters
+    const phr_header_t *headers;       ///< Request headers
+    uint32_t headers_count;            ///< Number of request headers
 } shttp_req_t;
 
+/**
+ * @brief Structure to represent the HTTP server statistics
+ */
+typedef struct {
+    pool_stat_t conn_pool;                      ///< Connection pool counters
+    pool_stat_t buf_pool[POOL_BUF_CLASS_COUNT]; ///< Buffer pool counters per size class
+} shttp_stat_t;
+
+/**
+ * @brief Structure to represent the HTTP server configuration
+ */
+typedef struct {
+    const char *sock_path;  ///< Path to the UNIX socket, NULL or empty to listen on TCP only
+    const char *listen;     ///< Comma-separated TCP addresses "ipv4:port" or "[ipv6]:port", NULL for none
+    uint32_t backlog;       ///< Listen backlog of every socket, 0 for SOMAXCONN
+    uint32_t workers;       ///< Number of worker threads, 0 to serve all connections on the default loop
+    uint32_t pool_threads;  ///< Number of threads running the blocking handlers, 0 to run them on the loop
+    uint32_t max_conn;      ///< Accepting is paused while this many connections are open, 0 for no limit
+    uint32_t header_sec;    ///< Time to receive the request header, 0 for no limit
+    uint32_t body_sec;      ///< Idle time between parts of the request body, 0 for no limit
+    uint32_t keepalive_sec; ///< Idle time of a keep-alive connection between requests, 0 for no limit
+} shttp_cfg_t;
+
 /**
  * @brief Callback function type for handling HTTP server requests
+ * @note In worker mode the callback runs on the worker thread which owns the connection
  * @param req - [in] Pointer to the HTTP server request structure
  * @return SHTTP_ERR_OK on success, error code otherwise
  */
 typedef shttp_err_t (*shttp_req_cb_t)(const shttp_req_t *req);
 
+/**
+ * @brief Callback function type for producing the next chunks of a streamed response
+ * @note Called each time the previously produced chunks are sent, must add chunks or end the stream
+ * @param conn - [in] Pointer to the HTTP connection
+ * @param priv_data - [in] Private data passed to shttp_resp_begin
+ * @return SHTTP_ERR_OK on success, error code otherwise to close the connection
+ */
+typedef shttp_err_t (*shttp_stream_cb_t)(shttp_conn_t *conn, void *priv_data);
+
+/**
+ * @brief Callback function type for freeing the stream private data
+ * @param priv_data - [in] Private data passed to shttp_resp_begin
+ */
+typedef void (*shttp_stream_free_cb_t)(void *priv_data);
+
 /**
  * @brief Initialize the HTTP server
- * @param sock_path - [in] Path to the UNIX socket
+ * @param cfg - [in] Pointer to the HTTP server configuration
  * @return SHTTP_ERR_OK on success, error code otherwise
  */
-shttp_err_t shttp_init(const char *sock_path);
+shttp_err_t shttp_init(const shttp_cfg_t *cfg);
+
+/**
+ * @brief Start accepting connections, request handlers must be added before this call
+ * @return SHTTP_ERR_OK on success, error code otherwise
+ */
+shttp_err_t shttp_start(void);
+
+/**
+ * @brief Get the HTTP server pool counters summed over all workers
+ * @param stat - [out] Pointer to the statistics structure
+ * @note Counters of running workers are read with relaxed atomics, so the sums are approximate.
+ *       They are also logged every 10 minutes.
+ */
+void shttp_get_stat(shttp_stat_t *stat);
 
 /**
  * @brief Destroy the HTTP server
- * @param shttp - [in] Pointer to the HTTP server structure
  */
 void shttp_destroy(void);
 
 /**
- * @brief Add an HTTP request handler
- * @param path - [in] Request path
+ * @brief Add an HTTP request handler, see http_router_t for the path pattern syntax
+ * @param method - [in] HTTP method to match, SHTTP_METHOD_MAX to match any method
+ * @param path - [in] Request path pattern
  * @param cb - [in] Request callback function
  * @return Pointer to the HTTP request handler structure
  */
-shttp_req_hand_t *shttp_add_req_hand(const char *path, shttp_req_cb_t cb);
+shttp_req_hand_t *shttp_add_req_hand(shttp_method_t method, const char *path, shttp_req_cb_t cb);
+
+/**
+ * @brief Mark the HTTP request handler as blocking, so it runs on a pool thread instead of the connection loop
+ * @param hand - [in] Pointer to the HTTP request handler structure
+ * @note The handler and its stream callback must send or begin the response before returning, and must not
+ *       touch the loop state. Requests are answered with 503 while the pool queue is full.
+ */
+void shttp_req_hand_set_blocking(shttp_req_hand_t *hand);
+
+/**
+ * @brief Get a path parameter of the request by name
+ * @param req - [in] Pointer to the HTTP server request
+ * @param name - [in] Parameter name as written in the route pattern
+ * @return Pointer to the parameter value, or NULL if not found
+ */
+const str_t *shttp_req_param(const shttp_req_t *req, const char *name);
 
 /**
  * @brief Delete an HTTP request handler
  * @param hand - [in] Pointer to the HTTP request handler structure
+ * @note Routes are compiled in shttp_start, so handlers must not be deleted while the server is running
  */
 void shttp_del_req_hand(shttp_req_hand_t *hand);
 
@@ -121,6 +218,72 @@ void shttp_del_req_hand(shttp_req_hand_t *hand);
 shttp_err_t shttp_resp(shttp_conn_t *conn, shttp_resp_code_t code, shttp_content_type_t content_type,
                        shttp_connection_t connection, const str_t *body);
 
+/**
+ * @brief Send an HTTP response with the body taken from a file using sendfile
+ * @param conn - [in] Pointer to the HTTP connection
+ * @param code - [in] HTTP response code
+ * @param content_type - [in] HTTP content type
+ * @param connection - [in] HTTP connection type
+ * @param headers - [in] Extra header lines, each terminated by "\r\n", may be NULL
+ * @param fd - [in] File descriptor of the body, owned and closed by the server, -1 for no body
+ * @param size - [in] Number of bytes to send from the start of the file
+ * @return SHTTP_ERR_OK on success, error code otherwise
+ */
+shttp_err_t shttp_resp_file(shttp_conn_t *conn, shttp_resp_code_t code, shttp_content_type_t content_type,
+                            shttp_connection_t connection, const char *headers, int fd, size_t size);
+
+/**
+ * @brief Start a streamed HTTP response with chunked transfer encoding
+ *
+ * The body is pulled from the callback chunk by chunk: it is called again only once the previous
+ * chunks are written to the socket, so a slow client holds back the producer instead of the memory.
+ * A callback which adds nothing leaves the response open until shttp_resp_resume is called.
+ *
+ * @param conn - [in] Pointer to the HTTP connection
+ * @param code - [in] HTTP response code
+ * @param content_type - [in] HTTP content type
+ * @param connection - [in] HTTP connection type
+ * @param headers - [in] Extra header lines, each terminated by "\r\n", may be NULL
+ * @param cb - [in] Callback to produce the body chunks with shttp_resp_chunk and shttp_resp_end
+ * @param free_cb - [in] Callback to free the private data when the stream is finished or aborted, may be NULL
+ * @param priv_data - [in] Private data for the callbacks
+ * @return SHTTP_ERR_OK on success, error code otherwise
+ */
+shttp_err_t shttp_resp_begin(shttp_conn_t *conn, shttp_resp_code_t code, shttp_content_type_t content_type,
+                             shttp_connection_t connection, const char *headers, shttp_stream_cb_t cb,
+                             shttp_stream_free_cb_t free_cb, void *priv_data);
+
+/**
+ * @brief Call the idle stream producer again once it has new data
+ * @param conn - [in] Pointer to the HTTP connection
+ * @return SHTTP_ERR_OK on success, error code otherwise and the connection is closed
+ * @note Must be called from the thread running the connection loop, does nothing while output is in flight
+ */
+shttp_err_t shttp_resp_resume(shttp_conn_t *conn);
+
+/**
+ * @brief Get the event loop which serves the HTTP connection
+ * @param conn - [in] Pointer to the HTTP connection
+ * @return Pointer to the loop of the worker owning the connection, the default loop if workers are disabled
+ * @note Watchers of the loop must be started from the thread running it, e.g. from the request callback
+ */
+struct ev_loop *shttp_conn_loop(const shttp_conn_t *conn);
+
+/**
+ * @brief Add a chunk to the streamed HTTP response, must be called from the stream callback
+ * @param conn - [in] Pointer to the HTTP connection
+ * @param data - [in] Pointer to the chunk data, empty data is ignored
+ * @return SHTTP_ERR_OK on success, error code otherwise
+ */
+shttp_err_t shttp_resp_chunk(shttp_conn_t *conn, const str_t *data);
+
+/**
+ * @brief Finish the streamed HTTP response, must be called from the stream callback
+ * @param conn - [in] Pointer to the HTTP connection
+ * @return SHTTP_ERR_OK on success, error code otherwise
+ */
+shttp_err_t shttp_resp_end(shttp_conn_t *conn);
+
 /**
  * @brief Free the HTTP connection buffer
  * @param conn - [in] Pointer to the HTTP connection
@@ -0,0 +1,367 @@
+#include <core/http/http-static.h>
+#include <core/http/http-ext.h>
+#include <core/base/log.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define STATIC_CACHE_SIZE 256
+#define STATIC_CHECK_SEC  2
+#define STATIC_PATH_MAX   256
+#define STATIC_INDEX      "index.html"
+#define STATIC_DATE_FMT   "%a, %d %b %Y %H:%M:%S GMT"
+
+typedef enum {
+    STATIC_ENC_IDENTITY, ///< Original file
+    STATIC_ENC_GZIP,     ///< Precompressed ".gz" sibling
+    STATIC_ENC_BR,       ///< Precompressed ".br" sibling
+    STATIC_ENC_MAX,
+} static_enc_t;
+
+typedef struct {
+    int fd;        ///< Open file, -1 if the variant does not exist
+    size_t size;   ///< File size
+    time_t mtime;  ///< File modification time
+    ino_t ino;     ///< File inode to detect replaced files
+    char etag[48]; ///< Entity tag of the variant
+} static_file_t;
+
+typedef struct {
+    char path[STATIC_PATH_MAX];          ///< Relative file path, empty if the slot is unused
+    time_t checked;                      ///< Time of the last validation
+    shttp_content_type_t content_type;   ///< Content type by file extension
+    static_file_t files[STATIC_ENC_MAX]; ///< File variants by encoding
+} static_ent_t;
+
+typedef struct {
+    int root_fd;          ///< Root directory
+    pthread_mutex_t lock; ///< Protects the cache, handlers run on all HTTP workers
+    static_ent_t *cache;  ///< Direct mapped cache of open files
+} http_static_t;
+
+static http_static_t static_glob = {
+    .root_fd = -1,
+};
+
+static const struct {
+    const char *ext;                   ///< File extension
+    shttp_content_type_t content_type; ///< Content type of the extension
+} static_types[] = {
+    { ".html", SHTTP_CONTENT_TYPE_HTML }, { ".css", SHTTP_CONTENT_TYPE_CSS },   { ".js", SHTTP_CONTENT_TYPE_JS },
+    { ".wasm", SHTTP_CONTENT_TYPE_WASM }, { ".json", SHTTP_CONTENT_TYPE_JSON }, { ".svg", SHTTP_CONTENT_TYPE_SVG },
+    { ".png", SHTTP_CONTENT_TYPE_PNG },   { ".ico", SHTTP_CONTENT_TYPE_ICON },  { ".txt", SHTTP_CONTENT_TYPE_TEXT },
+};
+
+static const char *enc_ext[] = {
+    [STATIC_ENC_IDENTITY] = "",
+    [STATIC_ENC_GZIP] = ".gz",
+    [STATIC_ENC_BR] = ".br",
+};
+STATIC_ASSERT(ARRAY_SIZE(enc_ext) == STATIC_ENC_MAX);
+static const char *enc_name[] = {
+    [STATIC_ENC_IDENTITY] = "identity",
+    [STATIC_ENC_GZIP] = "gzip",
+    [STATIC_ENC_BR] = "br",
+};
+STATIC_ASSERT(ARRAY_SIZE(enc_name) == STATIC_ENC_MAX);
+
+static uint32_t path_hash(const char *path)
+{
+    uint32_t hash = 2166136261u;
+    while(*path) {
+        hash = (hash ^ (uint8_t)*path++) * 16777619u;
+    }
+    return hash;
+}
+
+static shttp_content_type_t path_content_type(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if(ext) {
+        for(uint32_t i = 0; i < ARRAY_SIZE(static_types); i++) {
+            if(strcmp(ext, static_types[i].ext) == 0) {
+                return static_types[i].content_type;
+            }
+        }
+    }
+    return SHTTP_CONTENT_TYPE_BINARY;
+}
+
+static void ent_close(static_ent_t *ent)
+{
+    for(uint32_t i = 0; i < STATIC_ENC_MAX; i++) {
+        if(ent->files[i].fd >= 0) {
+            close(ent->files[i].fd);
+            ent->files[i].fd = -1;
+        }
+    }
+}
+
+static int root_openat(const char *path)
+{
+    // Neither ".." nor symlinks may resolve outside of the root directory //
+    struct open_how how = {
+        .flags = O_RDONLY | O_CLOEXEC,
+        .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS,
+    };
+    return syscall(__NR_openat2, static_glob.root_fd, path, &how, sizeof(how));
+}
+
+static void file_path(char *enc_path, uint32_t size, const char *path, static_enc_t enc)
+{
+    snprintf(enc_path, size, "%s%s", path, enc_ext[enc]);
+}
+
+static void file_open(static_file_t *file, const char *path, static_enc_t enc)
+{
+    char enc_path[STATIC_PATH_MAX + 8];
+    file_path(enc_path, sizeof(enc_path), path, enc);
+
+    // Missing variants keep a zero inode, so their later creation is detected //
+    file->size = 0;
+    file->mtime = 0;
+    file->ino = 0;
+    file->fd = root_openat(enc_path);
+    if(file->fd < 0) {
+        return;
+    }
+    struct stat st;
+    if(fstat(file->fd, &st) < 0) {
+        close(file->fd);
+        file->fd = -1;
+        return;
+    }
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    file->ino = st.st_ino;
+    if(S_ISREG(st.st_mode) == false) {
+        close(file->fd);
+        file->fd = -1;
+        return;
+    }
+    snprintf(file->etag, sizeof(file->etag), "\"%lx-%lx-%s\"", (unsigned long)file->size,
+             (unsigned long)file->mtime, enc_name[enc]);
+}
+
+static bool ent_load(static_ent_t *ent, const char *path, time_t now)
+{
+    ent_close(ent);
+    strcpy(ent->path, path);
+    ent->checked = now;
+    ent->content_type = path_content_type(path);
+
+    for(uint32_t i = 0; i < STATIC_ENC_MAX; i++) {
+        file_open(&ent->files[i], path, i);
+    }
+    static_file_t *orig = &ent->files[STATIC_ENC_IDENTITY];
+    if(orig->fd < 0) {
+        ent_close(ent);
+        ent->path[0] = '\0';
+        return false;
+    }
+    // Skip precompressed files which are older than the original //
+    for(uint32_t i = STATIC_ENC_IDENTITY + 1; i < STATIC_ENC_MAX; i++) {
+        static_file_t *file = &ent->files[i];
+        if(file->fd >= 0 && file->mtime < orig->mtime) {
+            log_warn("stale %s%s", path, enc_ext[i]);
+            close(file->fd);
+            file->fd = -1;
+        }
+    }
+    return true;
+}
+
+static bool file_is_valid(const static_file_t *file, const char *path, static_enc_t enc)
+{
+    char enc_path[STATIC_PATH_MAX + 8];
+    file_path(enc_path, sizeof(enc_path), path, enc);
+
+    struct stat st;
+    if(fstatat(static_glob.root_fd, enc_path, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+        return file->ino == 0;
+    }
+    return st.st_ino == file->ino && (size_t)st.st_size == file->size && st.st_mtime == file->mtime;
+}
+
+static bool ent_is_valid(static_ent_t *ent, time_t now)
+{
+    if(now - ent->checked < STATIC_CHECK_SEC) {
+        return true;
+    }
+    ent->checked = now;
+
+    // Every variant is checked, a precompressed one may change without the original //
+    for(uint32_t i = 0; i < STATIC_ENC_MAX; i++) {
+        if(file_is_valid(&ent->files[i], ent->path, i) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Convert the request path to a relative file path
+ * @return true on success, false if the path is invalid
+ */
+static bool path_to_file(const char *req_path, char *path, uint32_t size)
+{
+    uint32_t len = strcspn(req_path, "?#");
+    if(len == 0 || req_path[0] != '/') {
+        return false;
+    }
+    req_path++;
+    len--;
+    // Empty segments are rejected, so the file path is never absolute //
+    if((len > 0 && req_path[0] == '/') || memmem(req_path, len, "//", 2) || memmem(req_path, len, "..", 2) ||
+       memchr(req_path, '%', len) || memchr(req_path, '\\', len)) {
+        return false;
+    }
+    const char *index = (len == 0 || req_path[len - 1] == '/') ? STATIC_INDEX : "";
+    int n = snprintf(path, size, "%.*s%s", (int)len, req_path, index);
+    return n > 0 && (uint32_t)n < size;
+}
+
+static bool is_not_modified(const shttp_req_t *req, const static_file_t *file)
+{
+    const phr_header_t *header = http_find_header(req->headers, req->headers_count, "If-None-Match");
+    if(header) {
+        size_t etag_len = strlen(file->etag);
+        return memmem(header->value, header->value_len, file->etag, etag_len) ||
+               (header->value_len == 1 && header->value[0] == '*');
+    }
+
+    header = http_find_header(req->headers, req->headers_count, "If-Modified-Since");
+    if(header) {
+        char date[64];
+        struct tm tm = {};
+        snprintf(date, sizeof(date), "%.*s", (int)header->value_len, header->value);
+        if(strptime(date, STATIC_DATE_FMT, &tm) == NULL) {
+            return false;
+        }
+        return file->mtime <= timegm(&tm);
+    }
+    return false;
+}
+
+static shttp_err_t static_not_found(const shttp_req_t *req)
+{
+    str_t body = {
+        .data = "Not Found",
+        .len = strlen("Not Found"),
+    };
+    return shttp_resp(req->conn, SHTTP_RESP_CODE_404_NOT_FOUND, SHTTP_CONTENT_TYPE_TEXT, SHTTP_CONNECTION_DEFAULT,
+                      &body);
+}
+
+static shttp_err_t static_req_cb(const shttp_req_t *req)
+{
+    char path[STATIC_PATH_MAX];
+    if(path_to_file(req->path, path, sizeof(path)) == false) {
+        log_warn("invalid path %s", req->path);
+        return static_not_found(req);
+    }
+
+    const phr_header_t *accept_enc = http_find_header(req->headers, req->headers_count, "Accept-Encoding");
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&static_glob.lock);
+    static_ent_t *ent = &static_glob.cache[path_hash(path) % STATIC_CACHE_SIZE];
+    bool is_found = strcmp(ent->path, path) == 0 && ent_is_valid(ent, now);
+    if(is_found == false) {
+        is_found = ent_load(ent, path, now);
+    }
+    if(is_found == false) {
+        pthread_mutex_unlock(&static_glob.lock);
+        return static_not_found(req);
+    }
+
+    static_enc_t enc = STATIC_ENC_IDENTITY;
+    if(ent->files[STATIC_ENC_BR].fd >= 0 && http_header_accepts(accept_enc, enc_name[STATIC_ENC_BR])) {
+        enc = STATIC_ENC_BR;
+    } else if(ent->files[STATIC_ENC_GZIP].fd >= 0 && http_header_accepts(accept_enc, enc_name[STATIC_ENC_GZIP])) {
+        enc = STATIC_ENC_GZIP;
+    }
+    static_file_t file = ent->files[enc];
+    shttp_content_type_t content_type = ent->content_type;
+    bool not_modified = is_not_modified(req, &file);
+    // Server closes the response fd, so the cached one is duplicated //
+    int fd = not_modified ? -1 : fcntl(file.fd, F_DUPFD_CLOEXEC, 0);
+    pthread_mutex_unlock(&static_glob.lock);
+
+    if(not_modified == false && fd < 0) {
+        log_error("dup %s failed", path);
+        return SHTTP_ERR_IO;
+    }
+
+    char date[64];
+    struct tm tm;
+    gmtime_r(&file.mtime, &tm);
+    strftime(date, sizeof(date), STATIC_DATE_FMT, &tm);
+
+    char headers[256];
+    snprintf(headers, sizeof(headers),
+             "ETag: %s\r\n"
+             "Last-Modified: %s\r\n"
+             "Cache-Control: no-cache\r\n"
+             "Vary: Accept-Encoding\r\n"
+             "%s%s%s",
+             file.etag, date, enc != STATIC_ENC_IDENTITY ? "Content-Encoding: " : "",
+             enc != STATIC_ENC_IDENTITY ? enc_name[enc] : "", enc != STATIC_ENC_IDENTITY ? "\r\n" : "");
+
+    shttp_resp_code_t code = not_modified ? SHTTP_RESP_CODE_304_NOT_MODIFIED : SHTTP_RESP_CODE_200_OK;
+    return shttp_resp_file(req->conn, code, content_type, SHTTP_CONNECTION_DEFAULT, headers, fd, file.size);
+}
+
+http_static_err_t http_static_init(const char *root)
+{
+    static_glob.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(static_glob.root_fd < 0) {
+        log_error("open %s failed", root);
+        return HTTP_STATIC_ERR_OPEN;
+    }
+
+    static_glob.cache = calloc(STATIC_CACHE_SIZE, sizeof(static_ent_t));
+    if(static_glob.cache == NULL) {
+        log_error("calloc cache[%u] failed", STATIC_CACHE_SIZE);
+        http_static_destroy();
+        return HTTP_STATIC_ERR_MEM_ALLOC;
+    }
+    for(uint32_t i = 0; i < STATIC_CACHE_SIZE; i++) {
+        for(uint32_t j = 0; j < STATIC_ENC_MAX; j++) {
+            static_glob.cache[i].files[j].fd = -1;
+        }
+    }
+    pthread_mutex_init(&static_glob.lock, NULL);
+
+    if(shttp_add_req_hand(SHTTP_METHOD_GET, "/*", static_req_cb) == NULL) {
+        http_static_destroy();
+        return HTTP_STATIC_ERR_HANDLER;
+    }
+    return HTTP_STATIC_ERR_OK;
+}
+
+void http_static_destroy(void)
+{
+    if(static_glob.cache) {
+        for(uint32_t i = 0; i < STATIC_CACHE_SIZE; i++) {
+            ent_close(&static_glob.cache[i]);
+        }
+        free(static_glob.cache);
+        static_glob.cache = NULL;
+        pthread_mutex_destroy(&static_glob.lock);
+    }
+    if(static_glob.root_fd >= 0) {
+        close(static_glob.root_fd);
+        static_glob.root_fd = -1;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <core/http/http-server.h>
+
+/**
+ * @brief Static files error codes
+ */
+typedef enum {
+    HTTP_STATIC_ERR_OK,        ///< No error
+    HTTP_STATIC_ERR_OPEN,      ///< Failed to open the root directory
+    HTTP_STATIC_ERR_MEM_ALLOC, ///< Memory allocation failed
+    HTTP_STATIC_ERR_HANDLER,   ///< Failed to add the request handler
+    HTTP_STATIC_ERR_MAX,
+} http_static_err_t;
+
+/**
+ * @brief Serve static files from the root directory for all GET requests without a more specific route
+ *
+ * Files are sent with sendfile. When the client accepts it, a precompressed ".br" or ".gz" sibling
+ * of the file is sent instead. Open files and their metadata are cached and revalidated every few seconds.
+ *
+ * @param root - [in] Path to the root directory
+ * @return HTTP_STATIC_ERR_OK on success, error code otherwise
+ * @note Must be called between shttp_init and shttp_start
+ */
+http_static_err_t http_static_init(const char *root);
+
+/**
+ * @brief Close all cached files, must be called after shttp_destroy
+ */
+void http_static_destroy(void);
@@ -1,6 +1,9 @@
 #include <core/ipc/ipc-server.h>
 #include <core/ipc/ipc-priv.h>
 #include <core/base/log.h>
+#ifdef CONFIG_IO_URING
+#include <core/base/uring.h>
+#endif
 #include <sys/socket.h>
 #include <sys/queue.h>
 #include <sys/uio.h>
@@ -14,10 +17,32 @@
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
 
 #define MAX_CONN 16
+#ifdef CONFIG_IO_URING
+#define URING_ENTRIES   64
+#define URING_BUF_COUNT 4
+#endif
+
+#ifdef CONFIG_IO_URING
+typedef struct sipc_send {
+    STAILQ_ENTRY(sipc_send) entry;
+    uring_op_t op;
+    sipc_conn_t *conn;
+    uint32_t offset;
+    uint32_t len;
+    char data[];
+} sipc_send_t;
+#endif
 
 typedef struct sipc_conn {
     LIST_ENTRY(sipc_conn) entry;
     ev_io io;
+#ifdef CONFIG_IO_URING
+    STAILQ_HEAD(, sipc_send) send_queue;
+    uring_op_t recv_op;
+    bool recv_armed;
+    bool send_busy;
+    bool closing;
+#endif
 } sipc_conn_t;
 
 typedef LIST_HEAD(sipc_conn_list, sipc_conn) sipc_conn_list_t;
@@ -27,6 +52,12 @@ typedef struct {
     ev_io io;
     char *sock_path;
     sipc_cmd_handler_t *handlers;
+#ifdef CONFIG_IO_URING
+    uring_t uring;
+    uring_buf_ring_t bufs;
+    uring_op_t accept_op;
+    sipc_conn_list_t closing_list;
+#endif
     uint32_t handlers_count;
     uint32_t pad;
     char data[];
@@ -34,35 +65,42 @@ typedef struct {
 
 static sipc_t *sipc_glob = NULL;
 
-static void conn_close(sipc_conn_t *conn)
+static void conn_release(sipc_conn_t *conn)
 {
-    ev_io_stop(EV_DEFAULT, &conn->io);
     close(conn->io.fd);
-    LIST_REMOVE(conn, entry);
+#ifdef CONFIG_IO_URING
+    while(!STAILQ_EMPTY(&conn->send_queue)) {
+        sipc_send_t *send = STAILQ_FIRST(&conn->send_queue);
+        STAILQ_REMOVE_HEAD(&conn->send_queue, entry);
+        free(send);
+    }
+#endif
     free(conn);
 }
 
-static void read_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
+static void conn_close(sipc_conn_t *conn)
 {
-    sipc_conn_t *conn = container_of(io, sipc_conn_t, io);
-    sipc_t *sipc = io->data;
-    if((events & EV_READ) == 0) {
-        log_error("unexpected events=%d", events);
-        return;
-    }
-
-    char buf[IPC_BUF_SIZE];
-    ssize_t n = read(io->fd, buf, sizeof(buf));
-    if(n < 0) {
-        log_error("read(fd=%d) failed - %s", io->fd, strerror(errno));
-        conn_close(conn);
-        return;
-    } else if(n == 0) {
-        log_debug("fd=%d closed by peer", io->fd);
-        conn_close(conn);
+    ev_io_stop(EV_DEFAULT, &conn->io);
+    LIST_REMOVE(conn, entry);
+#ifdef CONFIG_IO_URING
+    if(conn->recv_armed || conn->send_busy) {
+        // Kernel still references the socket and the send buffer, free them once the operations complete //
+        conn->closing = true;
+        if(conn->recv_armed) {
+            uring_cancel(&sipc_glob->uring, &conn->recv_op);
+        }
+        if(conn->send_busy) {
+            uring_cancel(&sipc_glob->uring, &STAILQ_FIRST(&conn->send_queue)->op);
+        }
+        LIST_INSERT_HEAD(&sipc_glob->closing_list, conn, entry);
         return;
     }
+#endif
+    conn_release(conn);
+}
 
+static void conn_msg(sipc_t *sipc, sipc_conn_t *conn, char *buf, ssize_t n)
+{
     ipc_header_t *header = (ipc_header_t *)buf;
     if((size_t)n < sizeof(ipc_header_t)) {
         log_error("incomplete message: n=%zd", n);
@@ -86,7 +124,9 @@ static void read_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
                 },
                 .id = header->id,
             };
-            if(handler->cb(&req) != SIPC_ERR_OK) {
+            // SIPC_ERR_IO means sipc_resp failed and already closed the connection //
+            sipc_err_t res = handler->cb(&req);
+            if(res != SIPC_ERR_OK && res != SIPC_ERR_IO) {
                 sipc_resp(conn, header->id, IPC_CMD_FAIL_SRV, NULL);
             }
             return;
@@ -96,7 +136,198 @@ static void read_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
     sipc_resp(conn, header->id, IPC_CMD_FAIL_SRV, NULL);
 }
 
-static void accept_cb(struct ev_loop *loop, ev_io *io, int events)
+static void read_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
+{
+    sipc_conn_t *conn = container_of(io, sipc_conn_t, io);
+    sipc_t *sipc = io->data;
+    if((events & EV_READ) == 0) {
+        log_error("unexpected events=%d", events);
+        return;
+    }
+
+    char buf[IPC_BUF_SIZE];
+    ssize_t n = read(io->fd, buf, sizeof(buf));
+    if(n < 0) {
+        log_error("read(fd=%d) failed - %s", io->fd, strerror(errno));
+        conn_close(conn);
+        return;
+    } else if(n == 0) {
+        log_debug("fd=%d closed by peer", io->fd);
+        conn_close(conn);
+        return;
+    }
+    conn_msg(sipc, conn, buf, n);
+}
+
+#ifdef CONFIG_IO_URING
+static void conn_closing_done(sipc_conn_t *conn)
+{
+    if(conn->recv_armed == false && conn->send_busy == false) {
+        LIST_REMOVE(conn, entry);
+        conn_release(conn);
+    }
+}
+
+static void send_cb(uring_op_t *op, int res, UNUSED uint32_t flags);
+
+static bool conn_send_next(sipc_conn_t *conn)
+{
+    sipc_send_t *send = STAILQ_FIRST(&conn->send_queue);
+    if(send == NULL) {
+        return true;
+    }
+    // Only the head is submitted, so responses are never interleaved on the socket //
+    send->op.cb = send_cb;
+    if(uring_send(&sipc_glob->uring, &send->op, conn->io.fd, send->data + send->offset, send->len - send->offset) ==
+       false) {
+        return false;
+    }
+    conn->send_busy = true;
+    return true;
+}
+
+static void send_cb(uring_op_t *op, int res, UNUSED uint32_t flags)
+{
+    sipc_send_t *send = container_of(op, sipc_send_t, op);
+    sipc_conn_t *conn = send->conn;
+    conn->send_busy = false;
+    if(conn->closing) {
+        conn_closing_done(conn);
+        return;
+    }
+    if(res < 0) {
+        log_error("send(fd=%d) failed - %s", conn->io.fd, strerror(-res));
+        conn_close(conn);
+        return;
+    }
+    send->offset += res;
+    if(send->offset == send->len) {
+        STAILQ_REMOVE_HEAD(&conn->send_queue, entry);
+        free(send);
+    }
+    if(conn_send_next(conn) == false) {
+        conn_close(conn);
+    }
+}
+
+static sipc_err_t conn_send_queue(sipc_conn_t *conn, const struct iovec *iov, uint32_t iov_cnt, uint32_t size)
+{
+    sipc_send_t *send = malloc(sizeof(sipc_send_t) + size);
+    if(send == NULL) {
+        log_error("malloc(%u) failed", size);
+        return SIPC_ERR_NO_MEM;
+    }
+    send->conn = conn;
+    send->offset = 0;
+    send->len = 0;
+    for(uint32_t i = 0; i < iov_cnt; i++) {
+        memcpy(send->data + send->len, iov[i].iov_base, iov[i].iov_len);
+        send->len += iov[i].iov_len;
+    }
+    STAILQ_INSERT_TAIL(&conn->send_queue, send, entry);
+    if(conn->send_busy == false && conn_send_next(conn) == false) {
+        return SIPC_ERR_IO;
+    }
+    return SIPC_ERR_OK;
+}
+
+static bool conn_recv_arm(sipc_conn_t *conn);
+
+static void recv_cb(uring_op_t *op, int res, uint32_t flags)
+{
+    sipc_conn_t *conn = container_of(op, sipc_conn_t, recv_op);
+    sipc_t *sipc = sipc_glob;
+    if((flags & IORING_CQE_F_MORE) == 0) {
+        conn->recv_armed = false;
+    }
+    if(conn->closing) {
+        if(flags & IORING_CQE_F_BUFFER) {
+            uring_buf_put(&sipc->bufs, flags);
+        }
+        conn_closing_done(conn);
+        return;
+    }
+
+    if(res == -ENOBUFS) {
+        if(conn_recv_arm(conn) == false) {
+            conn_close(conn);
+        }
+        return;
+    } else if(res < 0) {
+        log_error("recv(fd=%d) failed - %s", conn->io.fd, strerror(-res));
+        conn_close(conn);
+        return;
+    } else if(res == 0) {
+        log_debug("fd=%d closed by peer", conn->io.fd);
+        conn_close(conn);
+        return;
+    }
+    // Receive is armed again before the handler, which may close the connection //
+    if(conn_recv_arm(conn) == false) {
+        uring_buf_put(&sipc->bufs, flags);
+        conn_close(conn);
+        return;
+    }
+    conn_msg(sipc, conn, uring_buf_get(&sipc->bufs, flags), res);
+    uring_buf_put(&sipc->bufs, flags);
+}
+
+static bool conn_recv_arm(sipc_conn_t *conn)
+{
+    if(conn->recv_armed) {
+        return true;
+    }
+    conn->recv_op.cb = recv_cb;
+    if(uring_recv_multishot(&sipc_glob->uring, &conn->recv_op, conn->io.fd, &sipc_glob->bufs) == false) {
+        return false;
+    }
+    conn->recv_armed = true;
+    return true;
+}
+#endif
+
+static void conn_new(sipc_t *sipc, int fd)
+{
+    sipc_conn_t *conn = calloc(1, sizeof(sipc_conn_t));
+    if(conn == NULL) {
+        log_error("malloc(sipc_conn_t) failed");
+        close(fd);
+        return;
+    }
+    LIST_INSERT_HEAD(&sipc->conn_list, conn, entry);
+    conn->io.fd = fd;
+
+    ev_io_init(&conn->io, read_cb, conn->io.fd, EV_READ);
+    conn->io.data = sipc;
+#ifdef CONFIG_IO_URING
+    STAILQ_INIT(&conn->send_queue);
+    if(conn_recv_arm(conn) == false) {
+        conn_close(conn);
+        return;
+    }
+#else
+    ev_io_start(EV_DEFAULT, &conn->io);
+#endif
+
+    log_debug("new fd=%d", conn->io.fd);
+}
+
+#ifdef CONFIG_IO_URING
+static void uring_accept_cb(uring_op_t *op, int res, uint32_t flags)
+{
+    sipc_t *sipc = container_of(op, sipc_t, accept_op);
+    if(res >= 0) {
+        conn_new(sipc, res);
+    } else {
+        log_error("accept(%s) failed - %s", sipc->sock_path, strerror(-res));
+    }
+    if((flags & IORING_CQE_F_MORE) == 0) {
+        uring_accept_multishot(&sipc->uring, &sipc->accept_op, sipc->io.fd);
+    }
+}
+#endif
+
+static void accept_cb(UNUSED struct ev_loop *loop, ev_io *io, int events)
 {
     sipc_t *sipc = io->data;
     if((events & EV_READ) == 0) {
@@ -113,21 +344,7 @@ static void accept_cb(struct ev_loop *loop, ev_io *io, int events)
             log_error("accept(%s) failed", sipc->sock_path);
             return;
         }
-
-        sipc_conn_t *conn = calloc(1, sizeof(sipc_conn_t));
-        if(conn == NULL) {
-            log_error("malloc(sipc_conn_t) failed");
-            close(fd);
-            return;
-        }
-        LIST_INSERT_HEAD(&sipc->conn_list, conn, entry);
-        conn->io.fd = fd;
-
-        ev_io_init(&conn->io, read_cb, conn->io.fd, EV_READ);
-        conn->io.data = sipc;
-        ev_io_start(loop, &conn->io);
-
-        log_debug("new fd=%d", conn->io.fd);
+        conn_new(sipc, fd);
     }
 }
 
@@ -176,7 +393,17 @@ sipc_err_t sipc_init(const char *sock_path, const sipc_cmd_handler_t *handlers,
 
     ev_io_init(&sipc->io, accept_cb, sipc->io.fd, EV_READ);
     sipc->io.data = sipc;
+#ifdef CONFIG_IO_URING
+    sipc->accept_op.cb = uring_accept_cb;
+    if(uring_init(&sipc->uring, EV_DEFAULT, URING_ENTRIES) != URING_ERR_OK ||
+       uring_buf_ring_init(&sipc->uring, &sipc->bufs, 0, URING_BUF_COUNT, IPC_BUF_SIZE) != URING_ERR_OK ||
+       uring_accept_multishot(&sipc->uring, &sipc->accept_op, sipc->io.fd) == false) {
+        sipc_deinit();
+        return SIPC_ERR_INIT;
+    }
+#else
     ev_io_start(EV_DEFAULT, &sipc->io);
+#endif
 
     return SIPC_ERR_OK;
 }
@@ -191,6 +418,16 @@ void sipc_deinit(void)
         sipc_conn_t *conn = LIST_FIRST(&sipc_glob->conn_list);
         conn_close(conn);
     }
+#ifdef CONFIG_IO_URING
+    // Closing the ring cancels the remaining operations, so the buffers can be released afterwards //
+    uring_buf_ring_destroy(&sipc_glob->uring, &sipc_glob->bufs);
+    uring_destroy(&sipc_glob->uring);
+    while(!LIST_EMPTY(&sipc_glob->closing_list)) {
+        sipc_conn_t *conn = LIST_FIRST(&sipc_glob->closing_list);
+        LIST_REMOVE(conn, entry);
+        conn_release(conn);
+    }
+#endif
 
     ev_io_stop(EV_DEFAULT, &sipc_glob->io);
     if(sipc_glob->io.fd >= 0) {
@@ -223,6 +460,12 @@ sipc_err_t sipc_resp(sipc_conn_t *conn, uint32_t id, uint32_t cmd, const buf_t *
     } else {
         header.len = 0;
     }
+#ifdef CONFIG_IO_URING
+    if(conn_send_queue(conn, iov, iov_cnt, req_size) != SIPC_ERR_OK) {
+        conn_close(conn);
+        return SIPC_ERR_IO;
+    }
+#else
     ssize_t n = writev(conn->io.fd, iov, iov_cnt);
     if(n < 0) {
         log_error("writev(fd=%d) failed - %s", conn->io.fd, strerror(errno));
@@ -234,6 +477,7 @@ sipc_err_t sipc_resp(sipc_conn_t *conn, uint32_t id, uint32_t cmd, const buf_t *
         conn_close(conn);
         return SIPC_ERR_IO;
     }
+#endif
     log_debug("response: cmd=%u, id=%u, len=%u", cmd, id, header.len);
     return SIPC_ERR_OK;
 }
@@ -28,6 +28,10 @@ json_gen_err_t json_gen_obj(str_buf_t *out, const json_gen_item_t *items, uint32
 json_gen_err_t json_gen_arr(str_buf_t *out, const json_gen_arr_t *info)
 {
     buf_putc(out, '[');
+    if(info->count == 0) {
+        buf_putc(out, ']');
+        return JSON_GEN_ERR_OK;
+    }
     const char *pval = info->arr;
     for(uint32_t i = 0; i < info->count; i++) {
         json_gen_err_t res = info->cb(out, pval);
@@ -59,6 +63,13 @@ json_gen_err_t json_gen_uint64(str_buf_t *out, const void *priv_data)
     return JSON_GEN_ERR_OK;
 }
 
+json_gen_err_t json_gen_uint32(str_buf_t *out, const void *priv_data)
+{
+    uint32_t val = *(uint32_t *)priv_data;
+    buf_printf(out, "%" PRIu32, val);
+    return JSON_GEN_ERR_OK;
+}
+
 json_gen_err_t json_gen_uint8(str_buf_t *out, const void *priv_data)
 {
     uint8_t val = *(uint8_t *)priv_data;
@@ -80,6 +80,14 @@ json_gen_err_t json_gen_float(str_buf_t *out, const void *priv_data);
  */
 json_gen_err_t json_gen_uint64(str_buf_t *out, const void *priv_data);
 
+/**
+ * @brief Generate JSON uint32
+ * @param out - [out] Pointer to output string
+ * @param priv_data - [in] Pointer to private data (uint32_t pointer)
+ * @return JSON_GEN_ERR_OK on success, error code otherwise
+ */
+json_gen_err_t json_gen_uint32(str_buf_t *out, const void *priv_data);
+
 /**
  * @brief Generate JSON uint8
  * @param out - [out] Pointer to output string
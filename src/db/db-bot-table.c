@@ -5,8 +5,9 @@
 
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
 
-#define BOT_USER_TABLE "bot_user"
-#define BOT_CHAT_TABLE "bot_chat"
+// Tables are counted by DB_BOT_TABLE_COUNT //
+static db_table_t user_table = DB_TABLE_INIT("bot_user");
+static db_table_t chat_table = DB_TABLE_INIT("bot_chat");
 
 db_err_t db_bot_user_put(uint32_t id, const db_bot_user_t *user)
 {
@@ -14,7 +15,7 @@ db_err_t db_bot_user_put(uint32_t id, const db_bot_user_t *user)
         .data = (void *)user,
         .size = sizeof(db_bot_user_t),
     };
-    return db_put_value_by_id(BOT_USER_TABLE, id, &value);
+    return db_put_value_by_id(&user_table, id, &value);
 }
 
 db_err_t db_bot_chat_get_meta(db_bot_chat_meta_t *meta)
@@ -22,7 +23,7 @@ db_err_t db_bot_chat_get_meta(db_bot_chat_meta_t *meta)
     buf_t value = {
         .size = sizeof(db_bot_chat_meta_t),
     };
-    db_err_t res = db_get_value_by_id64(BOT_CHAT_TABLE, 0, &value);
+    db_err_t res = db_get_value_by_id64(&chat_table, 0, &value);
     if(res != DB_ERR_OK) {
         if(res == DB_ERR_NOT_FOUND) {
             log_warn("bot chat meta not found, initializing new meta");
@@ -42,7 +43,7 @@ db_err_t db_bot_chat_put_meta(const db_bot_chat_meta_t *meta)
         .data = (void *)meta,
         .size = sizeof(db_bot_chat_meta_t),
     };
-    return db_put_value_by_id64(BOT_CHAT_TABLE, 0, &value);
+    return db_put_value_by_id64(&chat_table, 0, &value);
 }
 
 db_err_t db_bot_chat_put(uint64_t id, const db_bot_chat_t *chat)
@@ -51,7 +52,7 @@ db_err_t db_bot_chat_put(uint64_t id, const db_bot_chat_t *chat)
         .data = (void *)chat,
         .size = sizeof(db_bot_chat_t),
     };
-    return db_put_value_by_id64(BOT_CHAT_TABLE, id, &value);
+    return db_put_value_by_id64(&chat_table, id, &value);
 }
 
 db_err_t db_bot_chat_get_next(uint64_t *pid, db_bot_chat_t *chat)
@@ -61,7 +62,7 @@ db_err_t db_bot_chat_get_next(uint64_t *pid, db_bot_chat_t *chat)
         .size = sizeof(db_bot_chat_t),
     };
     while(true) {
-        db_err_t res = db_get_id64_value_next(BOT_CHAT_TABLE, pid, &value);
+        db_err_t res = db_get_id64_value_next(&chat_table, pid, &value);
         if(res != DB_ERR_OK) {
             return res;
         }
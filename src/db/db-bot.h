@@ -3,6 +3,7 @@
 #include <core/db/db.h>
 
 #define BOT_CHAT_ARR_BUF_SIZE 1024
+#define DB_BOT_TABLE_COUNT    2 ///< Named tables of the bot database
 
 /**
  * @brief Structure to hold bot user data
@@ -57,17 +57,20 @@ static ai_t ai = { 0 };
 
 static void update_cb(struct ev_loop *loop, ev_timer *timer, int events)
 {
+    // Timer reads in its own transaction, so it neither ends nor blocks the others of the loop thread //
+    db_txn_t *txn = db_rd_txn_open();
+    if(txn == NULL) {
+        return;
+    }
+    db_txn_t *prev = db_txn_switch(txn);
     db_cursor_op_t op = DB_CURSOR_OP_SET_RANGE;
     while(true) {
         crypto_t crypto;
         db_err_t res = db_crypto_get_next2(ai.sym_id, ai.last_ts, op, &crypto);
         if(res != DB_ERR_OK) {
-            if(res == DB_ERR_NOT_FOUND) {
-                break;
-            }
-            db_txn_abort();
-            return;
+            break;
         }
+        op = DB_CURSOR_OP_NEXT;
 
         calc_crypto_row_t row;
         calc_crypto(&ai.calc, &crypto, &row);
@@ -100,6 +103,8 @@ static void update_cb(struct ev_loop *loop, ev_timer *timer, int events)
         ai_row.cols[CALC_AI_COL_BID_ASK_DIFF_PCT] = row.bid_ask_diff_pct;
         ai_row.cols[CALC_AI_COL_LIQ_BID_GROWTH_15] = row.liq_bid_growth_15;
     }
+    db_txn_switch(prev);
+    db_rd_txn_close(txn);
 }
 
 db_err_t db_crypto_ai_train_model(const char *path, const char *sym_name)
@@ -0,0 +1,261 @@
+#include <db/db-crypto-chunk.h>
+#include <core/base/log.h>
+#include <stddef.h>
+#include <endian.h>
+#include <string.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define CHUNK_OFF_BITS    12 ///< Bits of the first offset, enough for DB_CRYPTO_CHUNK_SEC
+#define CHUNK_LEAD_BITS   5  ///< Bits of the leading zeros of a new XOR window
+#define CHUNK_LEN_BITS    5  ///< Bits of the length of a new XOR window minus one
+#define CHUNK_WHALES_BITS 8  ///< Bits of a changed number of whale transactions
+
+STATIC_ASSERT(DB_CRYPTO_CHUNK_SEC <= (1 << CHUNK_OFF_BITS));
+// Last delta-of-delta class must hold any change of the offset delta //
+STATIC_ASSERT(DB_CRYPTO_CHUNK_SEC * 2 < (1 << 13));
+STATIC_ASSERT(sizeof(db_crypto_chunk_hdr_t) == 4 + 4 * DB_CRYPTO_CHUNK_COL_MAX);
+// Float columns are copied from and to the row at once //
+STATIC_ASSERT(offsetof(db_crypto_t, close) == 0 && offsetof(db_crypto_t, liq_bid) == 12);
+
+/**
+ * @brief Delta-of-delta classes of the offsets, the prefix is followed by the signed value
+ */
+typedef struct {
+    uint32_t prefix;      ///< Class prefix bits
+    uint32_t prefix_bits; ///< Length of the prefix
+    uint32_t value_bits;  ///< Length of the signed value
+} chunk_dod_class_t;
+
+static const chunk_dod_class_t dod_classes[] = {
+    { 0x2, 2, 7 },
+    { 0x6, 3, 9 },
+    { 0xe, 4, 12 },
+    { 0xf, 4, 14 },
+};
+
+typedef struct {
+    uint8_t *data;
+    uint32_t pos;
+} chunk_writer_t;
+
+/**
+ * @brief Append 1 to 32 bits, the buffer is zeroed and padded by the caller
+ */
+static inline void chunk_put(chunk_writer_t *w, uint32_t value, uint32_t bits)
+{
+    uint8_t *p = w->data + (w->pos >> 3);
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    word = be64toh(word) | ((uint64_t)value << (64 - bits) >> (w->pos & 7));
+    word = htobe64(word);
+    memcpy(p, &word, sizeof(word));
+    w->pos += bits;
+}
+
+/**
+ * @brief Read 1 to 32 bits, the stream is followed by DB_CRYPTO_CHUNK_PAD zero bytes
+ */
+static inline uint32_t chunk_get(const uint8_t *data, uint32_t *pos, uint32_t bits)
+{
+    uint64_t word;
+    memcpy(&word, data + (*pos >> 3), sizeof(word));
+    word = be64toh(word) << (*pos & 7);
+    *pos += bits;
+    return word >> (64 - bits);
+}
+
+static inline int32_t chunk_sign_extend(uint32_t value, uint32_t bits)
+{
+    return (int32_t)(value << (32 - bits)) >> (32 - bits);
+}
+
+static void chunk_put_dod(chunk_writer_t *w, int32_t dod)
+{
+    if(dod == 0) {
+        chunk_put(w, 0, 1);
+        return;
+    }
+    for(uint32_t i = 0; i < ARRAY_SIZE(dod_classes); i++) {
+        const chunk_dod_class_t *cls = &dod_classes[i];
+        int32_t limit = 1 << (cls->value_bits - 1);
+        if((dod >= -limit && dod < limit) || i == ARRAY_SIZE(dod_classes) - 1) {
+            chunk_put(w, cls->prefix, cls->prefix_bits);
+            chunk_put(w, (uint32_t)dod & ((1u << cls->value_bits) - 1), cls->value_bits);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Append a float as XOR with the previous one, reusing the previous window of meaningful bits if it fits
+ */
+static void chunk_put_float(chunk_writer_t *w, uint32_t value, uint32_t *prev, uint8_t *lead, uint8_t *len)
+{
+    uint32_t xor = value ^ *prev;
+    *prev = value;
+    if(xor == 0) {
+        chunk_put(w, 0, 1);
+        return;
+    }
+    uint32_t xor_lead = __builtin_clz(xor);
+    uint32_t xor_trail = __builtin_ctz(xor);
+    if(*len > 0 && xor_lead >= *lead && xor_trail >= 32u - *lead - *len) {
+        chunk_put(w, 0x2, 2);
+        chunk_put(w, xor >> (32 - *lead - *len), *len);
+        return;
+    }
+    *lead = xor_lead;
+    *len = 32 - xor_lead - xor_trail;
+    chunk_put(w, 0x3, 2);
+    chunk_put(w, *lead, CHUNK_LEAD_BITS);
+    chunk_put(w, *len - 1, CHUNK_LEN_BITS);
+    chunk_put(w, xor >> xor_trail, *len);
+}
+
+uint32_t db_crypto_chunk_encode(uint8_t *data, const uint32_t *offs, const db_crypto_t *rows, uint32_t count)
+{
+    db_crypto_chunk_hdr_t *hdr = (db_crypto_chunk_hdr_t *)data;
+    memset(data, 0, DB_CRYPTO_CHUNK_SIZE(count));
+    hdr->count = count;
+    chunk_writer_t w = {
+        .data = data + sizeof(db_crypto_chunk_hdr_t),
+        .pos = 0,
+    };
+
+    // Timestamps //
+    hdr->offs[DB_CRYPTO_CHUNK_COL_TS] = w.pos;
+    chunk_put(&w, offs[0], CHUNK_OFF_BITS);
+    int32_t delta = 0;
+    for(uint32_t i = 1; i < count; i++) {
+        int32_t cur_delta = offs[i] - offs[i - 1];
+        chunk_put_dod(&w, cur_delta - delta);
+        delta = cur_delta;
+    }
+
+    // Floats, each column is XORed with its own previous value //
+    for(uint32_t col = 0; col < DB_CRYPTO_CHUNK_FLOATS; col++) {
+        hdr->offs[DB_CRYPTO_CHUNK_COL_CLOSE + col] = w.pos;
+        uint32_t vals[DB_CRYPTO_CHUNK_FLOATS];
+        memcpy(vals, &rows[0], sizeof(vals));
+        uint32_t prev = vals[col];
+        chunk_put(&w, prev, 32);
+        uint8_t lead = 0, len = 0;
+        for(uint32_t i = 1; i < count; i++) {
+            memcpy(vals, &rows[i], sizeof(vals));
+            chunk_put_float(&w, vals[col], &prev, &lead, &len);
+        }
+    }
+
+    // Whales //
+    hdr->offs[DB_CRYPTO_CHUNK_COL_WHALES] = w.pos;
+    chunk_put(&w, rows[0].whales, CHUNK_WHALES_BITS);
+    for(uint32_t i = 1; i < count; i++) {
+        if(rows[i].whales == rows[i - 1].whales) {
+            chunk_put(&w, 0, 1);
+        } else {
+            chunk_put(&w, 1, 1);
+            chunk_put(&w, rows[i].whales, CHUNK_WHALES_BITS);
+        }
+    }
+    return sizeof(db_crypto_chunk_hdr_t) + (w.pos + 7) / 8;
+}
+
+db_err_t db_crypto_chunk_dec_init(db_crypto_chunk_dec_t *dec, const uint8_t *data, uint32_t size)
+{
+    if(size < sizeof(db_crypto_chunk_hdr_t)) {
+        log_error("invalid chunk size=%u", size);
+        return DB_ERR_PARSE;
+    }
+    db_crypto_chunk_hdr_t hdr;
+    memcpy(&hdr, data, sizeof(hdr));
+    dec->data = data + sizeof(hdr);
+    dec->end = (size - sizeof(hdr)) * 8;
+    dec->count = hdr.count;
+    if(dec->count == 0 || dec->count > DB_CRYPTO_CHUNK_ROWS_MAX) {
+        log_error("invalid chunk rows=%u", dec->count);
+        return DB_ERR_PARSE;
+    }
+    for(uint32_t col = 0; col < DB_CRYPTO_CHUNK_COL_MAX; col++) {
+        if(hdr.offs[col] > dec->end || (col > 0 && hdr.offs[col] < hdr.offs[col - 1])) {
+            log_error("invalid chunk column %u offset=%u size=%u", col, hdr.offs[col], size);
+            return DB_ERR_PARSE;
+        }
+        dec->pos[col] = hdr.offs[col];
+    }
+    dec->idx = 0;
+    dec->off = 0;
+    dec->delta = 0;
+    memset(dec->len, 0, sizeof(dec->len));
+    return DB_ERR_OK;
+}
+
+db_err_t db_crypto_chunk_dec_next(db_crypto_chunk_dec_t *dec, uint32_t *poff, db_crypto_t *row)
+{
+    if(dec->idx == dec->count) {
+        return DB_ERR_NOT_FOUND;
+    }
+    // Every read of one row stays within the padding once it starts inside the streams //
+    for(uint32_t col = 0; col < DB_CRYPTO_CHUNK_COL_MAX; col++) {
+        if(dec->pos[col] > dec->end) {
+            log_error("chunk column %u overrun at row %u", col, dec->idx);
+            return DB_ERR_PARSE;
+        }
+    }
+    const uint8_t *data = dec->data;
+    uint32_t *pos = dec->pos;
+    bool first = (dec->idx == 0);
+
+    // Timestamp //
+    if(first) {
+        dec->off = chunk_get(data, &pos[DB_CRYPTO_CHUNK_COL_TS], CHUNK_OFF_BITS);
+    } else if(chunk_get(data, &pos[DB_CRYPTO_CHUNK_COL_TS], 1) == 0) {
+        dec->off += dec->delta;
+    } else {
+        uint32_t i = 0;
+        while(i < ARRAY_SIZE(dod_classes) - 1 && chunk_get(data, &pos[DB_CRYPTO_CHUNK_COL_TS], 1) == 1) {
+            i++;
+        }
+        uint32_t bits = dod_classes[i].value_bits;
+        dec->delta += chunk_sign_extend(chunk_get(data, &pos[DB_CRYPTO_CHUNK_COL_TS], bits), bits);
+        dec->off += dec->delta;
+    }
+    if(dec->off >= DB_CRYPTO_CHUNK_SEC) {
+        log_error("invalid chunk offset=%u at row %u", dec->off, dec->idx);
+        return DB_ERR_PARSE;
+    }
+
+    // Floats //
+    for(uint32_t col = 0; col < DB_CRYPTO_CHUNK_FLOATS; col++) {
+        uint32_t *col_pos = &pos[DB_CRYPTO_CHUNK_COL_CLOSE + col];
+        if(first) {
+            dec->val[col] = chunk_get(data, col_pos, 32);
+        } else if(chunk_get(data, col_pos, 1) == 1) {
+            if(chunk_get(data, col_pos, 1) == 1) {
+                dec->lead[col] = chunk_get(data, col_pos, CHUNK_LEAD_BITS);
+                dec->len[col] = chunk_get(data, col_pos, CHUNK_LEN_BITS) + 1;
+                if(dec->lead[col] + dec->len[col] > 32) {
+                    log_error("invalid chunk XOR window at row %u", dec->idx);
+                    return DB_ERR_PARSE;
+                }
+            } else if(dec->len[col] == 0) {
+                log_error("missing chunk XOR window at row %u", dec->idx);
+                return DB_ERR_PARSE;
+            }
+            uint32_t trail = 32 - dec->lead[col] - dec->len[col];
+            dec->val[col] ^= chunk_get(data, col_pos, dec->len[col]) << trail;
+        }
+    }
+    memcpy(row, dec->val, sizeof(dec->val));
+
+    // Whales //
+    if(first || chunk_get(data, &pos[DB_CRYPTO_CHUNK_COL_WHALES], 1) == 1) {
+        dec->whales = chunk_get(data, &pos[DB_CRYPTO_CHUNK_COL_WHALES], CHUNK_WHALES_BITS);
+    }
+    row->whales = dec->whales;
+    memset(row->pad, 0, sizeof(row->pad));
+
+    *poff = dec->off;
+    dec->idx++;
+    return DB_ERR_OK;
+}
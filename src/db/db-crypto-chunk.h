@@ -0,0 +1,79 @@
+#pragma once
+
+#include <db/db-crypto-table.h>
+
+#define DB_CRYPTO_CHUNK_SEC      3600                ///< Time span of one chunk in seconds
+#define DB_CRYPTO_CHUNK_ROWS_MAX DB_CRYPTO_CHUNK_SEC ///< Rows have unique timestamps in seconds
+#define DB_CRYPTO_CHUNK_PAD      16                  ///< Zero bytes the bit reader may touch past the end
+#define DB_CRYPTO_CHUNK_ROW_BITS (18 + 4 * 44 + 9)   ///< Worst case bits of one encoded row
+#define DB_CRYPTO_CHUNK_SIZE(count)                                                                                    \
+    (sizeof(db_crypto_chunk_hdr_t) + ((count) * DB_CRYPTO_CHUNK_ROW_BITS + 7) / 8 + DB_CRYPTO_CHUNK_PAD)
+
+/**
+ * @brief Enumeration of the column streams of a chunk
+ */
+typedef enum {
+    DB_CRYPTO_CHUNK_COL_TS,      ///< Delta-of-delta encoded offsets from the start of the chunk
+    DB_CRYPTO_CHUNK_COL_CLOSE,   ///< XOR compressed closing prices
+    DB_CRYPTO_CHUNK_COL_VOLUME,  ///< XOR compressed trading volumes
+    DB_CRYPTO_CHUNK_COL_LIQ_ASK, ///< XOR compressed ask side liquidity
+    DB_CRYPTO_CHUNK_COL_LIQ_BID, ///< XOR compressed bid side liquidity
+    DB_CRYPTO_CHUNK_COL_WHALES,  ///< Whale transactions, repeated values take one bit
+    DB_CRYPTO_CHUNK_COL_MAX,
+} db_crypto_chunk_col_t;
+
+#define DB_CRYPTO_CHUNK_FLOATS (DB_CRYPTO_CHUNK_COL_WHALES - DB_CRYPTO_CHUNK_COL_CLOSE)
+
+/**
+ * @brief Header of a chunk value, the column streams follow it back to back
+ */
+typedef struct {
+    uint16_t count;                         ///< Number of rows
+    uint16_t pad;                           ///< Padding for alignment
+    uint32_t offs[DB_CRYPTO_CHUNK_COL_MAX]; ///< Bit offsets of the column streams after the header
+} db_crypto_chunk_hdr_t;
+
+/**
+ * @brief Row by row decoder state of a chunk
+ */
+typedef struct {
+    const uint8_t *data;                   ///< Column streams
+    uint32_t pos[DB_CRYPTO_CHUNK_COL_MAX]; ///< Read positions of the column streams in bits
+    uint32_t end;                          ///< Length of the column streams in bits
+    uint32_t count;                        ///< Number of rows
+    uint32_t idx;                          ///< Number of decoded rows
+    uint32_t off;                          ///< Offset of the last row from the start of the chunk
+    int32_t delta;                         ///< Offset delta of the last two rows
+    uint32_t val[DB_CRYPTO_CHUNK_FLOATS];  ///< Bits of the last floats
+    uint8_t lead[DB_CRYPTO_CHUNK_FLOATS];  ///< Leading zero bits of the last stored XOR window
+    uint8_t len[DB_CRYPTO_CHUNK_FLOATS];   ///< Length of the last stored XOR window, 0 before the first one
+    uint8_t whales;                        ///< Last number of whale transactions
+} db_crypto_chunk_dec_t;
+
+/**
+ * @brief Encode rows into a chunk value
+ * @param data - [out] Buffer of DB_CRYPTO_CHUNK_SIZE(count) bytes
+ * @param offs - [in] Offsets of the rows from the start of the chunk, strictly increasing
+ * @param rows - [in] Rows to encode
+ * @param count - [in] Number of rows, 1 to DB_CRYPTO_CHUNK_ROWS_MAX
+ * @return Size of the chunk value in bytes
+ */
+uint32_t db_crypto_chunk_encode(uint8_t *data, const uint32_t *offs, const db_crypto_t *rows, uint32_t count);
+
+/**
+ * @brief Start decoding a chunk value
+ * @param dec - [out] Pointer to the decoder state
+ * @param data - [in] Chunk value followed by DB_CRYPTO_CHUNK_PAD zero bytes
+ * @param size - [in] Size of the chunk value
+ * @return DB_ERR_OK on success, DB_ERR_PARSE if the header is invalid
+ */
+db_err_t db_crypto_chunk_dec_init(db_crypto_chunk_dec_t *dec, const uint8_t *data, uint32_t size);
+
+/**
+ * @brief Decode the next row of a chunk
+ * @param dec - [in] Pointer to the decoder state
+ * @param poff - [out] Pointer to store the offset of the row from the start of the chunk
+ * @param row - [out] Pointer to store the row
+ * @return DB_ERR_OK on success, DB_ERR_NOT_FOUND past the last row, DB_ERR_PARSE if the chunk is corrupted
+ */
+db_err_t db_crypto_chunk_dec_next(db_crypto_chunk_dec_t *dec, uint32_t *poff, db_crypto_t *row);
@@ -0,0 +1,314 @@
+#include <db/db-crypto.h>
+#include <db/db-crypto-table.h>
+#include <db/db-crypto-chunk.h>
+#include <core/json/json-parser.h>
+#include <core/base/file.h>
+#include <core/base/log.h>
+#include <inttypes.h>
+#include <time.h>
+#include <ev.h>
+
+LOG_MOD_INIT(LOG_LVL_DEFAULT)
+
+#define RETENTION_BUF_SIZE (16 * 1024)
+#define RETENTION_SYM_MAX  64
+#define RETENTION_DAY_SEC  (24 * 3600)
+#define RETENTION_DAYS_MAX (100 * 365)
+
+// Days of a symbol policy which are taken from the global one //
+#define RETENTION_INHERIT UINT32_MAX
+
+/**
+ * @brief Days the tables of a symbol keep their rows
+ */
+typedef struct {
+    uint32_t sym_id;                       ///< Symbol ID, 0 for the global policy
+    uint32_t keep_days[DB_CRYPTO_LVL_MAX]; ///< Days each table keeps its rows, 0 to keep them forever
+} retention_policy_t;
+
+/**
+ * @brief Retention job, one pass walks all tables of all symbols in small write transactions
+ */
+typedef struct {
+    ev_timer timer;                             ///< Starts a pass in the run interval
+    ev_idle idle;                               ///< Runs one batch of the pass once the loop has no other events
+    bool started;                               ///< Job is started
+    retention_policy_t global;                  ///< Policy of the symbols without their own one
+    retention_policy_t syms[RETENTION_SYM_MAX]; ///< Policies of single symbols
+    uint32_t sym_count;                         ///< Number of policies of single symbols
+    uint64_t now;                               ///< Time the expiry of the pass is counted from
+    ev_tstamp start;                            ///< Start of the pass
+    uint32_t sym_id;                            ///< Symbol of the current step
+    uint32_t sym_id_last;                       ///< Last symbol of the pass
+    db_crypto_lvl_t lvl;                        ///< Table of the current step
+    bool chunks;                                ///< Current step deletes the chunks of the raw rows
+    db_crypto_purge_t purge;                    ///< Progress of the current step
+    uint32_t del_count;                         ///< Rows deleted by the pass
+} retention_t;
+
+static retention_t retention;
+
+static const char *const lvl_names[] = {
+    [DB_CRYPTO_LVL_RAW] = "raw",
+    [DB_CRYPTO_LVL_1M] = "1m",
+    [DB_CRYPTO_LVL_5M] = "5m",
+    [DB_CRYPTO_LVL_1H] = "1h",
+    [DB_CRYPTO_LVL_1D] = "1d",
+};
+STATIC_ASSERT(ARRAY_SIZE(lvl_names) == DB_CRYPTO_LVL_MAX);
+
+static json_parse_err_t json_parse_days(const jsmntok_t *cur, const char *json, void *priv_data)
+{
+    int64_t days;
+    json_parse_err_t res = json_parse_int64(cur, json, &days);
+    if(res != JSON_PARSE_ERR_OK) {
+        return res;
+    }
+    // Negative days would wrap around into a huge value and keep the rows forever //
+    if(days < 0 || days > RETENTION_DAYS_MAX) {
+        log_error("keep_days %" PRId64 " out of range 0..%u", days, RETENTION_DAYS_MAX);
+        return JSON_PARSE_ERR_CONVERT;
+    }
+    *(uint32_t *)priv_data = days;
+    return JSON_PARSE_ERR_OK;
+}
+
+static json_parse_err_t json_parse_keep_days(const jsmntok_t *cur, const char *json, void *priv_data)
+{
+    uint32_t *keep_days = priv_data;
+    json_item_t items[DB_CRYPTO_LVL_MAX];
+    for(db_crypto_lvl_t lvl = DB_CRYPTO_LVL_RAW; lvl < DB_CRYPTO_LVL_MAX; lvl++) {
+        items[lvl].name = lvl_names[lvl];
+        items[lvl].cb = json_parse_days;
+        items[lvl].priv_data = &keep_days[lvl];
+    }
+    return json_parse_obj(cur, json, items, ARRAY_SIZE(items));
+}
+
+static json_parse_err_t json_parse_sym(const jsmntok_t *cur, const char *json, UNUSED void *priv_data)
+{
+    if(retention.sym_count == RETENTION_SYM_MAX) {
+        log_error("too many symbol policies, max %u", RETENTION_SYM_MAX);
+        return JSON_PARSE_ERR_NO_MEM;
+    }
+    retention_policy_t *policy = &retention.syms[retention.sym_count];
+    for(db_crypto_lvl_t lvl = DB_CRYPTO_LVL_RAW; lvl < DB_CRYPTO_LVL_MAX; lvl++) {
+        policy->keep_days[lvl] = RETENTION_INHERIT;
+    }
+    const char *name = NULL;
+    json_item_t items[] = {
+        { "name", json_parse_pstr, &name },
+        { "keep_days", json_parse_keep_days, policy->keep_days },
+    };
+    json_parse_err_t res = json_parse_obj(cur, json, items, ARRAY_SIZE(items));
+    if(res != JSON_PARSE_ERR_OK) {
+        return res;
+    }
+    if(name == NULL) {
+        log_error("symbol policy without name");
+        return JSON_PARSE_ERR_INVALID;
+    }
+    db_err_t db_res = db_crypto_get_sym(name, &policy->sym_id);
+    if(db_res == DB_ERR_NOT_FOUND) {
+        log_warn("Symbol '%s' not found in DB, its policy is skipped", name);
+        return JSON_PARSE_ERR_OK;
+    }
+    if(db_res != DB_ERR_OK) {
+        return JSON_PARSE_ERR_INVALID;
+    }
+    retention.sym_count++;
+    return JSON_PARSE_ERR_OK;
+}
+
+static json_parse_err_t json_parse_syms(const jsmntok_t *cur, const char *json, void *priv_data)
+{
+    return json_parse_arr(cur, json, json_parse_sym, priv_data);
+}
+
+static const uint32_t *retention_keep_days(uint32_t sym_id)
+{
+    for(uint32_t i = 0; i < retention.sym_count; i++) {
+        if(retention.syms[i].sym_id == sym_id) {
+            return retention.syms[i].keep_days;
+        }
+    }
+    return retention.global.keep_days;
+}
+
+/**
+ * @brief Get the end of the expired rows of the current step
+ * @return Timestamp before which the rows are deleted, 0 if the table keeps them
+ */
+static uint64_t retention_cutoff(void)
+{
+    uint64_t keep_sec = (uint64_t)retention_keep_days(retention.sym_id)[retention.lvl] * RETENTION_DAY_SEC;
+    if(keep_sec == 0 || keep_sec >= retention.now) {
+        return 0;
+    }
+    // Rows go in whole buckets of the next coarser table, so no bucket is left backed by a part of its rows //
+    uint64_t cutoff = retention.now - keep_sec;
+    uint32_t align = 1;
+    if(retention.chunks) {
+        align = DB_CRYPTO_CHUNK_SEC;
+    } else if(retention.lvl + 1 < DB_CRYPTO_LVL_MAX) {
+        align = db_crypto_lvl_interval(retention.lvl + 1);
+    }
+    return cutoff - cutoff % align;
+}
+
+/**
+ * @brief Move to the next table or symbol
+ * @return true if the pass has more steps, false if it is done
+ */
+static bool retention_next_step(void)
+{
+    if(retention.purge.keep_count > 0) {
+        log_warn("symbol %u: %u expired %s rows kept, their rollups are missing", retention.sym_id,
+                 retention.purge.keep_count, lvl_names[retention.lvl]);
+    }
+    retention.del_count += retention.purge.del_count;
+    retention.purge.next_ts = 0;
+    retention.purge.del_count = 0;
+    retention.purge.keep_count = 0;
+#ifdef CONFIG_DB_CRYPTO_CHUNK
+    // Raw rows of the sealed time spans are in the chunks //
+    if(retention.lvl == DB_CRYPTO_LVL_RAW && !retention.chunks) {
+        retention.chunks = true;
+        return true;
+    }
+#endif
+    retention.chunks = false;
+    if(++retention.lvl < DB_CRYPTO_LVL_MAX) {
+        return true;
+    }
+    retention.lvl = DB_CRYPTO_LVL_RAW;
+    return ++retention.sym_id <= retention.sym_id_last;
+}
+
+static void retention_end(void)
+{
+    ev_idle_stop(EV_DEFAULT, &retention.idle);
+    if(retention.del_count > 0) {
+        log_info("deleted %u expired rows in %.1fs", retention.del_count, ev_time() - retention.start);
+    }
+}
+
+/**
+ * @brief Delete one batch of expired rows in its own write transaction
+ */
+static db_err_t retention_purge(uint64_t cutoff)
+{
+    db_err_t res = db_txn_begin(false);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+#ifdef CONFIG_DB_CRYPTO_CHUNK
+    if(retention.chunks) {
+        res = db_crypto_purge_chunks(retention.sym_id, cutoff, &retention.purge);
+    } else
+#endif
+    {
+        res = db_crypto_purge(retention.lvl, retention.sym_id, cutoff, &retention.purge);
+    }
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        db_txn_abort();
+        return res;
+    }
+    db_err_t commit_res = db_txn_commit();
+    return (commit_res != DB_ERR_OK) ? commit_res : res;
+}
+
+static void retention_idle_cb(UNUSED struct ev_loop *loop, UNUSED ev_idle *w, UNUSED int revents)
+{
+    uint64_t cutoff = retention_cutoff();
+    db_err_t res = (cutoff > 0) ? retention_purge(cutoff) : DB_ERR_NOT_FOUND;
+    if(res == DB_ERR_OK) {
+        // Rest of the step runs in the next batches, events which came in meanwhile are handled first //
+        return;
+    }
+    if(res != DB_ERR_NOT_FOUND) {
+        log_error("symbol %u: purge of %s rows failed, pass stopped", retention.sym_id, lvl_names[retention.lvl]);
+        retention_end();
+        return;
+    }
+    if(!retention_next_step()) {
+        retention_end();
+    }
+}
+
+static void retention_timer_cb(UNUSED struct ev_loop *loop, UNUSED ev_timer *w, UNUSED int revents)
+{
+    if(ev_is_active(&retention.idle)) {
+        return;
+    }
+    db_crypto_meta_t meta;
+    db_err_t res = db_crypto_get_meta(&meta);
+    db_txn_abort();
+    if(res != DB_ERR_OK || meta.sym_id_last == 0) {
+        return;
+    }
+    retention.now = time(NULL);
+    retention.start = ev_time();
+    retention.sym_id = 1;
+    retention.sym_id_last = meta.sym_id_last;
+    retention.lvl = DB_CRYPTO_LVL_RAW;
+    retention.chunks = false;
+    retention.purge.next_ts = 0;
+    retention.purge.del_count = 0;
+    retention.purge.keep_count = 0;
+    retention.del_count = 0;
+    ev_idle_start(EV_DEFAULT, &retention.idle);
+}
+
+db_err_t db_crypto_retention_start(const char *retention_path, uint32_t interval_sec)
+{
+    char buf[RETENTION_BUF_SIZE];
+    str_t file = {
+        .data = buf,
+        .len = sizeof(buf),
+    };
+    if(file_read_str(retention_path, &file) != FILE_ERR_OK) {
+        return DB_ERR_OPEN;
+    }
+    retention.sym_count = 0;
+    for(db_crypto_lvl_t lvl = DB_CRYPTO_LVL_RAW; lvl < DB_CRYPTO_LVL_MAX; lvl++) {
+        retention.global.keep_days[lvl] = 0;
+    }
+    json_item_t items[] = {
+        { "keep_days", json_parse_keep_days, retention.global.keep_days },
+        { "symbols", json_parse_syms, NULL },
+    };
+    json_parse_err_t json_res = json_parse(file.data, file.len, items, ARRAY_SIZE(items));
+    db_txn_abort();
+    if(json_res != JSON_PARSE_ERR_OK) {
+        return DB_ERR_PARSE;
+    }
+    for(uint32_t i = 0; i < retention.sym_count; i++) {
+        uint32_t *keep_days = retention.syms[i].keep_days;
+        for(db_crypto_lvl_t lvl = DB_CRYPTO_LVL_RAW; lvl < DB_CRYPTO_LVL_MAX; lvl++) {
+            if(keep_days[lvl] == RETENTION_INHERIT) {
+                keep_days[lvl] = retention.global.keep_days[lvl];
+            }
+        }
+    }
+
+    ev_idle_init(&retention.idle, retention_idle_cb);
+    ev_timer_init(&retention.timer, retention_timer_cb, 1.0, (interval_sec > 0) ? interval_sec : 1);
+    ev_timer_start(EV_DEFAULT, &retention.timer);
+    // Job alone does not keep the loop running //
+    ev_unref(EV_DEFAULT);
+    retention.started = true;
+    log_info("retention started with %u symbol policies, every %usec", retention.sym_count, interval_sec);
+    return DB_ERR_OK;
+}
+
+void db_crypto_retention_stop(void)
+{
+    if(!retention.started) {
+        return;
+    }
+    ev_ref(EV_DEFAULT);
+    ev_timer_stop(EV_DEFAULT, &retention.timer);
+    ev_idle_stop(EV_DEFAULT, &retention.idle);
+    retention.started = false;
+}
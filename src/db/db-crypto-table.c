@@ -1,19 +1,107 @@
 #include <db/db-crypto-table.h>
+#include <db/db-crypto-chunk.h>
 #include <core/db/db-table.h>
 #include <core/base/log.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <endian.h>
 #include <string.h>
 
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
 
-#define CRYPTO_SYM_TABLE "crypto_sym"
-#define CRYPTO_TABLE     "crypto"
+// One lookup returns at most one page of raw rows, which is never larger than the biggest LMDB page //
+#define CRYPTO_PAGE_SIZE_MAX (64 * 1024)
+
+/**
+ * @brief Raw row as stored among the values of its symbol key
+ */
+typedef struct PACKED {
+    uint64_t ts;     ///< Big-endian timestamp, orders the rows of the symbol
+    db_crypto_t row; ///< Row data
+} crypto_rec_t;
+
+#define CRYPTO_PAGE_ROWS_MAX (CRYPTO_PAGE_SIZE_MAX / sizeof(crypto_rec_t))
+
+/**
+ * @brief Raw rows of one page in the map
+ */
+typedef struct {
+    const crypto_rec_t *recs; ///< Rows of the page
+    uint32_t count;           ///< Number of rows
+    uint32_t idx;             ///< Index of the current row
+} crypto_page_t;
+
+/**
+ * @brief Read ahead of one source of rows
+ */
+typedef struct {
+    db_err_t res;    ///< Result of the read ahead, DB_ERR_NOT_FOUND past the walk
+    uint32_t sym_id; ///< Symbol ID of the row
+    uint64_t ts;     ///< Timestamp of the row
+    db_crypto_t row; ///< Row read ahead
+} crypto_head_t;
+
+/**
+ * @brief Walk state of db_crypto_get_next, which merges raw rows with the rows of the chunks
+ * @note Raw rows never share the time span of a chunk, they are sealed into it by the writer.
+ *       Chunk rows are decoded from a private copy, values in a write transaction do not outlive the next put.
+ */
+typedef struct {
+    uint32_t max_sym_id;                                          ///< Last symbol of the walk
+    bool raw_next;                                                ///< Raw row was returned, advance it first
+    bool chunk_next;                                              ///< Chunk row was returned, advance it first
+    crypto_head_t raw;                                            ///< Next raw row
+    crypto_head_t chunk;                                          ///< Next row of the chunk
+    uint32_t raw_idx;                                             ///< Index of the next raw row in the page
+    uint32_t raw_count;                                           ///< Number of raw rows in the page
+    crypto_rec_t raw_recs[CRYPTO_PAGE_ROWS_MAX];                  ///< Copy of the page of raw rows
+    uint64_t chunk_ts;                                            ///< Start of the chunk
+    db_crypto_chunk_dec_t dec;                                    ///< Decoder of the chunk
+    uint8_t data[DB_CRYPTO_CHUNK_SIZE(DB_CRYPTO_CHUNK_ROWS_MAX)]; ///< Copy of the chunk value
+} crypto_walk_t;
+
+/**
+ * @brief Buffers of db_crypto_chunk_seal, too large for the stack
+ */
+typedef struct {
+    uint32_t raw_offs[DB_CRYPTO_CHUNK_ROWS_MAX];                  ///< Offsets of the raw rows
+    db_crypto_t raw_rows[DB_CRYPTO_CHUNK_ROWS_MAX];               ///< Raw rows of the chunk time span
+    uint32_t offs[DB_CRYPTO_CHUNK_ROWS_MAX];                      ///< Offsets of the merged rows
+    db_crypto_t rows[DB_CRYPTO_CHUNK_ROWS_MAX];                   ///< Raw rows merged with the old chunk
+    uint8_t data[DB_CRYPTO_CHUNK_SIZE(DB_CRYPTO_CHUNK_ROWS_MAX)]; ///< Old chunk value, then the new one
+} crypto_seal_t;
+
+// Meta is at key 0:0 of the table, which held the raw rows under symbol and timestamp keys before //
+static db_table_t meta_table = DB_TABLE_INIT("crypto");
+static db_table_t sym_table = DB_TABLE_INIT("crypto_sym");
+static db_table_t chunk_table = DB_TABLE_INIT("crypto_chunk");
+static db_table_t lvl_table[] = {
+    [DB_CRYPTO_LVL_RAW] = DB_TABLE_INIT_DUP("crypto_raw"),
+    [DB_CRYPTO_LVL_1M] = DB_TABLE_INIT("crypto_1m"),
+    [DB_CRYPTO_LVL_5M] = DB_TABLE_INIT("crypto_5m"),
+    [DB_CRYPTO_LVL_1H] = DB_TABLE_INIT("crypto_1h"),
+    [DB_CRYPTO_LVL_1D] = DB_TABLE_INIT("crypto_1d"),
+};
+STATIC_ASSERT(ARRAY_SIZE(lvl_table) == DB_CRYPTO_LVL_MAX);
+STATIC_ASSERT(DB_CRYPTO_TABLE_COUNT == ARRAY_SIZE(lvl_table) + 3);
+
+static db_table_t *const raw_table = &lvl_table[DB_CRYPTO_LVL_RAW];
+
+static const uint32_t lvl_interval[] = {
+    [DB_CRYPTO_LVL_RAW] = 1,
+    [DB_CRYPTO_LVL_1M] = 60,
+    [DB_CRYPTO_LVL_5M] = 5 * 60,
+    [DB_CRYPTO_LVL_1H] = 3600,
+    [DB_CRYPTO_LVL_1D] = 24 * 3600,
+};
+STATIC_ASSERT(ARRAY_SIZE(lvl_interval) == DB_CRYPTO_LVL_MAX);
 
 db_err_t db_crypto_get_meta(db_crypto_meta_t *meta)
 {
     buf_t value = {
         .size = sizeof(db_crypto_meta_t),
     };
-    db_err_t res = db_get_value_by_id_ts(CRYPTO_TABLE, 0, 0, &value);
+    db_err_t res = db_get_value_by_id_ts(&meta_table, 0, 0, &value);
     if(res != DB_ERR_OK) {
         if(res == DB_ERR_NOT_FOUND) {
             log_warn("crypto meta not found, initializing new meta");
@@ -33,35 +121,172 @@ db_err_t db_crypto_put_meta(const db_crypto_meta_t *meta)
         .data = (void *)meta,
         .size = sizeof(db_crypto_meta_t),
     };
-    return db_put_value_by_id_ts(CRYPTO_TABLE, 0, 0, &value);
+    return db_put_value_by_id_ts(&meta_table, 0, 0, &value);
 }
 
 db_err_t db_crypto_get_sym(const char *sym, uint32_t *psym_id)
 {
-    return db_get_id_by_str(CRYPTO_SYM_TABLE, sym, psym_id);
+    return db_get_id_by_str(&sym_table, sym, psym_id);
 }
 
 db_err_t db_crypto_get_sym_next(const char **psym, uint32_t *psym_size, uint32_t *psym_id)
 {
-    return db_get_str_id_next(CRYPTO_SYM_TABLE, psym, psym_size, psym_id);
+    return db_get_str_id_next(&sym_table, psym, psym_size, psym_id);
 }
 
 db_err_t db_crypto_put_sym(const char *sym, uint32_t sym_id)
 {
-    return db_put_id_by_str(CRYPTO_SYM_TABLE, sym, sym_id);
+    return db_put_id_by_str(&sym_table, sym, sym_id);
 }
 
-db_err_t db_crypto_get_next(uint32_t min_sym_id, uint32_t max_sym_id, uint64_t min_ts, uint64_t max_ts, uint64_t *pts,
-                            db_crypto_t *crypto, db_cursor_op_t op)
+static void walk_raw_head(crypto_walk_t *walk)
+{
+    const crypto_rec_t *rec = &walk->raw_recs[walk->raw_idx];
+    walk->raw.ts = be64toh(rec->ts);
+    walk->raw.row = rec->row;
+}
+
+/**
+ * @brief Copy the page of raw rows at or after the key and take its first row
+ */
+static void walk_raw_read(crypto_walk_t *walk, uint32_t sym_id, uint64_t ts, db_cursor_op_t op)
+{
+    buf_t values = {
+        .size = sizeof(crypto_rec_t),
+    };
+    crypto_head_t *head = &walk->raw;
+    head->res = db_get_ts_values_by_id_next(raw_table, sym_id, walk->max_sym_id, ts, &head->sym_id, &values, op);
+    if(head->res != DB_ERR_OK) {
+        return;
+    }
+    if(values.size > sizeof(walk->raw_recs)) {
+        log_error("invalid raw page %u size=%zu", head->sym_id, values.size);
+        head->res = DB_ERR_SIZE_MISMATCH;
+        return;
+    }
+    memcpy(walk->raw_recs, values.data, values.size);
+    walk->raw_count = values.size / sizeof(crypto_rec_t);
+    walk->raw_idx = 0;
+    walk_raw_head(walk);
+}
+
+static void walk_raw_next(crypto_walk_t *walk)
+{
+    if(++walk->raw_idx < walk->raw_count) {
+        walk_raw_head(walk);
+        return;
+    }
+    walk_raw_read(walk, 0, 0, DB_CURSOR_OP_NEXT);
+}
+
+/**
+ * @brief Load the first chunk at or after the key and decode its first row
+ */
+static void walk_chunk_load(crypto_walk_t *walk, uint32_t sym_id, uint64_t ts)
 {
     buf_t value = {
-        .size = sizeof(db_crypto_t),
+        .size = 0,
     };
-    db_err_t res = db_get_ts_value_by_id_next(CRYPTO_TABLE, min_sym_id, max_sym_id, min_ts, max_ts, pts, &value, op);
-    if(res != DB_ERR_OK) {
-        return res;
+    crypto_head_t *head = &walk->chunk;
+    head->res = db_get_id_ts_value_next(&chunk_table, sym_id, walk->max_sym_id, ts, UINT64_MAX, &head->sym_id,
+                                        &walk->chunk_ts, &value, DB_CURSOR_OP_SET_RANGE);
+    if(head->res != DB_ERR_OK) {
+        return;
+    }
+    if(value.size > sizeof(walk->data) - DB_CRYPTO_CHUNK_PAD) {
+        log_error("invalid chunk %u:%" PRIu64 " size=%zu", head->sym_id, walk->chunk_ts, value.size);
+        head->res = DB_ERR_SIZE_MISMATCH;
+        return;
+    }
+    memcpy(walk->data, value.data, value.size);
+    memset(walk->data + value.size, 0, DB_CRYPTO_CHUNK_PAD);
+    head->res = db_crypto_chunk_dec_init(&walk->dec, walk->data, value.size);
+    if(head->res != DB_ERR_OK) {
+        return;
+    }
+    uint32_t off;
+    head->res = db_crypto_chunk_dec_next(&walk->dec, &off, &head->row);
+    head->ts = walk->chunk_ts + off;
+}
+
+static void walk_chunk_next(crypto_walk_t *walk)
+{
+    crypto_head_t *head = &walk->chunk;
+    uint32_t off;
+    head->res = db_crypto_chunk_dec_next(&walk->dec, &off, &head->row);
+    if(head->res == DB_ERR_OK) {
+        head->ts = walk->chunk_ts + off;
+    } else if(head->res == DB_ERR_NOT_FOUND) {
+        walk_chunk_load(walk, head->sym_id, walk->chunk_ts + 1);
+    }
+}
+
+static int walk_key_cmp(const crypto_head_t *a, const crypto_head_t *b)
+{
+    if(a->sym_id != b->sym_id) {
+        return (a->sym_id < b->sym_id) ? -1 : 1;
+    }
+    if(a->ts != b->ts) {
+        return (a->ts < b->ts) ? -1 : 1;
+    }
+    return 0;
+}
+
+db_err_t db_crypto_get_next(uint32_t min_sym_id, uint32_t max_sym_id, uint64_t min_ts, uint64_t max_ts, uint64_t *pts,
+                            db_crypto_t *crypto, db_cursor_op_t op)
+{
+    // Walk belongs to the transaction object, so walks in other objects of the thread do not disturb it //
+    crypto_walk_t *walk = db_txn_priv(sizeof(crypto_walk_t));
+    if(walk == NULL) {
+        return DB_ERR_NO_MEM;
+    }
+    if(op == DB_CURSOR_OP_SET_RANGE) {
+        walk->max_sym_id = max_sym_id;
+        walk->raw_next = false;
+        walk->chunk_next = false;
+        // Chunk which starts before the range may hold its first rows //
+        walk_chunk_load(walk, min_sym_id, min_ts - min_ts % DB_CRYPTO_CHUNK_SEC);
+        while(walk->chunk.res == DB_ERR_OK && walk->chunk.sym_id == min_sym_id && walk->chunk.ts < min_ts) {
+            walk_chunk_next(walk);
+        }
+        walk_raw_read(walk, min_sym_id, min_ts, DB_CURSOR_OP_SET_RANGE);
+    } else {
+        if(walk->chunk_next) {
+            walk_chunk_next(walk);
+        }
+        if(walk->raw_next) {
+            walk_raw_next(walk);
+        }
+    }
+
+    crypto_head_t *raw = &walk->raw, *chunk = &walk->chunk;
+    if(raw->res != DB_ERR_OK && raw->res != DB_ERR_NOT_FOUND) {
+        return raw->res;
     }
-    memcpy(crypto, value.data, sizeof(db_crypto_t));
+    if(chunk->res != DB_ERR_OK && chunk->res != DB_ERR_NOT_FOUND) {
+        return chunk->res;
+    }
+    int cmp;
+    if(raw->res == DB_ERR_OK && chunk->res == DB_ERR_OK) {
+        cmp = walk_key_cmp(raw, chunk);
+    } else if(raw->res == DB_ERR_OK) {
+        cmp = -1;
+    } else if(chunk->res == DB_ERR_OK) {
+        cmp = 1;
+    } else {
+        walk->raw_next = false;
+        walk->chunk_next = false;
+        return DB_ERR_NOT_FOUND;
+    }
+    // Raw row wins over a chunk row with the same key, it was written later //
+    const crypto_head_t *head = (cmp <= 0) ? raw : chunk;
+    walk->raw_next = (cmp <= 0);
+    walk->chunk_next = (cmp >= 0);
+    if(head->sym_id > max_sym_id || (head->sym_id == max_sym_id && head->ts >= max_ts)) {
+        return DB_ERR_NOT_FOUND;
+    }
+    *pts = head->ts;
+    memcpy(crypto, &head->row, sizeof(db_crypto_t));
     return DB_ERR_OK;
 }
 
@@ -97,9 +322,465 @@ db_err_t db_crypto_get_next2(uint32_t sym_id, uint64_t min_ts, db_cursor_op_t op
 
 db_err_t db_crypto_put(uint32_t sym_id, uint64_t ts, const db_crypto_t *crypto)
 {
+    crypto_rec_t rec = {
+        .ts = htobe64(ts),
+        .row = *crypto,
+    };
     buf_t value = {
-        .data = (void *)crypto,
-        .size = sizeof(db_crypto_t),
+        .data = &rec,
+        .size = sizeof(rec),
     };
-    return db_put_value_by_id_ts(CRYPTO_TABLE, sym_id, ts, &value);
+    return db_put_ts_value_by_id(raw_table, sym_id, &value);
+}
+
+db_err_t db_crypto_append(uint32_t sym_id, uint64_t ts, const db_crypto_t *crypto)
+{
+    crypto_rec_t rec = {
+        .ts = htobe64(ts),
+        .row = *crypto,
+    };
+    buf_t value = {
+        .data = &rec,
+        .size = sizeof(rec),
+    };
+    return db_append_ts_value_by_id(raw_table, sym_id, &value);
+}
+
+db_err_t db_crypto_raw_migrate(uint32_t *pcount)
+{
+    // Lookup in the write transaction creates the table before any reader needs it //
+    buf_t value = {
+        .size = sizeof(crypto_rec_t),
+    };
+    db_err_t res = db_get_value_by_id(raw_table, 0, &value);
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        return res;
+    }
+    uint32_t count = 0;
+    while(count < DB_CRYPTO_MIGRATE_MAX) {
+        // Rows are moved in key order, so they are appended to the pages of their symbols //
+        uint32_t sym_id;
+        uint64_t ts;
+        value.size = sizeof(db_crypto_t);
+        res = db_get_id_ts_value_next(&meta_table, 1, UINT32_MAX, 0, UINT64_MAX, &sym_id, &ts, &value,
+                                      DB_CURSOR_OP_SET_RANGE);
+        if(res != DB_ERR_OK) {
+            break;
+        }
+        db_crypto_t row;
+        memcpy(&row, value.data, sizeof(db_crypto_t));
+        res = db_crypto_append(sym_id, ts, &row);
+        if(res == DB_ERR_DBI_ORDER) {
+            res = db_crypto_put(sym_id, ts, &row);
+        }
+        if(res == DB_ERR_OK) {
+            res = db_del_value_by_id_ts(&meta_table, sym_id, ts);
+        }
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+        count++;
+    }
+    *pcount = count;
+    return res;
+}
+
+db_err_t db_crypto_has_chunk(uint32_t sym_id, uint64_t ts)
+{
+    buf_t value = {
+        .size = 0,
+    };
+    return db_get_value_by_id_ts(&chunk_table, sym_id, ts - ts % DB_CRYPTO_CHUNK_SEC, &value);
+}
+
+/**
+ * @brief Merge the old chunk with the raw rows, raw rows replace the chunk rows with the same timestamp
+ */
+static db_err_t chunk_merge(crypto_seal_t *seal, uint32_t raw_count, const buf_t *value, uint32_t *pcount)
+{
+    memcpy(seal->data, value->data, value->size);
+    memset(seal->data + value->size, 0, DB_CRYPTO_CHUNK_PAD);
+    db_crypto_chunk_dec_t dec;
+    db_err_t res = db_crypto_chunk_dec_init(&dec, seal->data, value->size);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    uint32_t off, i = 0, count = 0;
+    db_crypto_t row;
+    while((res = db_crypto_chunk_dec_next(&dec, &off, &row)) == DB_ERR_OK) {
+        while(i < raw_count && seal->raw_offs[i] <= off) {
+            seal->offs[count] = seal->raw_offs[i];
+            seal->rows[count++] = seal->raw_rows[i++];
+        }
+        if(count > 0 && seal->offs[count - 1] == off) {
+            continue;
+        }
+        seal->offs[count] = off;
+        seal->rows[count++] = row;
+    }
+    if(res != DB_ERR_NOT_FOUND) {
+        return res;
+    }
+    while(i < raw_count) {
+        seal->offs[count] = seal->raw_offs[i];
+        seal->rows[count++] = seal->raw_rows[i++];
+    }
+    *pcount = count;
+    return DB_ERR_OK;
+}
+
+/**
+ * @brief Move the raw rows of one chunk time span into the chunk
+ */
+static db_err_t chunk_seal(crypto_seal_t *seal, uint32_t sym_id, uint64_t chunk_ts)
+{
+    // Collect the raw rows page by page //
+    buf_t value = {
+        .size = sizeof(crypto_rec_t),
+    };
+    db_cursor_op_t op = DB_CURSOR_OP_SET_RANGE;
+    uint64_t end_ts = chunk_ts + DB_CRYPTO_CHUNK_SEC;
+    uint32_t raw_count = 0, id;
+    db_err_t res;
+    while((res = db_get_ts_values_by_id_next(raw_table, sym_id, sym_id, chunk_ts, &id, &value, op)) == DB_ERR_OK) {
+        const crypto_rec_t *recs = value.data;
+        uint32_t rec_count = value.size / sizeof(crypto_rec_t), i;
+        for(i = 0; i < rec_count; i++) {
+            uint64_t ts = be64toh(recs[i].ts);
+            if(ts >= end_ts) {
+                break;
+            }
+            seal->raw_offs[raw_count] = ts - chunk_ts;
+            seal->raw_rows[raw_count++] = recs[i].row;
+        }
+        if(i < rec_count) {
+            res = DB_ERR_NOT_FOUND;
+            break;
+        }
+        op = DB_CURSOR_OP_NEXT;
+        value.size = sizeof(crypto_rec_t);
+    }
+    if(res != DB_ERR_NOT_FOUND) {
+        return res;
+    }
+    if(raw_count == 0) {
+        return DB_ERR_OK;
+    }
+
+    // Merge them into the old chunk //
+    uint32_t count = raw_count;
+    value.size = 0;
+    res = db_get_value_by_id_ts(&chunk_table, sym_id, chunk_ts, &value);
+    if(res == DB_ERR_OK) {
+        if(value.size > sizeof(seal->data) - DB_CRYPTO_CHUNK_PAD) {
+            log_error("invalid chunk %u:%" PRIu64 " size=%zu", sym_id, chunk_ts, value.size);
+            return DB_ERR_SIZE_MISMATCH;
+        }
+        res = chunk_merge(seal, raw_count, &value, &count);
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+    } else if(res == DB_ERR_NOT_FOUND) {
+        memcpy(seal->offs, seal->raw_offs, raw_count * sizeof(uint32_t));
+        memcpy(seal->rows, seal->raw_rows, raw_count * sizeof(db_crypto_t));
+    } else {
+        return res;
+    }
+
+    value.data = seal->data;
+    value.size = db_crypto_chunk_encode(seal->data, seal->offs, seal->rows, count);
+    res = db_put_value_by_id_ts(&chunk_table, sym_id, chunk_ts, &value);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    for(uint32_t i = 0; i < raw_count; i++) {
+        res = db_del_ts_value_by_id(raw_table, sym_id, chunk_ts + seal->raw_offs[i]);
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+    }
+    log_debug("symbol %u: sealed %u rows at %" PRIu64 " into %zu bytes", sym_id, count, chunk_ts, value.size);
+    return DB_ERR_OK;
+}
+
+db_err_t db_crypto_chunk_seal(uint32_t sym_id, uint64_t min_ts, uint64_t max_ts, uint64_t *pchunk_ts)
+{
+    buf_t value = {
+        .size = sizeof(crypto_rec_t),
+    };
+    uint32_t id;
+    db_err_t res = db_get_ts_values_by_id_next(raw_table, sym_id, sym_id, min_ts, &id, &value, DB_CURSOR_OP_SET_RANGE);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    const crypto_rec_t *rec = value.data;
+    uint64_t ts = be64toh(rec->ts);
+    uint64_t chunk_ts = ts - ts % DB_CRYPTO_CHUNK_SEC;
+    if(chunk_ts >= max_ts) {
+        return DB_ERR_NOT_FOUND;
+    }
+    crypto_seal_t *seal = malloc(sizeof(crypto_seal_t));
+    if(seal == NULL) {
+        log_error("malloc seal buffers size=%zu failed", sizeof(crypto_seal_t));
+        return DB_ERR_NO_MEM;
+    }
+    res = chunk_seal(seal, sym_id, chunk_ts);
+    free(seal);
+    *pchunk_ts = chunk_ts;
+    return res;
+}
+
+/**
+ * @brief Read the next row of a table in the range of the purge, rows of a chunk are counted
+ * @note Page of raw rows stays valid during the walk, rows are deleted only after it
+ */
+static db_err_t purge_next(db_table_t *table, uint32_t sym_id, uint64_t min_ts, uint64_t max_ts, crypto_page_t *page,
+                           uint64_t *pts, uint32_t *prow_count, db_cursor_op_t op)
+{
+    uint32_t id;
+    if(table == raw_table) {
+        if(op == DB_CURSOR_OP_SET_RANGE || ++page->idx == page->count) {
+            buf_t values = {
+                .size = sizeof(crypto_rec_t),
+            };
+            db_err_t res = db_get_ts_values_by_id_next(raw_table, sym_id, sym_id, min_ts, &id, &values, op);
+            if(res != DB_ERR_OK) {
+                return res;
+            }
+            page->recs = values.data;
+            page->count = values.size / sizeof(crypto_rec_t);
+            page->idx = 0;
+        }
+        *pts = be64toh(page->recs[page->idx].ts);
+        *prow_count = 1;
+        return (*pts < max_ts) ? DB_ERR_OK : DB_ERR_NOT_FOUND;
+    }
+    buf_t value = {
+        .size = 0,
+    };
+    db_err_t res = db_get_id_ts_value_next(table, sym_id, sym_id, min_ts, max_ts, &id, pts, &value, op);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    *prow_count = 1;
+    if(table == &chunk_table) {
+        db_crypto_chunk_hdr_t hdr = { 0 };
+        memcpy(&hdr, value.data, (value.size < sizeof(hdr)) ? value.size : sizeof(hdr));
+        *prow_count = hdr.count;
+    }
+    return DB_ERR_OK;
+}
+
+/**
+ * @brief Delete the rows of a table before the timestamp which are covered by the buckets of the rollup table
+ * @note Keys are collected first and deleted after the walk, like the raw rows of a sealed chunk
+ */
+static db_err_t purge_table(db_table_t *table, db_crypto_lvl_t rollup_lvl, uint32_t span, uint32_t sym_id,
+                            uint64_t max_ts, db_crypto_purge_t *purge)
+{
+    uint64_t keys[DB_CRYPTO_PURGE_MAX];
+    uint32_t rows[DB_CRYPTO_PURGE_MAX];
+    uint64_t bucket_ts = UINT64_MAX;
+    db_err_t bucket_res = DB_ERR_NOT_FOUND;
+    db_cursor_op_t op = DB_CURSOR_OP_SET_RANGE;
+    uint32_t visit_count = 0, del_count = 0;
+    crypto_page_t page;
+    uint64_t ts;
+    buf_t value;
+    db_err_t res;
+    while(visit_count < DB_CRYPTO_PURGE_MAX) {
+        uint32_t row_count;
+        res = purge_next(table, sym_id, purge->next_ts, max_ts, &page, &ts, &row_count, op);
+        if(res != DB_ERR_OK) {
+            break;
+        }
+        op = DB_CURSOR_OP_NEXT;
+        visit_count++;
+        purge->next_ts = ts + 1;
+        if(rollup_lvl < DB_CRYPTO_LVL_MAX) {
+            // Rows of one bucket are checked once //
+            uint64_t cur_bucket_ts = ts - ts % lvl_interval[rollup_lvl];
+            if(cur_bucket_ts != bucket_ts) {
+                bucket_ts = cur_bucket_ts;
+                value.size = sizeof(db_crypto_rollup_t);
+                uint64_t rollup_ts;
+                bucket_res = db_get_ts_value_by_id_next(&lvl_table[rollup_lvl], sym_id, sym_id, bucket_ts, ts + span,
+                                                        &rollup_ts, &value, DB_CURSOR_OP_SET_RANGE);
+                if(bucket_res != DB_ERR_OK && bucket_res != DB_ERR_NOT_FOUND) {
+                    return bucket_res;
+                }
+            }
+            if(bucket_res != DB_ERR_OK) {
+                purge->keep_count += row_count;
+                continue;
+            }
+        }
+        keys[del_count] = ts;
+        rows[del_count++] = row_count;
+    }
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        return res;
+    }
+    for(uint32_t i = 0; i < del_count; i++) {
+        db_err_t del_res = (table == raw_table) ? db_del_ts_value_by_id(table, sym_id, keys[i])
+                                                : db_del_value_by_id_ts(table, sym_id, keys[i]);
+        if(del_res != DB_ERR_OK) {
+            return del_res;
+        }
+        purge->del_count += rows[i];
+    }
+    return res;
+}
+
+db_err_t db_crypto_purge_chunks(uint32_t sym_id, uint64_t max_ts, db_crypto_purge_t *purge)
+{
+    return purge_table(&chunk_table, DB_CRYPTO_LVL_1M, DB_CRYPTO_CHUNK_SEC, sym_id, max_ts, purge);
+}
+
+uint32_t db_crypto_lvl_interval(db_crypto_lvl_t lvl)
+{
+    return lvl_interval[lvl];
+}
+
+void db_crypto_rollup_init(db_crypto_rollup_t *rollup, const db_crypto_t *row)
+{
+    rollup->open = row->close;
+    rollup->high = row->close;
+    rollup->low = row->close;
+    rollup->close = row->close;
+    rollup->count = 1;
+    rollup->whales = row->whales;
+    rollup->volume = row->volume;
+    rollup->liq_ask = row->liq_ask;
+    rollup->liq_bid = row->liq_bid;
+    rollup->last_off = 0;
+    rollup->pad = 0;
+}
+
+db_err_t db_crypto_get_rollup(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t ts, db_crypto_rollup_t *rollup)
+{
+    buf_t value = {
+        .size = sizeof(db_crypto_rollup_t),
+    };
+    db_err_t res = db_get_value_by_id_ts(&lvl_table[lvl], sym_id, ts, &value);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    memcpy(rollup, value.data, sizeof(db_crypto_rollup_t));
+    return DB_ERR_OK;
+}
+
+db_err_t db_crypto_put_rollup(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t ts, const db_crypto_rollup_t *rollup)
+{
+    buf_t value = {
+        .data = (void *)rollup,
+        .size = sizeof(db_crypto_rollup_t),
+    };
+    return db_put_value_by_id_ts(&lvl_table[lvl], sym_id, ts, &value);
+}
+
+db_err_t db_crypto_get_rollup_next(db_crypto_lvl_t lvl, uint32_t min_sym_id, uint32_t max_sym_id, uint64_t min_ts,
+                                   uint64_t max_ts, uint64_t *pts, db_crypto_rollup_t *rollup, db_cursor_op_t op)
+{
+    if(lvl != DB_CRYPTO_LVL_RAW) {
+        buf_t value = {
+            .size = sizeof(db_crypto_rollup_t),
+        };
+        db_err_t res =
+            db_get_ts_value_by_id_next(&lvl_table[lvl], min_sym_id, max_sym_id, min_ts, max_ts, pts, &value, op);
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+        memcpy(rollup, value.data, sizeof(db_crypto_rollup_t));
+        return DB_ERR_OK;
+    }
+    db_crypto_t row;
+    db_err_t res = db_crypto_get_next(min_sym_id, max_sym_id, min_ts, max_ts, pts, &row, op);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    db_crypto_rollup_init(rollup, &row);
+    return DB_ERR_OK;
+}
+
+db_err_t db_crypto_purge(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t max_ts, db_crypto_purge_t *purge)
+{
+    return purge_table(&lvl_table[lvl], lvl + 1, lvl_interval[lvl], sym_id, max_ts, purge);
+}
+
+void db_crypto_rollup_fold(db_crypto_rollup_t *dst, uint64_t dst_ts, uint64_t src_ts, const db_crypto_rollup_t *src)
+{
+    uint32_t last_off = src_ts + src->last_off - dst_ts;
+    if(dst->count == 0) {
+        *dst = *src;
+        dst->last_off = last_off;
+        return;
+    }
+    dst->high = (src->high > dst->high) ? src->high : dst->high;
+    dst->low = (src->low < dst->low) ? src->low : dst->low;
+    dst->close = src->close;
+    dst->count += src->count;
+    dst->whales += src->whales;
+    dst->volume += src->volume;
+    dst->liq_ask += src->liq_ask;
+    dst->liq_bid += src->liq_bid;
+    dst->last_off = last_off;
+}
+
+void db_crypto_bucket_init(db_crypto_bucket_iter_t *iter, uint32_t sym_id, uint64_t min_ts, uint64_t max_ts,
+                           uint32_t interval)
+{
+    // Rollup buckets must not cross the range or the requested buckets //
+    db_crypto_lvl_t lvl = DB_CRYPTO_LVL_MAX - 1;
+    while(lvl > DB_CRYPTO_LVL_RAW) {
+        uint32_t lvl_sec = lvl_interval[lvl];
+        if(interval % lvl_sec == 0 && min_ts % lvl_sec == 0 && (max_ts % lvl_sec == 0 || max_ts == UINT64_MAX)) {
+            break;
+        }
+        lvl--;
+    }
+    iter->sym_id = sym_id;
+    iter->interval = interval;
+    iter->lvl = lvl;
+    iter->end_ts = max_ts;
+    iter->res = db_crypto_get_rollup_next(lvl, sym_id, sym_id, min_ts, max_ts, &iter->ts, &iter->row,
+                                          DB_CURSOR_OP_SET_RANGE);
+}
+
+db_err_t db_crypto_get_bucket(db_crypto_bucket_iter_t *iter, db_crypto_bucket_t *bucket)
+{
+    if(iter->res != DB_ERR_OK) {
+        return iter->res;
+    }
+    uint64_t bucket_ts = iter->ts - iter->ts % iter->interval;
+    uint64_t bucket_end = bucket_ts + iter->interval;
+    // Sums are kept in double, a bucket may fold millions of rows //
+    double volume = 0, liq_ask = 0, liq_bid = 0, whales = 0;
+    bucket->ts = bucket_ts;
+    bucket->open = iter->row.open;
+    bucket->high = iter->row.high;
+    bucket->low = iter->row.low;
+    bucket->count = 0;
+    do {
+        const db_crypto_rollup_t *row = &iter->row;
+        bucket->high = (row->high > bucket->high) ? row->high : bucket->high;
+        bucket->low = (row->low < bucket->low) ? row->low : bucket->low;
+        bucket->close = row->close;
+        volume += row->volume;
+        liq_ask += row->liq_ask;
+        liq_bid += row->liq_bid;
+        whales += row->whales;
+        bucket->count += row->count;
+        iter->res = db_crypto_get_rollup_next(iter->lvl, iter->sym_id, iter->sym_id, 0, iter->end_ts, &iter->ts,
+                                              &iter->row, DB_CURSOR_OP_NEXT);
+    } while(iter->res == DB_ERR_OK && iter->ts < bucket_end);
+
+    bucket->volume = volume;
+    bucket->liq_ask = liq_ask / bucket->count;
+    bucket->liq_bid = liq_bid / bucket->count;
+    bucket->whales = whales / bucket->count;
+    if(iter->res != DB_ERR_OK && iter->res != DB_ERR_NOT_FOUND) {
+        return iter->res;
+    }
+    return DB_ERR_OK;
 }
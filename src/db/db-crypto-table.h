@@ -2,6 +2,9 @@
 
 #include <db/db-crypto.h>
 
+#define DB_CRYPTO_PURGE_MAX   1024        ///< Rows visited by one purge call
+#define DB_CRYPTO_MIGRATE_MAX (64 * 1024) ///< Rows moved by one migration call
+
 /**
  * @brief Structure to hold cryptocurrency metadata
  */
@@ -22,6 +25,74 @@ typedef struct {
     uint8_t pad[3]; ///< Padding for alignment
 } db_crypto_t;
 
+/**
+ * @brief Enumeration of cryptocurrency data tables by resolution
+ */
+typedef enum {
+    DB_CRYPTO_LVL_RAW, ///< Rows as ingested
+    DB_CRYPTO_LVL_1M,  ///< 1 minute rollups
+    DB_CRYPTO_LVL_5M,  ///< 5 minute rollups
+    DB_CRYPTO_LVL_1H,  ///< 1 hour rollups
+    DB_CRYPTO_LVL_1D,  ///< 1 day rollups
+    DB_CRYPTO_LVL_MAX,
+} db_crypto_lvl_t;
+
+/**
+ * @brief Structure to hold cryptocurrency data rolled up over a fixed bucket
+ * @note Sums are stored instead of averages, so rows can be folded in one at a time
+ */
+typedef struct {
+    float open;        ///< First closing price in the bucket
+    float high;        ///< Highest closing price
+    float low;         ///< Lowest closing price
+    float close;       ///< Last closing price
+    uint32_t count;    ///< Number of raw rows in the bucket
+    uint32_t whales;   ///< Sum of the whale transactions
+    double volume;     ///< Sum of the trading volumes
+    double liq_ask;    ///< Sum of the liquidity on the ask side
+    double liq_bid;    ///< Sum of the liquidity on the bid side
+    uint32_t last_off; ///< Offset of the last raw row from the start of the bucket
+    uint32_t pad;      ///< Padding for alignment
+} db_crypto_rollup_t;
+
+/**
+ * @brief Structure to hold cryptocurrency data aggregated over a time bucket
+ */
+typedef struct {
+    uint64_t ts;    ///< Start of the bucket, a multiple of the interval
+    float open;     ///< First closing price in the bucket
+    float high;     ///< Highest closing price
+    float low;      ///< Lowest closing price
+    float close;    ///< Last closing price
+    float volume;   ///< Sum of the trading volumes
+    float liq_ask;  ///< Average liquidity on the ask side
+    float liq_bid;  ///< Average liquidity on the bid side
+    float whales;   ///< Average number of whale transactions
+    uint32_t count; ///< Number of rows in the bucket
+} db_crypto_bucket_t;
+
+/**
+ * @brief Progress of a purge of expired rows over several batches
+ */
+typedef struct {
+    uint64_t next_ts;    ///< Start of the next batch
+    uint32_t del_count;  ///< Number of deleted rows
+    uint32_t keep_count; ///< Number of expired rows kept, their bucket in the next coarser table is missing
+} db_crypto_purge_t;
+
+/**
+ * @brief Cursor walk state of db_crypto_get_bucket
+ */
+typedef struct {
+    uint32_t sym_id;        ///< Cryptocurrency symbol ID
+    uint32_t interval;      ///< Length of the buckets in seconds
+    db_crypto_lvl_t lvl;    ///< Table the buckets are folded from
+    uint64_t end_ts;        ///< End of the range, exclusive
+    uint64_t ts;            ///< Timestamp of the row read ahead
+    db_crypto_rollup_t row; ///< Row read ahead, the first one of the next bucket
+    db_err_t res;           ///< Result of the read ahead, DB_ERR_NOT_FOUND past the range
+} db_crypto_bucket_iter_t;
+
 /**
  * @brief Retrieve cryptocurrency metadata from the database
  * @param meta - [out] Pointer to store retrieved metadata
@@ -71,6 +142,9 @@ db_err_t db_crypto_put_sym(const char *sym, uint32_t sym_id);
  * @param crypto - [out] Pointer to store the retrieved cryptocurrency data
  * @param op - [in] Cursor operation (e.g., NEXT, PREV)
  * @return DB_ERR_OK on success, error code otherwise
+ * @note Raw rows and the rows of the compressed chunks are returned as one sequence.
+ *       Raw rows are read a page at a time into the walk state, which is kept per transaction object,
+ *       so one object runs one walk at a time
  */
 db_err_t db_crypto_get_next(uint32_t min_sym_id, uint32_t max_sym_id, uint64_t min_ts, uint64_t max_ts, uint64_t *pts,
                             db_crypto_t *crypto, db_cursor_op_t op);
@@ -95,10 +169,146 @@ db_err_t db_crypto_get_next1(uint32_t sym_id, db_cursor_op_t op, crypto_t *crypt
 db_err_t db_crypto_get_next2(uint32_t sym_id, uint64_t min_ts, db_cursor_op_t op, crypto_t *crypto);
 
 /**
- * @brief Put cryptocurrency data in the database
+ * @brief Put cryptocurrency data in the database, the row with the same timestamp is replaced
  * @param sym_id - [in] Cryptocurrency symbol ID
  * @param ts - [in] Timestamp of the cryptocurrency data
  * @param crypto - [in] Pointer to cryptocurrency data to be added
  * @return DB_ERR_OK on success, error code otherwise
  */
 db_err_t db_crypto_put(uint32_t sym_id, uint64_t ts, const db_crypto_t *crypto);
+
+/**
+ * @brief Append cryptocurrency data after the last raw row of the symbol
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param ts - [in] Timestamp of the cryptocurrency data
+ * @param crypto - [in] Pointer to cryptocurrency data to be added
+ * @return DB_ERR_OK on success, DB_ERR_DBI_ORDER if a row of the symbol is after it, error code otherwise
+ */
+db_err_t db_crypto_append(uint32_t sym_id, uint64_t ts, const db_crypto_t *crypto);
+
+/**
+ * @brief Move raw rows from the symbol and timestamp keys of the old layout to the values of their symbol keys
+ * @param pcount - [out] Pointer to store the number of moved rows
+ * @return DB_ERR_OK if rows may be left, DB_ERR_NOT_FOUND if all are moved, error code otherwise
+ * @note At most DB_CRYPTO_MIGRATE_MAX rows are moved in one call
+ */
+db_err_t db_crypto_raw_migrate(uint32_t *pcount);
+
+/**
+ * @brief Check if a chunk holds the rows of the time span of the timestamp
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param ts - [in] Timestamp in the time span of the chunk
+ * @return DB_ERR_OK if the chunk exists, DB_ERR_NOT_FOUND if not, error code otherwise
+ */
+db_err_t db_crypto_has_chunk(uint32_t sym_id, uint64_t ts);
+
+/**
+ * @brief Seal the raw rows of the time span of the first raw row in the range into its chunk
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param min_ts - [in] Minimum timestamp of the raw row
+ * @param max_ts - [in] End of the range, exclusive, for the start of the chunk
+ * @param pchunk_ts - [out] Pointer to store the start of the sealed chunk
+ * @return DB_ERR_OK on success, DB_ERR_NOT_FOUND if no raw rows are left in the range, error code otherwise
+ * @note Rows already in the chunk are kept unless a raw row has the same timestamp
+ */
+db_err_t db_crypto_chunk_seal(uint32_t sym_id, uint64_t min_ts, uint64_t max_ts, uint64_t *pchunk_ts);
+
+/**
+ * @brief Delete the chunks which start before the timestamp and have 1 minute rollups in their time span
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param max_ts - [in] End of the range, exclusive, a multiple of DB_CRYPTO_CHUNK_SEC
+ * @param purge - [in,out] Pointer to the purge progress, rows of the chunks are counted
+ * @return DB_ERR_OK if chunks may be left in the range, DB_ERR_NOT_FOUND past the range, error code otherwise
+ * @note At most DB_CRYPTO_PURGE_MAX chunks are visited in one call
+ */
+db_err_t db_crypto_purge_chunks(uint32_t sym_id, uint64_t max_ts, db_crypto_purge_t *purge);
+
+/**
+ * @brief Get the bucket length of the table
+ * @param lvl - [in] Table resolution
+ * @return Bucket length in seconds, 1 for raw rows
+ */
+uint32_t db_crypto_lvl_interval(db_crypto_lvl_t lvl);
+
+/**
+ * @brief Initialize a single row rollup
+ * @param rollup - [out] Pointer to the rollup
+ * @param row - [in] Pointer to the raw row
+ */
+void db_crypto_rollup_init(db_crypto_rollup_t *rollup, const db_crypto_t *row);
+
+/**
+ * @brief Retrieve rolled up cryptocurrency data of one bucket
+ * @param lvl - [in] Rollup table resolution, not DB_CRYPTO_LVL_RAW
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param ts - [in] Start of the bucket
+ * @param rollup - [out] Pointer to store the rolled up data
+ * @return DB_ERR_OK on success, error code otherwise
+ */
+db_err_t db_crypto_get_rollup(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t ts, db_crypto_rollup_t *rollup);
+
+/**
+ * @brief Put rolled up cryptocurrency data of one bucket
+ * @param lvl - [in] Rollup table resolution, not DB_CRYPTO_LVL_RAW
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param ts - [in] Start of the bucket
+ * @param rollup - [in] Pointer to the rolled up data
+ * @return DB_ERR_OK on success, error code otherwise
+ */
+db_err_t db_crypto_put_rollup(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t ts, const db_crypto_rollup_t *rollup);
+
+/**
+ * @brief Retrieve next rolled up cryptocurrency data, raw rows are returned as single row rollups
+ * @param lvl - [in] Table resolution
+ * @param min_sym_id - [in] Minimum symbol ID to consider
+ * @param max_sym_id - [in] Maximum symbol ID to consider
+ * @param min_ts - [in] Minimum timestamp to consider
+ * @param max_ts - [in] Maximum timestamp to consider
+ * @param pts - [out] Pointer to store the start of the bucket
+ * @param rollup - [out] Pointer to store the rolled up data
+ * @param op - [in] Cursor operation (e.g., NEXT, PREV)
+ * @return DB_ERR_OK on success, error code otherwise
+ */
+db_err_t db_crypto_get_rollup_next(db_crypto_lvl_t lvl, uint32_t min_sym_id, uint32_t max_sym_id, uint64_t min_ts,
+                                   uint64_t max_ts, uint64_t *pts, db_crypto_rollup_t *rollup, db_cursor_op_t op);
+
+/**
+ * @brief Delete the rows of the table before the timestamp whose bucket in the next coarser table exists
+ * @param lvl - [in] Table resolution, rows of the coarsest table are deleted without the check
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param max_ts - [in] End of the range, exclusive, a multiple of the bucket length of the next coarser table
+ * @param purge - [in,out] Pointer to the purge progress
+ * @return DB_ERR_OK if rows may be left in the range, DB_ERR_NOT_FOUND past the range, error code otherwise
+ * @note At most DB_CRYPTO_PURGE_MAX rows are visited in one call, raw rows sealed into chunks are not visited
+ */
+db_err_t db_crypto_purge(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t max_ts, db_crypto_purge_t *purge);
+
+/**
+ * @brief Fold rolled up data into a coarser bucket, sources must be folded in time order
+ * @param dst - [in,out] Pointer to the bucket, count is 0 for an empty one
+ * @param dst_ts - [in] Start of the bucket
+ * @param src_ts - [in] Start of the folded data
+ * @param src - [in] Pointer to the folded data
+ */
+void db_crypto_rollup_fold(db_crypto_rollup_t *dst, uint64_t dst_ts, uint64_t src_ts, const db_crypto_rollup_t *src);
+
+/**
+ * @brief Position the bucket walk at the first row of the range
+ * @param iter - [out] Pointer to the walk state
+ * @param sym_id - [in] Cryptocurrency symbol ID
+ * @param min_ts - [in] Start of the range
+ * @param max_ts - [in] End of the range, exclusive
+ * @param interval - [in] Length of the buckets in seconds, buckets start at multiples of it
+ * @note Buckets are folded from the coarsest rollup table that is aligned with the interval and the range.
+ *       Rows are read with the cursors of the current read transaction, which the caller closes after the walk
+ */
+void db_crypto_bucket_init(db_crypto_bucket_iter_t *iter, uint32_t sym_id, uint64_t min_ts, uint64_t max_ts,
+                           uint32_t interval);
+
+/**
+ * @brief Fold the rows of the next non-empty bucket
+ * @param iter - [in] Pointer to the walk state
+ * @param bucket - [out] Pointer to store the aggregated bucket
+ * @return DB_ERR_OK on success, DB_ERR_NOT_FOUND past the range, error code otherwise
+ */
+db_err_t db_crypto_get_bucket(db_crypto_bucket_iter_t *iter, db_crypto_bucket_t *bucket);
@@ -1,15 +1,18 @@
 #include <db/db-crypto.h>
 #include <db/db-crypto-table.h>
+#include <db/db-crypto-chunk.h>
 #include <core/json/json-parser.h>
 #include <core/csv/csv-parser.h>
 #include <core/csv/csv-gen.h>
 #include <core/base/file.h>
 #include <core/base/log.h>
 #include <sys/stat.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <ev.h>
 
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
@@ -32,11 +35,37 @@ typedef struct {
 } crypto_sym_arr_gen_t;
 
 typedef struct {
+    db_txn_t *txn;
     db_cursor_op_t op;
     uint32_t sym_id;
     uint32_t line_count;
+    uint32_t append_count;
+    bool append;
+    uint64_t min_ts;
+    uint64_t max_ts;
 } crypto_csv_parse_t;
 
+typedef struct {
+    db_crypto_commit_cb_t cb;
+    void *priv_data;
+    uint32_t sym_id;
+    crypto_t crypto;
+} crypto_queue_row_t;
+
+/**
+ * @brief Write-behind queue of the live rows, committed in one write transaction
+ */
+typedef struct {
+    ev_prepare prepare;                        ///< Commits the queue at the end of the loop iteration
+    ev_timer timer;                            ///< Commits the queue after the flush interval
+    ev_tstamp flush_sec;                       ///< Flush interval, 0 to commit every loop iteration
+    uint32_t count;                            ///< Number of queued rows
+    crypto_queue_row_t rows[CRYPTO_QUEUE_MAX]; ///< Queued rows
+} crypto_queue_t;
+
+// Queue is committed before it overflows, even if the flush interval did not pass //
+static crypto_queue_t queue;
+
 static const char *const csv_col_names[] = {
     [CRYPTO_CSV_COL_TS] = "timestamp",    [CRYPTO_CSV_COL_PRICE] = "price",     [CRYPTO_CSV_COL_VOLUME] = "volume",
     [CRYPTO_CSV_COL_LIQ_ASK] = "liq_ask", [CRYPTO_CSV_COL_LIQ_BID] = "liq_bid", [CRYPTO_CSV_COL_WHALES] = "whales",
@@ -60,13 +89,360 @@ static json_parse_err_t json_parse_crypto_arr(const jsmntok_t *cur, const char *
     return json_parse_arr(cur, json, json_parse_crypto_sym, gen);
 }
 
-db_err_t db_crypto_init(const char *crypto_list_path)
+/**
+ * @brief Rebuild a batch of buckets of the rollup table in one write transaction
+ * @note The batch ends with the first bucket which is complete after batch_max rows of the finer table are folded
+ * @return DB_ERR_OK if more buckets follow the batch, DB_ERR_NOT_FOUND after the last one, error code otherwise
+ */
+static db_err_t rollup_rebuild_txn(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t *pstart_ts, uint64_t end_ts,
+                                   uint32_t batch_max, uint32_t *pcount)
+{
+    db_err_t res = db_txn_begin(false);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    uint32_t lvl_sec = db_crypto_lvl_interval(lvl);
+    db_crypto_rollup_t rollup = { 0 }, src;
+    db_cursor_op_t op = DB_CURSOR_OP_SET_RANGE;
+    uint64_t bucket_ts = 0, src_ts, next_ts = end_ts;
+    uint32_t count = 0, src_count = 0;
+    while((res = db_crypto_get_rollup_next(lvl - 1, sym_id, sym_id, *pstart_ts, end_ts, &src_ts, &src, op)) ==
+          DB_ERR_OK) {
+        op = DB_CURSOR_OP_NEXT;
+        uint64_t src_bucket_ts = src_ts - src_ts % lvl_sec;
+        if(rollup.count > 0 && src_bucket_ts != bucket_ts) {
+            res = db_crypto_put_rollup(lvl, sym_id, bucket_ts, &rollup);
+            if(res != DB_ERR_OK) {
+                break;
+            }
+            rollup.count = 0;
+            count++;
+            if(src_count >= batch_max) {
+                next_ts = src_bucket_ts;
+                break;
+            }
+        }
+        bucket_ts = src_bucket_ts;
+        db_crypto_rollup_fold(&rollup, bucket_ts, src_ts, &src);
+        src_count++;
+    }
+    if(res == DB_ERR_NOT_FOUND && rollup.count > 0) {
+        db_err_t put_res = db_crypto_put_rollup(lvl, sym_id, bucket_ts, &rollup);
+        if(put_res != DB_ERR_OK) {
+            res = put_res;
+        }
+        count++;
+    }
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        db_txn_abort();
+        return res;
+    }
+    db_err_t commit_res = db_txn_commit();
+    if(commit_res != DB_ERR_OK) {
+        return commit_res;
+    }
+    // Batch is repeated from the same bucket if it fails //
+    *pstart_ts = next_ts;
+    *pcount += count;
+    return res;
+}
+
+/**
+ * @brief Rebuild the buckets of all rollup tables which cover the range
+ * @note Every table is folded from the next finer one in batches, each in its own write transaction
+ */
+static db_err_t rollup_rebuild(uint32_t sym_id, uint64_t min_ts, uint64_t max_ts)
+{
+    for(db_crypto_lvl_t lvl = DB_CRYPTO_LVL_1M; lvl < DB_CRYPTO_LVL_MAX; lvl++) {
+        uint32_t lvl_sec = db_crypto_lvl_interval(lvl);
+        uint64_t start_ts = min_ts - min_ts % lvl_sec;
+        uint64_t end_ts = max_ts;
+        if(end_ts % lvl_sec != 0) {
+            end_ts = (end_ts > UINT64_MAX - lvl_sec) ? UINT64_MAX : end_ts - end_ts % lvl_sec + lvl_sec;
+        }
+        // Day buckets are written in one transaction, rollup_migrate takes any of them for a complete rebuild //
+        uint32_t batch_max = (lvl == DB_CRYPTO_LVL_1D) ? UINT32_MAX : DB_TXN_SIZE;
+        uint32_t count = 0;
+        db_err_t res;
+        do {
+            res = rollup_rebuild_txn(lvl, sym_id, &start_ts, end_ts, batch_max, &count);
+            if(res == DB_ERR_MAP_FULL) {
+                // Map is grown by the end of the failed transaction //
+                res = rollup_rebuild_txn(lvl, sym_id, &start_ts, end_ts, batch_max, &count);
+            }
+            if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+                return res;
+            }
+        } while(res == DB_ERR_OK);
+        log_debug("symbol %u: rebuilt %u buckets of %us", sym_id, count, lvl_sec);
+    }
+    return DB_ERR_OK;
+}
+
+/**
+ * @brief Refold one bucket from the next finer table
+ */
+static db_err_t rollup_refold(db_crypto_lvl_t lvl, uint32_t sym_id, uint64_t bucket_ts, db_crypto_rollup_t *rollup)
+{
+    uint64_t end_ts = bucket_ts + db_crypto_lvl_interval(lvl);
+    db_cursor_op_t op = DB_CURSOR_OP_SET_RANGE;
+    db_crypto_rollup_t src;
+    uint64_t src_ts;
+    db_err_t res;
+    rollup->count = 0;
+    while((res = db_crypto_get_rollup_next(lvl - 1, sym_id, sym_id, bucket_ts, end_ts, &src_ts, &src, op)) ==
+          DB_ERR_OK) {
+        db_crypto_rollup_fold(rollup, bucket_ts, src_ts, &src);
+        op = DB_CURSOR_OP_NEXT;
+    }
+    return (res == DB_ERR_NOT_FOUND) ? DB_ERR_OK : res;
+}
+
+/**
+ * @brief Fold a new raw row into the buckets of all rollup tables
+ * @note Rows arriving in order are folded directly. A repeated or late row refolds its buckets instead,
+ *       the finer table is updated first, so only 1 minute buckets are ever read from raw rows.
+ */
+static db_err_t rollup_add(uint32_t sym_id, uint64_t ts, const db_crypto_t *row)
+{
+    db_crypto_rollup_t src;
+    db_crypto_rollup_init(&src, row);
+    for(db_crypto_lvl_t lvl = DB_CRYPTO_LVL_1M; lvl < DB_CRYPTO_LVL_MAX; lvl++) {
+        uint64_t bucket_ts = ts - ts % db_crypto_lvl_interval(lvl);
+        db_crypto_rollup_t rollup;
+        db_err_t res = db_crypto_get_rollup(lvl, sym_id, bucket_ts, &rollup);
+        if(res == DB_ERR_NOT_FOUND) {
+            rollup.count = 0;
+            db_crypto_rollup_fold(&rollup, bucket_ts, ts, &src);
+        } else if(res != DB_ERR_OK) {
+            return res;
+        } else if(ts - bucket_ts > rollup.last_off) {
+            db_crypto_rollup_fold(&rollup, bucket_ts, ts, &src);
+        } else {
+            res = rollup_refold(lvl, sym_id, bucket_ts, &rollup);
+            if(res != DB_ERR_OK) {
+                return res;
+            }
+        }
+        res = db_crypto_put_rollup(lvl, sym_id, bucket_ts, &rollup);
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+    }
+    return DB_ERR_OK;
+}
+
+static db_err_t raw_migrate_txn(uint32_t *pcount)
 {
-    db_crypto_meta_t meta;
     db_err_t res = db_txn_begin(false);
     if(res != DB_ERR_OK) {
         return res;
     }
+    res = db_crypto_raw_migrate(pcount);
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        db_txn_abort();
+        return res;
+    }
+    db_err_t commit_res = db_txn_commit();
+    return (commit_res != DB_ERR_OK) ? commit_res : res;
+}
+
+/**
+ * @brief Create the raw table and move the rows of the old key layout into it, each batch in its own write transaction
+ */
+static db_err_t raw_migrate(void)
+{
+    ev_tstamp start = ev_time();
+    uint32_t count = 0;
+    db_err_t res;
+    do {
+        uint32_t batch_count = 0;
+        res = raw_migrate_txn(&batch_count);
+        if(res == DB_ERR_MAP_FULL) {
+            // Map is grown by the end of the failed transaction //
+            res = raw_migrate_txn(&batch_count);
+        }
+        if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+            return res;
+        }
+        count += batch_count;
+    } while(res == DB_ERR_OK);
+    if(count > 0) {
+        log_info("migrated %u raw rows in %.1fs", count, ev_time() - start);
+    }
+    return DB_ERR_OK;
+}
+
+/**
+ * @brief Create the rollup tables and roll up symbols which have raw rows but no rollups yet
+ */
+static db_err_t rollup_migrate(const db_crypto_meta_t *meta)
+{
+    db_err_t res = db_txn_begin(false);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    // Lookups in a write transaction create missing tables before any reader needs them //
+    db_crypto_rollup_t rollup;
+    for(db_crypto_lvl_t lvl = DB_CRYPTO_LVL_1M; lvl < DB_CRYPTO_LVL_MAX; lvl++) {
+        res = db_crypto_get_rollup(lvl, 0, 0, &rollup);
+        if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+            db_txn_abort();
+            return res;
+        }
+    }
+    res = db_txn_commit();
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+
+    for(uint32_t sym_id = 1; sym_id <= meta->sym_id_last; sym_id++) {
+        // Day buckets are written last by rollup_rebuild, so a symbol with any of them was rolled up completely //
+        uint64_t ts;
+        res = db_crypto_get_rollup_next(DB_CRYPTO_LVL_1D, sym_id, sym_id, 0, UINT64_MAX, &ts, &rollup,
+                                        DB_CURSOR_OP_SET_RANGE);
+        if(res == DB_ERR_NOT_FOUND) {
+            res = db_crypto_get_rollup_next(DB_CRYPTO_LVL_RAW, sym_id, sym_id, 0, UINT64_MAX, &ts, &rollup,
+                                            DB_CURSOR_OP_SET_RANGE);
+            db_txn_abort();
+            if(res == DB_ERR_OK) {
+                log_info("symbol %u: building rollup tables", sym_id);
+                res = rollup_rebuild(sym_id, 0, UINT64_MAX);
+            } else if(res == DB_ERR_NOT_FOUND) {
+                res = DB_ERR_OK;
+            }
+        } else {
+            db_txn_abort();
+        }
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+    }
+    return DB_ERR_OK;
+}
+
+#ifdef CONFIG_DB_CRYPTO_CHUNK
+/**
+ * @brief Seal every chunk time span with raw rows in the range, each in its own write transaction
+ */
+static db_err_t chunk_seal_range(uint32_t sym_id, uint64_t min_ts, uint64_t max_ts)
+{
+    uint32_t count = 0;
+    db_err_t res;
+    while(true) {
+        res = db_txn_begin(false);
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+        uint64_t chunk_ts;
+        res = db_crypto_chunk_seal(sym_id, min_ts, max_ts, &chunk_ts);
+        if(res != DB_ERR_OK) {
+            db_txn_abort();
+            break;
+        }
+        res = db_txn_commit();
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+        min_ts = chunk_ts + DB_CRYPTO_CHUNK_SEC;
+        count++;
+    }
+    if(count > 0) {
+        log_info("symbol %u: sealed %u chunks", sym_id, count);
+    }
+    return (res == DB_ERR_NOT_FOUND) ? DB_ERR_OK : res;
+}
+
+/**
+ * @brief Seal the finished time spans of a new raw row, or the row itself if its time span has a chunk
+ */
+static db_err_t chunk_add(uint32_t sym_id, uint64_t ts)
+{
+    uint64_t chunk_ts = ts - ts % DB_CRYPTO_CHUNK_SEC;
+    db_err_t res = db_crypto_has_chunk(sym_id, ts);
+    if(res == DB_ERR_OK) {
+        return db_crypto_chunk_seal(sym_id, chunk_ts, chunk_ts + 1, &chunk_ts);
+    }
+    if(res != DB_ERR_NOT_FOUND) {
+        return res;
+    }
+    // Time spans before the one of the newest row do not get more rows in order //
+    uint64_t min_ts = 0, sealed_ts;
+    while((res = db_crypto_chunk_seal(sym_id, min_ts, chunk_ts, &sealed_ts)) == DB_ERR_OK) {
+        min_ts = sealed_ts + DB_CRYPTO_CHUNK_SEC;
+    }
+    return (res == DB_ERR_NOT_FOUND) ? DB_ERR_OK : res;
+}
+
+/**
+ * @brief Create the chunk table and seal the finished time spans of all symbols
+ */
+static db_err_t chunk_migrate(const db_crypto_meta_t *meta)
+{
+    db_err_t res = db_txn_begin(false);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    res = db_crypto_has_chunk(0, 0);
+    if(res != DB_ERR_OK && res != DB_ERR_NOT_FOUND) {
+        db_txn_abort();
+        return res;
+    }
+    res = db_txn_commit();
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    uint64_t now = time(NULL);
+    for(uint32_t sym_id = 1; sym_id <= meta->sym_id_last; sym_id++) {
+        res = chunk_seal_range(sym_id, 0, now - now % DB_CRYPTO_CHUNK_SEC);
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+    }
+    return DB_ERR_OK;
+}
+#endif
+
+/**
+ * @brief Bring the derived tables of an existing database up to date
+ */
+static db_err_t crypto_migrate(const db_crypto_meta_t *meta)
+{
+    // Derived tables are built from the raw rows, which must be in their new layout first //
+    db_err_t res = raw_migrate();
+    if(res == DB_ERR_OK) {
+        res = rollup_migrate(meta);
+    }
+#ifdef CONFIG_DB_CRYPTO_CHUNK
+    if(res == DB_ERR_OK) {
+        res = chunk_migrate(meta);
+    }
+#endif
+    return res;
+}
+
+static void queue_prepare_cb(UNUSED struct ev_loop *loop, UNUSED ev_prepare *w, UNUSED int revents)
+{
+    db_crypto_flush();
+}
+
+static void queue_timer_cb(UNUSED struct ev_loop *loop, UNUSED ev_timer *w, UNUSED int revents)
+{
+    db_crypto_flush();
+}
+
+db_err_t db_crypto_init(const char *crypto_list_path, uint32_t flush_ms)
+{
+    ev_prepare_init(&queue.prepare, queue_prepare_cb);
+    ev_init(&queue.timer, queue_timer_cb);
+    queue.flush_sec = flush_ms / 1000.0;
+    queue.count = 0;
+
+    db_crypto_meta_t meta;
+    db_err_t res = db_txn_begin(db_is_rd_only());
+    if(res != DB_ERR_OK) {
+        return res;
+    }
     res = db_crypto_get_meta(&meta);
     if(res != DB_ERR_OK) {
         db_txn_abort();
@@ -74,7 +450,11 @@ db_err_t db_crypto_init(const char *crypto_list_path)
     }
     if(meta.sym_count > 0) {
         db_txn_abort();
-        return DB_ERR_OK;
+        // Read-only environment, e.g. for export, can not create the tables //
+        if(db_is_rd_only()) {
+            return DB_ERR_OK;
+        }
+        return crypto_migrate(&meta);
     }
 
     // Read default crypto list //
@@ -119,8 +499,11 @@ db_err_t db_crypto_init(const char *crypto_list_path)
         db_txn_abort();
         return res;
     }
-
-    return db_txn_commit();
+    res = db_txn_commit();
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+    return crypto_migrate(&meta);
 }
 
 static csv_parse_err_t csv_parse_row(const csv_parse_ctx_t *pctx, const char **cols, const uint32_t cols_count,
@@ -152,9 +535,27 @@ static csv_parse_err_t csv_parse_row(const csv_parse_ctx_t *pctx, const char **c
             return CSV_PARSE_ERR_ABORT;
         }
     }
-    if(db_crypto_put(ctx->sym_id, ts, &crypto) != DB_ERR_OK) {
+    db_err_t db_res = DB_ERR_DBI_ORDER;
+    if(ctx->append) {
+        // Sorted rows past the last row of the symbol are appended to its last page without a search //
+        if(ctx->line_count == 0 || ts > ctx->max_ts) {
+            db_res = db_crypto_append(ctx->sym_id, ts, &crypto);
+        }
+        if(db_res == DB_ERR_DBI_ORDER) {
+            log_info("row %u is not after the last stored row, continuing with regular puts", ctx->line_count + 1);
+            ctx->append = false;
+        } else if(db_res == DB_ERR_OK) {
+            ctx->append_count++;
+        }
+    }
+    if(db_res == DB_ERR_DBI_ORDER) {
+        db_res = db_crypto_put(ctx->sym_id, ts, &crypto);
+    }
+    if(db_res != DB_ERR_OK) {
         return CSV_PARSE_ERR_INVALID;
     }
+    ctx->min_ts = (ts < ctx->min_ts) ? ts : ctx->min_ts;
+    ctx->max_ts = (ts > ctx->max_ts) ? ts : ctx->max_ts;
     ctx->line_count++;
     return CSV_PARSE_ERR_OK;
 }
@@ -163,6 +564,10 @@ db_err_t db_crypto_import_csv(const char *csv_path, const char *sym_name)
 {
     crypto_csv_parse_t ctx = {
         .line_count = 0,
+        .append_count = 0,
+        .append = true,
+        .min_ts = UINT64_MAX,
+        .max_ts = 0,
     };
     db_err_t res = db_crypto_get_sym(sym_name, &ctx.sym_id);
     if(res != DB_ERR_OK) {
@@ -172,19 +577,69 @@ db_err_t db_crypto_import_csv(const char *csv_path, const char *sym_name)
         db_txn_abort();
         return res;
     }
+    ev_tstamp start = ev_time();
     if(csv_parse_file(csv_path, csv_parse_row, csv_col_names, ARRAY_SIZE(csv_col_names), &ctx) != CSV_PARSE_ERR_OK) {
         db_txn_abort();
         return DB_ERR_PARSE;
     }
-    log_info("imported %u rows for '%s'", ctx.line_count, sym_name);
-    return db_txn_commit();
+    res = db_txn_commit();
+    ev_tstamp elapsed = ev_time() - start;
+    log_info("imported %u rows for '%s' in %.1fs (%.0f rows/s), %u appended", ctx.line_count, sym_name, elapsed,
+             (elapsed > 0) ? ctx.line_count / elapsed : 0.0, ctx.append_count);
+    if(res != DB_ERR_OK || ctx.line_count == 0) {
+        return res;
+    }
+#ifdef CONFIG_DB_CRYPTO_CHUNK
+    uint64_t now = time(NULL);
+    res = chunk_seal_range(ctx.sym_id, ctx.min_ts, now - now % DB_CRYPTO_CHUNK_SEC);
+    if(res != DB_ERR_OK) {
+        return res;
+    }
+#endif
+    return rollup_rebuild(ctx.sym_id, ctx.min_ts, ctx.max_ts + 1);
+}
+
+db_err_t db_crypto_rollup_rebuild(const char *sym_name)
+{
+    uint32_t sym_id, sym_id_last;
+    if(strcmp(sym_name, "all") == 0) {
+        db_crypto_meta_t meta;
+        db_err_t res = db_crypto_get_meta(&meta);
+        db_txn_abort();
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+        sym_id = 1;
+        sym_id_last = meta.sym_id_last;
+    } else {
+        db_err_t res = db_crypto_get_sym(sym_name, &sym_id);
+        db_txn_abort();
+        if(res != DB_ERR_OK) {
+            if(res == DB_ERR_NOT_FOUND) {
+                log_error("Symbol '%s' not found in DB", sym_name);
+            }
+            return res;
+        }
+        sym_id_last = sym_id;
+    }
+    for(; sym_id <= sym_id_last; sym_id++) {
+        db_err_t res = rollup_rebuild(sym_id, 0, UINT64_MAX);
+        if(res != DB_ERR_OK) {
+            return res;
+        }
+        log_info("rebuilt rollup tables for symbol %u", sym_id);
+    }
+    return DB_ERR_OK;
 }
 
 static csv_gen_err_t csv_gen_row(const csv_gen_ctx_t *gctx, void *priv_data)
 {
     crypto_csv_parse_t *ctx = priv_data;
     crypto_t crypto;
+    // Export keeps its own snapshot, the event loop below may run other transactions on the thread //
+    db_txn_t *prev = db_txn_switch(ctx->txn);
     db_err_t res = db_crypto_get_next1(ctx->sym_id, ctx->op, &crypto);
+    db_txn_switch(prev);
     if(res != DB_ERR_OK) {
         if(res == DB_ERR_NOT_FOUND) {
             return CSV_GEN_ERR_EOF;
@@ -240,15 +695,19 @@ db_err_t db_crypto_export_csv(const char *csv_path, const char *sym_name)
         for(uint32_t i = 0; i < arr.count; i++) {
             const crypto_sym_t *sym = &arr.data[i];
             crypto_csv_parse_t ctx = {
+                .txn = db_rd_txn_open(),
                 .op = DB_CURSOR_OP_SET_RANGE,
                 .sym_id = sym->id,
                 .line_count = 0,
             };
+            if(ctx.txn == NULL) {
+                return DB_ERR_NO_MEM;
+            }
             char path[FILE_PATH_LEN_MAX];
             snprintf(path, sizeof(path), "%s/%s.csv", csv_path, sym->name);
 
             csv_gen_err_t csv_err = csv_gen_file(path, csv_gen_row, csv_col_names, ARRAY_SIZE(csv_col_names), &ctx);
-            db_txn_abort();
+            db_rd_txn_close(ctx.txn);
             if(csv_err != CSV_GEN_ERR_OK) {
                 return DB_ERR_PARSE;
             }
@@ -269,9 +728,15 @@ db_err_t db_crypto_export_csv(const char *csv_path, const char *sym_name)
             return res;
         }
 
+        db_txn_abort();
+
         // Export specified symbol //
+        ctx.txn = db_rd_txn_open();
+        if(ctx.txn == NULL) {
+            return DB_ERR_NO_MEM;
+        }
         csv_gen_err_t csv_err = csv_gen_file(csv_path, csv_gen_row, csv_col_names, ARRAY_SIZE(csv_col_names), &ctx);
-        db_txn_abort();
+        db_rd_txn_close(ctx.txn);
         if(csv_err != CSV_GEN_ERR_OK) {
             return DB_ERR_PARSE;
         }
@@ -280,7 +745,10 @@ db_err_t db_crypto_export_csv(const char *csv_path, const char *sym_name)
     return DB_ERR_OK;
 }
 
-db_err_t db_crypto_add(uint32_t sym_id, const crypto_t *crypto)
+/**
+ * @brief Add a row and update its derived tables in the running write transaction
+ */
+static db_err_t crypto_add_row(uint32_t sym_id, const crypto_t *crypto)
 {
     db_crypto_t db_crypto = {
         .close = crypto->close,
@@ -291,6 +759,20 @@ db_err_t db_crypto_add(uint32_t sym_id, const crypto_t *crypto)
         .pad = { 0 },
     };
     db_err_t res = db_crypto_put(sym_id, crypto->ts, &db_crypto);
+#ifdef CONFIG_DB_CRYPTO_CHUNK
+    if(res == DB_ERR_OK) {
+        res = chunk_add(sym_id, crypto->ts);
+    }
+#endif
+    if(res == DB_ERR_OK) {
+        res = rollup_add(sym_id, crypto->ts, &db_crypto);
+    }
+    return res;
+}
+
+static db_err_t crypto_add_txn(uint32_t sym_id, const crypto_t *crypto)
+{
+    db_err_t res = crypto_add_row(sym_id, crypto);
     if(res != DB_ERR_OK) {
         db_txn_abort();
         return res;
@@ -298,6 +780,130 @@ db_err_t db_crypto_add(uint32_t sym_id, const crypto_t *crypto)
     return db_txn_commit();
 }
 
+db_err_t db_crypto_add(uint32_t sym_id, const crypto_t *crypto)
+{
+    db_err_t res = crypto_add_txn(sym_id, crypto);
+    if(res == DB_ERR_MAP_FULL) {
+        // Map is grown by the end of the failed transaction, unless other transactions are running //
+        res = crypto_add_txn(sym_id, crypto);
+    }
+    return res;
+}
+
+static void queue_start(void)
+{
+    if(queue.flush_sec > 0) {
+        ev_timer_set(&queue.timer, queue.flush_sec, 0);
+        ev_timer_start(EV_DEFAULT, &queue.timer);
+    } else {
+        ev_prepare_start(EV_DEFAULT, &queue.prepare);
+    }
+}
+
+void db_crypto_queue(uint32_t sym_id, const crypto_t *crypto, db_crypto_commit_cb_t cb, void *priv_data)
+{
+    if(queue.count == CRYPTO_QUEUE_MAX && db_crypto_flush() != DB_ERR_OK && queue.count == CRYPTO_QUEUE_MAX) {
+        log_error("queue full, row of symbol %u dropped", sym_id);
+        return;
+    }
+    crypto_queue_row_t *row = &queue.rows[queue.count++];
+    row->cb = cb;
+    row->priv_data = priv_data;
+    row->sym_id = sym_id;
+    row->crypto = *crypto;
+    if(queue.count == 1) {
+        queue_start();
+    }
+}
+
+/**
+ * @brief Add the first queued rows in one write transaction
+ */
+static db_err_t queue_commit(uint32_t count)
+{
+    // One commit for all symbols, so its cost does not grow with their count //
+    db_err_t res = DB_ERR_OK;
+    for(uint32_t i = 0; i < count && res == DB_ERR_OK; i++) {
+        res = crypto_add_row(queue.rows[i].sym_id, &queue.rows[i].crypto);
+    }
+    if(res != DB_ERR_OK) {
+        db_txn_abort();
+        return res;
+    }
+    return db_txn_commit();
+}
+
+/**
+ * @brief Add the first queued rows one per write transaction, after the batch of them failed
+ * @return Number of added rows, moved to the front of the queue
+ */
+static uint32_t queue_replay(uint32_t count)
+{
+    uint32_t added = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        const crypto_queue_row_t *row = &queue.rows[i];
+        db_err_t res = db_crypto_add(row->sym_id, &row->crypto);
+        if(res != DB_ERR_OK) {
+            log_error("row of symbol %u at %" PRIu64 " dropped", row->sym_id, row->crypto.ts);
+            continue;
+        }
+        if(added != i) {
+            queue.rows[added] = *row;
+        }
+        added++;
+    }
+    return added;
+}
+
+db_err_t db_crypto_flush(void)
+{
+    uint32_t count = queue.count;
+    if(count == 0) {
+        return DB_ERR_OK;
+    }
+    ev_prepare_stop(EV_DEFAULT, &queue.prepare);
+    ev_timer_stop(EV_DEFAULT, &queue.timer);
+
+    db_err_t res = queue_commit(count);
+    if(res == DB_ERR_MAP_FULL) {
+        res = queue_commit(count);
+    }
+    if(res == DB_ERR_MAP_FULL) {
+        // Rows stay queued until running transactions end and the map is grown //
+        log_warn("map full, %u queued rows kept", count);
+        queue_start();
+        return res;
+    }
+    queue.count = 0;
+    if(res != DB_ERR_OK) {
+        // Only the failing rows are lost, not the rows of every symbol queued with them //
+        log_warn("commit of %u queued rows failed, adding them one by one", count);
+        uint32_t added = queue_replay(count);
+        if(added == count) {
+            res = DB_ERR_OK;
+        } else {
+            log_error("%u of %u queued rows dropped", count - added, count);
+        }
+        count = added;
+    } else {
+        log_debug("committed %u queued rows", count);
+    }
+
+    // Rows are visible to the readers only now //
+    for(uint32_t i = 0; i < count; i++) {
+        const crypto_queue_row_t *row = &queue.rows[i];
+        if(row->cb) {
+            row->cb(row->sym_id, &row->crypto, row->priv_data);
+        }
+    }
+    return res;
+}
+
+void db_crypto_destroy(void)
+{
+    db_crypto_flush();
+}
+
 db_err_t db_crypto_sym_arr_get(crypto_sym_arr_t *arr, buf_ext_t *buf)
 {
     db_crypto_meta_t meta;
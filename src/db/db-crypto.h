@@ -3,6 +3,8 @@
 #include <core/db/db.h>
 
 #define CRYPTO_SYM_ARR_BUF_SIZE (128 * 1024)
+#define CRYPTO_QUEUE_MAX        4096 ///< Most rows committed by one queue flush
+#define DB_CRYPTO_TABLE_COUNT   8    ///< Named tables of the cryptocurrency database
 
 /**
  * @brief Structure to hold cryptocurrency data
@@ -40,12 +42,26 @@ typedef struct {
     uint32_t count;     ///< Number of symbols
 } crypto_sym_arr_t;
 
+/**
+ * @brief Callback called for a queued row once it is committed
+ * @param sym_id - [in] ID of the cryptocurrency symbol
+ * @param crypto - [in] Pointer to the committed cryptocurrency data
+ * @param priv_data - [in] Private data given to db_crypto_queue
+ */
+typedef void (*db_crypto_commit_cb_t)(uint32_t sym_id, const crypto_t *crypto, void *priv_data);
+
 /**
  * @brief Initialize the cryptocurrency database
  * @param crypto_list_path - [in] Path to the file containing the list of cryptocurrency symbols
+ * @param flush_ms - [in] Commit interval of the queued rows, 0 to commit them at the end of every loop iteration
  * @return ERR_DB_OK on success, error code on failure
  */
-db_err_t db_crypto_init(const char *crypto_list_path);
+db_err_t db_crypto_init(const char *crypto_list_path, uint32_t flush_ms);
+
+/**
+ * @brief Commit the queued rows and stop the queue
+ */
+void db_crypto_destroy(void);
 
 /**
  * @brief Import cryptocurrency data from a CSV file into the database
@@ -55,6 +71,13 @@ db_err_t db_crypto_init(const char *crypto_list_path);
  */
 db_err_t db_crypto_import_csv(const char *csv_path, const char *sym_name);
 
+/**
+ * @brief Rebuild the 1m, 5m, 1h and 1d rollup tables from raw cryptocurrency data
+ * @param sym_name - [in] Name of the cryptocurrency symbol or "all"
+ * @return ERR_DB_OK on success, error code on failure
+ */
+db_err_t db_crypto_rollup_rebuild(const char *sym_name);
+
 /**
  * @brief Export cryptocurrency data from the database to a CSV file
  * @param csv_path - [in] Path to the CSV file
@@ -79,6 +102,38 @@ db_err_t db_crypto_export_calc_csv(const char *csv_path, const char *sym_name);
  */
 db_err_t db_crypto_add(uint32_t sym_id, const crypto_t *crypto);
 
+/**
+ * @brief Queue cryptocurrency data to be added together with other queued rows in one write transaction
+ * @note Must be called from the main loop, the rows are committed by it in db_crypto_init flush_ms intervals
+ * @param sym_id - [in] ID of the cryptocurrency symbol
+ * @param crypto - [in] Pointer to the cryptocurrency data structure
+ * @param cb - [in] Callback called after the row is committed, NULL if not needed
+ * @param priv_data - [in] Private data passed to the callback
+ */
+void db_crypto_queue(uint32_t sym_id, const crypto_t *crypto, db_crypto_commit_cb_t cb, void *priv_data);
+
+/**
+ * @brief Commit all queued rows in one write transaction now
+ * @note If the transaction fails other than with DB_ERR_MAP_FULL, the rows are added one per transaction
+ * @return ERR_DB_OK on success, error code on failure, only the rows which still fail are dropped
+ */
+db_err_t db_crypto_flush(void);
+
+/**
+ * @brief Start the job which deletes expired rows in the background
+ * @param retention_path - [in] Path to the file with the days (0..36500, 0 keeps forever) each table keeps its rows
+ * @param interval_sec - [in] Interval between the passes of the job
+ * @return ERR_DB_OK on success, error code on failure
+ * @note Rows are deleted in small write transactions from an idle watcher, so the loop handles its events between
+ *       them. Rows of a table are only deleted once their bucket in the next coarser table exists.
+ */
+db_err_t db_crypto_retention_start(const char *retention_path, uint32_t interval_sec);
+
+/**
+ * @brief Stop the retention job, a running pass is abandoned
+ */
+void db_crypto_retention_stop(void);
+
 /**
  * @brief Get cryptocurrency symbols from the database
  * @param arr - [out] Pointer to the array to hold the cryptocurrency symbols
@@ -17,3 +17,8 @@ cipc_err_t cipc_crypto_parser_get_status(cipc_resp_cb_t cb, const buf_t *user_da
 {
     return cipc_send(cipc, IPC_CRYPTO_PARSER_CMD_GET_STATUS, NULL, cb, user_data);
 }
+
+cipc_err_t cipc_crypto_parser_db_backup(cipc_resp_cb_t cb, const buf_t *user_data)
+{
+    return cipc_send(cipc, IPC_CRYPTO_PARSER_CMD_DB_BACKUP, NULL, cb, user_data);
+}
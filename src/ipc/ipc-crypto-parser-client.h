@@ -22,3 +22,11 @@ void cipc_crypto_parser_deinit(void);
  * @return CIPC_ERR_OK on success, error code otherwise
  */
 cipc_err_t cipc_crypto_parser_get_status(cipc_resp_cb_t cb, const buf_t *user_data);
+
+/**
+ * @brief Start database backup of crypto parser
+ * @param cb - [in] Response callback
+ * @param user_data - [in] User data passed to callback
+ * @return CIPC_ERR_OK on success, error code otherwise
+ */
+cipc_err_t cipc_crypto_parser_db_backup(cipc_resp_cb_t cb, const buf_t *user_data);
@@ -1,6 +1,14 @@
 #include <ipc/ipc-crypto-parser-server.h>
 #include <parser/parser-binance.h>
 #include <core/db/db.h>
+#include <time.h>
+
+typedef struct {
+    const char *backup_path;
+    uint32_t backup_rate_kb;
+} sipc_crypto_parser_t;
+
+static sipc_crypto_parser_t parser = { 0 };
 
 static sipc_err_t resp_fail(sipc_conn_t *conn, uint32_t id, ipc_crypto_parser_err_t err)
 {
@@ -22,11 +30,19 @@ static sipc_err_t get_status(const sipc_req_t *req)
     if(db_get_stat(&db_stat) != DB_ERR_OK) {
         return resp_fail(req->conn, req->id, IPC_CRYPTO_PARSER_ERR_DB);
     }
+    db_backup_stat_t backup_stat;
+    db_backup_get_stat(&backup_stat);
+    uint64_t backup_end_ts = backup_stat.end_ts ? backup_stat.end_ts : (uint64_t)time(NULL);
     ipc_crypto_parser_status_t status = {
         .start_ts = bin_stat.start_ts,
         .last_upd_ts = bin_stat.last_upd_ts,
         .db_used_size_kb = db_stat.used_size / 1024,
         .db_tot_size_kb = db_stat.tot_size / 1024,
+        .backup_start_ts = backup_stat.start_ts,
+        .backup_sec = backup_stat.start_ts ? backup_end_ts - backup_stat.start_ts : 0,
+        .backup_done_kb = backup_stat.done_size / 1024,
+        .backup_tot_kb = backup_stat.tot_size / 1024,
+        .backup_state = backup_stat.state,
     };
     buf_t buf = {
         .data = &status,
@@ -35,10 +51,24 @@ static sipc_err_t get_status(const sipc_req_t *req)
     return sipc_resp(req->conn, req->id, IPC_CMD_OK, &buf);
 }
 
-sipc_err_t sipc_crypto_parser_init(const char *sock_path)
+static sipc_err_t db_backup(const sipc_req_t *req)
+{
+    db_err_t res = db_backup_start(parser.backup_path, parser.backup_rate_kb);
+    if(res == DB_ERR_BUSY) {
+        return resp_fail(req->conn, req->id, IPC_CRYPTO_PARSER_ERR_BUSY);
+    } else if(res != DB_ERR_OK) {
+        return resp_fail(req->conn, req->id, IPC_CRYPTO_PARSER_ERR_DB);
+    }
+    return sipc_resp(req->conn, req->id, IPC_CMD_OK, NULL);
+}
+
+sipc_err_t sipc_crypto_parser_init(const char *sock_path, const char *backup_path, uint32_t backup_rate_kb)
 {
     static const sipc_cmd_handler_t handlers[] = {
         { IPC_CRYPTO_PARSER_CMD_GET_STATUS, get_status },
+        { IPC_CRYPTO_PARSER_CMD_DB_BACKUP, db_backup },
     };
+    parser.backup_path = backup_path;
+    parser.backup_rate_kb = backup_rate_kb;
     return sipc_init(sock_path, handlers, ARRAY_SIZE(handlers));
 }
@@ -6,6 +6,8 @@
 /**
  * @brief Initialize IPC crypto parser server
  * @param sock_path - [in] Socket path
+ * @param backup_path - [in] Path to database backups
+ * @param backup_rate_kb - [in] Write rate limit of database backups in KB/s, 0 for no limit
  * @return SIPC_ERR_OK on success, error code otherwise
  */
-sipc_err_t sipc_crypto_parser_init(const char *sock_path);
+sipc_err_t sipc_crypto_parser_init(const char *sock_path, const char *backup_path, uint32_t backup_rate_kb);
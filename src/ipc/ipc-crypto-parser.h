@@ -7,6 +7,7 @@
  */
 typedef enum {
     IPC_CRYPTO_PARSER_CMD_GET_STATUS = IPC_CMD_MAX, ///< Get crypto parser status
+    IPC_CRYPTO_PARSER_CMD_DB_BACKUP,                ///< Start database backup
     IPC_CRYPTO_PARSER_CMD_MAX,
 } ipc_crypto_parser_cmd_t;
 
@@ -14,7 +15,8 @@ typedef enum {
  * @brief IPC crypto parser error codes
  */
 typedef enum {
-    IPC_CRYPTO_PARSER_ERR_DB, ///< Database error
+    IPC_CRYPTO_PARSER_ERR_DB,   ///< Database error
+    IPC_CRYPTO_PARSER_ERR_BUSY, ///< Database backup is already running
     IPC_CRYPTO_PARSER_ERR_MAX,
 } ipc_crypto_parser_err_t;
 
@@ -26,6 +28,11 @@ typedef struct {
     uint64_t last_upd_ts;     ///< Last update time
     uint32_t db_used_size_kb; ///< Database used size in KB
     uint32_t db_tot_size_kb;  ///< Total database size in KB
+    uint64_t backup_start_ts; ///< Start time of the last database backup
+    uint32_t backup_sec;      ///< Duration of the last database backup
+    uint32_t backup_done_kb;  ///< Written size of the last database backup in KB
+    uint32_t backup_tot_kb;   ///< Used database size in KB when the last backup started
+    uint32_t backup_state;    ///< State of the last database backup (db_backup_state_t)
 } ipc_crypto_parser_status_t;
 
 /**
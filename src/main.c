@@ -4,6 +4,7 @@
 #include <core/base/log.h>
 #include <core/base/cfg.h>
 #include <core/http/http-server.h>
+#include <core/http/http-static.h>
 #include <core/http/http-client.h>
 #include <core/ipc/ipc-server.h>
 #include <core/ipc/ipc-client.h>
@@ -11,11 +12,13 @@
 #include <core/db/db.h>
 #include <core/lang.h>
 #include <db/db-crypto.h>
+#include <db/db-bot.h>
 #include <parser/parser-binance.h>
 #include <ipc/ipc-crypto-parser-server.h>
 #include <ipc/ipc-crypto-parser-client.h>
 #include <bot/bot-crypto-notify.h>
 #include <bot/bot-admin.h>
+#include <api/api-crypto.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
@@ -106,6 +109,22 @@ static int db_import(const char *table, UNUSED const char *prm, UNUSED const cha
     return EXIT_SUCCESS;
 }
 
+static int db_rebuild(const char *table, UNUSED const char *prm)
+{
+    #ifdef CONFIG_DB_CRYPTO_TABLE
+    if(strcmp(table, "crypto") == 0) {
+        if(db_crypto_rollup_rebuild(prm) != DB_ERR_OK) {
+            return EXIT_FAILURE;
+        }
+    } else
+    #endif
+    {
+        log_error("unknown table for rebuild: %s", table);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
 static int db_export(const char *table, UNUSED const char *prm, UNUSED const char *file)
 {
     #ifdef CONFIG_DB_CRYPTO_TABLE
@@ -128,6 +147,21 @@ static int db_export(const char *table, UNUSED const char *prm, UNUSED const cha
     }
     return EXIT_SUCCESS;
 }
+
+/**
+ * @brief Get the number of named tables opened by the enabled modules
+ */
+static uint32_t db_table_count(void)
+{
+    uint32_t count = 0;
+    #ifdef CONFIG_DB_CRYPTO_TABLE
+    count += DB_CRYPTO_TABLE_COUNT;
+    #endif
+    #ifdef CONFIG_DB_BOT_TABLE
+    count += DB_BOT_TABLE_COUNT;
+    #endif
+    return count;
+}
 #endif
 
 static void cleanup(void)
@@ -141,6 +175,10 @@ static void cleanup(void)
 #ifdef CONFIG_PARSER_CVBANKAS
     parser_cvb_destroy();
 #endif
+#ifdef CONFIG_DB_CRYPTO_TABLE
+    db_crypto_retention_stop();
+    db_crypto_destroy();
+#endif
 #ifdef CONFIG_DB
     db_close();
 #endif
@@ -156,6 +194,9 @@ static void cleanup(void)
 #ifdef CONFIG_HTTP_SERVER
     shttp_destroy();
 #endif
+#ifdef CONFIG_HTTP_STATIC
+    http_static_destroy();
+#endif
 #ifdef CONFIG_HTTP_CLIENT
     chttp_destroy();
 #endif
@@ -201,14 +242,28 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 #ifdef CONFIG_DB
+    if(args.db_restore_dir) {
+        int res = db_restore(args.db_restore_dir, cfg.db_path) == DB_ERR_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+        cleanup();
+        return res;
+    }
     bool db_rd_only = args.db_export_file ? true : false;
-    if(db_open(cfg.db_path, cfg.db_size_mb, cfg.db_count, db_rd_only) != DB_ERR_OK) {
+    // Too few named tables would fail only once a module opens one, so it is checked up front //
+    uint32_t db_count = db_table_count();
+    if(cfg.db_count == 0) {
+        cfg.db_count = db_count;
+    } else if(cfg.db_count < db_count) {
+        log_error("db_count %u is too low, the enabled modules use %u tables", cfg.db_count, db_count);
+        cleanup();
+        return EXIT_FAILURE;
+    }
+    if(db_open(cfg.db_path, cfg.db_size_mb, cfg.db_count, cfg.db_sync, cfg.db_sync_ms, db_rd_only) != DB_ERR_OK) {
         cleanup();
         return EXIT_FAILURE;
     }
 #endif
 #ifdef CONFIG_DB_CRYPTO_TABLE
-    if(db_crypto_init(cfg.crypto_list_path) != DB_ERR_OK) {
+    if(db_crypto_init(cfg.crypto_list_path, cfg.crypto_flush_ms) != DB_ERR_OK) {
         cleanup();
         return EXIT_FAILURE;
     }
@@ -224,6 +279,11 @@ int main(int argc, char *argv[])
         cleanup();
         return res;
     }
+    if(args.db_rebuild) {
+        int res = db_rebuild(args.db_table, args.db_prm);
+        cleanup();
+        return res;
+    }
 #endif
 #ifdef CONFIG_LANG
     if(lang_load(cfg.lang_path) != LANG_ERR_OK) {
@@ -238,13 +298,36 @@ int main(int argc, char *argv[])
     }
 #endif
 #ifdef CONFIG_HTTP_SERVER
-    if(shttp_init(cfg.http_sock) != SHTTP_ERR_OK) {
+    shttp_cfg_t shttp_cfg = {
+        .sock_path = cfg.http_sock,
+        .listen = cfg.http_listen,
+        .backlog = cfg.http_backlog,
+        .workers = cfg.http_workers,
+        .pool_threads = cfg.http_pool,
+        .max_conn = cfg.http_max_conn,
+        .header_sec = cfg.http_header_sec,
+        .body_sec = cfg.http_body_sec,
+        .keepalive_sec = cfg.http_keepalive_sec,
+    };
+    if(shttp_init(&shttp_cfg) != SHTTP_ERR_OK) {
+        cleanup();
+        return EXIT_FAILURE;
+    }
+#endif
+#ifdef CONFIG_HTTP_STATIC
+    if(http_static_init(cfg.html_path) != HTTP_STATIC_ERR_OK) {
+        cleanup();
+        return EXIT_FAILURE;
+    }
+#endif
+#ifdef CONFIG_APP_CRYPTO_API
+    if(api_crypto_init() != SHTTP_ERR_OK) {
         cleanup();
         return EXIT_FAILURE;
     }
 #endif
 #ifdef CONFIG_IPC_CRYPTO_PARSER_SERVER
-    if(sipc_crypto_parser_init(cfg.ipc_sock) != SIPC_ERR_OK) {
+    if(sipc_crypto_parser_init(cfg.ipc_sock, cfg.db_backup_path, cfg.db_backup_rate_kb) != SIPC_ERR_OK) {
         cleanup();
         return EXIT_FAILURE;
     }
@@ -272,6 +355,12 @@ int main(int argc, char *argv[])
         cleanup();
         return EXIT_FAILURE;
     }
+    // Expired rows are deleted by the process which writes them //
+    if(cfg.crypto_retention_path &&
+       db_crypto_retention_start(cfg.crypto_retention_path, cfg.crypto_retention_sec) != DB_ERR_OK) {
+        cleanup();
+        return EXIT_FAILURE;
+    }
 #endif
 #ifdef CONFIG_APP_CRYPTO_BOT_NOTIFY
     if(bot_crypto_notify_init(cfg.bot_token, cfg.bot_upd_sec) != BOT_CRYPTO_ERR_OK) {
@@ -285,6 +374,12 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 #endif
+#ifdef CONFIG_HTTP_SERVER
+    if(shttp_start() != SHTTP_ERR_OK) {
+        cleanup();
+        return EXIT_FAILURE;
+    }
+#endif
 
     db_crypto_ai_train_model("tmp/mod.ubj", "ethusdt");
 
@@ -1,6 +1,9 @@
 #include <parser/parser-binance-priv.h>
 #include <core/base/log.h>
 #include <db/db-crypto.h>
+#ifdef CONFIG_APP_CRYPTO_API
+#include <api/api-crypto.h>
+#endif
 #include <inttypes.h>
 #include <string.h>
 #include <stdlib.h>
@@ -142,6 +145,19 @@ json_parse_err_t parser_bin_data(const jsmntok_t *cur, const char *json, void *p
     return cb[update->type](cur, json, &update->data);
 }
 
+/**
+ * @brief Publish a kline once it is committed, so the readers find it in the database
+ */
+static void kline_commit_cb(UNUSED uint32_t sym_id, const crypto_t *crypto, void *priv_data)
+{
+    uint64_t *pts = priv_data;
+#ifdef CONFIG_APP_CRYPTO_API
+    api_crypto_cache_drop(sym_id, crypto->ts);
+    api_crypto_live_push(sym_id, crypto);
+#endif
+    *pts = crypto->ts;
+}
+
 void parser_bin_calc_kline(const bin_update_t *update, const bin_depth_val_t *val, uint64_t *pts)
 {
     const bin_kline_t *kline = &update->data.kline;
@@ -159,10 +175,7 @@ void parser_bin_calc_kline(const bin_update_t *update, const bin_depth_val_t *va
     };
     log_debug("symbol %s: time=%" PRIu64 " close=%g, volume=%g, liq_ask=%g, liq_bid=%g, whales=%u", update->symbol,
               crypto.ts, crypto.close, crypto.volume, crypto.liq_ask, crypto.liq_bid, crypto.whales);
-    if(db_crypto_add(val->sym_id, &crypto) != DB_ERR_OK) {
-        return;
-    }
-    *pts = crypto.ts;
+    db_crypto_queue(val->sym_id, &crypto, kline_commit_cb, pts);
 }
 
 void parser_bin_calc_depth(const bin_update_t *update, bin_depth_val_t *val)
@@ -104,10 +104,10 @@ json_parse_err_t parser_bin_stream(const jsmntok_t *cur, const char *json, void
 json_parse_err_t parser_bin_data(const jsmntok_t *cur, const char *json, void *priv_data);
 
 /**
- * @brief Calculate kline values from Binance update
+ * @brief Calculate kline values from Binance update and queue them to the database
  * @param update - [in] Pointer to Binance update
  * @param val - [in] Pointer to depth values structure
- * @param pts - [in] Pointer to timestamp of the kline
+ * @param pts - [in] Pointer to timestamp of the last kline, updated once the kline is committed
  */
 void parser_bin_calc_kline(const bin_update_t *update, const bin_depth_val_t *val, uint64_t *pts);
 
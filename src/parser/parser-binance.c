@@ -11,10 +11,9 @@
 
 LOG_MOD_INIT(LOG_LVL_DEFAULT)
 
-#define BIN_ADDR     "stream.binance.com"
-#define BIN_PORT     9443
-#define BIN_WS_PATH  "/stream?streams="
-#define BIN_SYNC_CNT 1000
+#define BIN_ADDR    "stream.binance.com"
+#define BIN_PORT    9443
+#define BIN_WS_PATH "/stream?streams="
 
 typedef struct {
     struct hsearch_data depth_htab;
@@ -22,7 +21,6 @@ typedef struct {
     cws_conn_t **conn;
     uint64_t start_ts;
     uint64_t last_upd_ts;
-    uint32_t db_put_cnt;
     uint32_t depth_count;
     uint32_t conn_count;
 } parser_bin_t;
@@ -61,11 +59,6 @@ static void recv_cb(const cws_recv_t *recv)
         break;
     case BIN_STREAM_KLINE:
         parser_bin_calc_kline(&update, val, &bin->last_upd_ts);
-        bin->db_put_cnt++;
-        if(bin->db_put_cnt >= BIN_SYNC_CNT) {
-            db_sync();
-            bin->db_put_cnt = 0;
-        }
         break;
     default:
         break;
@@ -179,6 +172,8 @@ void parser_bin_destroy(void)
     if(bin == NULL) {
         return;
     }
+    // Queued klines point to the last update time //
+    db_crypto_flush();
     if(app_is_running) {
         for(uint32_t i = 0; i < bin->conn_count; i++) {
             cws_disconnect(bin->conn[i]);
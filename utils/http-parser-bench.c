@@ -0,0 +1,148 @@
+/**
+ * @brief Request header parse microbenchmark
+ *
+ * Parses captured request headers with every vector extension the CPU supports.
+ * Build and run with "make bench-http-parser", or pass another capture file and iteration count:
+ * tmp/http-parser-bench [file] [iterations]
+ * Requests in the file are separated by empty lines, plain LF line ends are converted to CRLF.
+ */
+#include <common.h>
+#include <core/http/http-parser.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_FILE       "utils/http-parser-bench.txt"
+#define BENCH_ITERATIONS 200000
+#define BENCH_HEADERS    64
+
+typedef struct {
+    char *data;      ///< Requests with CRLF line ends
+    size_t len;      ///< Length of all requests
+    size_t count;    ///< Number of requests
+    size_t *offsets; ///< Offset of every request, the last one is the total length
+} bench_t;
+
+static const char *simd_str[] = {
+    [PHR_SIMD_NONE] = "none",
+    [PHR_SIMD_AVX2] = "avx2",
+    [PHR_SIMD_AVX512] = "avx512",
+};
+
+static int bench_load(bench_t *bench, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        perror(path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *raw = malloc(size);
+    bench->data = malloc(size * 2);
+    bench->offsets = malloc((size + 1) * sizeof(size_t));
+    if(raw == NULL || bench->data == NULL || bench->offsets == NULL || fread(raw, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "read %s failed\n", path);
+        fclose(file);
+        free(raw);
+        return -1;
+    }
+    fclose(file);
+
+    bench->len = 0;
+    for(long i = 0; i < size; i++) {
+        if(raw[i] == '\n' && (i == 0 || raw[i - 1] != '\r')) {
+            bench->data[bench->len++] = '\r';
+        }
+        bench->data[bench->len++] = raw[i];
+    }
+    free(raw);
+
+    // Split the capture by parsing it once, every request must be complete //
+    bench->count = 0;
+    size_t offset = 0;
+    while(offset < bench->len) {
+        const char *method, *path_str;
+        size_t method_len, path_len, headers_count = BENCH_HEADERS;
+        int minor_version;
+        struct phr_header headers[BENCH_HEADERS];
+        int res = phr_parse_request(bench->data + offset, bench->len - offset, &method, &method_len, &path_str,
+                                    &path_len, &minor_version, headers, &headers_count, 0);
+        if(res < 0) {
+            fprintf(stderr, "request %zu at offset %zu is invalid\n", bench->count, offset);
+            return -1;
+        }
+        bench->offsets[bench->count++] = offset;
+        offset += res;
+    }
+    bench->offsets[bench->count] = offset;
+    return bench->count > 0 ? 0 : -1;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t bench_run(const bench_t *bench, long iterations)
+{
+    size_t headers_total = 0;
+    for(long it = 0; it < iterations; it++) {
+        for(size_t i = 0; i < bench->count; i++) {
+            const char *method, *path;
+            size_t method_len, path_len, headers_count = BENCH_HEADERS;
+            int minor_version;
+            struct phr_header headers[BENCH_HEADERS];
+            size_t len = bench->offsets[i + 1] - bench->offsets[i];
+            int res = phr_parse_request(bench->data + bench->offsets[i], len, &method, &method_len, &path, &path_len,
+                                        &minor_version, headers, &headers_count, 0);
+            if(res != (int)len) {
+                fprintf(stderr, "request %zu parse failed %d\n", i, res);
+                exit(EXIT_FAILURE);
+            }
+            headers_total += headers_count;
+        }
+    }
+    return headers_total;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : BENCH_FILE;
+    long iterations = argc > 2 ? atol(argv[2]) : BENCH_ITERATIONS;
+    bench_t bench;
+    if(bench_load(&bench, path) != 0) {
+        return EXIT_FAILURE;
+    }
+    printf("%zu requests, %zu bytes, %ld iterations\n", bench.count, bench.len, iterations);
+
+    phr_simd_t best = phr_simd_get();
+    double base_ns = 0;
+    for(int simd = PHR_SIMD_NONE; simd < PHR_SIMD_MAX; simd++) {
+        if(phr_simd_set(simd) != 0) {
+            printf("%-8s unsupported\n", simd_str[simd]);
+            continue;
+        }
+        bench_run(&bench, iterations / 10 + 1); // Warm up caches and clocks //
+        double start = bench_now();
+        size_t headers = bench_run(&bench, iterations);
+        double sec = bench_now() - start;
+
+        double req_ns = sec * 1e9 / ((double)iterations * bench.count);
+        double mb_sec = (double)bench.len * iterations / sec / (1024 * 1024);
+        if(simd == PHR_SIMD_NONE) {
+            base_ns = req_ns;
+        }
+        printf("%-8s %8.1f ns/req %8.1f MB/s %6.2fx headers=%zu%s\n", simd_str[simd], req_ns, mb_sec, base_ns / req_ns,
+               headers, simd == (int)best ? " (default)" : "");
+    }
+    phr_simd_set(best);
+
+    free(bench.data);
+    free(bench.offsets);
+    return EXIT_SUCCESS;
+}